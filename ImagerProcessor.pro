@@ -9,15 +9,91 @@ CONFIG += c++17
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    bilateral.cpp \
+    bitmask.cpp \
+    canny.cpp \
+    ccl.cpp \
+    cli.cpp \
+    colorspace.cpp \
+    compare.cpp \
+    contrast.cpp \
+    fft.cpp \
+    framering.cpp \
+    freqfilter.cpp \
     gtransform.cpp \
+    imgfilter.cpp \
+    integral.cpp \
+    ipxfile.cpp \
+    jpegxform.cpp \
+    lens.cpp \
+    liveview.cpp \
     main.cpp \
     ip.cpp \
-    mouseevent.cpp
+    match.cpp \
+    morphology.cpp \
+    mouseevent.cpp \
+    pipeline.cpp \
+    quantize.cpp \
+    rankfilter.cpp \
+    roi.cpp \
+    scheduler.cpp \
+    stack.cpp \
+    startup.cpp \
+    streamproc.cpp \
+    threshold.cpp \
+    tiles.cpp \
+    warp.cpp \
+    watchfolder.cpp
 
 HEADERS += \
+    bilateral.h \
+    bitmask.h \
+    canny.h \
+    ccl.h \
+    cli.h \
+    colorspace.h \
+    compare.h \
+    contrast.h \
+    fft.h \
+    framering.h \
+    freqfilter.h \
     gtransform.h \
+    imgfilter.h \
+    integral.h \
+    ipxfile.h \
     ip.h \
-    mouseevent.h
+    jpegxform.h \
+    lens.h \
+    liveview.h \
+    match.h \
+    morphology.h \
+    mouseevent.h \
+    pipeline.h \
+    quantize.h \
+    rankfilter.h \
+    roi.h \
+    scheduler.h \
+    stack.h \
+    startup.h \
+    streamproc.h \
+    threshold.h \
+    tiles.h \
+    warp.h \
+    watchfolder.h
+
+# Lossless JPEG rotation works on DCT coefficients and needs libjpeg itself;
+# without it saving falls back to re-encoding the pixels. Streaming jpg/png
+# decode and encode a band of rows at a time, which QImageReader cannot do.
+packagesExist(libjpeg) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libjpeg
+    DEFINES += HAVE_LIBJPEG
+}
+packagesExist(libpng) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libpng
+    DEFINES += HAVE_LIBPNG
+}
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
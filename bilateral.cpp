@@ -0,0 +1,180 @@
+#include "bilateral.h"
+#include "colorspace.h"
+#include "scheduler.h"
+#include <QtMath>
+
+namespace {
+
+// Cells the 1-4-6-4-1 blur reaches on either side.
+const int Pad = 2;
+// Target size of one strip of grid cells (two such buffers per task).
+const qsizetype StripBytes = 4 << 20;
+
+// dst[i] = src[i-2] + 4 src[i-1] + 6 src[i] + 4 src[i+1] + src[i+2] for n
+// items of len floats each, zero past the ends. The overall scale does not
+// matter: slicing divides by the blurred weight.
+void blurItems(const float *src, float *dst, int n, qsizetype len)
+{
+    for (int i = 0; i < n; ++i) {
+        float *d = dst + i * len;
+        const float *c = src + i * len;
+        for (qsizetype e = 0; e < len; ++e)
+            d[e] = 6 * c[e];
+        for (int o = -2; o <= 2; ++o) {
+            if (o == 0 || i + o < 0 || i + o >= n)
+                continue;
+            const float weight = (o == -1 || o == 1) ? 4 : 1;
+            const float *s = src + (i + o) * len;
+            for (qsizetype e = 0; e < len; ++e)
+                d[e] += weight * s[e];
+        }
+    }
+}
+
+inline int nearestCell(double v)
+{
+    return int(v + 0.5) + Pad;
+}
+
+} // namespace
+
+QImage bilateralFilter(const QImage &src, double spatialSigma, double rangeSigma)
+{
+    if (src.isNull())
+        return QImage();
+    const double ss = qMax(1.0, spatialSigma), sr = qMax(1.0, rangeSigma);
+    const QImage img = src.convertToFormat(QImage::Format_ARGB32);
+    const int w = img.width(), h = img.height();
+
+    // Grid cells (4 floats: r, g, b, weight) are laid out row by row, then by
+    // x, with the range axis innermost.
+    const int nx = int((w - 1) / ss) + 2 * Pad + 2;
+    const int nz = int(255 / sr) + 2 * Pad + 2;
+    const int gridRows = int((h - 1) / ss) + 1;
+    const int gridCols = nx - 2 * Pad - 1;
+    // Blocks of tileRows x tileCols sliced cells plus their halo must fit in
+    // StripBytes: whole grid rows when at least four fit, square tiles when the
+    // frame is too wide for that.
+    const qsizetype cellBytes = qsizetype(nz) * 4 * sizeof(float);
+    const int halo = 2 * Pad + 1;
+    const qsizetype budget = qMax<qsizetype>(StripBytes / cellBytes, (1 + halo) * (1 + halo));
+    int tileCols = gridCols;
+    int tileRows = int(qMin<qsizetype>(64, budget / (gridCols + halo) - halo));
+    if (tileRows < 4) {
+        tileRows = qBound(1, int(qSqrt(double(budget))) - halo, 64);
+        tileCols = qMin(tileRows, gridCols);
+    }
+    const int strips = (gridRows + tileRows - 1) / tileRows;
+    const int columns = (gridCols + tileCols - 1) / tileCols;
+    const int blockRows = tileRows + halo;
+    const int blockCols = tileCols + halo;
+    const qsizetype rowFloats = qsizetype(blockCols) * nz * 4;
+
+    // Per-column and per-level cell coordinates, for splatting (nearest) and
+    // slicing (cell plus fraction).
+    QVector<int> splatX(w), sliceX(w);
+    QVector<float> fracX(w);
+    for (int x = 0; x < w; ++x) {
+        splatX[x] = nearestCell(x / ss);
+        const double f = x / ss + Pad;
+        sliceX[x] = int(f);
+        fracX[x] = float(f - int(f));
+    }
+    int splatZ[256], sliceZ[256];
+    float fracZ[256];
+    for (int l = 0; l < 256; ++l) {
+        splatZ[l] = nearestCell(l / sr);
+        const double f = l / sr + Pad;
+        sliceZ[l] = int(f);
+        fracZ[l] = float(f - int(f));
+    }
+    // First image row and column sliced from each block; pixels belong to the
+    // block of the grid cell at or above and left of them.
+    QVector<int> firstRow(strips + 1, h), firstCol(columns + 1, w);
+    for (int y = h - 1; y >= 0; --y)
+        firstRow[int(y / ss) / tileRows] = y;
+    for (int x = w - 1; x >= 0; --x)
+        firstCol[int(x / ss) / tileCols] = x;
+
+    QImage out(w, h, QImage::Format_ARGB32);
+    uchar *outBits = out.bits();
+    const qsizetype outBpl = out.bytesPerLine();
+    const int *sx = splatX.constData(), *lx = sliceX.constData();
+    const float *fx = fracX.constData();
+
+    TaskScheduler::instance().run(strips * columns, [&](int t) {
+        // Grid rows j0 .. j0 + blockRows - 1 and cells i0 .. i0 + blockCols - 1
+        // across; the halo of Pad cells before and Pad + 1 after makes every
+        // cell this block slices exact.
+        const int ty = t / columns, tx = t % columns;
+        const int j0 = ty * tileRows - Pad;
+        const int i0 = tx * tileCols;
+        QVector<float> block(rowFloats * blockRows, 0.0f), temp(block.size());
+        float *grid = block.data(), *tmp = temp.data();
+
+        const int yFirst = qMax(0, int(qFloor((j0 - 0.5) * ss)));
+        const int yLast = qMin(h - 1, int(qCeil((j0 + blockRows - 0.5) * ss)));
+        const int xFirst = qMax(0, int(qFloor((i0 - Pad - 0.5) * ss)));
+        const int xLast = qMin(w - 1, int(qCeil((i0 + blockCols - Pad - 0.5) * ss)));
+        for (int y = yFirst; y <= yLast; ++y) {
+            const int jj = int(y / ss + 0.5) - j0;
+            if (jj < 0 || jj >= blockRows)
+                continue;
+            const QRgb *s = reinterpret_cast<const QRgb *>(img.constScanLine(y));
+            float *row = grid + jj * rowFloats;
+            for (int x = xFirst; x <= xLast; ++x) {
+                const int ii = sx[x] - i0;
+                if (ii < 0 || ii >= blockCols)
+                    continue;
+                float *cell = row + (qsizetype(ii) * nz + splatZ[lumaOf(s[x])]) * 4;
+                cell[0] += qRed(s[x]);
+                cell[1] += qGreen(s[x]);
+                cell[2] += qBlue(s[x]);
+                cell[3] += 1;
+            }
+        }
+
+        blurItems(grid, tmp, blockRows, rowFloats);
+        for (int jj = 0; jj < blockRows; ++jj)
+            blurItems(tmp + jj * rowFloats, grid + jj * rowFloats, blockCols, qsizetype(nz) * 4);
+        for (qsizetype line = 0; line < qsizetype(blockRows) * blockCols; ++line)
+            blurItems(grid + line * nz * 4, tmp + line * nz * 4, nz, 4);
+
+        for (int y = firstRow[ty]; y < firstRow[ty + 1]; ++y) {
+            const QRgb *s = reinterpret_cast<const QRgb *>(img.constScanLine(y));
+            QRgb *d = reinterpret_cast<QRgb *>(outBits + y * outBpl);
+            const double fyLocal = y / ss - j0;
+            const int jj = int(fyLocal);
+            const float ay = float(fyLocal - jj);
+            const float *r0 = tmp + jj * rowFloats, *r1 = r0 + rowFloats;
+            for (int x = firstCol[tx]; x < firstCol[tx + 1]; ++x) {
+                const int l = lumaOf(s[x]);
+                const int k = sliceZ[l];
+                const float ax = fx[x], az = fracZ[l];
+                const qsizetype c00 = (qsizetype(lx[x] - i0) * nz + k) * 4;
+                const qsizetype c10 = c00 + qsizetype(nz) * 4;
+                float acc[4];
+                for (int c = 0; c < 4; ++c) {
+                    const float v00 = r0[c00 + c] + az * (r0[c00 + 4 + c] - r0[c00 + c]);
+                    const float v10 = r0[c10 + c] + az * (r0[c10 + 4 + c] - r0[c10 + c]);
+                    const float v01 = r1[c00 + c] + az * (r1[c00 + 4 + c] - r1[c00 + c]);
+                    const float v11 = r1[c10 + c] + az * (r1[c10 + 4 + c] - r1[c10 + c]);
+                    const float v0 = v00 + ax * (v10 - v00);
+                    const float v1 = v01 + ax * (v11 - v01);
+                    acc[c] = v0 + ay * (v1 - v0);
+                }
+                if (acc[3] <= 1e-6f) {
+                    d[x] = s[x];
+                    continue;
+                }
+                const float inv = 1 / acc[3];
+                d[x] = qRgba(qBound(0, int(acc[0] * inv + 0.5f), 255),
+                             qBound(0, int(acc[1] * inv + 0.5f), 255),
+                             qBound(0, int(acc[2] * inv + 0.5f), 255), qAlpha(s[x]));
+            }
+        }
+    });
+
+    return src.format() == QImage::Format_Grayscale8
+        ? out.convertToFormat(QImage::Format_Grayscale8) : out;
+}
@@ -0,0 +1,20 @@
+#ifndef BILATERAL_H
+#define BILATERAL_H
+
+#include <QImage>
+
+// Edge-preserving smoothing: every pixel becomes a Gaussian-weighted mean of
+// the pixels within about spatialSigma pixels whose luma is within about
+// rangeSigma levels of its own, so noise is averaged away but edges are not.
+//
+// Bilateral grid approximation: pixels are splatted into a grid sampled every
+// spatialSigma pixels and rangeSigma levels, the grid is blurred with a
+// 1-4-6-4-1 kernel along all three axes and the result is sliced back out by
+// trilinear interpolation. The grid has (w h / spatialSigma^2) x
+// (256 / rangeSigma) cells, so larger spatial radii get cheaper, not dearer.
+// It is built and sliced in blocks of grid cells with a halo, in parallel;
+// each block stays within about 4 MB however wide the frame is. Colour
+// channels are smoothed together with luma as the edge guide; alpha is kept.
+QImage bilateralFilter(const QImage &src, double spatialSigma, double rangeSigma);
+
+#endif // BILATERAL_H
@@ -0,0 +1,198 @@
+#include "bitmask.h"
+#include "tiles.h"
+#include <QtEndian>
+#include <cstring>
+
+namespace {
+
+const int BandRows = 64;
+
+// The eight Grayscale8 pixels of every byte of mask bits.
+struct ByteExpansion
+{
+    uchar pixels[256][8];
+
+    ByteExpansion()
+    {
+        for (int b = 0; b < 256; ++b)
+            for (int i = 0; i < 8; ++i)
+                pixels[b][i] = b >> i & 1 ? 255 : 0;
+    }
+};
+
+} // namespace
+
+BitMask::BitMask(int width, int height, bool value)
+{
+    if (width <= 0 || height <= 0)
+        return;
+    w = width;
+    h = height;
+    stride = (width + 63) / 64;
+    words.resize(qsizetype(stride) * height);
+    fill(value);
+}
+
+BitMask BitMask::fromImage(const QImage &img)
+{
+    if (img.isNull())
+        return BitMask();
+    const QImage gray = img.convertToFormat(QImage::Format_Grayscale8);
+    BitMask mask(gray.width(), gray.height());
+    quint64 *bits = mask.row(0);
+    parallelRows(gray.rect(), BandRows, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const uchar *s = gray.constScanLine(y);
+            quint64 *d = bits + qsizetype(y) * mask.stride;
+            for (int i = 0; i < mask.stride; ++i) {
+                const int x0 = i * 64, n = qMin(64, mask.w - x0);
+                quint64 word = 0;
+                for (int x = 0; x < n; ++x)
+                    word |= quint64(s[x0 + x] != 0) << x;
+                d[i] = word;
+            }
+        }
+    });
+    return mask;
+}
+
+QImage BitMask::toImage() const
+{
+    if (isNull())
+        return QImage();
+    QImage img(w, h, QImage::Format_Grayscale8);
+    uchar *bits = img.bits();
+    const qsizetype bpl = img.bytesPerLine();
+    static const ByteExpansion expand;
+    parallelRows(rect(), BandRows, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const quint64 *s = constRow(y);
+            uchar *d = bits + y * bpl;
+            int x = 0;
+            for (; x + 8 <= w; x += 8)
+                std::memcpy(d + x, expand.pixels[s[x >> 6] >> (x & 63) & 0xff], 8);
+            for (; x < w; ++x)
+                d[x] = expand.pixels[s[x >> 6] >> (x & 63) & 1][0];
+        }
+    });
+    return img;
+}
+
+QImage BitMask::toOverlay(QRgb color) const
+{
+    if (isNull())
+        return QImage();
+    QImage img(w, h, QImage::Format_MonoLSB);
+    img.setColorTable({ qRgba(0, 0, 0, 0), color });
+    uchar *bits = img.bits();
+    const qsizetype bpl = img.bytesPerLine();
+    const size_t rowBytes = size_t(w + 7) / 8;
+    parallelRows(rect(), BandRows, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            // MonoLSB is the same bit order byte for byte, once the words are
+            // laid out little-endian.
+            const quint64 *s = constRow(y);
+            uchar *d = bits + y * bpl;
+            for (int i = 0; i < stride; ++i) {
+                const quint64 word = qToLittleEndian(s[i]);
+                std::memcpy(d + i * 8, &word, qMin<size_t>(8, rowBytes - i * 8));
+            }
+        }
+    });
+    return img;
+}
+
+void BitMask::fill(bool on)
+{
+    words.fill(on ? ~quint64(0) : 0);
+    if (on && (w & 63)) {
+        const quint64 last = lastWordMask();
+        for (int y = 0; y < h; ++y)
+            row(y)[stride - 1] = last;
+    }
+}
+
+qint64 BitMask::count() const
+{
+    qint64 n = 0;
+    for (quint64 word : words)
+        n += qPopulationCount(word);
+    return n;
+}
+
+QRect BitMask::boundingRect() const
+{
+    int x0 = w, x1 = -1, y0 = -1, y1 = -1;
+    for (int y = 0; y < h; ++y) {
+        const quint64 *r = constRow(y);
+        int first = -1, last = -1;
+        for (int i = 0; i < stride; ++i) {
+            if (!r[i])
+                continue;
+            if (first < 0)
+                first = i * 64 + qCountTrailingZeroBits(r[i]);
+            last = i * 64 + 63 - qCountLeadingZeroBits(r[i]);
+        }
+        if (first < 0)
+            continue;
+        if (y0 < 0)
+            y0 = y;
+        y1 = y;
+        x0 = qMin(x0, first);
+        x1 = qMax(x1, last);
+    }
+    return y0 < 0 ? QRect() : QRect(QPoint(x0, y0), QPoint(x1, y1));
+}
+
+BitMask &BitMask::operator&=(const BitMask &other)
+{
+    Q_ASSERT(size() == other.size());
+    quint64 *d = words.data();
+    const quint64 *s = other.words.constData();
+    for (qsizetype i = 0; i < words.size(); ++i)
+        d[i] &= s[i];
+    return *this;
+}
+
+BitMask &BitMask::operator|=(const BitMask &other)
+{
+    Q_ASSERT(size() == other.size());
+    quint64 *d = words.data();
+    const quint64 *s = other.words.constData();
+    for (qsizetype i = 0; i < words.size(); ++i)
+        d[i] |= s[i];
+    return *this;
+}
+
+BitMask &BitMask::operator^=(const BitMask &other)
+{
+    Q_ASSERT(size() == other.size());
+    quint64 *d = words.data();
+    const quint64 *s = other.words.constData();
+    for (qsizetype i = 0; i < words.size(); ++i)
+        d[i] ^= s[i];
+    return *this;
+}
+
+BitMask &BitMask::subtract(const BitMask &other)
+{
+    Q_ASSERT(size() == other.size());
+    quint64 *d = words.data();
+    const quint64 *s = other.words.constData();
+    for (qsizetype i = 0; i < words.size(); ++i)
+        d[i] &= ~s[i];
+    return *this;
+}
+
+BitMask &BitMask::invert()
+{
+    quint64 *d = words.data();
+    for (qsizetype i = 0; i < words.size(); ++i)
+        d[i] = ~d[i];
+    if (w & 63) {
+        const quint64 last = lastWordMask();
+        for (int y = 0; y < h; ++y)
+            row(y)[stride - 1] &= last;
+    }
+    return *this;
+}
@@ -0,0 +1,120 @@
+#ifndef BITMASK_H
+#define BITMASK_H
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+#include <QtAlgorithms>
+
+// Binary mask at one bit per pixel, 8 times smaller than a Grayscale8 mask.
+// Every row is a whole number of 64-bit words with pixel x in bit x % 64 of
+// word x / 64; the bits past the width are always 0, so the set operations,
+// count() and == work a word at a time without masking.
+class BitMask
+{
+public:
+    BitMask() = default;
+    BitMask(int width, int height, bool value = false);
+    explicit BitMask(const QSize &size, bool value = false)
+        : BitMask(size.width(), size.height(), value) {}
+
+    // Set where img (read as Grayscale8) is non-zero.
+    static BitMask fromImage(const QImage &img);
+    // Grayscale8, 255 where set and 0 elsewhere.
+    QImage toImage() const;
+    // MonoLSB image sharing the mask's bit layout, with color where set and
+    // transparent elsewhere, to draw over the picture the mask came from.
+    QImage toOverlay(QRgb color) const;
+
+    bool isNull() const { return words.isEmpty(); }
+    int width() const { return w; }
+    int height() const { return h; }
+    QSize size() const { return QSize(w, h); }
+    QRect rect() const { return QRect(0, 0, w, h); }
+    int wordsPerLine() const { return stride; }
+
+    quint64 *row(int y) { return words.data() + qsizetype(y) * stride; }
+    const quint64 *constRow(int y) const { return words.constData() + qsizetype(y) * stride; }
+
+    bool testBit(int x, int y) const
+    {
+        return constRow(y)[x >> 6] >> (x & 63) & 1;
+    }
+    void setBit(int x, int y, bool on = true)
+    {
+        const quint64 bit = quint64(1) << (x & 63);
+        quint64 &word = row(y)[x >> 6];
+        word = on ? word | bit : word & ~bit;
+    }
+    void fill(bool on);
+
+    // Number of pixels set.
+    qint64 count() const;
+    // Smallest rectangle holding every pixel set; empty if none is.
+    QRect boundingRect() const;
+
+    // Calls fn(x0, x1) for every run of set pixels of row y, x1 inclusive, left
+    // to right. Whole words of 0 or 1 are skipped in one step.
+    template <typename Fn>
+    void forEachRun(int y, Fn fn) const;
+
+    // Both masks must have the same size.
+    BitMask &operator&=(const BitMask &other);
+    BitMask &operator|=(const BitMask &other);
+    BitMask &operator^=(const BitMask &other);
+    // Clears the pixels set in other.
+    BitMask &subtract(const BitMask &other);
+    BitMask &invert();
+
+    BitMask operator&(const BitMask &other) const { return BitMask(*this) &= other; }
+    BitMask operator|(const BitMask &other) const { return BitMask(*this) |= other; }
+    BitMask operator^(const BitMask &other) const { return BitMask(*this) ^= other; }
+    BitMask operator~() const { return BitMask(*this).invert(); }
+
+    bool operator==(const BitMask &other) const
+    {
+        return w == other.w && h == other.h && words == other.words;
+    }
+    bool operator!=(const BitMask &other) const { return !(*this == other); }
+
+private:
+    // The bits of the last word of a row that lie inside the image.
+    quint64 lastWordMask() const
+    {
+        return w & 63 ? (quint64(1) << (w & 63)) - 1 : ~quint64(0);
+    }
+
+    int w = 0;
+    int h = 0;
+    int stride = 0;
+    QVector<quint64> words;
+};
+
+template <typename Fn>
+void BitMask::forEachRun(int y, Fn fn) const
+{
+    const quint64 *r = constRow(y);
+    int i = 0;
+    quint64 bits = stride ? r[0] : 0;
+    while (i < stride) {
+        // Next set bit, then the next clear one after it.
+        while (!bits) {
+            if (++i == stride)
+                return;
+            bits = r[i];
+        }
+        const int x0 = i * 64 + qCountTrailingZeroBits(bits);
+        bits = ~bits & (~quint64(0) << (x0 & 63));
+        while (!bits) {
+            if (++i == stride)
+                break;
+            bits = ~r[i];
+        }
+        const int x1 = i < stride ? i * 64 + qCountTrailingZeroBits(bits) : stride * 64;
+        fn(x0, qMin(x1, w) - 1);
+        if (i < stride)
+            bits = r[i] & (~quint64(0) << (x1 & 63));
+    }
+}
+
+#endif // BITMASK_H
@@ -0,0 +1,184 @@
+#include "canny.h"
+#include "ccl.h"
+#include "colorspace.h"
+#include "tiles.h"
+#include <QtMath>
+#include <algorithm>
+
+namespace {
+
+// Output tile edge; with the halo the float planes of a tile stay in L2.
+const int TileSize = 128;
+const int BandRows = 64;
+const uchar Weak = 128;
+const uchar Strong = 255;
+
+// Per-thread planes, reused from tile to tile.
+struct Scratch
+{
+    QVector<int> columns;
+    QVector<float> line, rows, smooth, gx, gy, mag;
+};
+
+// Weak/strong classification of the pixels of tile: Gaussian rows and
+// columns over the tile plus a halo of 2 + r (border pixels repeat), Sobel
+// over the tile plus 1, then non-maximum suppression on the tile itself.
+// Magnitudes stay squared throughout; the thresholds are squared to match.
+void classifyTile(const QImage &luma, const QRect &tile, const QVector<float> &kernel,
+                  float low2, float high2, uchar *cls, qsizetype clsBpl)
+{
+    thread_local Scratch s;
+    const int w = luma.width(), h = luma.height();
+    const int r = int(kernel.size()) / 2, taps = int(kernel.size());
+    const int tw = tile.width(), th = tile.height();
+    const int sw = tw + 4, sh = th + 4;          // smoothed plane
+    const int gw = tw + 2, gh = th + 2;          // gradient planes
+    const int sx0 = tile.left() - 2, sy0 = tile.top() - 2;
+    const float *k = kernel.constData();
+
+    s.columns.resize(sw + 2 * r);
+    for (int i = 0; i < s.columns.size(); ++i)
+        s.columns[i] = qBound(0, sx0 - r + i, w - 1);
+    s.line.resize(sw + 2 * r);
+    s.rows.resize(qsizetype(sw) * (sh + 2 * r));
+    s.smooth.resize(qsizetype(sw) * sh);
+    s.gx.resize(qsizetype(gw) * gh);
+    s.gy.resize(s.gx.size());
+    s.mag.resize(s.gx.size());
+    const int *columns = s.columns.constData();
+    float *line = s.line.data(), *rows = s.rows.data(), *smooth = s.smooth.data();
+    float *gxs = s.gx.data(), *gys = s.gy.data(), *mag = s.mag.data();
+
+    // The kernel is symmetric, so mirrored taps share one multiply.
+    for (int j = 0; j < sh + 2 * r; ++j) {
+        const uchar *src = luma.constScanLine(qBound(0, sy0 - r + j, h - 1));
+        for (int i = 0; i < sw + 2 * r; ++i)
+            line[i] = src[columns[i]];
+        float *d = rows + qsizetype(j) * sw;
+        for (int x = 0; x < sw; ++x)
+            d[x] = k[r] * line[x + r];
+        for (int t = 0; t < r; ++t)
+            for (int x = 0; x < sw; ++x)
+                d[x] += k[t] * (line[x + t] + line[x + taps - 1 - t]);
+    }
+    for (int y = 0; y < sh; ++y) {
+        float *d = smooth + qsizetype(y) * sw;
+        const float *mid = rows + qsizetype(y + r) * sw;
+        for (int x = 0; x < sw; ++x)
+            d[x] = k[r] * mid[x];
+        for (int t = 0; t < r; ++t) {
+            const float *above = rows + qsizetype(y + t) * sw;
+            const float *below = rows + qsizetype(y + taps - 1 - t) * sw;
+            for (int x = 0; x < sw; ++x)
+                d[x] += k[t] * (above[x] + below[x]);
+        }
+    }
+
+    // Plain loops over whole rows so the compiler vectorises the Sobel and
+    // magnitude arithmetic.
+    for (int y = 0; y < gh; ++y) {
+        const float *a = smooth + qsizetype(y) * sw, *b = a + sw, *c = b + sw;
+        float *dx = gxs + qsizetype(y) * gw, *dy = gys + qsizetype(y) * gw;
+        float *m = mag + qsizetype(y) * gw;
+        for (int x = 0; x < gw; ++x) {
+            const float gx = (a[x + 2] + 2 * b[x + 2] + c[x + 2]) - (a[x] + 2 * b[x] + c[x]);
+            const float gy = (c[x] + 2 * c[x + 1] + c[x + 2]) - (a[x] + 2 * a[x + 1] + a[x + 2]);
+            dx[x] = gx;
+            dy[x] = gy;
+            m[x] = gx * gx + gy * gy;
+        }
+    }
+
+    // tan(22.5) and tan(67.5) split the gradient directions into four.
+    const float tan22 = 0.41421356f, tan67 = 2.41421356f;
+    for (int y = 0; y < th; ++y) {
+        uchar *out = cls + qsizetype(tile.top() + y) * clsBpl + tile.left();
+        for (int x = 0; x < tw; ++x) {
+            const qsizetype i = qsizetype(y + 1) * gw + x + 1;
+            const float m = mag[i];
+            if (m < low2) {
+                out[x] = 0;
+                continue;
+            }
+            const float ax = qAbs(gxs[i]), ay = qAbs(gys[i]);
+            qsizetype step;
+            if (ay <= ax * tan22)
+                step = 1;
+            else if (ay >= ax * tan67)
+                step = gw;
+            else if ((gxs[i] > 0) == (gys[i] > 0))
+                step = gw + 1;
+            else
+                step = gw - 1;
+            // Ties go to the pixel before, so plateaus keep one pixel.
+            const bool peak = m > mag[i - step] && m >= mag[i + step];
+            out[x] = !peak ? 0 : (m >= high2 ? Strong : Weak);
+        }
+    }
+}
+
+} // namespace
+
+QImage cannyEdges(const QImage &src, double sigma, double low, double high)
+{
+    return cannyMask(src, sigma, low, high).toImage();
+}
+
+BitMask cannyMask(const QImage &src, double sigma, double low, double high)
+{
+    if (src.isNull())
+        return BitMask();
+    const QImage luma = lumaImage(src);
+    const int w = luma.width(), h = luma.height();
+
+    sigma = qMax(sigma, 0.1);
+    const int r = qMax(1, qCeil(3.0 * sigma));
+    QVector<float> kernel(2 * r + 1);
+    float sum = 0;
+    for (int i = -r; i <= r; ++i)
+        sum += kernel[i + r] = float(qExp(-0.5 * i * i / (sigma * sigma)));
+    for (float &k : kernel)
+        k /= sum;
+    if (high < low)
+        std::swap(low, high);
+
+    QImage cls(w, h, QImage::Format_Grayscale8);
+    uchar *clsBits = cls.bits();
+    const qsizetype clsBpl = cls.bytesPerLine();
+    parallelTiles(luma.rect(), TileSize, [&](const QRect &tile) {
+        classifyTile(luma, tile, kernel, float(low * low), float(high * high), clsBits, clsBpl);
+    });
+
+    // Hysteresis: a candidate survives if its 8-connected component of
+    // candidates reaches a strong pixel.
+    const Labeling labeling = labelComponents(BitMask::fromImage(cls), true);
+    QVector<QVector<qint32>> strong((h + BandRows - 1) / BandRows);
+    const qint32 *labels = labeling.labels.constData();
+    parallelRows(cls.rect(), BandRows, [&](const QRect &band) {
+        QVector<qint32> &found = strong[band.top() / BandRows];
+        qint32 last = 0;
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const uchar *c = clsBits + y * clsBpl;
+            const qint32 *l = labels + qsizetype(y) * w;
+            for (int x = 0; x < w; ++x)
+                if (c[x] == Strong && l[x] != last)
+                    found.append(last = l[x]);
+        }
+    });
+    QVector<uchar> keep(labeling.components.size() + 1, 0);
+    for (const QVector<qint32> &found : strong)
+        for (qint32 label : found)
+            keep[label] = 1;
+
+    BitMask edges(w, h);
+    const uchar *kept = keep.constData();
+    parallelRows(edges.rect(), BandRows, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const qint32 *l = labels + qsizetype(y) * w;
+            quint64 *d = edges.row(y);
+            for (int x = 0; x < w; ++x)
+                d[x >> 6] |= quint64(kept[l[x]]) << (x & 63);
+        }
+    });
+    return edges;
+}
@@ -0,0 +1,20 @@
+#ifndef CANNY_H
+#define CANNY_H
+
+#include "bitmask.h"
+#include <QImage>
+
+// Canny edges of the luma of src as a Grayscale8 mask, 255 on edge pixels, or
+// as a BitMask. sigma is the Gaussian pre-smoothing; low and high are the
+// hysteresis thresholds on the Sobel gradient magnitude of the smoothed 0..255
+// luma.
+//
+// Smoothing, gradients and non-maximum suppression run fused, one tile with
+// its halo at a time, so the intermediate planes never leave the cache; only
+// the weak/strong classification is written out. Hysteresis then labels the
+// candidate pixels with labelComponents() and keeps every component that
+// holds a strong pixel, so no pixel-by-pixel flood fill is needed.
+QImage cannyEdges(const QImage &src, double sigma = 1.4, double low = 30, double high = 90);
+BitMask cannyMask(const QImage &src, double sigma = 1.4, double low = 30, double high = 90);
+
+#endif // CANNY_H
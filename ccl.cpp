@@ -0,0 +1,187 @@
+#include "ccl.h"
+#include "scheduler.h"
+#include <vector>
+
+namespace {
+
+struct Run
+{
+    int x0;   // first pixel
+    int x1;   // last pixel
+    int y;
+};
+
+struct Band
+{
+    int y0;
+    int y1;
+    int first;              // global index of the band's first run
+    std::vector<Run> runs;
+    std::vector<int> rows;  // runs of row y0 + i are rows[i] .. rows[i + 1] - 1
+};
+
+// Union-find over run indices. The root of a set is always its smallest index,
+// which is the set's first run in raster order.
+int findRoot(std::vector<int> &parent, int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+void unite(std::vector<int> &parent, int a, int b)
+{
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a < b)
+        parent[b] = a;
+    else if (b < a)
+        parent[a] = b;
+}
+
+// Joins the runs of two neighbouring rows that touch. Both lists are sorted by
+// x, so one merge-like sweep finds every overlapping pair.
+void joinRows(std::vector<int> &parent, const Run *above, int aFirst, int aCount,
+              const Run *below, int bFirst, int bCount, int reach)
+{
+    int i = 0, j = 0;
+    while (i < aCount && j < bCount) {
+        const Run &a = above[i], &b = below[j];
+        if (a.x0 <= b.x1 + reach && b.x0 <= a.x1 + reach)
+            unite(parent, aFirst + i, bFirst + j);
+        if (a.x1 < b.x1)
+            ++i;
+        else
+            ++j;
+    }
+}
+
+} // namespace
+
+int Labeling::labelAt(const QPoint &pos) const
+{
+    if (pos.x() < 0 || pos.y() < 0 || pos.x() >= width || pos.y() >= height)
+        return 0;
+    return labels[qsizetype(pos.y()) * width + pos.x()];
+}
+
+const Component *Labeling::componentAt(const QPoint &pos) const
+{
+    const int label = labelAt(pos);
+    return label > 0 ? &components[label - 1] : nullptr;
+}
+
+Labeling labelComponents(const QImage &mask, bool eightConnected)
+{
+    return labelComponents(BitMask::fromImage(mask), eightConnected);
+}
+
+Labeling labelComponents(const BitMask &mask, bool eightConnected)
+{
+    Labeling result;
+    if (mask.isNull())
+        return result;
+    const int w = mask.width(), h = mask.height();
+    const int reach = eightConnected ? 1 : 0;
+    result.width = w;
+    result.height = h;
+
+    const int workers = TaskScheduler::instance().workerCount() + 1;
+    const int bandRows = qMax(16, (h + 4 * workers - 1) / (4 * workers));
+    std::vector<Band> bands((h + bandRows - 1) / bandRows);
+
+    // Runs of every band.
+    TaskScheduler::instance().run(int(bands.size()), [&](int b) {
+        Band &band = bands[b];
+        band.y0 = b * bandRows;
+        band.y1 = qMin(h, band.y0 + bandRows);
+        band.rows.reserve(band.y1 - band.y0 + 1);
+        for (int y = band.y0; y < band.y1; ++y) {
+            band.rows.push_back(int(band.runs.size()));
+            mask.forEachRun(y, [&](int x0, int x1) {
+                band.runs.push_back({ x0, x1, y });
+            });
+        }
+        band.rows.push_back(int(band.runs.size()));
+    });
+
+    int total = 0;
+    for (Band &band : bands) {
+        band.first = total;
+        total += int(band.runs.size());
+    }
+    std::vector<int> parent(total);
+    for (int i = 0; i < total; ++i)
+        parent[i] = i;
+
+    // Inside a band; every band only touches its own indices.
+    TaskScheduler::instance().run(int(bands.size()), [&](int b) {
+        const Band &band = bands[b];
+        for (int r = 1; r < band.y1 - band.y0; ++r) {
+            const int a0 = band.rows[r - 1], b0 = band.rows[r];
+            joinRows(parent, band.runs.data() + a0, band.first + a0, b0 - a0,
+                     band.runs.data() + b0, band.first + b0, band.rows[r + 1] - b0, reach);
+        }
+    });
+
+    // Merge pass across the seams.
+    for (size_t b = 1; b < bands.size(); ++b) {
+        const Band &up = bands[b - 1], &down = bands[b];
+        const int a0 = up.rows[up.rows.size() - 2];
+        const int aCount = int(up.runs.size()) - a0;
+        joinRows(parent, up.runs.data() + a0, up.first + a0, aCount,
+                 down.runs.data(), down.first, down.rows[1], reach);
+    }
+
+    // Final labels and statistics. Roots come before the rest of their set,
+    // so one pass in run order numbers the components in raster order.
+    std::vector<qint32> runLabel(total);
+    struct Stats { qint64 area; double sx, sy; int x0, y0, x1, y1; };
+    std::vector<Stats> stats;
+    for (const Band &band : bands) {
+        for (size_t k = 0; k < band.runs.size(); ++k) {
+            const int i = band.first + int(k);
+            const int root = findRoot(parent, i);
+            const Run &run = band.runs[k];
+            if (root == i) {
+                stats.push_back({ 0, 0, 0, run.x0, run.y, run.x1, run.y });
+                runLabel[i] = qint32(stats.size());
+            } else {
+                runLabel[i] = runLabel[root];
+            }
+            Stats &s = stats[runLabel[i] - 1];
+            const int len = run.x1 - run.x0 + 1;
+            s.area += len;
+            s.sx += 0.5 * (run.x0 + run.x1 + 1) * len;
+            s.sy += (run.y + 0.5) * len;
+            s.x0 = qMin(s.x0, run.x0);
+            s.x1 = qMax(s.x1, run.x1);
+            s.y1 = run.y;
+        }
+    }
+
+    result.components.resize(qsizetype(stats.size()));
+    for (size_t i = 0; i < stats.size(); ++i) {
+        const Stats &s = stats[i];
+        Component &c = result.components[qsizetype(i)];
+        c.label = int(i) + 1;
+        c.area = s.area;
+        c.bounds = QRect(QPoint(s.x0, s.y0), QPoint(s.x1, s.y1));
+        c.centroid = QPointF(s.sx / s.area, s.sy / s.area);
+    }
+
+    result.labels.resize(qsizetype(w) * h);
+    qint32 *labels = result.labels.data();
+    TaskScheduler::instance().run(int(bands.size()), [&](int b) {
+        const Band &band = bands[b];
+        for (size_t k = 0; k < band.runs.size(); ++k) {
+            const Run &run = band.runs[k];
+            qint32 *d = labels + qsizetype(run.y) * w;
+            for (int x = run.x0; x <= run.x1; ++x)
+                d[x] = runLabel[band.first + k];
+        }
+    });
+    return result;
+}
@@ -0,0 +1,40 @@
+#ifndef CCL_H
+#define CCL_H
+
+#include "bitmask.h"
+#include <QImage>
+#include <QPointF>
+#include <QRect>
+#include <QVector>
+
+struct Component
+{
+    int label;          // value of the component's pixels in Labeling::labels
+    qint64 area;        // pixel count
+    QRect bounds;
+    QPointF centroid;   // mean pixel position (pixel centres at +0.5)
+};
+
+struct Labeling
+{
+    int width = 0;
+    int height = 0;
+    QVector<qint32> labels;          // width x height, 0 on the background
+    QVector<Component> components;   // components[i].label == i + 1
+
+    bool isEmpty() const { return components.isEmpty(); }
+    int labelAt(const QPoint &pos) const;
+    // nullptr on the background or outside the image.
+    const Component *componentAt(const QPoint &pos) const;
+};
+
+// Labels the connected non-zero pixels of mask (read as Grayscale8), with 8- or
+// 4-connectivity. Works on horizontal runs instead of pixels: bands of rows are
+// split into runs and joined with union-find in parallel, then a merge pass joins
+// the runs that touch across band seams. Labels are numbered in raster order of
+// each component's first pixel, so the result does not depend on the banding.
+Labeling labelComponents(const QImage &mask, bool eightConnected = true);
+// Same on a bit mask, whose runs are read a word at a time.
+Labeling labelComponents(const BitMask &mask, bool eightConnected = true);
+
+#endif // CCL_H
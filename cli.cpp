@@ -0,0 +1,682 @@
+#include "cli.h"
+#include "streamproc.h"
+#include "compare.h"
+#include "framering.h"
+#include "ipxfile.h"
+#include "lens.h"
+#include "match.h"
+#include "morphology.h"
+#include "pipeline.h"
+#include "quantize.h"
+#include "scheduler.h"
+#include "stack.h"
+#include "watchfolder.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QImage>
+#include <QTextStream>
+#include <QThread>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+int streamCommand(const QStringList &args)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Decodes the input a band of rows at a time, applies the operations in order\n"
+        "and encodes the output as it goes, so the whole image is never in memory.\n"
+        "Operations: hmirror, invert, gray, gamma:G, downscale:N, blur:SIGMA");
+    parser.addHelpOption();
+    QCommandLineOption bandOption("band", "Rows decoded per band (default 64).", "rows", "64");
+    QCommandLineOption opOption("op", "Operation to apply, may be repeated.", "op");
+    parser.addOption(bandOption);
+    parser.addOption(opOption);
+    parser.addPositionalArgument("input", "ppm/pgm, bmp, jpg or png file.");
+    parser.addPositionalArgument("output", "ppm, bmp, jpg or png file.");
+    parser.process(args);
+
+    QTextStream err(stderr);
+    const QStringList files = parser.positionalArguments();
+    if (files.size() != 2) {
+        err << "stream: expected an input and an output file\n";
+        return 2;
+    }
+    QList<StreamOp> ops;
+    for (const QString &text : parser.values(opOption)) {
+        StreamOp op;
+        if (!parseStreamOp(text, &op)) {
+            err << "stream: unknown operation " << text << "\n";
+            return 2;
+        }
+        ops.append(op);
+    }
+    QString error;
+    if (!streamProcess(files[0], files[1], ops, parser.value(bandOption).toInt(), &error)) {
+        err << "stream: " << error << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int morphCommand(const QStringList &args)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Erodes, dilates, opens or closes the input with a flat structuring element.\n"
+        "Shapes: rect (size x height), hline, vline, diag, antidiag (size long).");
+    parser.addHelpOption();
+    QCommandLineOption opOption("op", "erode, dilate, open or close.", "op", "erode");
+    QCommandLineOption shapeOption("shape", "Structuring element shape.", "shape", "rect");
+    QCommandLineOption sizeOption("size", "Element width or line length.", "pixels", "3");
+    QCommandLineOption heightOption("height", "Rectangle height (default: size).", "pixels", "0");
+    parser.addOption(opOption);
+    parser.addOption(shapeOption);
+    parser.addOption(sizeOption);
+    parser.addOption(heightOption);
+    parser.addPositionalArgument("input", "Image file.");
+    parser.addPositionalArgument("output", "Image file.");
+    parser.process(args);
+
+    QTextStream err(stderr);
+    const QStringList files = parser.positionalArguments();
+    MorphOp op;
+    MorphShape shape;
+    if (files.size() != 2) {
+        err << "morph: expected an input and an output file\n";
+        return 2;
+    }
+    if (!parseMorphOp(parser.value(opOption), &op)
+        || !parseMorphShape(parser.value(shapeOption), &shape)) {
+        err << "morph: unknown operation or shape\n";
+        return 2;
+    }
+    QImage img(files[0]);
+    if (img.isNull()) {
+        err << "morph: cannot read " << files[0] << "\n";
+        return 1;
+    }
+    img = morphology(img, op, shape, parser.value(sizeOption).toInt(),
+                     parser.value(heightOption).toInt());
+    if (!img.save(files[1])) {
+        err << "morph: cannot write " << files[1] << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int undistortCommand(const QStringList &args)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Corrects radial and tangential lens distortion (Brown-Conrady model, on\n"
+        "coordinates normalised by the focal length). Every input is written to the\n"
+        "output folder under the same name; the remap is built once per image size.");
+    parser.addHelpOption();
+    QCommandLineOption k1Option("k1", "Radial coefficient of r^2.", "k", "0");
+    QCommandLineOption k2Option("k2", "Radial coefficient of r^4.", "k", "0");
+    QCommandLineOption k3Option("k3", "Radial coefficient of r^6.", "k", "0");
+    QCommandLineOption p1Option("p1", "Tangential coefficient.", "p", "0");
+    QCommandLineOption p2Option("p2", "Tangential coefficient.", "p", "0");
+    QCommandLineOption focalOption("focal", "Focal length in pixels (default: half the diagonal).", "pixels", "0");
+    QCommandLineOption cxOption("cx", "Principal point, pixels right of the centre.", "pixels", "0");
+    QCommandLineOption cyOption("cy", "Principal point, pixels below the centre.", "pixels", "0");
+    QCommandLineOption outOption("out", "Output folder.", "dir");
+    parser.addOption(k1Option);
+    parser.addOption(k2Option);
+    parser.addOption(k3Option);
+    parser.addOption(p1Option);
+    parser.addOption(p2Option);
+    parser.addOption(focalOption);
+    parser.addOption(cxOption);
+    parser.addOption(cyOption);
+    parser.addOption(outOption);
+    parser.addPositionalArgument("images", "Image files.", "images...");
+    parser.process(args);
+
+    QTextStream err(stderr);
+    const QStringList files = parser.positionalArguments();
+    const QString outDir = parser.value(outOption);
+    if (files.isEmpty() || outDir.isEmpty()) {
+        err << "undistort: expected --out and at least one image\n";
+        return 2;
+    }
+    LensModel lens;
+    bool ok[8];
+    lens.k1 = parser.value(k1Option).toDouble(&ok[0]);
+    lens.k2 = parser.value(k2Option).toDouble(&ok[1]);
+    lens.k3 = parser.value(k3Option).toDouble(&ok[2]);
+    lens.p1 = parser.value(p1Option).toDouble(&ok[3]);
+    lens.p2 = parser.value(p2Option).toDouble(&ok[4]);
+    lens.focal = parser.value(focalOption).toDouble(&ok[5]);
+    lens.cx = parser.value(cxOption).toDouble(&ok[6]);
+    lens.cy = parser.value(cyOption).toDouble(&ok[7]);
+    for (bool b : ok)
+        if (!b) {
+            err << "undistort: bad lens parameter\n";
+            return 2;
+        }
+    if (!QDir().mkpath(outDir)) {
+        err << "undistort: cannot create " << outDir << "\n";
+        return 1;
+    }
+
+    int failed = 0;
+    for (const QString &file : files) {
+        const QImage img(file);
+        const QString target = QDir(outDir).filePath(QFileInfo(file).fileName());
+        if (img.isNull()) {
+            err << "undistort: cannot read " << file << "\n";
+            ++failed;
+        } else if (!undistortImage(img, lens).save(target)) {
+            err << "undistort: cannot write " << target << "\n";
+            ++failed;
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+QImage loadAnyImage(const QString &path)
+{
+    return isIpxFile(path) ? loadIpx(path) : QImage(path);
+}
+
+int compareCommand(const QStringList &args)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Compares two images, or every image of a folder with the file of the same\n"
+        "name in another, and prints: name mse psnr ssim max-error differing-pixels.\n"
+        "Exits with 1 when a pair is missing, differs in size or falls below a limit.");
+    parser.addHelpOption();
+    QCommandLineOption heatOption("heatmap", "Write difference heat maps here (a file, or a folder\n"
+                                  "of <file name>.png, e.g. a.jpg.png, when comparing folders).", "path");
+    QCommandLineOption psnrOption("min-psnr", "Lowest acceptable PSNR in dB.", "dB", "0");
+    QCommandLineOption ssimOption("min-ssim", "Lowest acceptable SSIM.", "ssim", "-1");
+    parser.addOption(heatOption);
+    parser.addOption(psnrOption);
+    parser.addOption(ssimOption);
+    parser.addPositionalArgument("reference", "Image file or folder.");
+    parser.addPositionalArgument("test", "Image file or folder.");
+    parser.process(args);
+
+    QTextStream err(stderr);
+    QTextStream out(stdout);
+    const QStringList paths = parser.positionalArguments();
+    bool psnrOk, ssimOk;
+    const double minPsnr = parser.value(psnrOption).toDouble(&psnrOk);
+    const double minSsim = parser.value(ssimOption).toDouble(&ssimOk);
+    if (paths.size() != 2) {
+        err << "compare: expected a reference and a test image or folder\n";
+        return 2;
+    }
+    if (!psnrOk || !ssimOk) {
+        err << "compare: bad PSNR or SSIM limit\n";
+        return 2;
+    }
+    const QString heatPath = parser.value(heatOption);
+    const bool folders = QFileInfo(paths[0]).isDir();
+    QStringList refs, tests, heats;
+    if (folders) {
+        refs = stackFrameFiles(paths[0]);
+        for (const QString &ref : refs) {
+            const QString name = QFileInfo(ref).fileName();
+            tests.append(QDir(paths[1]).filePath(name));
+            heats.append(heatPath.isEmpty() ? QString()
+                         : QDir(heatPath).filePath(name + ".png"));
+        }
+        if (!heatPath.isEmpty() && !QDir().mkpath(heatPath)) {
+            err << "compare: cannot create " << heatPath << "\n";
+            return 1;
+        }
+    } else {
+        refs.append(paths[0]);
+        tests.append(paths[1]);
+        heats.append(heatPath);
+    }
+
+    // Pairs run side by side; each comparison is parallel inside as well.
+    QVector<ImageComparison> results(refs.size());
+    QVector<QString> errors(refs.size());
+    TaskScheduler::instance().run(int(refs.size()), [&](int i) {
+        const QImage a = loadAnyImage(refs[i]), b = loadAnyImage(tests[i]);
+        QImage heat;
+        if (a.isNull() || b.isNull()) {
+            errors[i] = QStringLiteral("cannot read %1").arg(a.isNull() ? refs[i] : tests[i]);
+        } else if (compareImages(a, b, &results[i], heats[i].isEmpty() ? nullptr : &heat, &errors[i])
+                   && !heats[i].isEmpty() && !heat.save(heats[i])) {
+            errors[i] = QStringLiteral("cannot write %1").arg(heats[i]);
+        }
+    });
+
+    int failed = 0;
+    double psnrSum = 0, worstSsim = 1;
+    int compared = 0, finite = 0;
+    for (int i = 0; i < refs.size(); ++i) {
+        const QString name = folders ? QFileInfo(refs[i]).fileName() : refs[i];
+        if (!errors[i].isEmpty()) {
+            err << "compare: " << name << ": " << errors[i] << "\n";
+            ++failed;
+            continue;
+        }
+        const ImageComparison &r = results[i];
+        out << name << " " << QString::number(r.mse, 'f', 4) << " "
+            << (std::isinf(r.psnr) ? QStringLiteral("inf") : QString::number(r.psnr, 'f', 2)) << " "
+            << QString::number(r.ssim, 'f', 5) << " " << r.maxError << " " << r.differingPixels << "\n";
+        if (r.psnr < minPsnr || r.ssim < minSsim)
+            ++failed;
+        if (!std::isinf(r.psnr)) {
+            psnrSum += r.psnr;
+            ++finite;
+        }
+        worstSsim = qMin(worstSsim, r.ssim);
+        ++compared;
+    }
+    if (folders)
+        out << compared << " compared, " << failed << " failed; mean finite PSNR "
+            << QString::number(finite ? psnrSum / finite : 0, 'f', 2)
+            << ", lowest SSIM " << QString::number(worstSsim, 'f', 5) << "\n";
+    return failed ? 1 : 0;
+}
+
+int quantizeCommand(const QStringList &args)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Reduces the input to an indexed palette of at most N colours, written as an\n"
+        "8-bit palette image when the output format supports one (png, bmp).");
+    parser.addHelpOption();
+    QCommandLineOption colorsOption("colors", "Palette size, 2 to 256.", "N", "256");
+    QCommandLineOption methodOption("method", "octree or kmeans.", "method", "kmeans");
+    QCommandLineOption ditherOption("dither", "none, fs (Floyd-Steinberg) or ordered.", "mode", "fs");
+    parser.addOption(colorsOption);
+    parser.addOption(methodOption);
+    parser.addOption(ditherOption);
+    parser.addPositionalArgument("input", "Image file.");
+    parser.addPositionalArgument("output", "Image file.");
+    parser.process(args);
+
+    QTextStream err(stderr);
+    const QStringList files = parser.positionalArguments();
+    QuantizeMethod method;
+    DitherMode dither;
+    bool ok;
+    const int colors = parser.value(colorsOption).toInt(&ok);
+    if (files.size() != 2) {
+        err << "quantize: expected an input and an output file\n";
+        return 2;
+    }
+    if (!ok || colors < 2 || colors > 256
+        || !parseQuantizeMethod(parser.value(methodOption), &method)
+        || !parseDitherMode(parser.value(ditherOption), &dither)) {
+        err << "quantize: bad colour count, method or dither mode\n";
+        return 2;
+    }
+    QImage img(files[0]);
+    if (img.isNull()) {
+        err << "quantize: cannot read " << files[0] << "\n";
+        return 1;
+    }
+    if (!quantizeImage(img, colors, method, dither).save(files[1])) {
+        err << "quantize: cannot write " << files[1] << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int stackCommand(const QStringList &args)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Combines aligned frames of one size, pixel by pixel, into a single image.\n"
+        "Modes: mean, sigma (mean after sigma clipping), median, min, max.");
+    parser.addHelpOption();
+    QCommandLineOption modeOption("mode", "How frames are combined.", "mode", "mean");
+    QCommandLineOption sigmaOption("sigma", "Clipping distance in standard deviations.", "k", "2.5");
+    QCommandLineOption memoryOption("memory", "Memory for median and sigma bands, in MB.", "MB", "512");
+    parser.addOption(modeOption);
+    parser.addOption(sigmaOption);
+    parser.addOption(memoryOption);
+    parser.addPositionalArgument("input", "Folder of frames, or several frame files.");
+    parser.addPositionalArgument("output", "Image file.");
+    parser.process(args);
+
+    QTextStream err(stderr);
+    QStringList files = parser.positionalArguments();
+    StackMode mode;
+    bool ok;
+    const double sigma = parser.value(sigmaOption).toDouble(&ok);
+    const qsizetype memory = qsizetype(parser.value(memoryOption).toInt()) << 20;
+    if (files.size() < 2) {
+        err << "stack: expected input frames and an output file\n";
+        return 2;
+    }
+    if (!parseStackMode(parser.value(modeOption), &mode) || !ok || memory <= 0) {
+        err << "stack: bad mode, sigma or memory size\n";
+        return 2;
+    }
+    const QString output = files.takeLast();
+    if (files.size() == 1)
+        files = stackFrameFiles(files[0]);
+    QString error;
+    const QImage img = stackFrames(files, mode, sigma, memory, &error);
+    if (img.isNull()) {
+        err << "stack: " << error << "\n";
+        return 1;
+    }
+    if (!img.save(output)) {
+        err << "stack: cannot write " << output << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+int matchCommand(const QStringList &args)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Finds the template in every image by normalised cross-correlation and prints\n"
+        "one line per match: image x y score, with x y the template's top-left corner.");
+    parser.addHelpOption();
+    QCommandLineOption templateOption("template", "Template image file.", "file");
+    QCommandLineOption countOption("count", "Matches reported per image.", "N", "1");
+    QCommandLineOption scoreOption("min-score", "Lowest correlation reported, -1 to 1.", "score", "0.8");
+    parser.addOption(templateOption);
+    parser.addOption(countOption);
+    parser.addOption(scoreOption);
+    parser.addPositionalArgument("images", "Image files to search.", "images...");
+    parser.process(args);
+
+    QTextStream err(stderr);
+    QTextStream out(stdout);
+    const QStringList files = parser.positionalArguments();
+    bool countOk, scoreOk;
+    const int count = parser.value(countOption).toInt(&countOk);
+    const double minScore = parser.value(scoreOption).toDouble(&scoreOk);
+    if (files.isEmpty() || parser.value(templateOption).isEmpty()) {
+        err << "match: expected a template and at least one image\n";
+        return 2;
+    }
+    if (!countOk || count < 1 || !scoreOk) {
+        err << "match: bad match count or score\n";
+        return 2;
+    }
+    const TemplateMatcher matcher(QImage(parser.value(templateOption)));
+    if (!matcher.isValid()) {
+        err << "match: cannot read " << parser.value(templateOption) << " or it is flat\n";
+        return 1;
+    }
+    int status = 0;
+    for (const QString &file : files) {
+        QImage img(file);
+        if (img.isNull()) {
+            err << "match: cannot read " << file << "\n";
+            status = 1;
+            continue;
+        }
+        for (const TemplateMatch &m : matcher.find(img, count, minScore))
+            out << file << " " << m.pos.x() << " " << m.pos.y() << " "
+                << QString::number(m.score, 'f', 4) << "\n";
+    }
+    return status;
+}
+
+// Moving test pattern for the producer when no images are given: a diagonal
+// gradient that scrolls one pixel per frame with a bright square on it.
+QImage testFrame(const QSize &size, quint64 n)
+{
+    QImage img(size, QImage::Format_ARGB32);
+    const int square = qMax(8, size.height() / 8);
+    const int sx = int(n * 4 % qMax(1, size.width() - square));
+    const int sy = (size.height() - square) / 2;
+    for (int y = 0; y < size.height(); ++y) {
+        QRgb *d = reinterpret_cast<QRgb *>(img.scanLine(y));
+        for (int x = 0; x < size.width(); ++x) {
+            const int v = int((x + y + n) & 255);
+            const bool inSquare = x >= sx && x < sx + square && y >= sy && y < sy + square;
+            d[x] = inSquare ? qRgb(255, 255, 255) : qRgb(v, v / 2, 255 - v);
+        }
+    }
+    return img;
+}
+
+int produceCommand(const QStringList &args)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Test producer for the live view: publishes frames into a shared-memory ring\n"
+        "at a fixed rate, cycling through the given images or, without any, a moving\n"
+        "test pattern.");
+    parser.addHelpOption();
+    QCommandLineOption keyOption("key", "Shared-memory key of the ring.", "key", "imagerprocessor-live");
+    QCommandLineOption fpsOption("fps", "Frames per second.", "fps", "30");
+    QCommandLineOption countOption("count", "Frames to publish, 0 for no limit.", "N", "300");
+    QCommandLineOption slotsOption("slots", "Frames the ring holds.", "N", "4");
+    QCommandLineOption sizeOption("size", "Test pattern size.", "WxH", "640x480");
+    parser.addOption(keyOption);
+    parser.addOption(fpsOption);
+    parser.addOption(countOption);
+    parser.addOption(slotsOption);
+    parser.addOption(sizeOption);
+    parser.addPositionalArgument("images", "Frames to cycle through.", "[images...]");
+    parser.process(args);
+
+    QTextStream err(stderr);
+    bool fpsOk, countOk, slotsOk, wOk, hOk;
+    const double fps = parser.value(fpsOption).toDouble(&fpsOk);
+    const int count = parser.value(countOption).toInt(&countOk);
+    const int slotCount = parser.value(slotsOption).toInt(&slotsOk);
+    const QStringList sizeParts = parser.value(sizeOption).split('x');
+    const QSize patternSize(sizeParts.value(0).toInt(&wOk), sizeParts.value(1).toInt(&hOk));
+    if (!fpsOk || fps <= 0 || !countOk || count < 0 || !slotsOk || slotCount < 2
+        || !wOk || !hOk || patternSize.isEmpty()) {
+        err << "produce: bad rate, count, slot count or size\n";
+        return 2;
+    }
+    QList<QImage> images;
+    QSize maxSize = patternSize;
+    for (const QString &file : parser.positionalArguments()) {
+        QImage img(file);
+        if (img.isNull()) {
+            err << "produce: cannot read " << file << "\n";
+            return 1;
+        }
+        images.append(img);
+    }
+    if (!images.isEmpty()) {
+        maxSize = QSize(0, 0);
+        for (const QImage &img : images)
+            maxSize = QSize(qMax(maxSize.width(), img.width()), qMax(maxSize.height(), img.height()));
+    }
+
+    FrameRingWriter ring;
+    QString error;
+    if (!ring.create(parser.value(keyOption), slotCount, maxSize, &error)) {
+        err << "produce: " << error << "\n";
+        return 1;
+    }
+    const qint64 period = qint64(1e9 / fps);
+    const qint64 start = frameClockNs();
+    for (quint64 n = 0; count == 0 || n < quint64(count); ++n) {
+        const qint64 due = start + qint64(n) * period;
+        const qint64 wait = due - frameClockNs();
+        if (wait > 0)
+            QThread::usleep(static_cast<unsigned long>(wait / 1000));
+        ring.write(images.isEmpty() ? testFrame(patternSize, n) : images[int(n % images.size())]);
+    }
+    ring.close();
+    return 0;
+}
+
+int liveCommand(const QStringList &args)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Headless live consumer: runs the recipe on the newest frame of the ring,\n"
+        "dropping frames it has no time for, and reports throughput and latency from\n"
+        "capture to processed frame.\n"
+        "Recipe steps: gray downscale:N median:R erode|dilate|open|close:W:H equalize\n"
+        "clahe:TILES:CLIP otsu[:inv] adaptive:R:OFFSET canny:SIGMA:LOW:HIGH\n"
+        "bilateral:SPATIAL:RANGE undistort:K1:K2:P1:P2:K3");
+    parser.addHelpOption();
+    QCommandLineOption keyOption("key", "Shared-memory key of the ring.", "key", "imagerprocessor-live");
+    QCommandLineOption recipeOption("recipe", "Processing steps, space separated.", "steps", "");
+    QCommandLineOption framesOption("frames", "Stop after N processed frames (default: when the producer stops).", "N");
+    QCommandLineOption waitOption("wait", "Seconds to wait for the producer.", "s", "5");
+    parser.addOption(keyOption);
+    parser.addOption(recipeOption);
+    parser.addOption(framesOption);
+    parser.addOption(waitOption);
+    parser.process(args);
+
+    QTextStream err(stderr);
+    QTextStream out(stdout);
+    QList<PipelineStep> steps;
+    QString error;
+    if (!parsePipeline(parser.value(recipeOption), &steps, &error)) {
+        err << "live: " << error << "\n";
+        return 2;
+    }
+    bool framesOk = true, waitOk;
+    const int frames = parser.isSet(framesOption) ? parser.value(framesOption).toInt(&framesOk) : 0;
+    const double wait = parser.value(waitOption).toDouble(&waitOk);
+    if (!framesOk || (parser.isSet(framesOption) && frames <= 0) || !waitOk || wait < 0) {
+        err << "live: bad frame count or wait\n";
+        return 2;
+    }
+    const qint64 waitUntil = frameClockNs() + qint64(wait * 1e9);
+
+    FrameRingReader ring;
+    while (!ring.attach(parser.value(keyOption), &error)) {
+        if (frameClockNs() > waitUntil) {
+            err << "live: " << error << "\n";
+            return 1;
+        }
+        QThread::msleep(50);
+    }
+
+    LatencyStats latency;
+    int processed = 0;
+    const qint64 start = frameClockNs();
+    while (frames == 0 || processed < frames) {
+        QImage frame;
+        FrameInfo info;
+        if (!ring.readLatest(&frame, &info)) {
+            if (ring.isFinished())
+                break;
+            QThread::usleep(200);
+            continue;
+        }
+        runPipeline(frame, steps);
+        latency.add((frameClockNs() - info.timestamp) / 1e6);
+        ++processed;
+    }
+    const double seconds = (frameClockNs() - start) / 1e9;
+    out << "processed " << processed << ", dropped " << ring.dropped() << ", "
+        << QString::number(seconds > 0 ? processed / seconds : 0, 'f', 1) << " fps\n"
+        << "latency " << latency.summary() << "\n";
+    return 0;
+}
+
+int watchCommand(const QStringList &args)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Watches the input folder and runs every image that appears or changes\n"
+        "through the recipe, writing <file name>.png (a.jpg.png for a.jpg) to the\n"
+        "output folder. Results are cached by content and recipe hash, so restarts\n"
+        "and repeated files only copy the cached result. Recipe steps are those of\n"
+        "the live command.");
+    parser.addHelpOption();
+    QCommandLineOption recipeOption("recipe", "Processing steps, space separated.", "steps", "");
+    QCommandLineOption cacheOption("cache", "Result cache folder (default: <output>/.cache).", "dir");
+    QCommandLineOption onceOption("once", "Process what is there now and exit.");
+    parser.addOption(recipeOption);
+    parser.addOption(cacheOption);
+    parser.addOption(onceOption);
+    parser.addPositionalArgument("input", "Folder to watch.");
+    parser.addPositionalArgument("output", "Folder for the results.");
+    parser.process(args);
+
+    QTextStream err(stderr);
+    const QStringList dirs = parser.positionalArguments();
+    if (dirs.size() != 2) {
+        err << "watch: expected an input and an output folder\n";
+        return 2;
+    }
+    QList<PipelineStep> steps;
+    QString error;
+    if (!parsePipeline(parser.value(recipeOption), &steps, &error)) {
+        err << "watch: " << error << "\n";
+        return 2;
+    }
+    const QString cacheDir = parser.value(cacheOption).isEmpty()
+        ? QDir(dirs[1]).filePath(".cache") : parser.value(cacheOption);
+
+    FolderWatcher watcher(dirs[0], dirs[1], cacheDir, steps);
+    QObject::connect(&watcher, &FolderWatcher::fileDone,
+                     [](const QString &file, int outcome, const QString &error) {
+        static const char *const names[] = { "processed", "cached", "failed" };
+        QTextStream out(stdout);
+        out << names[outcome] << " " << file;
+        if (!error.isEmpty())
+            out << ": " << error;
+        out << "\n";
+        out.flush();
+    });
+    if (parser.isSet("once")) {
+        const int failed = watcher.processAll(&error);
+        if (failed < 0)
+            err << "watch: " << error << "\n";
+        return failed ? 1 : 0;
+    }
+    if (!watcher.start(&error)) {
+        err << "watch: " << error << "\n";
+        return 1;
+    }
+    return QCoreApplication::exec();
+}
+
+struct Command
+{
+    const char *name;
+    int (*run)(const QStringList &args);
+};
+
+const Command commands[] = {
+    { "stream", streamCommand },
+    { "morph", morphCommand },
+    { "undistort", undistortCommand },
+    { "match", matchCommand },
+    { "compare", compareCommand },
+    { "quantize", quantizeCommand },
+    { "stack", stackCommand },
+    { "produce", produceCommand },
+    { "live", liveCommand },
+    { "watch", watchCommand },
+};
+
+} // namespace
+
+bool isCliCommand(const char *arg)
+{
+    for (const Command &c : commands)
+        if (strcmp(arg, c.name) == 0)
+            return true;
+    return false;
+}
+
+int runCli(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    // Drop the command name so each parser sees "<program> [options] files".
+    const QString name = args.takeAt(1);
+    for (const Command &c : commands)
+        if (name == QLatin1String(c.name))
+            return c.run(args);
+    return 2;
+}
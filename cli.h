@@ -0,0 +1,9 @@
+#ifndef CLI_H
+#define CLI_H
+
+// Headless entry points, used as "ImagerProcessor <command> ...".
+// isCliCommand() tells main() whether argv[1] names one of them.
+bool isCliCommand(const char *arg);
+int runCli(int argc, char *argv[]);
+
+#endif // CLI_H
@@ -0,0 +1,297 @@
+#include "colorspace.h"
+#include "roi.h"
+#include "tiles.h"
+#include <QtMath>
+#include <cmath>
+
+namespace {
+
+// D65 white point.
+const float WhiteX = 0.95047f;
+const float WhiteZ = 1.08883f;
+
+struct SrgbTables
+{
+    float decode[256];       // 8-bit sRGB -> linear 0..1
+    uchar encode[65536];     // linear 0..1 in 1/65535 steps -> 8-bit sRGB
+
+    SrgbTables()
+    {
+        for (int i = 0; i < 256; ++i) {
+            const double c = i / 255.0;
+            decode[i] = float(c <= 0.04045 ? c / 12.92 : qPow((c + 0.055) / 1.055, 2.4));
+        }
+        for (int i = 0; i < 65536; ++i) {
+            const double l = i / 65535.0;
+            const double c = l <= 0.0031308 ? l * 12.92 : 1.055 * qPow(l, 1 / 2.4) - 0.055;
+            encode[i] = uchar(qBound(0, qRound(c * 255), 255));
+        }
+    }
+};
+
+const SrgbTables &srgb()
+{
+    static const SrgbTables tables;
+    return tables;
+}
+
+inline uchar toByte(float v)
+{
+    return v <= 0 ? 0 : (v >= 255 ? 255 : uchar(v + 0.5f));
+}
+
+inline float labF(float t)
+{
+    return t > 0.008856f ? std::cbrt(t) : 7.787f * t + 16.0f / 116.0f;
+}
+
+inline float labFInverse(float f)
+{
+    return f > 0.206893f ? f * f * f : (f - 16.0f / 116.0f) / 7.787f;
+}
+
+// byte = value * scale + offset for channelImage()/setChannel().
+void channelRange(ColorSpace space, int channel, float *scale, float *offset)
+{
+    *scale = 1;
+    *offset = 0;
+    switch (space) {
+    case ColorRgb:
+    case ColorYCbCr:
+        break;
+    case ColorHsv:
+        *scale = channel == 0 ? 255.0f / 360.0f : 255.0f;
+        break;
+    case ColorLab:
+        if (channel == 0)
+            *scale = 2.55f;
+        else
+            *offset = 128;
+        break;
+    }
+}
+
+} // namespace
+
+void rgbToSpace(const QRgb *in, int n, ColorSpace space, float *c0, float *c1, float *c2)
+{
+    if (space == ColorLab) {
+        const float *dec = srgb().decode;
+        for (int i = 0; i < n; ++i) {
+            const float r = dec[qRed(in[i])], g = dec[qGreen(in[i])], b = dec[qBlue(in[i])];
+            const float fx = labF((0.4124564f * r + 0.3575761f * g + 0.1804375f * b) / WhiteX);
+            const float fy = labF(0.2126729f * r + 0.7151522f * g + 0.0721750f * b);
+            const float fz = labF((0.0193339f * r + 0.1191920f * g + 0.9503041f * b) / WhiteZ);
+            c0[i] = 116 * fy - 16;
+            c1[i] = 500 * (fx - fy);
+            c2[i] = 200 * (fy - fz);
+        }
+        return;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        c0[i] = qRed(in[i]);
+        c1[i] = qGreen(in[i]);
+        c2[i] = qBlue(in[i]);
+    }
+    switch (space) {
+    case ColorRgb:
+    case ColorLab:
+        break;
+    case ColorYCbCr:
+        for (int i = 0; i < n; ++i) {
+            const float r = c0[i], g = c1[i], b = c2[i];
+            c0[i] = 0.299f * r + 0.587f * g + 0.114f * b;
+            c1[i] = 128 - 0.168736f * r - 0.331264f * g + 0.5f * b;
+            c2[i] = 128 + 0.5f * r - 0.418688f * g - 0.081312f * b;
+        }
+        break;
+    case ColorHsv:
+        for (int i = 0; i < n; ++i) {
+            const float r = c0[i], g = c1[i], b = c2[i];
+            const float mx = qMax(r, qMax(g, b)), mn = qMin(r, qMin(g, b));
+            const float d = mx - mn;
+            float h = 0;
+            if (d > 0) {
+                if (mx == r)
+                    h = 60 * (g - b) / d;
+                else if (mx == g)
+                    h = 60 * (b - r) / d + 120;
+                else
+                    h = 60 * (r - g) / d + 240;
+                if (h < 0)
+                    h += 360;
+            }
+            c0[i] = h;
+            c1[i] = mx > 0 ? d / mx : 0;
+            c2[i] = mx / 255;
+        }
+        break;
+    }
+}
+
+void spaceToRgb(const float *c0, const float *c1, const float *c2, const uchar *alpha, int n,
+                ColorSpace space, QRgb *out)
+{
+    switch (space) {
+    case ColorRgb:
+        for (int i = 0; i < n; ++i)
+            out[i] = qRgba(toByte(c0[i]), toByte(c1[i]), toByte(c2[i]), alpha ? alpha[i] : 255);
+        break;
+    case ColorYCbCr:
+        for (int i = 0; i < n; ++i) {
+            const float y = c0[i], cb = c1[i] - 128, cr = c2[i] - 128;
+            out[i] = qRgba(toByte(y + 1.402f * cr), toByte(y - 0.344136f * cb - 0.714136f * cr),
+                           toByte(y + 1.772f * cb), alpha ? alpha[i] : 255);
+        }
+        break;
+    case ColorHsv:
+        for (int i = 0; i < n; ++i) {
+            const float s = qBound(0.0f, c1[i], 1.0f), v = qBound(0.0f, c2[i], 1.0f) * 255;
+            float h = std::fmod(c0[i], 360.0f);
+            if (h < 0)
+                h += 360;
+            const float hh = h / 60;
+            const int sector = int(hh) % 6;
+            const float f = hh - int(hh);
+            const float p = v * (1 - s), q = v * (1 - s * f), t = v * (1 - s * (1 - f));
+            float r, g, b;
+            switch (sector) {
+            case 0: r = v; g = t; b = p; break;
+            case 1: r = q; g = v; b = p; break;
+            case 2: r = p; g = v; b = t; break;
+            case 3: r = p; g = q; b = v; break;
+            case 4: r = t; g = p; b = v; break;
+            default: r = v; g = p; b = q; break;
+            }
+            out[i] = qRgba(toByte(r), toByte(g), toByte(b), alpha ? alpha[i] : 255);
+        }
+        break;
+    case ColorLab: {
+        const uchar *enc = srgb().encode;
+        auto encode = [enc](float l) {
+            return enc[l <= 0 ? 0 : (l >= 1 ? 65535 : int(l * 65535 + 0.5f))];
+        };
+        for (int i = 0; i < n; ++i) {
+            const float fy = (c0[i] + 16) / 116;
+            const float x = labFInverse(fy + c1[i] / 500) * WhiteX;
+            const float y = labFInverse(fy);
+            const float z = labFInverse(fy - c2[i] / 200) * WhiteZ;
+            const float r = 3.2404542f * x - 1.5371385f * y - 0.4985314f * z;
+            const float g = -0.9692660f * x + 1.8760108f * y + 0.0415560f * z;
+            const float b = 0.0556434f * x - 0.2040259f * y + 1.0572252f * z;
+            out[i] = qRgba(encode(r), encode(g), encode(b), alpha ? alpha[i] : 255);
+        }
+        break;
+    }
+    }
+}
+
+QImage lumaImage(const QImage &src)
+{
+    if (src.isNull() || src.format() == QImage::Format_Grayscale8)
+        return src;
+    const QImage img = src.convertToFormat(QImage::Format_ARGB32);
+    QImage luma(img.size(), QImage::Format_Grayscale8);
+    uchar *bits = luma.bits();
+    const qsizetype bpl = luma.bytesPerLine();
+    parallelRows(img.rect(), 64, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const QRgb *s = reinterpret_cast<const QRgb *>(img.constScanLine(y));
+            uchar *d = bits + y * bpl;
+            for (int x = 0; x < img.width(); ++x)
+                d[x] = uchar(lumaOf(s[x]));
+        }
+    });
+    return luma;
+}
+
+ColorPlanes splitColor(const QImage &src, ColorSpace space, const QRect &rect)
+{
+    ColorPlanes p;
+    p.space = space;
+    p.rect = rect.isNull() ? src.rect() : rect.intersected(src.rect());
+    if (p.rect.isEmpty()) {
+        p.rect = QRect();
+        return p;
+    }
+    const QImage part = p.rect == src.rect() ? src : roiView(src, p.rect);
+    const QImage img = part.convertToFormat(QImage::Format_ARGB32);
+    const int w = p.width();
+    float *planes[3];
+    for (int c = 0; c < 3; ++c) {
+        p.planes[c].resize(qsizetype(w) * p.height());
+        planes[c] = p.planes[c].data();
+    }
+    p.alpha.resize(qsizetype(w) * p.height());
+    uchar *alpha = p.alpha.data();
+    parallelRows(QRect(0, 0, w, p.height()), 32, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const QRgb *s = reinterpret_cast<const QRgb *>(img.constScanLine(y));
+            const qsizetype o = qsizetype(y) * w;
+            rgbToSpace(s, w, space, planes[0] + o, planes[1] + o, planes[2] + o);
+            for (int x = 0; x < w; ++x)
+                alpha[o + x] = uchar(qAlpha(s[x]));
+        }
+    });
+    return p;
+}
+
+QImage mergeColor(const ColorPlanes &planes)
+{
+    if (planes.rect.isEmpty())
+        return QImage();
+    const int w = planes.width();
+    QImage out(planes.rect.size(), QImage::Format_ARGB32);
+    uchar *bits = out.bits();
+    const qsizetype bpl = out.bytesPerLine();
+    parallelRows(out.rect(), 32, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const qsizetype o = qsizetype(y) * w;
+            spaceToRgb(planes.row(0, y), planes.row(1, y), planes.row(2, y),
+                       planes.alpha.isEmpty() ? nullptr : planes.alpha.constData() + o, w,
+                       planes.space, reinterpret_cast<QRgb *>(bits + y * bpl));
+        }
+    });
+    return out;
+}
+
+QImage channelImage(const ColorPlanes &planes, int channel)
+{
+    if (planes.rect.isEmpty() || channel < 0 || channel > 2)
+        return QImage();
+    float scale, offset;
+    channelRange(planes.space, channel, &scale, &offset);
+    QImage out(planes.rect.size(), QImage::Format_Grayscale8);
+    uchar *bits = out.bits();
+    const qsizetype bpl = out.bytesPerLine();
+    parallelRows(out.rect(), 64, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const float *s = planes.row(channel, y);
+            uchar *d = bits + y * bpl;
+            for (int x = 0; x < out.width(); ++x)
+                d[x] = toByte(s[x] * scale + offset);
+        }
+    });
+    return out;
+}
+
+void setChannel(ColorPlanes &planes, int channel, const QImage &gray)
+{
+    if (channel < 0 || channel > 2 || gray.size() != planes.rect.size())
+        return;
+    const QImage img = gray.convertToFormat(QImage::Format_Grayscale8);
+    float scale, offset;
+    channelRange(planes.space, channel, &scale, &offset);
+    const float inv = 1 / scale;
+    float *plane = planes.planes[channel].data();
+    const int w = planes.width();
+    parallelRows(img.rect(), 64, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const uchar *s = img.constScanLine(y);
+            float *d = plane + qsizetype(y) * w;
+            for (int x = 0; x < w; ++x)
+                d[x] = (s[x] - offset) * inv;
+        }
+    });
+}
@@ -0,0 +1,58 @@
+#ifndef COLORSPACE_H
+#define COLORSPACE_H
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+enum ColorSpace { ColorRgb, ColorHsv, ColorYCbCr, ColorLab };
+
+// BT.601 luma in 8-bit fixed point.
+inline int lumaOf(QRgb p)
+{
+    return (qRed(p) * 77 + qGreen(p) * 150 + qBlue(p) * 29 + 128) >> 8;
+}
+
+// Luma of any image as Grayscale8; a Grayscale8 image is returned as is.
+QImage lumaImage(const QImage &src);
+
+// An image (or part of one) as three float planes in one colour space:
+//   RGB    R, G, B 0..255
+//   HSV    H 0..360, S and V 0..1
+//   YCbCr  full-range BT.601: Y 0..255, Cb and Cr 0..255 centred on 128
+//   Lab    CIE L*a*b* of sRGB under D65: L 0..100, a and b about -128..127
+// Alpha rides along unchanged.
+struct ColorPlanes
+{
+    ColorSpace space = ColorRgb;
+    QRect rect;                 // the part of the source image the planes cover
+    QVector<float> planes[3];
+    QVector<uchar> alpha;
+
+    int width() const { return rect.width(); }
+    int height() const { return rect.height(); }
+    float *row(int channel, int y) { return planes[channel].data() + qsizetype(y) * width(); }
+    const float *row(int channel, int y) const { return planes[channel].constData() + qsizetype(y) * width(); }
+};
+
+// Converts rect of src (the whole image if rect is null) band-parallel.
+ColorPlanes splitColor(const QImage &src, ColorSpace space, const QRect &rect = QRect());
+
+// Back to ARGB32 at the size of planes.rect; pasteRoi() puts it in place.
+QImage mergeColor(const ColorPlanes &planes);
+
+// One channel as Grayscale8, its range above mapped onto 0..255 (hue 0..360,
+// L 0..100, a and b offset by 128), so any 8-bit filter can work on it;
+// setChannel() maps a filtered one back.
+QImage channelImage(const ColorPlanes &planes, int channel);
+void setChannel(ColorPlanes &planes, int channel, const QImage &gray);
+
+// The row kernels behind splitColor()/mergeColor(): n pixels from or to three
+// separate float arrays, written as plain loops the compiler can vectorise.
+// sRGB decoding for Lab goes through a 256-entry table and encoding through a
+// 64K-entry one, so neither calls pow().
+void rgbToSpace(const QRgb *in, int n, ColorSpace space, float *c0, float *c1, float *c2);
+void spaceToRgb(const float *c0, const float *c1, const float *c2, const uchar *alpha, int n,
+                ColorSpace space, QRgb *out);
+
+#endif // COLORSPACE_H
@@ -0,0 +1,216 @@
+#include "compare.h"
+#include "colorspace.h"
+#include "tiles.h"
+#include <QVector>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+const int BandRows = 32;
+const int SsimRadius = 5;
+const double SsimSigma = 1.5;
+const double C1 = (0.01 * 255) * (0.01 * 255);
+const double C2 = (0.03 * 255) * (0.03 * 255);
+
+struct BandErrors
+{
+    quint64 squared = 0;
+    int maxError = 0;
+    qint64 differing = 0;
+};
+
+void setError(QString *error, const QString &message)
+{
+    if (error)
+        *error = message;
+}
+
+// Squared error, largest difference and differing pixels of rows
+// [top, bottom]; each pixel's largest channel difference goes to diff. The
+// padding byte of RGB32 is always 0xff in both, so it adds nothing.
+template <int Bytes>
+BandErrors bandErrors(const QImage &a, const QImage &b, int top, int bottom, uchar *diff, qsizetype diffBpl)
+{
+    BandErrors e;
+    const int w = a.width();
+    for (int y = top; y <= bottom; ++y) {
+        const uchar *pa = a.constScanLine(y), *pb = b.constScanLine(y);
+        uchar *d = diff ? diff + y * diffBpl : nullptr;
+        quint64 rowSquared = 0;
+        for (int x = 0; x < w; ++x) {
+            int largest = 0;
+            for (int c = 0; c < Bytes; ++c) {
+                const int v = qAbs(pa[x * Bytes + c] - pb[x * Bytes + c]);
+                rowSquared += uint(v * v);
+                largest = qMax(largest, v);
+            }
+            e.maxError = qMax(e.maxError, largest);
+            e.differing += largest != 0;
+            if (d)
+                d[x] = uchar(largest);
+        }
+        e.squared += rowSquared;
+    }
+    return e;
+}
+
+// Mean SSIM over every window that fits inside the images. Each band filters
+// its rows plus the window's reach horizontally into five planes (a, b, a^2,
+// b^2, ab), then vertically, a tap at a time so the inner loops run along rows.
+double meanSsim(const QImage &a, const QImage &b)
+{
+    const int w = a.width(), h = a.height();
+    const int r = qMin(SsimRadius, (qMin(w, h) - 1) / 2);
+    const int taps = 2 * r + 1;
+    QVector<float> g(taps);
+    double total = 0;
+    for (int i = 0; i < taps; ++i)
+        total += g[i] = float(qExp(-double(i - r) * (i - r) / (2 * SsimSigma * SsimSigma)));
+    for (float &v : g)
+        v = float(v / total);
+
+    const int vw = w - 2 * r, vh = h - 2 * r;
+    QVector<double> bandSums((vh + BandRows - 1) / BandRows, 0.0);
+    parallelRows(QRect(0, 0, vw, vh), BandRows, [&](const QRect &band) {
+        const int rows = band.height() + 2 * r;
+        QVector<float> planes(qsizetype(5) * rows * vw, 0.0f);
+        float *ma = planes.data(), *mb = ma + qsizetype(rows) * vw;
+        float *saa = mb + qsizetype(rows) * vw, *sbb = saa + qsizetype(rows) * vw;
+        float *sab = sbb + qsizetype(rows) * vw;
+        QVector<float> fa(w), fb(w), faa(w), fbb(w), fab(w);
+        for (int row = 0; row < rows; ++row) {
+            const uchar *pa = a.constScanLine(band.top() + row), *pb = b.constScanLine(band.top() + row);
+            for (int x = 0; x < w; ++x) {
+                fa[x] = pa[x];
+                fb[x] = pb[x];
+                faa[x] = fa[x] * fa[x];
+                fbb[x] = fb[x] * fb[x];
+                fab[x] = fa[x] * fb[x];
+            }
+            const qsizetype o = qsizetype(row) * vw;
+            for (int i = 0; i < taps; ++i) {
+                const float c = g[i];
+                for (int x = 0; x < vw; ++x) {
+                    ma[o + x] += c * fa[x + i];
+                    mb[o + x] += c * fb[x + i];
+                    saa[o + x] += c * faa[x + i];
+                    sbb[o + x] += c * fbb[x + i];
+                    sab[o + x] += c * fab[x + i];
+                }
+            }
+        }
+
+        double sum = 0;
+        QVector<float> va(vw), vb(vw), vaa(vw), vbb(vw), vab(vw);
+        for (int y = 0; y < band.height(); ++y) {
+            std::fill(va.begin(), va.end(), 0.0f);
+            std::fill(vb.begin(), vb.end(), 0.0f);
+            std::fill(vaa.begin(), vaa.end(), 0.0f);
+            std::fill(vbb.begin(), vbb.end(), 0.0f);
+            std::fill(vab.begin(), vab.end(), 0.0f);
+            for (int j = 0; j < taps; ++j) {
+                const float c = g[j];
+                const qsizetype o = qsizetype(y + j) * vw;
+                for (int x = 0; x < vw; ++x) {
+                    va[x] += c * ma[o + x];
+                    vb[x] += c * mb[o + x];
+                    vaa[x] += c * saa[o + x];
+                    vbb[x] += c * sbb[o + x];
+                    vab[x] += c * sab[o + x];
+                }
+            }
+            for (int x = 0; x < vw; ++x) {
+                const double mx = va[x], my = vb[x];
+                const double varX = vaa[x] - mx * mx, varY = vbb[x] - my * my, cov = vab[x] - mx * my;
+                sum += (2 * mx * my + C1) * (2 * cov + C2)
+                       / ((mx * mx + my * my + C1) * (varX + varY + C2));
+            }
+        }
+        bandSums[band.top() / BandRows] = sum;
+    });
+
+    double sum = 0;
+    for (double s : bandSums)
+        sum += s;
+    return sum / (double(vw) * vh);
+}
+
+QRgb heatColor(double t)
+{
+    // Black, red, yellow, white in equal steps.
+    static const int stops[4][3] = { { 0, 0, 0 }, { 255, 0, 0 }, { 255, 255, 0 }, { 255, 255, 255 } };
+    const double p = qBound(0.0, t, 1.0) * 3;
+    const int i = qMin(2, int(p));
+    const double f = p - i;
+    return qRgb(qRound(stops[i][0] + f * (stops[i + 1][0] - stops[i][0])),
+                qRound(stops[i][1] + f * (stops[i + 1][1] - stops[i][1])),
+                qRound(stops[i][2] + f * (stops[i + 1][2] - stops[i][2])));
+}
+
+} // namespace
+
+bool compareImages(const QImage &a, const QImage &b, ImageComparison *result,
+                   QImage *heatMap, QString *error)
+{
+    if (a.isNull() || b.isNull()) {
+        setError(error, QStringLiteral("missing image"));
+        return false;
+    }
+    if (a.size() != b.size()) {
+        setError(error, QStringLiteral("sizes differ: %1x%2 and %3x%4")
+                 .arg(a.width()).arg(a.height()).arg(b.width()).arg(b.height()));
+        return false;
+    }
+
+    const bool gray = a.format() == QImage::Format_Grayscale8 && b.format() == QImage::Format_Grayscale8;
+    const QImage ca = gray ? a : a.convertToFormat(QImage::Format_RGB32);
+    const QImage cb = gray ? b : b.convertToFormat(QImage::Format_RGB32);
+    QImage diff;
+    if (heatMap)
+        diff = QImage(a.size(), QImage::Format_Grayscale8);
+    uchar *diffBits = heatMap ? diff.bits() : nullptr;
+    const qsizetype diffBpl = heatMap ? diff.bytesPerLine() : 0;
+
+    QVector<BandErrors> bands((a.height() + BandRows - 1) / BandRows);
+    parallelRows(a.rect(), BandRows, [&](const QRect &band) {
+        bands[band.top() / BandRows] = gray
+            ? bandErrors<1>(ca, cb, band.top(), band.bottom(), diffBits, diffBpl)
+            : bandErrors<4>(ca, cb, band.top(), band.bottom(), diffBits, diffBpl);
+    });
+
+    ImageComparison r;
+    quint64 squared = 0;
+    r.maxError = 0;
+    r.differingPixels = 0;
+    for (const BandErrors &e : bands) {
+        squared += e.squared;
+        r.maxError = qMax(r.maxError, e.maxError);
+        r.differingPixels += e.differing;
+    }
+    r.mse = double(squared) / (double(a.width()) * a.height() * (gray ? 1 : 3));
+    r.psnr = r.mse > 0 ? 10 * std::log10(255.0 * 255.0 / r.mse) : std::numeric_limits<double>::infinity();
+    r.ssim = meanSsim(lumaImage(ca), lumaImage(cb));
+    *result = r;
+
+    if (heatMap) {
+        QRgb lut[256];
+        for (int v = 0; v < 256; ++v)
+            lut[v] = r.maxError > 0 ? heatColor(double(v) / r.maxError) : qRgb(0, 0, 0);
+        QImage map(a.size(), QImage::Format_RGB32);
+        uchar *mapBits = map.bits();
+        const qsizetype mapBpl = map.bytesPerLine();
+        parallelRows(map.rect(), BandRows, [&](const QRect &band) {
+            for (int y = band.top(); y <= band.bottom(); ++y) {
+                const uchar *d = diff.constScanLine(y);
+                QRgb *out = reinterpret_cast<QRgb *>(mapBits + y * mapBpl);
+                for (int x = 0; x < map.width(); ++x)
+                    out[x] = lut[d[x]];
+            }
+        });
+        *heatMap = map;
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <QImage>
+#include <QString>
+
+struct ImageComparison
+{
+    double mse;              // mean squared error per channel, over R, G, B (or gray)
+    double psnr;             // dB against 255; infinite for identical images
+    double ssim;             // mean SSIM of luma over 11x11 Gaussian windows
+    int maxError;            // largest absolute channel difference
+    qint64 differingPixels;  // pixels with any channel different
+};
+
+// Compares two images of the same size. Both are compared as Grayscale8 when
+// both are gray, otherwise on RGB with alpha ignored. heatMap, if given,
+// receives the largest channel difference of every pixel on a black - red -
+// yellow - white ramp scaled to maxError, so even 1-level differences show.
+bool compareImages(const QImage &a, const QImage &b, ImageComparison *result,
+                   QImage *heatMap = nullptr, QString *error = nullptr);
+
+#endif // COMPARE_H
@@ -0,0 +1,185 @@
+#include "contrast.h"
+#include "colorspace.h"
+#include "scheduler.h"
+#include "tiles.h"
+#include <QVector>
+#include <QtMath>
+
+namespace {
+
+inline uchar clampByte(int v)
+{
+    return uchar(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+// The luma the operation works on: a Grayscale8 image itself, anything else
+// the Y plane of its YCbCr split, so Cb and Cr (and with them the hues) stay put.
+struct LumaImage
+{
+    bool gray;
+    ColorPlanes color;
+    QImage luma;
+    int w;
+    int h;
+
+    explicit LumaImage(const QImage &src)
+    {
+        gray = src.format() == QImage::Format_Grayscale8;
+        if (gray) {
+            luma = src;
+        } else {
+            color = splitColor(src, ColorYCbCr);
+            luma = channelImage(color, 0);
+        }
+        w = luma.width();
+        h = luma.height();
+    }
+
+    const uchar *lumaRow(int y) const { return luma.constScanLine(y); }
+
+    // The image with its luma replaced by newLuma.
+    QImage result(const QImage &newLuma)
+    {
+        if (gray)
+            return newLuma;
+        setChannel(color, 0, newLuma);
+        return mergeColor(color);
+    }
+};
+
+// Clips hist at limit and spreads the excess evenly, then turns it into a
+// mapping through its cumulative sum.
+void buildLut(quint32 *hist, int area, int limit, uchar *lut)
+{
+    if (limit > 0) {
+        quint32 excess = 0;
+        for (int i = 0; i < 256; ++i)
+            if (hist[i] > quint32(limit)) {
+                excess += hist[i] - quint32(limit);
+                hist[i] = quint32(limit);
+            }
+        const quint32 each = excess / 256, rest = excess % 256;
+        for (int i = 0; i < 256; ++i)
+            hist[i] += each;
+        if (rest) {
+            const quint32 step = qMax(1u, 256 / rest);
+            for (quint32 i = 0, left = rest; i < 256 && left; i += step, --left)
+                ++hist[i];
+        }
+    }
+    const double scale = 255.0 / qMax(1, area);
+    quint32 sum = 0;
+    for (int i = 0; i < 256; ++i) {
+        sum += hist[i];
+        lut[i] = clampByte(qRound(sum * scale));
+    }
+}
+
+} // namespace
+
+QImage equalizeHistogram(const QImage &src)
+{
+    if (src.isNull())
+        return QImage();
+    LumaImage li(src);
+
+    // Per-band histograms, summed afterwards, so no thread shares a counter.
+    const int bandRows = 64;
+    const int bands = (li.h + bandRows - 1) / bandRows;
+    QVector<quint32> partial(qsizetype(bands) * 256, 0);
+    TaskScheduler::instance().run(bands, [&](int b) {
+        quint32 *hist = partial.data() + b * 256;
+        for (int y = b * bandRows; y < qMin(li.h, (b + 1) * bandRows); ++y) {
+            const uchar *s = li.lumaRow(y);
+            for (int x = 0; x < li.w; ++x)
+                ++hist[s[x]];
+        }
+    });
+    quint32 hist[256] = {};
+    for (int b = 0; b < bands; ++b)
+        for (int i = 0; i < 256; ++i)
+            hist[i] += partial[b * 256 + i];
+    uchar lut[256];
+    buildLut(hist, li.w * li.h, 0, lut);
+
+    QImage out(li.w, li.h, QImage::Format_Grayscale8);
+    uchar *bits = out.bits();
+    const qsizetype bpl = out.bytesPerLine();
+    parallelRows(out.rect(), bandRows, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const uchar *s = li.lumaRow(y);
+            uchar *d = bits + y * bpl;
+            for (int x = 0; x < li.w; ++x)
+                d[x] = lut[s[x]];
+        }
+    });
+    return li.result(out);
+}
+
+QImage clahe(const QImage &src, int tilesX, int tilesY, double clipLimit)
+{
+    if (src.isNull())
+        return QImage();
+    LumaImage li(src);
+    const int w = li.w, h = li.h;
+    tilesX = qBound(1, tilesX, w);
+    tilesY = qBound(1, tilesY, h);
+    const int tileW = (w + tilesX - 1) / tilesX;
+    const int tileH = (h + tilesY - 1) / tilesY;
+    // Rounding the tile size up can leave trailing tiles empty; drop them.
+    tilesX = (w + tileW - 1) / tileW;
+    tilesY = (h + tileH - 1) / tileH;
+
+    // One histogram and mapping per tile, all tiles in parallel.
+    QVector<uchar> luts(qsizetype(tilesX) * tilesY * 256);
+    TaskScheduler::instance().run(tilesX * tilesY, [&](int t) {
+        const int tx = t % tilesX, ty = t / tilesX;
+        const QRect tile = QRect(tx * tileW, ty * tileH, tileW, tileH).intersected(QRect(0, 0, w, h));
+        quint32 hist[256] = {};
+        for (int y = tile.top(); y <= tile.bottom(); ++y) {
+            const uchar *s = li.lumaRow(y);
+            for (int x = tile.left(); x <= tile.right(); ++x)
+                ++hist[s[x]];
+        }
+        const int area = tile.width() * tile.height();
+        const int limit = clipLimit > 0 ? qMax(1, int(clipLimit * area / 256)) : 0;
+        buildLut(hist, area, limit, luts.data() + t * 256);
+    });
+
+    // Each pixel blends the mappings of the four tiles whose centres surround it;
+    // along the border the nearest tiles are reused. The column side of that is
+    // the same for every row, so it is worked out once.
+    QVector<int> x0(w), x1(w);
+    QVector<int> wx(w);
+    for (int x = 0; x < w; ++x) {
+        const double fx = (x + 0.5) / tileW - 0.5;
+        const int t = qFloor(fx);
+        x0[x] = qBound(0, t, tilesX - 1);
+        x1[x] = qBound(0, t + 1, tilesX - 1);
+        wx[x] = qBound(0, int((fx - t) * 256), 256);
+    }
+
+    QImage out(w, h, QImage::Format_Grayscale8);
+    uchar *bits = out.bits();
+    const qsizetype bpl = out.bytesPerLine();
+    parallelRows(out.rect(), 32, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const double fy = (y + 0.5) / tileH - 0.5;
+            const int t = qFloor(fy);
+            const int wy = qBound(0, int((fy - t) * 256), 256);
+            const uchar *top = luts.constData() + qBound(0, t, tilesY - 1) * tilesX * 256;
+            const uchar *bottom = luts.constData() + qBound(0, t + 1, tilesY - 1) * tilesX * 256;
+            const uchar *s = li.lumaRow(y);
+            uchar *dst = bits + y * bpl;
+            for (int x = 0; x < w; ++x) {
+                const int v = s[x];
+                const int a = top[x0[x] * 256 + v], b = top[x1[x] * 256 + v];
+                const int c = bottom[x0[x] * 256 + v], d = bottom[x1[x] * 256 + v];
+                const int upper = a * 256 + (b - a) * wx[x];
+                const int lower = c * 256 + (d - c) * wx[x];
+                dst[x] = uchar((upper * 256 + (lower - upper) * wy + 32768) >> 16);
+            }
+        }
+    });
+    return li.result(out);
+}
@@ -0,0 +1,24 @@
+#ifndef CONTRAST_H
+#define CONTRAST_H
+
+#include <QImage>
+
+// Both work on Grayscale8 directly and on the Y plane of anything else (see
+// colorspace.h), leaving Cb and Cr unchanged so hues do not drift.
+
+// Global histogram equalisation.
+QImage equalizeHistogram(const QImage &src);
+
+// Contrast-limited adaptive histogram equalisation over a tilesX x tilesY grid.
+// Every bin of a tile's histogram is capped at clipLimit times the mean bin
+// height (tile pixels / 256, truncated, at least 1). What is clipped off is
+// handed back once, evenly to all 256 bins with the remainder one count each
+// to bins spaced across the range, so bins may end up a little above the cap.
+// 1 flattens the histogram and leaves the mapping close to identity, larger
+// values allow more contrast (typical 2..4), and 0 or less disables clipping,
+// which is plain equalisation per tile. Tile histograms are built in parallel,
+// and the four neighbouring tile mappings are blended bilinearly in the one
+// output pass.
+QImage clahe(const QImage &src, int tilesX = 8, int tilesY = 8, double clipLimit = 2.0);
+
+#endif // CONTRAST_H
@@ -0,0 +1,217 @@
+#include "fft.h"
+#include "scheduler.h"
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QtMath>
+#include <utility>
+
+namespace {
+
+// Rows per task and columns per gathered block.
+const int RowChunk = 16;
+const int ColumnBlock = 16;
+
+struct FftPlan
+{
+    int n;
+    bool radix2First;        // log2 n is odd
+    QVector<int> bitrev;
+    QVector<Complex> stages; // per radix-4 pass of span m: (w^k, w^2k, w^3k), k < m
+    QVector<Complex> split;  // e^(-i pi k / n), k < n: unpacks a real transform of 2n points
+};
+
+QSharedPointer<const FftPlan> makePlan(int n)
+{
+    QSharedPointer<FftPlan> plan(new FftPlan);
+    plan->n = n;
+    int bits = 0;
+    while ((1 << bits) < n)
+        ++bits;
+    plan->radix2First = bits % 2 == 1;
+    plan->bitrev.resize(n);
+    for (int i = 0; i < n; ++i) {
+        int r = 0;
+        for (int b = 0; b < bits; ++b)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        plan->bitrev[i] = r;
+    }
+    for (int m = plan->radix2First ? 2 : 1; m < n; m *= 4)
+        for (int k = 0; k < m; ++k)
+            for (int j = 1; j <= 3; ++j) {
+                const double a = -2 * M_PI * j * k / (4.0 * m);
+                plan->stages.append(Complex(float(qCos(a)), float(qSin(a))));
+            }
+    plan->split.resize(n);
+    for (int k = 0; k < n; ++k)
+        plan->split[k] = Complex(float(qCos(M_PI * k / n)), float(-qSin(M_PI * k / n)));
+    return plan;
+}
+
+QSharedPointer<const FftPlan> planFor(int n)
+{
+    static QMutex mutex;
+    static QHash<int, QSharedPointer<const FftPlan>> cache;
+    QMutexLocker locker(&mutex);
+    QSharedPointer<const FftPlan> &plan = cache[n];
+    if (!plan)
+        plan = makePlan(n);
+    return plan;
+}
+
+template <bool Inverse>
+void transform(const FftPlan &plan, Complex *a)
+{
+    const int n = plan.n;
+    const int *rev = plan.bitrev.constData();
+    for (int i = 0; i < n; ++i)
+        if (i < rev[i])
+            std::swap(a[i], a[rev[i]]);
+
+    int m = 1;
+    if (plan.radix2First) {
+        for (int i = 0; i < n; i += 2) {
+            const Complex t = a[i + 1];
+            a[i + 1] = a[i] - t;
+            a[i] += t;
+        }
+        m = 2;
+    }
+    // After bit reversal a block of 4m holds the transforms of the samples that
+    // are 0, 2, 1 and 3 mod 4, m points each.
+    const Complex *tw = plan.stages.constData();
+    for (; m < n; tw += 3 * m, m *= 4) {
+        for (int base = 0; base < n; base += 4 * m) {
+            Complex *p0 = a + base, *p1 = p0 + m, *p2 = p1 + m, *p3 = p2 + m;
+            for (int k = 0; k < m; ++k) {
+                Complex w1 = tw[3 * k], w2 = tw[3 * k + 1], w3 = tw[3 * k + 2];
+                if (Inverse) {
+                    w1 = std::conj(w1);
+                    w2 = std::conj(w2);
+                    w3 = std::conj(w3);
+                }
+                const Complex s0 = p0[k] + p1[k] * w2, s1 = p0[k] - p1[k] * w2;
+                const Complex c = p2[k] * w1, d = p3[k] * w3;
+                const Complex s2 = c + d, s3 = c - d;
+                // -i s3 forward, +i s3 inverse.
+                const Complex r3 = Inverse ? Complex(-s3.imag(), s3.real())
+                                           : Complex(s3.imag(), -s3.real());
+                p0[k] = s0 + s2;
+                p1[k] = s1 + r3;
+                p2[k] = s0 - s2;
+                p3[k] = s1 - r3;
+            }
+        }
+    }
+}
+
+void transform(const FftPlan &plan, Complex *a, bool inverse)
+{
+    if (inverse)
+        transform<true>(plan, a);
+    else
+        transform<false>(plan, a);
+}
+
+// Transforms every kept column of s, ColumnBlock columns per task.
+void columnPass(Spectrum &s, bool inverse)
+{
+    const QSharedPointer<const FftPlan> plan = planFor(s.height);
+    const int cols = s.rowLength(), h = s.height;
+    Complex *bins = s.bins.data();
+    TaskScheduler::instance().run((cols + ColumnBlock - 1) / ColumnBlock, [&](int b) {
+        const int u0 = b * ColumnBlock, n = qMin(ColumnBlock, cols - u0);
+        QVector<Complex> buf(qsizetype(n) * h);
+        for (int v = 0; v < h; ++v) {
+            const Complex *src = bins + qsizetype(v) * cols + u0;
+            for (int c = 0; c < n; ++c)
+                buf[c * h + v] = src[c];
+        }
+        for (int c = 0; c < n; ++c)
+            transform(*plan, buf.data() + c * h, inverse);
+        for (int v = 0; v < h; ++v) {
+            Complex *dst = bins + qsizetype(v) * cols + u0;
+            for (int c = 0; c < n; ++c)
+                dst[c] = buf[c * h + v];
+        }
+    });
+}
+
+} // namespace
+
+int fftSize(int n)
+{
+    int size = 2;
+    while (size < n)
+        size *= 2;
+    return size;
+}
+
+void fft(Complex *data, int n, bool inverse)
+{
+    if (n > 1)
+        transform(*planFor(n), data, inverse);
+}
+
+Spectrum forwardFft(const QVector<float> &plane, int width, int height)
+{
+    Spectrum s;
+    s.width = width;
+    s.height = height;
+    s.bins.resize(qsizetype(s.rowLength()) * height);
+    const int n = width / 2;
+    const QSharedPointer<const FftPlan> plan = planFor(n);
+
+    TaskScheduler::instance().run((height + RowChunk - 1) / RowChunk, [&](int chunk) {
+        QVector<Complex> z(n);
+        for (int v = chunk * RowChunk; v < qMin(height, (chunk + 1) * RowChunk); ++v) {
+            const float *x = plane.constData() + qsizetype(v) * width;
+            for (int j = 0; j < n; ++j)
+                z[j] = Complex(x[2 * j], x[2 * j + 1]);
+            transform(*plan, z.data(), false);
+            // Z holds the even samples' transform as its real part and the odd
+            // ones' as its imaginary part; X = E + w^k O.
+            Complex *out = s.row(v);
+            out[0] = Complex(z[0].real() + z[0].imag(), 0);
+            out[n] = Complex(z[0].real() - z[0].imag(), 0);
+            for (int k = 1; k < n; ++k) {
+                const Complex a = z[k], b = std::conj(z[n - k]);
+                const Complex e = 0.5f * (a + b);
+                const Complex o = Complex(0, -0.5f) * (a - b);
+                out[k] = e + plan->split[k] * o;
+            }
+        }
+    });
+    columnPass(s, false);
+    return s;
+}
+
+QVector<float> inverseFft(const Spectrum &spectrum)
+{
+    Spectrum s = spectrum;
+    columnPass(s, true);
+    const int width = s.width, height = s.height, n = width / 2;
+    const QSharedPointer<const FftPlan> plan = planFor(n);
+    const float scale = 1.0f / (float(n) * height);
+    QVector<float> plane(qsizetype(width) * height);
+
+    TaskScheduler::instance().run((height + RowChunk - 1) / RowChunk, [&](int chunk) {
+        QVector<Complex> z(n);
+        for (int v = chunk * RowChunk; v < qMin(height, (chunk + 1) * RowChunk); ++v) {
+            const Complex *in = s.row(v);
+            for (int k = 0; k < n; ++k) {
+                const Complex a = in[k], b = std::conj(in[n - k]);
+                const Complex e = 0.5f * (a + b);
+                const Complex o = 0.5f * (a - b) * std::conj(plan->split[k]);
+                z[k] = e + Complex(0, 1) * o;
+            }
+            transform(*plan, z.data(), true);
+            float *x = plane.data() + qsizetype(v) * width;
+            for (int j = 0; j < n; ++j) {
+                x[2 * j] = z[j].real() * scale;
+                x[2 * j + 1] = z[j].imag() * scale;
+            }
+        }
+    });
+    return plane;
+}
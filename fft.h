@@ -0,0 +1,40 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <QVector>
+#include <complex>
+
+typedef std::complex<float> Complex;
+
+// Smallest power of two >= n (at least 2).
+int fftSize(int n);
+
+// Spectrum of a real width x height plane; both sizes are powers of two. A real
+// input has X(-u, -v) = conj X(u, v), so only the columns u = 0 .. width / 2 are
+// kept. Row v holds frequency v for v < height / 2 and v - height above that.
+struct Spectrum
+{
+    int width = 0;
+    int height = 0;
+    QVector<Complex> bins;   // height rows of rowLength() bins
+
+    int rowLength() const { return width / 2 + 1; }
+    Complex *row(int v) { return bins.data() + qsizetype(v) * rowLength(); }
+    const Complex *row(int v) const { return bins.constData() + qsizetype(v) * rowLength(); }
+};
+
+// 2D transform of a row-major width x height plane. Rows go through a complex
+// transform of half their length (even and odd samples packed as real and
+// imaginary parts), then the kept columns are transformed in cache-sized blocks;
+// both passes run in parallel on the task scheduler.
+Spectrum forwardFft(const QVector<float> &plane, int width, int height);
+
+// Inverse of forwardFft, including the 1 / (width height) scale.
+QVector<float> inverseFft(const Spectrum &spectrum);
+
+// In-place complex transform of n points, n a power of two; the inverse is not
+// scaled. Radix-4 passes (plus one radix-2 pass for odd powers) over
+// bit-reversed data; twiddle tables are built once per size and cached.
+void fft(Complex *data, int n, bool inverse = false);
+
+#endif // FFT_H
@@ -0,0 +1,294 @@
+#include "framering.h"
+#include <QStringList>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <new>
+
+namespace {
+
+const quint32 RingVersion = 1;
+const int ReadAttempts = 4;
+
+struct RingHeader
+{
+    char magic[4];                    // "IPFR"
+    quint32 version;
+    quint32 slotCount;
+    quint32 slotBytes;                // pixel capacity of a slot
+    std::atomic<quint64> published;   // frames written so far
+    std::atomic<quint32> closed;
+};
+
+struct SlotHeader
+{
+    std::atomic<quint32> sequence;    // odd while the slot is being written
+    qint32 width;
+    qint32 height;
+    qint32 format;                    // QImage::Format, Grayscale8 or ARGB32
+    quint64 number;
+    qint64 timestamp;
+};
+
+static_assert(std::atomic<quint64>::is_always_lock_free,
+              "ring counters must be lock-free to work across processes");
+
+qsizetype headerBytes()
+{
+    return (sizeof(RingHeader) + 63) & ~qsizetype(63);
+}
+
+qsizetype slotStride(quint32 slotBytes)
+{
+    return (sizeof(SlotHeader) + slotBytes + 63) & ~qsizetype(63);
+}
+
+RingHeader *ringHeader(QSharedMemory &memory)
+{
+    return static_cast<RingHeader *>(memory.data());
+}
+
+SlotHeader *slotAt(QSharedMemory &memory, quint64 index)
+{
+    RingHeader *h = ringHeader(memory);
+    char *base = static_cast<char *>(memory.data()) + headerBytes();
+    return reinterpret_cast<SlotHeader *>(base + qsizetype(index % h->slotCount) * slotStride(h->slotBytes));
+}
+
+uchar *slotPixels(SlotHeader *slot)
+{
+    return reinterpret_cast<uchar *>(slot + 1);
+}
+
+void setError(QString *error, const QString &message)
+{
+    if (error)
+        *error = message;
+}
+
+} // namespace
+
+qint64 frameClockNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//------------------------------------------------------------------------------
+
+FrameRingWriter::~FrameRingWriter()
+{
+    close();
+}
+
+bool FrameRingWriter::create(const QString &key, int slotCount, const QSize &maxSize, QString *error)
+{
+    if (slotCount < 2 || maxSize.isEmpty()) {
+        setError(error, QStringLiteral("a ring needs at least two slots of a non-empty size"));
+        return false;
+    }
+    const qint64 pixelBytes = qint64(maxSize.width()) * maxSize.height() * 4;
+    if (pixelBytes > 0x7fffffff) {
+        setError(error, QStringLiteral("frames too large for the ring"));
+        return false;
+    }
+    const quint32 slotBytes = quint32(pixelBytes);
+    const qsizetype bytes = headerBytes() + slotCount * slotStride(slotBytes);
+
+    memory.setKey(key);
+    if (!memory.create(bytes)) {
+        // A segment left behind by a producer that crashed: attaching and
+        // detaching again as its last user removes it.
+        if (memory.error() != QSharedMemory::AlreadyExists || !memory.attach()) {
+            setError(error, memory.errorString());
+            return false;
+        }
+        memory.detach();
+        if (!memory.create(bytes)) {
+            setError(error, memory.errorString());
+            return false;
+        }
+    }
+
+    std::memset(memory.data(), 0, bytes);
+    RingHeader *h = new (memory.data()) RingHeader;
+    std::memcpy(h->magic, "IPFR", 4);
+    h->version = RingVersion;
+    h->slotCount = quint32(slotCount);
+    h->slotBytes = slotBytes;
+    h->closed.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < slotCount; ++i)
+        new (slotAt(memory, i)) SlotHeader;
+    h->published.store(0, std::memory_order_release);
+    written = 0;
+    return true;
+}
+
+bool FrameRingWriter::write(const QImage &frame)
+{
+    if (!memory.isAttached() || frame.isNull())
+        return false;
+    const QImage img = frame.format() == QImage::Format_Grayscale8
+        ? frame : frame.convertToFormat(QImage::Format_ARGB32);
+    const qsizetype rowBytes = qsizetype(img.width()) * (img.depth() / 8);
+    RingHeader *h = ringHeader(memory);
+    if (rowBytes * img.height() > h->slotBytes)
+        return false;
+
+    SlotHeader *slot = slotAt(memory, written);
+    const quint32 sequence = slot->sequence.load(std::memory_order_relaxed);
+    slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->width = img.width();
+    slot->height = img.height();
+    slot->format = img.format();
+    slot->number = written;
+    slot->timestamp = frameClockNs();
+    uchar *pixels = slotPixels(slot);
+    for (int y = 0; y < img.height(); ++y)
+        std::memcpy(pixels + y * rowBytes, img.constScanLine(y), rowBytes);
+    slot->sequence.store(sequence + 2, std::memory_order_release);
+
+    h->published.store(++written, std::memory_order_release);
+    return true;
+}
+
+void FrameRingWriter::close()
+{
+    if (!memory.isAttached())
+        return;
+    ringHeader(memory)->closed.store(1, std::memory_order_release);
+    memory.detach();
+}
+
+//------------------------------------------------------------------------------
+
+bool FrameRingReader::attach(const QString &key, QString *error)
+{
+    detach();
+    memory.setKey(key);
+    if (!memory.attach()) {
+        setError(error, memory.errorString());
+        return false;
+    }
+    const RingHeader *h = ringHeader(memory);
+    if (memory.size() < headerBytes() || std::memcmp(h->magic, "IPFR", 4) != 0
+        || h->version != RingVersion || h->slotCount < 2
+        || memory.size() < headerBytes() + qsizetype(h->slotCount) * slotStride(h->slotBytes)) {
+        setError(error, QStringLiteral("%1 is not a frame ring").arg(key));
+        memory.detach();
+        return false;
+    }
+    // The newest frame already there is the first one handed out.
+    next = qMax<quint64>(1, h->published.load(std::memory_order_acquire)) - 1;
+    droppedFrames = 0;
+    return true;
+}
+
+void FrameRingReader::detach()
+{
+    if (memory.isAttached())
+        memory.detach();
+}
+
+bool FrameRingReader::readLatest(QImage *frame, FrameInfo *info)
+{
+    if (!memory.isAttached())
+        return false;
+    RingHeader *h = ringHeader(memory);
+    for (int attempt = 0; attempt < ReadAttempts; ++attempt) {
+        const quint64 published = h->published.load(std::memory_order_acquire);
+        if (published <= next)
+            return false;
+        const quint64 number = published - 1;
+        SlotHeader *slot = slotAt(memory, number);
+        const quint32 before = slot->sequence.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+        const int width = slot->width, height = slot->height;
+        const QImage::Format format = QImage::Format(slot->format);
+        const quint64 slotNumber = slot->number;
+        const qint64 timestamp = slot->timestamp;
+        if (width <= 0 || height <= 0
+            || (format != QImage::Format_Grayscale8 && format != QImage::Format_ARGB32))
+            continue;
+        QImage img(width, height, format);
+        const qsizetype rowBytes = qsizetype(width) * (img.depth() / 8);
+        if (rowBytes * height > h->slotBytes)
+            continue;
+        const uchar *pixels = slotPixels(slot);
+        for (int y = 0; y < height; ++y)
+            std::memcpy(img.scanLine(y), pixels + y * rowBytes, rowBytes);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->sequence.load(std::memory_order_relaxed) != before || slotNumber != number)
+            continue;
+
+        droppedFrames += number - next;
+        next = number + 1;
+        *frame = img;
+        if (info)
+            *info = { number, timestamp };
+        return true;
+    }
+    return false;
+}
+
+bool FrameRingReader::isFinished() const
+{
+    if (!memory.isAttached())
+        return true;
+    const RingHeader *h = static_cast<const RingHeader *>(memory.constData());
+    return h->closed.load(std::memory_order_acquire)
+        && h->published.load(std::memory_order_acquire) <= next;
+}
+
+//------------------------------------------------------------------------------
+
+void LatencyStats::add(double ms)
+{
+    if (samples.size() < Window) {
+        samples.append(ms);
+        return;
+    }
+    samples[oldest] = ms;
+    oldest = (oldest + 1) % Window;
+}
+
+void LatencyStats::clear()
+{
+    samples.clear();
+    oldest = 0;
+}
+
+double LatencyStats::mean() const
+{
+    double sum = 0;
+    for (double s : samples)
+        sum += s;
+    return samples.isEmpty() ? 0 : sum / samples.size();
+}
+
+double LatencyStats::percentile(double p) const
+{
+    if (samples.isEmpty())
+        return 0;
+    QVector<double> sorted = samples;
+    const qsizetype k = qBound<qsizetype>(0, qsizetype(p / 100 * (sorted.size() - 1) + 0.5),
+                                          sorted.size() - 1);
+    std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+    return sorted[k];
+}
+
+double LatencyStats::max() const
+{
+    return samples.isEmpty() ? 0 : *std::max_element(samples.constData(),
+                                                     samples.constData() + samples.size());
+}
+
+QString LatencyStats::summary() const
+{
+    return QStringLiteral("mean %1 ms, p50 %2, p95 %3, max %4")
+        .arg(mean(), 0, 'f', 1).arg(percentile(50), 0, 'f', 1)
+        .arg(percentile(95), 0, 'f', 1).arg(max(), 0, 'f', 1);
+}
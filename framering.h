@@ -0,0 +1,87 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <QImage>
+#include <QSharedMemory>
+#include <QString>
+#include <QVector>
+
+// Single-producer ring of frames in shared memory, for feeding a live view
+// from another process. Every slot is guarded by its own sequence lock: the
+// writer makes the count odd, copies the frame in and makes it even again,
+// and a reader retries a copy that saw the count change. The writer never
+// waits, and readers always take the newest frame, so a slow consumer drops
+// frames instead of holding the camera back.
+
+// Nanoseconds on the monotonic clock, which all processes on a machine share;
+// frames carry it so consumers can measure latency from capture.
+qint64 frameClockNs();
+
+struct FrameInfo
+{
+    quint64 number;        // 0 for the first frame written
+    qint64 timestamp;      // frameClockNs() when written
+};
+
+class FrameRingWriter
+{
+public:
+    ~FrameRingWriter();
+
+    // Frames up to maxSize pixels of 4 bytes fit; slotCount of them are kept.
+    bool create(const QString &key, int slotCount, const QSize &maxSize, QString *error = nullptr);
+    // Publishes frame (Grayscale8 as is, anything else as ARGB32); false if
+    // it is too large for the ring.
+    bool write(const QImage &frame);
+    // Tells readers no more frames will come.
+    void close();
+
+    quint64 framesWritten() const { return written; }
+
+private:
+    QSharedMemory memory;
+    quint64 written = 0;
+};
+
+class FrameRingReader
+{
+public:
+    bool attach(const QString &key, QString *error = nullptr);
+    void detach();
+    bool isAttached() const { return memory.isAttached(); }
+
+    // The newest frame published since the last call, if any. Frames that
+    // were overwritten or skipped in between are counted as dropped.
+    bool readLatest(QImage *frame, FrameInfo *info = nullptr);
+    // True once the writer has closed and every frame was seen.
+    bool isFinished() const;
+
+    quint64 dropped() const { return droppedFrames; }
+
+private:
+    QSharedMemory memory;
+    quint64 next = 0;           // number of the first frame not yet seen
+    quint64 droppedFrames = 0;
+};
+
+// Rolling window of per-frame latencies, in milliseconds.
+class LatencyStats
+{
+public:
+    void add(double ms);
+    void clear();
+
+    int count() const { return int(samples.size()); }
+    double mean() const;
+    double percentile(double p) const;
+    double max() const;
+    // "mean 12.3 ms, p50 11.8, p95 20.1, max 25.0" over the window.
+    QString summary() const;
+
+private:
+    static const int Window = 256;
+    QVector<double> samples;
+    int oldest = 0;
+};
+
+#endif // FRAMERING_H
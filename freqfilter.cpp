@@ -0,0 +1,365 @@
+#include "freqfilter.h"
+#include "colorspace.h"
+#include "fft.h"
+#include "scheduler.h"
+#include "tiles.h"
+#include <QtMath>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace {
+
+// Index i mirrored into 0 .. n - 1, edge pixels repeated (... 1 0 | 0 1 ... ).
+inline int reflect(int i, int n)
+{
+    const int period = 2 * n;
+    i %= period;
+    if (i < 0)
+        i += period;
+    return i < n ? i : period - 1 - i;
+}
+
+// The channels of an image as float planes, mirror-padded to a power-of-two
+// size with the image at (ox, oy).
+struct Planes
+{
+    QImage img;
+    int comps;              // bytes per pixel of img
+    QList<int> channels;    // byte offsets that are filtered
+    int width;
+    int height;
+    int ox;
+    int oy;
+    QVector<QVector<float>> data;
+};
+
+// lumaOnly gives a single luma plane, for analysis.
+Planes extractPlanes(const QImage &src, int minWidth, int minHeight, bool lumaOnly = false)
+{
+    Planes p;
+    const bool gray = src.format() == QImage::Format_Grayscale8;
+    p.img = src.convertToFormat(gray ? QImage::Format_Grayscale8 : QImage::Format_ARGB32);
+    p.comps = gray ? 1 : 4;
+    p.channels = gray || lumaOnly ? QList<int>{ 0 } : QList<int>{ 0, 1, 2 };
+    const int w = p.img.width(), h = p.img.height();
+    p.width = fftSize(qMax(w, minWidth));
+    p.height = fftSize(qMax(h, minHeight));
+    p.ox = (p.width - w) / 2;
+    p.oy = (p.height - h) / 2;
+
+    QVector<int> xs(p.width);
+    for (int x = 0; x < p.width; ++x)
+        xs[x] = reflect(x - p.ox, w);
+    p.data.resize(p.channels.size());
+    QVector<float *> planes;
+    for (QVector<float> &plane : p.data) {
+        plane.resize(qsizetype(p.width) * p.height);
+        planes.append(plane.data());
+    }
+    const bool luma = lumaOnly && !gray;
+    parallelRows(QRect(0, 0, p.width, p.height), 32, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const uchar *s = p.img.constScanLine(reflect(y - p.oy, h));
+            for (int c = 0; c < planes.size(); ++c) {
+                float *d = planes[c] + qsizetype(y) * p.width;
+                if (luma) {
+                    const QRgb *px = reinterpret_cast<const QRgb *>(s);
+                    for (int x = 0; x < p.width; ++x)
+                        d[x] = float(lumaOf(px[xs[x]]));
+                } else {
+                    const uchar *sc = s + p.channels[c];
+                    for (int x = 0; x < p.width; ++x)
+                        d[x] = sc[xs[x] * p.comps];
+                }
+            }
+        }
+    });
+    return p;
+}
+
+// Crops the planes back into the image, rounded and clamped.
+QImage insertPlanes(Planes &p)
+{
+    uchar *bits = p.img.bits();
+    const qsizetype bpl = p.img.bytesPerLine();
+    parallelRows(p.img.rect(), 32, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            for (int c = 0; c < p.channels.size(); ++c) {
+                const float *s = p.data[c].constData() + qsizetype(y + p.oy) * p.width + p.ox;
+                uchar *d = bits + y * bpl + p.channels[c];
+                for (int x = 0; x < p.img.width(); ++x) {
+                    const int v = qRound(s[x]);
+                    d[x * p.comps] = uchar(v < 0 ? 0 : (v > 255 ? 255 : v));
+                }
+            }
+        }
+    });
+    return p.img;
+}
+
+void filterPlanes(Planes &p, const std::function<void(Spectrum &)> &fn)
+{
+    for (QVector<float> &plane : p.data) {
+        Spectrum s = forwardFft(plane, p.width, p.height);
+        fn(s);
+        plane = inverseFft(s);
+    }
+}
+
+inline double frequencyX(int u, int width)
+{
+    return double(u) / width;
+}
+
+inline double frequencyY(int v, int height)
+{
+    return double(v < height / 2 ? v : v - height) / height;
+}
+
+// A real-valued response over the kept bins, computed once for all channels.
+QVector<float> buildResponse(int width, int height,
+                             const std::function<float(double fx, double fy)> &fn)
+{
+    const int cols = width / 2 + 1;
+    QVector<float> response(qsizetype(cols) * height);
+    float *r = response.data();
+    TaskScheduler::instance().run(height, [&](int v) {
+        const double fy = frequencyY(v, height);
+        for (int u = 0; u < cols; ++u)
+            r[qsizetype(v) * cols + u] = fn(frequencyX(u, width), fy);
+    });
+    return response;
+}
+
+void applyResponse(Spectrum &s, const QVector<float> &response)
+{
+    Complex *bins = s.bins.data();
+    const int cols = s.rowLength();
+    TaskScheduler::instance().run(s.height, [&](int v) {
+        Complex *b = bins + qsizetype(v) * cols;
+        const float *r = response.constData() + qsizetype(v) * cols;
+        for (int u = 0; u < cols; ++u)
+            b[u] *= r[u];
+    });
+}
+
+QImage filterWithResponse(const QImage &src,
+                          const std::function<float(double fx, double fy)> &fn)
+{
+    Planes p = extractPlanes(src, 0, 0);
+    const QVector<float> response = buildResponse(p.width, p.height, fn);
+    filterPlanes(p, [&](Spectrum &s) { applyResponse(s, response); });
+    return insertPlanes(p);
+}
+
+// |F| at any integer frequency (u, v), using F(-u, -v) = conj F(u, v) for the
+// half that is not stored.
+inline float magnitudeAt(const Spectrum &s, const QVector<float> &mag, int u, int v)
+{
+    u %= s.width;
+    if (u < 0)
+        u += s.width;
+    if (u > s.width / 2) {
+        u = s.width - u;
+        v = -v;
+    }
+    v %= s.height;
+    if (v < 0)
+        v += s.height;
+    return mag[qsizetype(v) * s.rowLength() + u];
+}
+
+QVector<float> magnitudes(const Spectrum &s)
+{
+    QVector<float> mag(s.bins.size());
+    float *m = mag.data();
+    TaskScheduler::instance().run(s.height, [&](int v) {
+        const Complex *b = s.row(v);
+        for (int u = 0; u < s.rowLength(); ++u)
+            m[qsizetype(v) * s.rowLength() + u] = std::abs(b[u]);
+    });
+    return mag;
+}
+
+} // namespace
+
+QImage fftConvolve(const QImage &src, const QVector<float> &kernel, int kw, int kh)
+{
+    if (src.isNull() || kw < 1 || kh < 1 || kernel.size() < qsizetype(kw) * kh)
+        return src;
+    // Enough mirrored margin on every side that the circular wrap of the
+    // transform never reaches back into the image.
+    Planes p = extractPlanes(src, src.width() + kw, src.height() + kh);
+
+    QVector<float> k(qsizetype(p.width) * p.height, 0.0f);
+    for (int j = 0; j < kh; ++j)
+        for (int i = 0; i < kw; ++i) {
+            const int x = (i - kw / 2 + p.width) % p.width;
+            const int y = (j - kh / 2 + p.height) % p.height;
+            k[qsizetype(y) * p.width + x] += kernel[j * kw + i];
+        }
+    const Spectrum ks = forwardFft(k, p.width, p.height);
+
+    filterPlanes(p, [&](Spectrum &s) {
+        Complex *bins = s.bins.data();
+        const Complex *kb = ks.bins.constData();
+        const int cols = s.rowLength();
+        TaskScheduler::instance().run(s.height, [&](int v) {
+            for (int u = 0; u < cols; ++u)
+                bins[qsizetype(v) * cols + u] *= kb[qsizetype(v) * cols + u];
+        });
+    });
+    return insertPlanes(p);
+}
+
+QVector<float> diskKernel(int radius)
+{
+    radius = qMax(0, radius);
+    const int n = 2 * radius + 1;
+    QVector<float> k(qsizetype(n) * n, 0.0f);
+    double sum = 0;
+    for (int y = -radius; y <= radius; ++y)
+        for (int x = -radius; x <= radius; ++x)
+            if (x * x + y * y <= radius * radius + radius) {
+                k[(y + radius) * n + x + radius] = 1.0f;
+                sum += 1;
+            }
+    for (float &v : k)
+        v = float(v / sum);
+    return k;
+}
+
+QImage passFilter(const QImage &src, PassFilter type, double low, double high, int order)
+{
+    if (src.isNull())
+        return src;
+    const double n2 = 2 * qBound(1, order, 10);
+    auto lowPass = [n2](double r, double cutoff) {
+        return cutoff <= 0 ? 0.0 : 1.0 / (1.0 + qPow(r / cutoff, n2));
+    };
+    auto highPass = [n2](double r, double cutoff) {
+        return r <= 0 || cutoff <= 0 ? 1.0 : 1.0 / (1.0 + qPow(cutoff / r, n2));
+    };
+    return filterWithResponse(src, [=](double fx, double fy) {
+        const double r = qSqrt(fx * fx + fy * fy);
+        if (r == 0)
+            return 1.0f;
+        switch (type) {
+        case LowPass:
+            return float(lowPass(r, high));
+        case HighPass:
+            return float(highPass(r, low));
+        case BandPass:
+            break;
+        }
+        return float(lowPass(r, high) * highPass(r, low));
+    });
+}
+
+QList<QPointF> findPeriodicNoise(const QImage &src, double ratio, double minFrequency, int maxPeaks)
+{
+    QList<QPointF> result;
+    if (src.isNull())
+        return result;
+    const Planes p = extractPlanes(src, 0, 0, true);
+    const Spectrum s = forwardFft(p.data[0], p.width, p.height);
+    const QVector<float> mag = magnitudes(s);
+    const int cols = s.rowLength();
+
+    struct Peak { double score; int u; int v; };
+    std::vector<std::vector<Peak>> rows(s.height);
+    TaskScheduler::instance().run(s.height, [&](int v) {
+        const double fy = frequencyY(v, s.height);
+        for (int u = 0; u < cols; ++u) {
+            // On the columns that are their own mirror, keep one of each pair.
+            if ((u == 0 || u == s.width / 2) && fy < 0)
+                continue;
+            const double fx = frequencyX(u, s.width);
+            if (fx * fx + fy * fy < minFrequency * minFrequency)
+                continue;
+            const float m = mag[qsizetype(v) * cols + u];
+            bool isMax = true;
+            double ring = 0;
+            int ringCount = 0;
+            for (int dy = -3; dy <= 3 && isMax; ++dy)
+                for (int dx = -3; dx <= 3; ++dx) {
+                    const int d = qMax(qAbs(dx), qAbs(dy));
+                    if (d == 0)
+                        continue;
+                    const float n = magnitudeAt(s, mag, u + dx, v + dy);
+                    if (d == 1 && n > m) {
+                        isMax = false;
+                        break;
+                    }
+                    if (d >= 2) {
+                        ring += n;
+                        ++ringCount;
+                    }
+                }
+            if (!isMax)
+                continue;
+            const double mean = ring / ringCount;
+            if (m > ratio * mean && m > 0)
+                rows[v].push_back({ mean > 0 ? m / mean : m, u, v });
+        }
+    });
+
+    std::vector<Peak> peaks;
+    for (const std::vector<Peak> &r : rows)
+        peaks.insert(peaks.end(), r.begin(), r.end());
+    std::sort(peaks.begin(), peaks.end(), [](const Peak &a, const Peak &b) {
+        return a.score > b.score;
+    });
+    for (int i = 0; i < int(peaks.size()) && i < maxPeaks; ++i)
+        result.append(QPointF(frequencyX(peaks[i].u, s.width), frequencyY(peaks[i].v, s.height)));
+    return result;
+}
+
+QImage notchFilter(const QImage &src, const QList<QPointF> &notches, double radius)
+{
+    if (src.isNull() || notches.isEmpty() || radius <= 0)
+        return src;
+    const double twoR2 = 2 * radius * radius;
+    const double reach2 = 16 * radius * radius;
+    return filterWithResponse(src, [&](double fx, double fy) {
+        double h = 1;
+        for (const QPointF &n : notches)
+            for (int sign = -1; sign <= 1; sign += 2) {
+                const double dx = fx - sign * n.x(), dy = fy - sign * n.y();
+                const double d2 = dx * dx + dy * dy;
+                if (d2 < reach2)
+                    h *= 1 - qExp(-d2 / twoR2);
+            }
+        return float(h);
+    });
+}
+
+QImage powerSpectrum(const QImage &src)
+{
+    if (src.isNull())
+        return QImage();
+    const Planes p = extractPlanes(src, 0, 0, true);
+    const Spectrum s = forwardFft(p.data[0], p.width, p.height);
+    QVector<float> mag = magnitudes(s);
+    for (float &m : mag)
+        m = std::log1p(m);
+    float top = 0;
+    for (qsizetype i = 1; i < mag.size(); ++i)
+        top = qMax(top, mag[i]);
+    const float scale = top > 0 ? 255.0f / top : 0.0f;
+
+    QImage out(s.width, s.height, QImage::Format_Grayscale8);
+    uchar *bits = out.bits();
+    const qsizetype bpl = out.bytesPerLine();
+    parallelRows(out.rect(), 32, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            uchar *d = bits + y * bpl;
+            for (int x = 0; x < s.width; ++x) {
+                const float v = magnitudeAt(s, mag, x - s.width / 2, y - s.height / 2) * scale;
+                d[x] = uchar(qMin(255, qRound(v)));
+            }
+        }
+    });
+    return out;
+}
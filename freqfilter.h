@@ -0,0 +1,43 @@
+#ifndef FREQFILTER_H
+#define FREQFILTER_H
+
+#include <QImage>
+#include <QList>
+#include <QPointF>
+#include <QVector>
+
+// Filters that work on the image's spectrum (see fft.h). Each colour channel
+// (or the one gray channel) is padded to a power-of-two size by mirroring the
+// image at its edges, filtered and cropped back; alpha is kept. Frequencies are
+// in cycles per pixel, 0 .. 0.5 along each axis.
+
+enum PassFilter { LowPass, HighPass, BandPass };
+
+// Convolution with a kw x kh kernel centred on (kw / 2, kh / 2). The cost does
+// not depend on the kernel size, which is what makes large kernels affordable.
+QImage fftConvolve(const QImage &src, const QVector<float> &kernel, int kw, int kh);
+
+// Normalised disc of the given radius ((2 radius + 1)^2 taps), e.g. for defocus.
+QVector<float> diskKernel(int radius);
+
+// Butterworth filter of the given order. LowPass keeps frequencies below high,
+// HighPass those above low and BandPass those in between. The DC term always
+// passes, so the mean brightness stays.
+QImage passFilter(const QImage &src, PassFilter type, double low, double high, int order = 2);
+
+// Isolated spikes in the luma spectrum that stand at least ratio times above
+// their surroundings and lie above minFrequency: the signature of periodic
+// noise such as scanner banding or screen patterns. At most maxPeaks, the most
+// prominent first; only one of each pair f, -f is listed.
+QList<QPointF> findPeriodicNoise(const QImage &src, double ratio = 8.0,
+                                 double minFrequency = 0.03, int maxPeaks = 32);
+
+// Gaussian notches of the given radius at every frequency in notches and its
+// mirror image.
+QImage notchFilter(const QImage &src, const QList<QPointF> &notches, double radius = 0.004);
+
+// log(1 + |F|) of the luma as Grayscale8 at the padded size, with zero frequency
+// in the centre and scaled to the strongest non-DC term.
+QImage powerSpectrum(const QImage &src);
+
+#endif // FREQFILTER_H
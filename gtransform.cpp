@@ -2,8 +2,16 @@
 #include <QPixmap>
 #include <QPainter>
 #include<QFileDialog>
+#include <QMessageBox>
+#include "warp.h"
+#include "lens.h"
+#include "jpegxform.h"
+#include "roi.h"
+#include "quantize.h"
+#include "ipxfile.h"
 gtransform::gtransform(QWidget *parent)
-    : QWidget(parent)
+    : QWidget(parent), hFlipped(false), vFlipped(false), dstAngle(0),
+      pendingAngle(0), pendingRoi(false)
 {
     mainLayout = new QHBoxLayout (this);
     leftLayout = new QVBoxLayout (this);
@@ -24,6 +32,9 @@ gtransform::gtransform(QWidget *parent)
     groupLayout->addWidget (vCheckBox);
     groupLayout->addWidget (mirrorButton);
     groupLayout->addWidget (saveButton);
+    roiCheckBox = new QCheckBox (QStringLiteral("僅處理選取區域"), this);
+    roiCheckBox->setEnabled (false);
+    leftLayout->addWidget (roiCheckBox);
     leftLayout->addWidget (mirrorGroup);
 
     rotateDial = new QDial (this);
@@ -34,6 +45,60 @@ gtransform::gtransform(QWidget *parent)
     vSpacer = new QSpacerItem (20, 58, QSizePolicy:: Minimum,
                               QSizePolicy:: Expanding);
     leftLayout->addWidget (rotateDial);
+
+    warpGroup = new QGroupBox (QStringLiteral("變形"), this);
+    warpLayout = new QVBoxLayout (warpGroup);
+    warpModeBox = new QComboBox (warpGroup);
+    warpModeBox->addItem (QStringLiteral("仿射 (3 點)"));
+    warpModeBox->addItem (QStringLiteral("透視 (4 點)"));
+    interpBox = new QComboBox (warpGroup);
+    interpBox->addItem (QStringLiteral("最近鄰"));
+    interpBox->addItem (QStringLiteral("雙線性"));
+    interpBox->addItem (QStringLiteral("雙三次"));
+    interpBox->setCurrentIndex (WarpBilinear);
+    clearPointsButton = new QPushButton (QStringLiteral("清除控制點"), warpGroup);
+    warpButton = new QPushButton (QStringLiteral("執行變形"), warpGroup);
+    warpGroup->setToolTip (QStringLiteral("依序點選左上、右上、右下、左下角"));
+    warpLayout->addWidget (warpModeBox);
+    warpLayout->addWidget (interpBox);
+    warpLayout->addWidget (clearPointsButton);
+    warpLayout->addWidget (warpButton);
+    leftLayout->addWidget (warpGroup);
+
+    lensGroup = new QGroupBox (QStringLiteral("鏡頭校正"), this);
+    lensLayout = new QVBoxLayout (lensGroup);
+    QDoubleSpinBox **lensBoxes[] = { &k1Box, &k2Box, &p1Box, &p2Box };
+    const char *lensNames[] = { "k1 ", "k2 ", "p1 ", "p2 " };
+    for (int i = 0; i < 4; ++i) {
+        QDoubleSpinBox *box = new QDoubleSpinBox (lensGroup);
+        box->setRange (-2.0, 2.0);
+        box->setDecimals (4);
+        box->setSingleStep (0.01);
+        box->setPrefix (QString::fromLatin1 (lensNames[i]));
+        lensLayout->addWidget (box);
+        *lensBoxes[i] = box;
+    }
+    undistortButton = new QPushButton (QStringLiteral("校正變形"), lensGroup);
+    lensGroup->setToolTip (QStringLiteral("k1 < 0 校正桶狀變形, k1 > 0 校正枕狀變形"));
+    lensLayout->addWidget (undistortButton);
+    leftLayout->addWidget (lensGroup);
+
+    saveGroup = new QGroupBox (QStringLiteral("存檔選項"), this);
+    saveLayout = new QVBoxLayout (saveGroup);
+    paletteBox = new QComboBox (saveGroup);
+    paletteBox->addItem (QStringLiteral("全彩"), 0);
+    paletteBox->addItem (QStringLiteral("256 色"), 256);
+    paletteBox->addItem (QStringLiteral("64 色"), 64);
+    paletteBox->addItem (QStringLiteral("16 色"), 16);
+    ditherBox = new QComboBox (saveGroup);
+    ditherBox->addItem (QStringLiteral("不抖動"));
+    ditherBox->addItem (QStringLiteral("Floyd-Steinberg"));
+    ditherBox->addItem (QStringLiteral("有序抖動"));
+    ditherBox->setCurrentIndex (DitherFloydSteinberg);
+    saveGroup->setToolTip (QStringLiteral("PNG 可存成 8 位元索引色"));
+    saveLayout->addWidget (paletteBox);
+    saveLayout->addWidget (ditherBox);
+    leftLayout->addWidget (saveGroup);
     leftLayout->addItem(vSpacer);
     mainLayout->addLayout (leftLayout);
 
@@ -65,7 +130,13 @@ gtransform::gtransform(QWidget *parent)
 
     connect (mirrorButton, SIGNAL (clicked()), this, SLOT (mirroredImage()));
     connect (saveButton, SIGNAL (clicked()), this, SLOT (saveimage()));
+    rotateJob = new ImageJob (this);
     connect (rotateDial, SIGNAL (valueChanged(int)), this, SLOT (rotatedImage()));
+    connect (rotateJob, SIGNAL (ready(QImage)), this, SLOT (rotateReady(QImage)));
+    connect (warpButton, SIGNAL (clicked()), this, SLOT (warpedImage()));
+    connect (clearPointsButton, SIGNAL (clicked()), this, SLOT (clearPoints()));
+    connect (warpModeBox, SIGNAL (currentIndexChanged(int)), this, SLOT (clearPoints()));
+    connect (undistortButton, SIGNAL (clicked()), this, SLOT (undistortedImage()));
 }
 
 gtransform::~gtransform() {
@@ -73,35 +144,223 @@ gtransform::~gtransform() {
 }
 
 void gtransform:: saveimage(){
+    QString pngFilter = QStringLiteral("PNG Files (*.png)");
+    QString jpegFilter = QStringLiteral("JPEG Files (*.jpg *.jpeg)");
+    QString ipxFilter = QStringLiteral("IPX 暫存檔 (*.ipx)");
+    bool fromJpeg = !srcPath.isEmpty() && isJpegFile(srcPath);
     QString filepath = QFileDialog::getSaveFileName(this,
                                                     QStringLiteral("存檔"),
                                                     "",
-                                                    QStringLiteral("PNG Files (*.png)"));
+                                                    (fromJpeg ? jpegFilter + ";;" + pngFilter
+                                                              : pngFilter + ";;" + jpegFilter)
+                                                    + ";;" + ipxFilter);
     if (filepath.isEmpty())
         return;
-    if (!dstImg.isNull()) {
-        dstImg.save(filepath);
+    // Mirrors and quarter turns of an untouched JPEG are redone on its DCT
+    // coefficients instead of re-encoding the pixels.
+    if (fromJpeg && isJpegFile(filepath) && jpegLosslessAvailable())
+    {
+        JpegXform xform = jpegXformFor(hFlipped, vFlipped, dstAngle);
+        if (xform != JpegInvalid && transformJpegFile(srcPath, filepath, xform))
+            return;
+    }
+    if (dstImg.isNull())
+        return;
+    bool saved;
+    QString error;
+    if (filepath.endsWith(QLatin1String(".ipx"), Qt::CaseInsensitive)) {
+        // Intermediate results: lossless and far cheaper to write than PNG.
+        saved = saveIpx(dstImg, filepath, &error);
+    } else {
+        // Indexed PNG when a palette size is chosen; JPEG has no palettes.
+        int colors = paletteBox->currentData().toInt();
+        if (colors > 0 && filepath.endsWith(QLatin1String(".png"), Qt::CaseInsensitive))
+            saved = quantizeImage(dstImg, colors, QuantizeKMeans,
+                                  DitherMode(ditherBox->currentIndex())).save(filepath);
+        else
+            saved = dstImg.save(filepath);
     }
+    if (!saved)
+        QMessageBox::warning(this, QStringLiteral("存檔"),
+                             error.isEmpty() ? QStringLiteral("無法寫入 %1").arg(filepath)
+                                             : QStringLiteral("無法寫入 %1: %2").arg(filepath, error));
 }
 void gtransform::mirroredImage ()
 {
     bool H,V;
     if (srcImg.isNull())
         return;
+    rotateJob->cancel();
     H=hCheckBox->isChecked ();
     V=vCheckBox->isChecked();
+    QRect r = activeRoi();
+    if (!r.isEmpty())
+    {
+        // Only the selected pixels are mirrored; the rest of the frame is untouched.
+        QImage region = roiView (srcImg, r).mirrored (H,V);
+        dstImg = QImage();
+        pasteRoi (srcImg, r.topLeft(), region);
+        dstImg = srcImg;
+        srcPath.clear();
+        inWin->setPixmap (QPixmap:: fromImage (dstImg));
+        return;
+    }
     dstImg=srcImg.mirrored (H,V);
     inWin->setPixmap (QPixmap:: fromImage (dstImg));
     srcImg = dstImg;
+    hFlipped ^= H;
+    vFlipped ^= V;
+    dstAngle = 0;
 }
 void gtransform::rotatedImage ()
 {
-    QTransform tran;
     int angle;
     if (srcImg.isNull())
         return;
     angle=rotateDial->value();
-    tran.rotate (angle);
-    dstImg=srcImg.transformed (tran);
+    QRect r = activeRoi();
+    QImage src = srcImg;
+    pendingAngle = angle;
+    pendingRoi = !r.isEmpty();
+    // Runs off the GUI thread. Turning the dial again cancels this rotation
+    // between tiles, and only the newest angle is ever shown.
+    rotateJob->start ([src, r, angle]() {
+        QTransform tran;
+        if (!r.isEmpty())
+        {
+            // Turn the selection about its own centre and lay it over the original.
+            QPointF c (r.width() / 2.0, r.height() / 2.0);
+            tran.translate (c.x(), c.y()).rotate (angle).translate (-c.x(), -c.y());
+            QImage region = warpImage (roiView (src, r), tran, r.size(), WarpBilinear);
+            QImage out = src.convertToFormat (QImage::Format_ARGB32_Premultiplied);
+            QPainter paint(&out);
+            paint.drawImage (r.topLeft(), region);
+            paint.end();
+            return out;
+        }
+        tran.rotate (angle);
+        QRect box = tran.mapRect (QRectF(src.rect())).toAlignedRect();
+        tran *= QTransform::fromTranslate (-box.x(), -box.y());
+        return warpImage (src, tran, box.size(), WarpBilinear);
+    });
+}
+
+void gtransform::rotateReady (const QImage &image)
+{
+    dstImg = image;
+    if (pendingRoi)
+        srcPath.clear();
+    else
+        dstAngle = pendingAngle;
+    inWin->setPixmap (QPixmap:: fromImage (dstImg));
+}
+
+const QImage &gtransform::currentImage() const
+{
+    return dstImg.isNull() ? srcImg : dstImg;
+}
+
+QRect gtransform::activeRoi() const
+{
+    if (!roiCheckBox->isChecked())
+        return QRect();
+    return roi.intersected (srcImg.rect());
+}
+
+void gtransform::mousePressEvent (QMouseEvent *event)
+{
+    const QImage &img = currentImage();
+    QRect area = inWin->geometry();
+    QPointF pos = event->position();
+    if (event->button() != Qt::LeftButton || img.isNull() || !area.contains(pos.toPoint()))
+        return;
+    // inWin scales the image to fill the label, so undo that scale.
+    int needed = warpModeBox->currentIndex() == 0 ? 3 : 4;
+    if (ctrlPoints.size() >= needed)
+        ctrlPoints.clear();
+    ctrlPoints.append (QPointF((pos.x() - area.x()) * img.width() / area.width(),
+                               (pos.y() - area.y()) * img.height() / area.height()));
+    showControlPoints();
+}
+
+void gtransform::showControlPoints ()
+{
+    const QImage &img = currentImage();
+    if (img.isNull())
+        return;
+    QPixmap pix = QPixmap::fromImage (img);
+    if (!ctrlPoints.isEmpty())
+    {
+        int r = qMax(3, qMax(img.width(), img.height()) / 150);
+        QPainter paint(&pix);
+        paint.setRenderHint (QPainter::Antialiasing);
+        paint.setPen (QPen(QColor(255, 0, 0), qMax(1, r / 3)));
+        paint.drawPolyline (ctrlPoints);
+        for (const QPointF &p : ctrlPoints)
+            paint.drawEllipse (p, r, r);
+    }
+    inWin->setPixmap (pix);
+}
+
+void gtransform::clearPoints ()
+{
+    ctrlPoints.clear();
+    showControlPoints();
+}
+
+void gtransform::warpedImage ()
+{
+    const QImage &img = currentImage();
+    bool affine = warpModeBox->currentIndex() == 0;
+    if (img.isNull() || ctrlPoints.size() < (affine ? 3 : 4))
+        return;
+    QSize size;
+    QTransform tran = affine ? affineDeskew (ctrlPoints, &size)
+                             : perspectiveDeskew (ctrlPoints, &size);
+    if (size.isEmpty())
+        return;
+    rotateJob->cancel();
+    dstImg = warpImage (img, tran, size, WarpInterp(interpBox->currentIndex()));
+    srcImg = dstImg;
+    srcPath.clear();
+    roi = QRect();
+    roiCheckBox->setChecked (false);
+    roiCheckBox->setEnabled (false);
+    ctrlPoints.clear();
+    inWin->setPixmap (QPixmap:: fromImage (dstImg));
+}
+
+void gtransform::undistortedImage ()
+{
+    if (srcImg.isNull())
+        return;
+    LensModel lens;
+    lens.k1 = k1Box->value();
+    lens.k2 = k2Box->value();
+    lens.p1 = p1Box->value();
+    lens.p2 = p2Box->value();
+    rotateJob->cancel();
+    // Like a mirror, this works on the unrotated frame or just the selection,
+    // and a lossless JPEG save can no longer reproduce the result.
+    QRect r = activeRoi();
+    if (!r.isEmpty())
+    {
+        // Undistorted as ARGB even for gray, so the corners the lens pulls in
+        // are transparent and the original shows there instead of black.
+        QImage region = undistortImage (roiView (srcImg, r)
+                                            .convertToFormat (QImage::Format_ARGB32_Premultiplied), lens);
+        bool gray = srcImg.format() == QImage::Format_Grayscale8;
+        QImage out = srcImg.convertToFormat (QImage::Format_ARGB32_Premultiplied);
+        QPainter paint(&out);
+        paint.drawImage (r.topLeft(), region);
+        paint.end();
+        srcImg = gray ? out.convertToFormat (QImage::Format_Grayscale8) : out;
+    }
+    else
+        srcImg = undistortImage (srcImg, lens);
+    dstImg = srcImg;
+    srcPath.clear();
+    dstAngle = 0;
+    ctrlPoints.clear();
     inWin->setPixmap (QPixmap:: fromImage (dstImg));
 }
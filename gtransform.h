@@ -12,6 +12,11 @@
 #include <QHBoxLayout>
 #include <QVBoxLayout>
 #include <QImage>
+#include <QComboBox>
+#include <QDoubleSpinBox>
+#include <QPolygonF>
+#include <QMouseEvent>
+#include "scheduler.h"
 
 class gtransform : public QWidget
 {
@@ -24,19 +29,58 @@ public:
     QGroupBox *mirrorGroup;
     QCheckBox *hCheckBox;
     QCheckBox *vCheckBox;
+    QCheckBox *roiCheckBox;
     QPushButton *mirrorButton;
     QPushButton *saveButton;
     QDial *rotateDial;
+    QGroupBox *warpGroup;
+    QVBoxLayout *warpLayout;
+    QComboBox *warpModeBox;
+    QComboBox *interpBox;
+    QPushButton *clearPointsButton;
+    QPushButton *warpButton;
+    QGroupBox *lensGroup;
+    QVBoxLayout *lensLayout;
+    QDoubleSpinBox *k1Box;
+    QDoubleSpinBox *k2Box;
+    QDoubleSpinBox *p1Box;
+    QDoubleSpinBox *p2Box;
+    QPushButton *undistortButton;
+    QGroupBox *saveGroup;
+    QVBoxLayout *saveLayout;
+    QComboBox *paletteBox;
+    QComboBox *ditherBox;
     QSpacerItem *vSpacer;
     QHBoxLayout *mainLayout;
     QVBoxLayout *groupLayout;
     QVBoxLayout *leftLayout;
     QImage srcImg;
     QImage dstImg;
+    QPolygonF ctrlPoints;
+    QString srcPath;
+    bool hFlipped;
+    bool vFlipped;
+    int dstAngle;
+    QRect roi;
+    ImageJob *rotateJob;
+
+protected:
+    void mousePressEvent(QMouseEvent *event) override;
+
+private:
+    const QImage &currentImage() const;
+    QRect activeRoi() const;
+    void showControlPoints();
+    int pendingAngle;
+    bool pendingRoi;
 
 private slots:
     void mirroredImage();
     void rotatedImage();
+    void rotateReady(const QImage &image);
     void saveimage();
+    void warpedImage();
+    void undistortedImage();
+    void clearPoints();
 };
 #endif // GTRANSFORM_H
@@ -0,0 +1,451 @@
+#include "imgfilter.h"
+#include <QPixmap>
+#include <QFileDialog>
+#include "bilateral.h"
+#include "canny.h"
+#include "colorspace.h"
+#include "contrast.h"
+#include "freqfilter.h"
+#include "morphology.h"
+#include "rankfilter.h"
+#include "roi.h"
+#include "threshold.h"
+
+imgfilter::imgfilter(QWidget *parent)
+    : QWidget(parent)
+{
+    setWindowTitle (QStringLiteral("濾波工具"));
+    mainLayout = new QHBoxLayout (this);
+    leftLayout = new QVBoxLayout ();
+
+    roiCheckBox = new QCheckBox (QStringLiteral("僅處理選取區域"), this);
+    roiCheckBox->setEnabled (false);
+    leftLayout->addWidget (roiCheckBox);
+
+    colorGroup = new QGroupBox (QStringLiteral("色彩空間"), this);
+    colorLayout = new QVBoxLayout (colorGroup);
+    colorSpaceBox = new QComboBox (colorGroup);
+    colorSpaceBox->addItem (QStringLiteral("RGB"));
+    colorSpaceBox->addItem (QStringLiteral("HSV"));
+    colorSpaceBox->addItem (QStringLiteral("YCbCr"));
+    colorSpaceBox->addItem (QStringLiteral("Lab"));
+    channelBox = new QComboBox (colorGroup);
+    channelCheckBox = new QCheckBox (QStringLiteral("僅處理此通道"), colorGroup);
+    splitButton = new QPushButton (QStringLiteral("分離通道"), colorGroup);
+    colorLayout->addWidget (colorSpaceBox);
+    colorLayout->addWidget (channelBox);
+    colorLayout->addWidget (channelCheckBox);
+    colorLayout->addWidget (splitButton);
+    leftLayout->addWidget (colorGroup);
+    colorSpaceChanged (0);
+
+    morphGroup = new QGroupBox (QStringLiteral("形態學"), this);
+    morphLayout = new QVBoxLayout (morphGroup);
+    morphOpBox = new QComboBox (morphGroup);
+    morphOpBox->addItem (QStringLiteral("侵蝕"));
+    morphOpBox->addItem (QStringLiteral("膨脹"));
+    morphOpBox->addItem (QStringLiteral("斷開"));
+    morphOpBox->addItem (QStringLiteral("閉合"));
+    morphShapeBox = new QComboBox (morphGroup);
+    morphShapeBox->addItem (QStringLiteral("矩形"));
+    morphShapeBox->addItem (QStringLiteral("水平線"));
+    morphShapeBox->addItem (QStringLiteral("垂直線"));
+    morphShapeBox->addItem (QStringLiteral("斜線 \\"));
+    morphShapeBox->addItem (QStringLiteral("斜線 /"));
+    morphWidthBox = new QSpinBox (morphGroup);
+    morphWidthBox->setRange (1, 999);
+    morphWidthBox->setValue (3);
+    morphWidthBox->setPrefix (QStringLiteral("寬 "));
+    morphHeightBox = new QSpinBox (morphGroup);
+    morphHeightBox->setRange (1, 999);
+    morphHeightBox->setValue (3);
+    morphHeightBox->setPrefix (QStringLiteral("高 "));
+    morphButton = new QPushButton (QStringLiteral("執行"), morphGroup);
+    morphLayout->addWidget (morphOpBox);
+    morphLayout->addWidget (morphShapeBox);
+    morphLayout->addWidget (morphWidthBox);
+    morphLayout->addWidget (morphHeightBox);
+    morphLayout->addWidget (morphButton);
+    leftLayout->addWidget (morphGroup);
+
+    rankGroup = new QGroupBox (QStringLiteral("中值 / 排序"), this);
+    rankLayout = new QVBoxLayout (rankGroup);
+    rankRadiusBox = new QSpinBox (rankGroup);
+    rankRadiusBox->setRange (1, 500);
+    rankRadiusBox->setValue (2);
+    rankRadiusBox->setPrefix (QStringLiteral("半徑 "));
+    rankPercentBox = new QSpinBox (rankGroup);
+    rankPercentBox->setRange (0, 100);
+    rankPercentBox->setValue (50);
+    rankPercentBox->setPrefix (QStringLiteral("百分位 "));
+    rankPercentBox->setToolTip (QStringLiteral("50 為中值, 0 為最小值, 100 為最大值"));
+    rankButton = new QPushButton (QStringLiteral("執行"), rankGroup);
+    rankLayout->addWidget (rankRadiusBox);
+    rankLayout->addWidget (rankPercentBox);
+    rankLayout->addWidget (rankButton);
+    leftLayout->addWidget (rankGroup);
+
+    bilateralGroup = new QGroupBox (QStringLiteral("保邊平滑"), this);
+    bilateralLayout = new QVBoxLayout (bilateralGroup);
+    bilateralSpatialBox = new QDoubleSpinBox (bilateralGroup);
+    bilateralSpatialBox->setRange (2.0, 64.0);
+    bilateralSpatialBox->setSingleStep (1.0);
+    bilateralSpatialBox->setValue (8.0);
+    bilateralSpatialBox->setPrefix (QStringLiteral("空間 "));
+    bilateralSpatialBox->setToolTip (QStringLiteral("平滑範圍 (像素), 越大越快"));
+    bilateralRangeBox = new QDoubleSpinBox (bilateralGroup);
+    bilateralRangeBox->setRange (1.0, 128.0);
+    bilateralRangeBox->setSingleStep (1.0);
+    bilateralRangeBox->setValue (20.0);
+    bilateralRangeBox->setPrefix (QStringLiteral("亮度 "));
+    bilateralRangeBox->setToolTip (QStringLiteral("亮度差小於此值的像素才一起平均, 越小越保留邊緣"));
+    bilateralButton = new QPushButton (QStringLiteral("雙邊濾波"), bilateralGroup);
+    bilateralLayout->addWidget (bilateralSpatialBox);
+    bilateralLayout->addWidget (bilateralRangeBox);
+    bilateralLayout->addWidget (bilateralButton);
+    leftLayout->addWidget (bilateralGroup);
+
+    contrastGroup = new QGroupBox (QStringLiteral("對比"), this);
+    contrastLayout = new QVBoxLayout (contrastGroup);
+    equalizeButton = new QPushButton (QStringLiteral("直方圖等化"), contrastGroup);
+    claheTilesBox = new QSpinBox (contrastGroup);
+    claheTilesBox->setRange (1, 64);
+    claheTilesBox->setValue (8);
+    claheTilesBox->setPrefix (QStringLiteral("區塊數 "));
+    claheClipBox = new QDoubleSpinBox (contrastGroup);
+    claheClipBox->setRange (1.0, 40.0);
+    claheClipBox->setSingleStep (0.5);
+    claheClipBox->setValue (2.0);
+    claheClipBox->setPrefix (QStringLiteral("限制 "));
+    claheButton = new QPushButton (QStringLiteral("CLAHE"), contrastGroup);
+    contrastLayout->addWidget (equalizeButton);
+    contrastLayout->addWidget (claheTilesBox);
+    contrastLayout->addWidget (claheClipBox);
+    contrastLayout->addWidget (claheButton);
+    leftLayout->addWidget (contrastGroup);
+
+    thresholdGroup = new QGroupBox (QStringLiteral("二值化"), this);
+    thresholdLayout = new QVBoxLayout (thresholdGroup);
+    thresholdInvertBox = new QCheckBox (QStringLiteral("反相 (暗色為前景)"), thresholdGroup);
+    otsuButton = new QPushButton (QStringLiteral("Otsu"), thresholdGroup);
+    adaptiveRadiusBox = new QSpinBox (thresholdGroup);
+    adaptiveRadiusBox->setRange (1, 500);
+    adaptiveRadiusBox->setValue (15);
+    adaptiveRadiusBox->setPrefix (QStringLiteral("半徑 "));
+    adaptiveOffsetBox = new QSpinBox (thresholdGroup);
+    adaptiveOffsetBox->setRange (-128, 128);
+    adaptiveOffsetBox->setValue (5);
+    adaptiveOffsetBox->setPrefix (QStringLiteral("偏移 "));
+    adaptiveOffsetBox->setToolTip (QStringLiteral("高於區域平均值減去偏移的像素為前景"));
+    adaptiveButton = new QPushButton (QStringLiteral("自適應"), thresholdGroup);
+    thresholdLayout->addWidget (thresholdInvertBox);
+    thresholdLayout->addWidget (otsuButton);
+    thresholdLayout->addWidget (adaptiveRadiusBox);
+    thresholdLayout->addWidget (adaptiveOffsetBox);
+    thresholdLayout->addWidget (adaptiveButton);
+    leftLayout->addWidget (thresholdGroup);
+
+    edgeGroup = new QGroupBox (QStringLiteral("邊緣"), this);
+    edgeLayout = new QVBoxLayout (edgeGroup);
+    cannySigmaBox = new QDoubleSpinBox (edgeGroup);
+    cannySigmaBox->setRange (0.5, 10.0);
+    cannySigmaBox->setSingleStep (0.1);
+    cannySigmaBox->setValue (1.4);
+    cannySigmaBox->setPrefix (QStringLiteral("平滑 "));
+    cannyLowBox = new QSpinBox (edgeGroup);
+    cannyLowBox->setRange (0, 2000);
+    cannyLowBox->setValue (30);
+    cannyLowBox->setPrefix (QStringLiteral("低門檻 "));
+    cannyHighBox = new QSpinBox (edgeGroup);
+    cannyHighBox->setRange (0, 2000);
+    cannyHighBox->setValue (90);
+    cannyHighBox->setPrefix (QStringLiteral("高門檻 "));
+    cannyHighBox->setToolTip (QStringLiteral("梯度強度高於高門檻的邊緣, 連同與其相連且高於低門檻的部分"));
+    cannyButton = new QPushButton (QStringLiteral("Canny"), edgeGroup);
+    edgeLayout->addWidget (cannySigmaBox);
+    edgeLayout->addWidget (cannyLowBox);
+    edgeLayout->addWidget (cannyHighBox);
+    edgeLayout->addWidget (cannyButton);
+    leftLayout->addWidget (edgeGroup);
+
+    freqGroup = new QGroupBox (QStringLiteral("頻域"), this);
+    freqLayout = new QVBoxLayout (freqGroup);
+    passTypeBox = new QComboBox (freqGroup);
+    passTypeBox->addItem (QStringLiteral("低通"));
+    passTypeBox->addItem (QStringLiteral("高通"));
+    passTypeBox->addItem (QStringLiteral("帶通"));
+    passLowBox = new QDoubleSpinBox (freqGroup);
+    passLowBox->setRange (0.0, 0.5);
+    passLowBox->setDecimals (3);
+    passLowBox->setSingleStep (0.005);
+    passLowBox->setValue (0.02);
+    passLowBox->setPrefix (QStringLiteral("下限 "));
+    passHighBox = new QDoubleSpinBox (freqGroup);
+    passHighBox->setRange (0.0, 0.5);
+    passHighBox->setDecimals (3);
+    passHighBox->setSingleStep (0.005);
+    passHighBox->setValue (0.15);
+    passHighBox->setPrefix (QStringLiteral("上限 "));
+    passHighBox->setToolTip (QStringLiteral("截止頻率, 單位為每像素週期 (0 ~ 0.5)"));
+    passLowBox->setToolTip (QStringLiteral("截止頻率, 單位為每像素週期 (0 ~ 0.5)"));
+    passButton = new QPushButton (QStringLiteral("執行"), freqGroup);
+    diskRadiusBox = new QSpinBox (freqGroup);
+    diskRadiusBox->setRange (1, 300);
+    diskRadiusBox->setValue (15);
+    diskRadiusBox->setPrefix (QStringLiteral("半徑 "));
+    diskButton = new QPushButton (QStringLiteral("圓盤模糊"), freqGroup);
+    notchButton = new QPushButton (QStringLiteral("去除週期雜訊"), freqGroup);
+    spectrumButton = new QPushButton (QStringLiteral("頻譜"), freqGroup);
+    freqLayout->addWidget (passTypeBox);
+    freqLayout->addWidget (passLowBox);
+    freqLayout->addWidget (passHighBox);
+    freqLayout->addWidget (passButton);
+    freqLayout->addWidget (diskRadiusBox);
+    freqLayout->addWidget (diskButton);
+    freqLayout->addWidget (notchButton);
+    freqLayout->addWidget (spectrumButton);
+    leftLayout->addWidget (freqGroup);
+
+    resetButton = new QPushButton (QStringLiteral("還原"), this);
+    saveButton = new QPushButton (QStringLiteral("存檔"), this);
+    applyButton = new QPushButton (QStringLiteral("送回主視窗"), this);
+    leftLayout->addWidget (resetButton);
+    leftLayout->addWidget (saveButton);
+    leftLayout->addWidget (applyButton);
+    vSpacer = new QSpacerItem (20, 58, QSizePolicy:: Minimum,
+                              QSizePolicy:: Expanding);
+    leftLayout->addItem (vSpacer);
+    mainLayout->addLayout (leftLayout);
+
+    inWin = new QLabel (this);
+    inWin->setScaledContents (true);
+    inWin->setSizePolicy (QSizePolicy:: Expanding, QSizePolicy:: Expanding);
+    mainLayout->addWidget (inWin);
+
+    filterJob = new ImageJob (this);
+    connect (filterJob, SIGNAL (ready(QImage)), this, SLOT (filterReady(QImage)));
+    connect (colorSpaceBox, SIGNAL (currentIndexChanged(int)), this, SLOT (colorSpaceChanged(int)));
+    connect (splitButton, SIGNAL (clicked()), this, SLOT (splitChannels()));
+    connect (morphButton, SIGNAL (clicked()), this, SLOT (morphImage()));
+    connect (rankButton, SIGNAL (clicked()), this, SLOT (rankImage()));
+    connect (bilateralButton, SIGNAL (clicked()), this, SLOT (bilateralImage()));
+    connect (equalizeButton, SIGNAL (clicked()), this, SLOT (equalizedImage()));
+    connect (claheButton, SIGNAL (clicked()), this, SLOT (claheImage()));
+    connect (otsuButton, SIGNAL (clicked()), this, SLOT (otsuImage()));
+    connect (adaptiveButton, SIGNAL (clicked()), this, SLOT (adaptiveImage()));
+    connect (cannyButton, SIGNAL (clicked()), this, SLOT (cannyImage()));
+    connect (passButton, SIGNAL (clicked()), this, SLOT (passImage()));
+    connect (diskButton, SIGNAL (clicked()), this, SLOT (diskImage()));
+    connect (notchButton, SIGNAL (clicked()), this, SLOT (notchImage()));
+    connect (spectrumButton, SIGNAL (clicked()), this, SLOT (showSpectrum()));
+    connect (resetButton, SIGNAL (clicked()), this, SLOT (resetImage()));
+    connect (saveButton, SIGNAL (clicked()), this, SLOT (saveimage()));
+    connect (applyButton, SIGNAL (clicked()), this, SLOT (applyImage()));
+}
+
+imgfilter::~imgfilter()
+{
+}
+
+void imgfilter::setImage (const QImage &image, const QRect &selection)
+{
+    filterJob->cancel();
+    srcImg = image;
+    dstImg = image;
+    roi = selection.intersected (image.rect());
+    roiCheckBox->setEnabled (!roi.isEmpty());
+    roiCheckBox->setChecked (!roi.isEmpty());
+    inWin->setPixmap (QPixmap:: fromImage (dstImg));
+}
+
+void imgfilter::runFilter (const std::function<QImage(const QImage &)> &filter)
+{
+    if (dstImg.isNull())
+        return;
+    QImage src = dstImg;
+    QRect r = roiCheckBox->isChecked() ? roi : QRect();
+    bool perChannel = channelCheckBox->isChecked();
+    ColorSpace space = ColorSpace(colorSpaceBox->currentIndex());
+    int channel = channelBox->currentIndex();
+    filterJob->start ([src, r, filter, perChannel, space, channel]() {
+        auto apply = [&](const QImage &img) {
+            if (!perChannel)
+                return filter (img);
+            ColorPlanes planes = splitColor (img, space);
+            setChannel (planes, channel, filter (channelImage (planes, channel)));
+            return mergeColor (planes);
+        };
+        if (r.isEmpty())
+            return apply (src);
+        QImage out = src;
+        pasteRoi (out, r.topLeft(), apply (roiView (src, r)));
+        return out;
+    });
+}
+
+void imgfilter::colorSpaceChanged (int index)
+{
+    static const char *names[4][3] = {
+        { "R", "G", "B" }, { "H", "S", "V" }, { "Y", "Cb", "Cr" }, { "L*", "a*", "b*" },
+    };
+    int channel = qMax(0, channelBox->currentIndex());
+    channelBox->clear();
+    for (int c = 0; c < 3; ++c)
+        channelBox->addItem (QStringLiteral("通道 ") + QLatin1String(names[index][c]));
+    channelBox->setCurrentIndex (channel);
+}
+
+void imgfilter::splitChannels ()
+{
+    if (dstImg.isNull())
+        return;
+    QImage src = roiCheckBox->isChecked() ? roiView (dstImg, roi) : dstImg;
+    ColorPlanes planes = splitColor (src, ColorSpace(colorSpaceBox->currentIndex()));
+    QImage sheet (src.width() * 3, src.height(), QImage::Format_Grayscale8);
+    for (int c = 0; c < 3; ++c)
+        pasteRoi (sheet, QPoint(c * src.width(), 0), channelImage (planes, c));
+    QLabel *ret = new QLabel();
+    ret->setPixmap (QPixmap::fromImage (sheet));
+    ret->setWindowTitle (QStringLiteral("分離通道 ") + colorSpaceBox->currentText());
+    ret->show();
+}
+
+void imgfilter::filterReady (const QImage &image)
+{
+    dstImg = image;
+    inWin->setPixmap (QPixmap:: fromImage (dstImg));
+}
+
+void imgfilter::morphImage ()
+{
+    MorphOp op = MorphOp(morphOpBox->currentIndex());
+    MorphShape shape = MorphShape(morphShapeBox->currentIndex());
+    int w = morphWidthBox->value();
+    int h = morphHeightBox->value();
+    runFilter ([op, shape, w, h](const QImage &img) {
+        return morphology (img, op, shape, w, h);
+    });
+}
+
+void imgfilter::rankImage ()
+{
+    int radius = rankRadiusBox->value();
+    double percent = rankPercentBox->value();
+    runFilter ([radius, percent](const QImage &img) {
+        return rankFilter (img, radius, percent);
+    });
+}
+
+void imgfilter::bilateralImage ()
+{
+    double spatial = bilateralSpatialBox->value();
+    double range = bilateralRangeBox->value();
+    runFilter ([spatial, range](const QImage &img) {
+        return bilateralFilter (img, spatial, range);
+    });
+}
+
+void imgfilter::equalizedImage ()
+{
+    runFilter ([](const QImage &img) {
+        return equalizeHistogram (img);
+    });
+}
+
+void imgfilter::claheImage ()
+{
+    int tiles = claheTilesBox->value();
+    double clip = claheClipBox->value();
+    runFilter ([tiles, clip](const QImage &img) {
+        return clahe (img, tiles, tiles, clip);
+    });
+}
+
+void imgfilter::otsuImage ()
+{
+    bool invert = thresholdInvertBox->isChecked();
+    runFilter ([invert](const QImage &img) {
+        return thresholdImage (img, otsuThreshold (img), invert);
+    });
+}
+
+void imgfilter::adaptiveImage ()
+{
+    int radius = adaptiveRadiusBox->value();
+    int offset = adaptiveOffsetBox->value();
+    bool invert = thresholdInvertBox->isChecked();
+    runFilter ([radius, offset, invert](const QImage &img) {
+        return adaptiveThreshold (img, radius, offset, invert);
+    });
+}
+
+void imgfilter::cannyImage ()
+{
+    double sigma = cannySigmaBox->value();
+    int low = cannyLowBox->value();
+    int high = cannyHighBox->value();
+    runFilter ([sigma, low, high](const QImage &img) {
+        return cannyEdges (img, sigma, low, high);
+    });
+}
+
+void imgfilter::passImage ()
+{
+    PassFilter type = PassFilter(passTypeBox->currentIndex());
+    double low = passLowBox->value();
+    double high = passHighBox->value();
+    runFilter ([type, low, high](const QImage &img) {
+        return passFilter (img, type, low, high);
+    });
+}
+
+void imgfilter::diskImage ()
+{
+    int radius = diskRadiusBox->value();
+    runFilter ([radius](const QImage &img) {
+        return fftConvolve (img, diskKernel (radius), 2 * radius + 1, 2 * radius + 1);
+    });
+}
+
+void imgfilter::notchImage ()
+{
+    runFilter ([](const QImage &img) {
+        return notchFilter (img, findPeriodicNoise (img));
+    });
+}
+
+void imgfilter::showSpectrum ()
+{
+    if (dstImg.isNull())
+        return;
+    QImage src = roiCheckBox->isChecked() ? roiView (dstImg, roi) : dstImg;
+    QLabel *ret = new QLabel();
+    ret->setPixmap (QPixmap::fromImage (powerSpectrum (src)));
+    ret->setWindowTitle (QStringLiteral("頻譜"));
+    ret->show();
+}
+
+void imgfilter::resetImage ()
+{
+    filterJob->cancel();
+    dstImg = srcImg;
+    inWin->setPixmap (QPixmap:: fromImage (dstImg));
+}
+
+void imgfilter::saveimage ()
+{
+    if (dstImg.isNull())
+        return;
+    QString filepath = QFileDialog::getSaveFileName(this,
+                                                    QStringLiteral("存檔"),
+                                                    "",
+                                                    QStringLiteral("PNG Files (*.png)"));
+    if (!filepath.isEmpty())
+        dstImg.save (filepath);
+}
+
+void imgfilter::applyImage ()
+{
+    if (!dstImg.isNull())
+        emit applied (dstImg);
+}
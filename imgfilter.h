@@ -0,0 +1,122 @@
+#ifndef IMGFILTER_H
+#define IMGFILTER_H
+
+#include <QWidget>
+#include <QLabel>
+#include <QGroupBox>
+#include <QCheckBox>
+#include <QPushButton>
+#include <QComboBox>
+#include <QSpinBox>
+#include <QDoubleSpinBox>
+#include <QSpacerItem>
+#include <QHBoxLayout>
+#include <QVBoxLayout>
+#include <QImage>
+#include <functional>
+#include "scheduler.h"
+
+class imgfilter : public QWidget
+{
+    Q_OBJECT
+
+public:
+    imgfilter(QWidget *parent = nullptr);
+    ~imgfilter();
+    void setImage (const QImage &image, const QRect &selection);
+    QLabel *inWin;
+    QCheckBox *roiCheckBox;
+    QGroupBox *colorGroup;
+    QVBoxLayout *colorLayout;
+    QComboBox *colorSpaceBox;
+    QComboBox *channelBox;
+    QCheckBox *channelCheckBox;
+    QPushButton *splitButton;
+    QGroupBox *morphGroup;
+    QVBoxLayout *morphLayout;
+    QComboBox *morphOpBox;
+    QComboBox *morphShapeBox;
+    QSpinBox *morphWidthBox;
+    QSpinBox *morphHeightBox;
+    QPushButton *morphButton;
+    QGroupBox *rankGroup;
+    QVBoxLayout *rankLayout;
+    QSpinBox *rankRadiusBox;
+    QSpinBox *rankPercentBox;
+    QPushButton *rankButton;
+    QGroupBox *bilateralGroup;
+    QVBoxLayout *bilateralLayout;
+    QDoubleSpinBox *bilateralSpatialBox;
+    QDoubleSpinBox *bilateralRangeBox;
+    QPushButton *bilateralButton;
+    QGroupBox *contrastGroup;
+    QVBoxLayout *contrastLayout;
+    QPushButton *equalizeButton;
+    QSpinBox *claheTilesBox;
+    QDoubleSpinBox *claheClipBox;
+    QPushButton *claheButton;
+    QGroupBox *thresholdGroup;
+    QVBoxLayout *thresholdLayout;
+    QCheckBox *thresholdInvertBox;
+    QPushButton *otsuButton;
+    QSpinBox *adaptiveRadiusBox;
+    QSpinBox *adaptiveOffsetBox;
+    QPushButton *adaptiveButton;
+    QGroupBox *edgeGroup;
+    QVBoxLayout *edgeLayout;
+    QDoubleSpinBox *cannySigmaBox;
+    QSpinBox *cannyLowBox;
+    QSpinBox *cannyHighBox;
+    QPushButton *cannyButton;
+    QGroupBox *freqGroup;
+    QVBoxLayout *freqLayout;
+    QComboBox *passTypeBox;
+    QDoubleSpinBox *passLowBox;
+    QDoubleSpinBox *passHighBox;
+    QPushButton *passButton;
+    QSpinBox *diskRadiusBox;
+    QPushButton *diskButton;
+    QPushButton *notchButton;
+    QPushButton *spectrumButton;
+    QPushButton *resetButton;
+    QPushButton *saveButton;
+    QPushButton *applyButton;
+    QSpacerItem *vSpacer;
+    QHBoxLayout *mainLayout;
+    QVBoxLayout *leftLayout;
+    QImage srcImg;
+    QImage dstImg;
+    QRect roi;
+
+signals:
+    // The current image was sent back to the main window.
+    void applied(const QImage &image);
+
+private:
+    // Runs filter on the current image (or only on the selection) off the GUI
+    // thread; the result replaces the current image, so filters chain. With
+    // channelCheckBox set, filter only sees the chosen colour channel.
+    void runFilter (const std::function<QImage(const QImage &)> &filter);
+    ImageJob *filterJob;
+
+private slots:
+    void colorSpaceChanged(int index);
+    void splitChannels();
+    void morphImage();
+    void rankImage();
+    void bilateralImage();
+    void equalizedImage();
+    void claheImage();
+    void otsuImage();
+    void adaptiveImage();
+    void cannyImage();
+    void passImage();
+    void diskImage();
+    void notchImage();
+    void showSpectrum();
+    void filterReady(const QImage &image);
+    void resetImage();
+    void saveimage();
+    void applyImage();
+};
+#endif // IMGFILTER_H
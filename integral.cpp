@@ -0,0 +1,91 @@
+#include "integral.h"
+#include "colorspace.h"
+#include "tiles.h"
+#include <QtMath>
+#include <cstring>
+
+namespace {
+
+// Column strip width of the vertical pass, in table entries.
+const int StripEntries = 512;
+
+void columnPass(quint64 *table, int stride, int rows)
+{
+    parallelTiles(QRect(0, 0, stride, 1), StripEntries, [&](const QRect &strip) {
+        for (int y = 2; y < rows; ++y) {
+            quint64 *row = table + qsizetype(y) * stride;
+            const quint64 *above = row - stride;
+            for (int x = strip.left(); x <= strip.right(); ++x)
+                row[x] += above[x];
+        }
+    });
+}
+
+} // namespace
+
+quint64 IntegralImage::sum(const QRect &rect) const
+{
+    const QRect r = rect.intersected(QRect(0, 0, width, height));
+    if (r.isEmpty() || isNull())
+        return 0;
+    return sum(r.left(), r.top(), r.right(), r.bottom());
+}
+
+BoxStats IntegralImage::stats(const QRect &rect) const
+{
+    BoxStats st = { 0, 0, 0 };
+    const QRect r = rect.intersected(QRect(0, 0, width, height));
+    if (r.isEmpty() || isNull())
+        return st;
+    st.count = qint64(r.width()) * r.height();
+    st.mean = double(sum(r.left(), r.top(), r.right(), r.bottom())) / st.count;
+    if (!squares.isEmpty()) {
+        const double meanSq = double(sumOfSquares(r.left(), r.top(), r.right(), r.bottom())) / st.count;
+        st.stddev = qSqrt(qMax(0.0, meanSq - st.mean * st.mean));
+    }
+    return st;
+}
+
+IntegralImage buildIntegralImage(const QImage &src, bool withSquares)
+{
+    IntegralImage t;
+    if (src.isNull())
+        return t;
+    const QImage img = lumaImage(src);
+    const int w = img.width(), h = img.height();
+    const int stride = w + 1;
+    t.width = w;
+    t.height = h;
+    t.sums.resize(qsizetype(stride) * (h + 1));
+    if (withSquares)
+        t.squares.resize(t.sums.size());
+    quint64 *sums = t.sums.data();
+    quint64 *squares = withSquares ? t.squares.data() : nullptr;
+    memset(sums, 0, sizeof(quint64) * stride);
+    if (squares)
+        memset(squares, 0, sizeof(quint64) * stride);
+
+    // Row prefix sums; table row y + 1 belongs to image row y.
+    parallelRows(img.rect(), 64, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const uchar *luma = img.constScanLine(y);
+            quint64 *row = sums + qsizetype(y + 1) * stride;
+            quint64 acc = 0;
+            row[0] = 0;
+            for (int x = 0; x < w; ++x)
+                row[x + 1] = acc += luma[x];
+            if (squares) {
+                row = squares + qsizetype(y + 1) * stride;
+                acc = 0;
+                row[0] = 0;
+                for (int x = 0; x < w; ++x)
+                    row[x + 1] = acc += quint64(luma[x]) * luma[x];
+            }
+        }
+    });
+
+    columnPass(sums, stride, h + 1);
+    if (squares)
+        columnPass(squares, stride, h + 1);
+    return t;
+}
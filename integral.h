@@ -0,0 +1,55 @@
+#ifndef INTEGRAL_H
+#define INTEGRAL_H
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+struct BoxStats
+{
+    qint64 count;
+    double mean;
+    double stddev;
+};
+
+// Summed-area tables of the BT.601 luma and of its square. Entry (x, y) holds the
+// total over all pixels above and left of it, so any box sum costs four lookups.
+struct IntegralImage
+{
+    int width = 0;
+    int height = 0;
+    QVector<quint64> sums;      // (width + 1) x (height + 1), first row and column 0
+    QVector<quint64> squares;   // same layout; empty if not requested
+
+    bool isNull() const { return sums.isEmpty(); }
+
+    // Sum over the box with inclusive corners (x0, y0) and (x1, y1), which must
+    // lie inside the image.
+    quint64 sum(int x0, int y0, int x1, int y1) const
+    {
+        return boxSum(sums, x0, y0, x1, y1);
+    }
+    quint64 sumOfSquares(int x0, int y0, int x1, int y1) const
+    {
+        return boxSum(squares, x0, y0, x1, y1);
+    }
+
+    // rect is clipped to the image first; stddev needs the squares table.
+    quint64 sum(const QRect &rect) const;
+    BoxStats stats(const QRect &rect) const;
+
+private:
+    quint64 boxSum(const QVector<quint64> &t, int x0, int y0, int x1, int y1) const
+    {
+        const qsizetype stride = width + 1;
+        const quint64 *top = t.constData() + y0 * stride;
+        const quint64 *bottom = t.constData() + (y1 + 1) * stride;
+        return bottom[x1 + 1] - bottom[x0] - top[x1 + 1] + top[x0];
+    }
+};
+
+// Builds the tables in two parallel passes: a prefix sum along every row, then
+// one down every column, in strips. withSquares = false skips the second table.
+IntegralImage buildIntegralImage(const QImage &src, bool withSquares = true);
+
+#endif // INTEGRAL_H
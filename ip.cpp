@@ -4,6 +4,25 @@
 #include <QFileDialog>
 #include <QDebug>
 #include <QStatusBar>
+#include <QPainter>
+#include <QInputDialog>
+#include <QMessageBox>
+#include <cmath>
+#include "roi.h"
+#include "compare.h"
+#include "ipxfile.h"
+#include "stack.h"
+#include "streamproc.h"
+#include "threshold.h"
+#include "warp.h"
+
+namespace {
+
+// Shared by every window, so a template picked in one image can be found in
+// the others.
+TemplateMatcher sharedTemplate;
+
+} // namespace
 
 ip::ip(QWidget *parent)
     : QMainWindow(parent)
@@ -14,8 +33,11 @@ ip::ip(QWidget *parent)
     mousePosLabel = new QLabel;
     mousePosLabel->setText(tr(" "));
     mousePosLabel->setFixedWidth (100);
+    statsLabel = new QLabel;
+    statsLabel->setFixedWidth (180);
     statusBar()->addPermanentWidget (statusLabel);
     statusBar()->addPermanentWidget (mousePosLabel);
+    statusBar()->addPermanentWidget (statsLabel);
     setMouseTracking (true);
 
     setWindowTitle (QStringLiteral("影像處理"));
@@ -25,13 +47,27 @@ ip::ip(QWidget *parent)
     imgWin = new QLabel();
     imgWin->setMouseTracking (true);
     QPixmap *initPixmap = new QPixmap(300,200);
-    gWin =new gtransform();
+    // Tool windows are built on first use; most runs never open them.
+    gWin = nullptr;
+    filterWin = nullptr;
+    liveWin = nullptr;
     initPixmap->fill (QColor(255,255,255));
     imgWin->resize (300,200);
     imgWin->setScaledContents (true);
     imgWin->setPixmap (*initPixmap);
     mainLayout->addWidget(imgWin);
     setCentralWidget (central);
+    rubberBand = new QRubberBand (QRubberBand::Rectangle, this);
+    selectedLabel = 0;
+    matchJob = new ImageJob (this);
+    connect (matchJob, SIGNAL (ready(QImage)), this, SLOT (matchReady(QImage)));
+    stackJob = new ImageJob (this);
+    connect (stackJob, SIGNAL (ready(QImage)), this, SLOT (stackReady(QImage)));
+    streamJob = new ImageJob (this);
+    connect (streamJob, SIGNAL (ready(QImage)), this, SLOT (streamReady(QImage)));
+    streamTimer = new QTimer (this);
+    streamTimer->setInterval (200);
+    connect (streamTimer, SIGNAL (timeout()), this, SLOT (streamProgress()));
     createActions();
     createMenus();
     createToolBars();
@@ -68,7 +104,51 @@ void ip::createActions()
     geometryAction->setShortcut (tr("Ctrl+G"));
     geometryAction->setStatusTip (QStringLiteral("影像幾何轉換"));
     connect (geometryAction, SIGNAL (triggered()), this, SLOT (showGeometryTransform()));
-    connect (exitAction, SIGNAL (triggered()),gWin, SLOT (close()));
+
+    filterAction = new QAction (QStringLiteral("濾波工具"),this);
+    filterAction->setShortcut (tr("Ctrl+F"));
+    filterAction->setStatusTip (QStringLiteral("形態學等影像濾波"));
+    connect (filterAction, SIGNAL (triggered()), this, SLOT (showFilterTool()));
+
+    cropAction = new QAction (QStringLiteral("裁切選取區域"),this);
+    cropAction->setShortcut (tr("Ctrl+R"));
+    cropAction->setStatusTip (QStringLiteral("以滑鼠拖曳選取的區域開啟新視窗"));
+    connect (cropAction, SIGNAL (triggered()), this, SLOT (cropRoi()));
+
+    clearRoiAction = new QAction (QStringLiteral("取消選取"),this);
+    clearRoiAction->setStatusTip (QStringLiteral("取消選取區域"));
+    connect (clearRoiAction, SIGNAL (triggered()), this, SLOT (clearRoi()));
+
+    streamAction = new QAction (QStringLiteral("串流處理"),this);
+    streamAction->setStatusTip (QStringLiteral("逐段讀寫檔案, 處理無法整張載入的大型影像"));
+    connect (streamAction, SIGNAL (triggered()), this, SLOT (streamFile()));
+
+    stackAction = new QAction (QStringLiteral("多張疊合"),this);
+    stackAction->setStatusTip (QStringLiteral("將資料夾中已對齊的連拍影像逐像素疊合以降低雜訊"));
+    connect (stackAction, SIGNAL (triggered()), this, SLOT (stackFolder()));
+
+    liveAction = new QAction (QStringLiteral("即時影像"),this);
+    liveAction->setStatusTip (QStringLiteral("從共享記憶體接收連續影像並即時套用處理步驟"));
+    connect (liveAction, SIGNAL (triggered()), this, SLOT (showLiveView()));
+
+    setTemplateAction = new QAction (QStringLiteral("設為樣板"),this);
+    setTemplateAction->setStatusTip (QStringLiteral("以滑鼠拖曳選取的區域作為要尋找的樣板"));
+    connect (setTemplateAction, SIGNAL (triggered()), this, SLOT (setTemplate()));
+
+    findTemplateAction = new QAction (QStringLiteral("尋找樣板"),this);
+    findTemplateAction->setShortcut (tr("Ctrl+M"));
+    findTemplateAction->setStatusTip (QStringLiteral("以正規化互相關在影像中尋找樣板"));
+    connect (findTemplateAction, SIGNAL (triggered()), this, SLOT (findTemplate()));
+
+    compareAction = new QAction (QStringLiteral("比較影像"),this);
+    compareAction->setStatusTip (QStringLiteral("與另一張同尺寸影像比較 PSNR / SSIM, 並顯示差異熱圖"));
+    connect (compareAction, SIGNAL (triggered()), this, SLOT (compareWith()));
+
+    labelAction = new QAction (QStringLiteral("連通區域"),this);
+    labelAction->setShortcut (tr("Ctrl+L"));
+    labelAction->setStatusTip (QStringLiteral("以 Otsu 門檻二值化後標記連通區域, 點選區域查看面積與重心"));
+    labelAction->setCheckable (true);
+    connect (labelAction, SIGNAL (toggled(bool)), this, SLOT (showComponents(bool)));
 }
 void ip::createMenus()
 {
@@ -76,10 +156,20 @@ void ip::createMenus()
     fileMenu->addAction(openFileAction);
     fileMenu->addAction (exitAction);
 
-    fileMenu = menuBar ()->addMenu (QStringLiteral ("工具&T"));
-    fileMenu->addAction(bigFileAction);
-    fileMenu->addAction (sAction);
-    fileMenu->addAction (geometryAction);
+    toolMenu = menuBar ()->addMenu (QStringLiteral ("工具&T"));
+    toolMenu->addAction(bigFileAction);
+    toolMenu->addAction (sAction);
+    toolMenu->addAction (geometryAction);
+    toolMenu->addAction (filterAction);
+    toolMenu->addAction (cropAction);
+    toolMenu->addAction (clearRoiAction);
+    toolMenu->addAction (labelAction);
+    toolMenu->addAction (setTemplateAction);
+    toolMenu->addAction (findTemplateAction);
+    toolMenu->addAction (compareAction);
+    toolMenu->addAction (streamAction);
+    toolMenu->addAction (stackAction);
+    toolMenu->addAction (liveAction);
 }
 void ip::createToolBars ()
 {
@@ -89,34 +179,61 @@ void ip::createToolBars ()
     fileTool->addAction (bigFileAction);
     fileTool->addAction (sAction);
     fileTool->addAction (geometryAction);
+    fileTool->addAction (filterAction);
+    fileTool->addAction (cropAction);
+    fileTool->addAction (labelAction);
 }
-void ip::loadFile (QString filename)
+void ip::loadFile (QString path)
 {
-    qDebug() <<QString("file name: %1").arg(filename);
-    QByteArray ba=filename.toLatin1();
+    qDebug() <<QString("file name: %1").arg(path);
+    QByteArray ba=path.toLatin1();
     printf("FN:%s\n", (char *) ba.data());
-    img.load(filename);
-    imgWin->setPixmap (QPixmap::fromImage(img));
+    if (isIpxFile (path))
+        img = loadIpx (path);
+    else
+        img.load(path);
+    // The geometry window saves JPEG mirrors and turns losslessly from this
+    // file, so it must always name the file img holds.
+    filename = img.isNull() ? QString() : path;
+    roi = QRect();
+    integral = IntegralImage();
+    matches.clear();
+    matchJob->cancel();
+    labelAction->setChecked (false);
+    updateView();
+}
+
+void ip::setImage (const QImage &image)
+{
+    img = image;
+    // No longer the file's pixels, so there is nothing to save losslessly from.
+    filename.clear();
+    roi = QRect();
+    integral = IntegralImage();
+    matches.clear();
+    matchJob->cancel();
+    labelAction->setChecked (false);
+    updateView();
 }
 void ip::showOpenFile()
 {
-    filename = QFileDialog::getOpenFileName(this,
-                                            QStringLiteral("開啟影像"),
-                                            tr("."),
-                                            "bmp(*.bmp);;png(*.png)"
-                                            ";;Jpeg(*.jpg)");
-    if (!filename.isEmpty())
+    QString path = QFileDialog::getOpenFileName(this,
+                                                QStringLiteral("開啟影像"),
+                                                tr("."),
+                                                "bmp(*.bmp);;png(*.png)"
+                                                ";;Jpeg(*.jpg);;ipx(*.ipx)");
+    if (!path.isEmpty())
     {
         if (img.isNull())
         {
-            loadFile(filename);
+            loadFile(path);
         }
         else
         {
             ip *newIPWin
                 = new ip();
             newIPWin->show();
-            newIPWin->loadFile(filename);
+            newIPWin->loadFile(path);
         }
     }
 }
@@ -124,7 +241,8 @@ void ip::showOpenFile()
 void ip::bigsize()
 {
     QImage bigsize;
-    bigsize =img.scaled(img.width()*2,img.width()*2);
+    QImage src = roiImage();
+    bigsize =scaleImage(src, QSize(src.width()*2,src.height()*2));
     QLabel *ret=new QLabel();
     ret->setPixmap(QPixmap::fromImage(bigsize));
     ret->setWindowTitle(tr("放大結果"));
@@ -134,25 +252,374 @@ void ip::bigsize()
 void ip::ssize()
 {
     QImage ssize;
-    ssize =img.scaled(img.width()/2,img.width()/2);
+    QImage src = roiImage();
+    ssize =scaleImage(src, QSize(src.width()/2,src.height()/2));
     QLabel *ret=new QLabel();
     ret->setPixmap(QPixmap::fromImage(ssize));
     ret->setWindowTitle(tr("縮小結果"));
     ret->show();
 }
 
+gtransform *ip::geometryWindow ()
+{
+    if (!gWin) {
+        gWin = new gtransform();
+        connect (exitAction, SIGNAL (triggered()), gWin, SLOT (close()));
+    }
+    return gWin;
+}
+
+imgfilter *ip::filterWindow ()
+{
+    if (!filterWin) {
+        filterWin = new imgfilter();
+        connect (exitAction, SIGNAL (triggered()), filterWin, SLOT (close()));
+        connect (filterWin, SIGNAL (applied(QImage)), this, SLOT (setImage(QImage)));
+    }
+    return filterWin;
+}
+
+liveview *ip::liveWindow ()
+{
+    if (!liveWin) {
+        liveWin = new liveview();
+        connect (exitAction, SIGNAL (triggered()), liveWin, SLOT (close()));
+    }
+    return liveWin;
+}
+
 void ip:: showGeometryTransform()
 {
+    geometryWindow();
     if (!img.isNull())
     gWin->srcImg = img;
+    gWin->dstImg = gWin->srcImg;
+    gWin->ctrlPoints.clear();
+    gWin->srcPath = filename;
+    gWin->hFlipped = gWin->vFlipped = false;
+    gWin->dstAngle = 0;
+    gWin->roi = roi;
+    gWin->roiCheckBox->setEnabled (!roi.isEmpty());
+    gWin->roiCheckBox->setChecked (!roi.isEmpty());
     gWin->inWin->setPixmap (QPixmap:: fromImage (gWin->srcImg));
     gWin->show();
 }
 
+void ip::showFilterTool()
+{
+    if (img.isNull())
+        return;
+    filterWindow();
+    filterWin->setImage (img, roi);
+    filterWin->show();
+}
+
+void ip::showLiveView()
+{
+    liveWindow()->show();
+}
+
+QPoint ip::toImagePos (const QPoint &pos) const
+{
+    // imgWin stretches the image over the whole label.
+    QPoint p = imgWin->mapFrom (this, pos);
+    if (img.isNull() || imgWin->width() <= 0 || imgWin->height() <= 0)
+        return p;
+    return QPoint (p.x() * img.width() / imgWin->width(),
+                   p.y() * img.height() / imgWin->height());
+}
+
+QImage ip::roiImage () const
+{
+    if (roi.isEmpty())
+        return img;
+    return roiView (img, roi);
+}
+
+void ip::updateView ()
+{
+    QPixmap pix = QPixmap::fromImage (img);
+    int penWidth = qMax(1, qMax(img.width(), img.height()) / 400);
+    if (!labeling.isEmpty())
+    {
+        QPainter paint(&pix);
+        paint.setPen (QPen(QColor(0, 255, 0), 0));
+        for (const Component &c : labeling.components)
+            paint.drawRect (c.bounds);
+        if (selectedLabel > 0)
+        {
+            // Tint the selected component's own pixels, not just its box.
+            const Component &c = labeling.components[selectedLabel - 1];
+            BitMask tint (c.bounds.size());
+            for (int y = 0; y < tint.height(); ++y)
+            {
+                const qint32 *l = labeling.labels.constData()
+                                  + qsizetype(c.bounds.y() + y) * labeling.width + c.bounds.x();
+                for (int x = 0; x < tint.width(); ++x)
+                    if (l[x] == selectedLabel)
+                        tint.setBit (x, y);
+            }
+            paint.drawImage (c.bounds.topLeft(), tint.toOverlay (qRgba(255, 0, 0, 128)));
+            paint.setPen (QPen(QColor(255, 0, 0), penWidth));
+            paint.drawRect (c.bounds);
+            int arm = 3 * penWidth;
+            paint.drawLine (c.centroid - QPointF(arm, 0), c.centroid + QPointF(arm, 0));
+            paint.drawLine (c.centroid - QPointF(0, arm), c.centroid + QPointF(0, arm));
+        }
+    }
+    if (!matches.isEmpty())
+    {
+        QPainter paint(&pix);
+        paint.setPen (QPen(QColor(0, 255, 255), penWidth));
+        for (const TemplateMatch &m : matches)
+            paint.drawRect (QRect(m.pos, sharedTemplate.size()));
+    }
+    if (!roi.isEmpty())
+    {
+        QPainter paint(&pix);
+        QPen pen(QColor(255, 255, 0), penWidth, Qt::DashLine);
+        paint.setPen (pen);
+        paint.drawRect (roi);
+    }
+    imgWin->setPixmap (pix);
+}
+
+void ip::showComponents (bool on)
+{
+    selectedLabel = 0;
+    if (!on || img.isNull())
+    {
+        labeling = Labeling();
+        updateView();
+        return;
+    }
+    int level = otsuThreshold (img);
+    labeling = labelComponents (thresholdMask (img, level));
+    updateView();
+    statusBar()->showMessage (QStringLiteral("連通區域: %1 個 (門檻 %2)")
+                                  .arg(labeling.components.size()).arg(level));
+}
+
+void ip::selectComponent (const QPoint &pos)
+{
+    if (labeling.isEmpty())
+        return;
+    const Component *c = labeling.componentAt (pos);
+    selectedLabel = c ? c->label : 0;
+    updateView();
+    if (!c)
+        return;
+    statusBar()->showMessage (QStringLiteral("區域 #%1: 面積 %2, 範圍 (%3,%4) %5x%6, 重心 (%7,%8)")
+                                  .arg(c->label).arg(c->area)
+                                  .arg(c->bounds.x()).arg(c->bounds.y())
+                                  .arg(c->bounds.width()).arg(c->bounds.height())
+                                  .arg(c->centroid.x(), 0, 'f', 1).arg(c->centroid.y(), 0, 'f', 1));
+}
+
+// Built on first use and dropped whenever img changes.
+const IntegralImage &ip::integralTable ()
+{
+    if (integral.isNull() && !img.isNull())
+        integral = buildIntegralImage (img);
+    return integral;
+}
+
+void ip::cropRoi ()
+{
+    if (img.isNull() || roi.isEmpty())
+        return;
+    ip *newIPWin = new ip();
+    newIPWin->show();
+    newIPWin->setImage (roiView (img, roi));
+    newIPWin->setWindowTitle (QStringLiteral("裁切結果"));
+}
+
+void ip::clearRoi ()
+{
+    roi = QRect();
+    rubberBand->hide();
+    updateView();
+    statusBar()->clearMessage();
+}
+
+void ip::streamFile ()
+{
+    if (streamJob->isRunning())
+    {
+        if (QMessageBox::question (this, QStringLiteral("串流處理"), QStringLiteral("取消目前的串流處理?"))
+            != QMessageBox::Yes)
+            return;
+        streamJob->cancel();
+        streamTimer->stop();
+        statusBar()->showMessage (QStringLiteral("已取消串流處理"));
+        return;
+    }
+    QString inName = QFileDialog::getOpenFileName (this, QStringLiteral("選擇來源影像"), ".",
+                                                   "Images (*.ppm *.pgm *.pnm *.bmp *.jpg *.jpeg *.png)");
+    if (inName.isEmpty())
+        return;
+    QString outName = QFileDialog::getSaveFileName (this, QStringLiteral("儲存結果"), ".",
+                                                    "Images (*.ppm *.bmp *.jpg *.png)");
+    if (outName.isEmpty())
+        return;
+    bool ok = false;
+    QString text = QInputDialog::getText (this, QStringLiteral("串流處理"),
+                                          QStringLiteral("處理步驟 (hmirror invert gray gamma:G downscale:N blur:S)"),
+                                          QLineEdit::Normal, "downscale:4", &ok);
+    if (!ok)
+        return;
+    QList<StreamOp> ops;
+    for (const QString &part : text.split(' ', Qt::SkipEmptyParts)) {
+        StreamOp op;
+        if (!parseStreamOp (part, &op)) {
+            QMessageBox::warning (this, QStringLiteral("串流處理"), QStringLiteral("無法辨識的步驟: %1").arg(part));
+            return;
+        }
+        ops.append (op);
+    }
+    QSharedPointer<QString> error (new QString);
+    QSharedPointer<QAtomicInt> percent (new QAtomicInt(0));
+    streamError = error;
+    streamPercent = percent;
+    streamOutName = outName;
+    streamJob->start ([inName, outName, ops, error, percent]() {
+        bool done = streamProcess (inName, outName, ops, 64, error.data(), [percent](int rows, int total) {
+            percent->storeRelaxed (int(qint64(rows) * 100 / total));
+        });
+        // The result is on disk; a non-null image only reports success.
+        return done ? QImage(1, 1, QImage::Format_Grayscale8) : QImage();
+    }, PriorityBatch);
+    streamTimer->start();
+    streamProgress();
+}
+
+void ip::streamProgress ()
+{
+    if (!streamJob->isRunning())
+    {
+        streamTimer->stop();
+        return;
+    }
+    statusBar()->showMessage (QStringLiteral("串流處理中... %1% (再選一次「串流處理」可取消)")
+                                  .arg(streamPercent->loadRelaxed()));
+}
+
+void ip::streamReady (const QImage &done)
+{
+    streamTimer->stop();
+    statusBar()->clearMessage();
+    if (done.isNull()) {
+        QMessageBox::warning (this, QStringLiteral("串流處理"), *streamError);
+        return;
+    }
+    statusBar()->showMessage (QStringLiteral("已寫入 %1").arg(streamOutName));
+}
+
+void ip::stackFolder ()
+{
+    QString dir = QFileDialog::getExistingDirectory (this, QStringLiteral("選擇連拍影像資料夾"), ".");
+    if (dir.isEmpty())
+        return;
+    QStringList files = stackFrameFiles (dir);
+    if (files.size() < 2) {
+        QMessageBox::warning (this, QStringLiteral("多張疊合"), QStringLiteral("資料夾中至少需要兩張影像"));
+        return;
+    }
+    static const StackMode modes[] = { StackMean, StackSigmaClip, StackMedian, StackMin, StackMax };
+    QStringList names;
+    names << QStringLiteral("平均") << QStringLiteral("σ 裁剪平均") << QStringLiteral("中值")
+          << QStringLiteral("最小值") << QStringLiteral("最大值");
+    bool ok = false;
+    QString name = QInputDialog::getItem (this, QStringLiteral("多張疊合"),
+                                          QStringLiteral("%1 張影像, 疊合方式").arg(files.size()),
+                                          names, 1, false, &ok);
+    if (!ok)
+        return;
+    StackMode mode = modes[names.indexOf (name)];
+    QSharedPointer<QString> error (new QString);
+    stackError = error;
+    stackJob->start ([files, mode, error]() {
+        return stackFrames (files, mode, 2.5, qsizetype(512) << 20, error.data());
+    }, PriorityBatch);
+    statusBar()->showMessage (QStringLiteral("疊合 %1 張影像中...").arg(files.size()));
+}
+
+void ip::stackReady (const QImage &image)
+{
+    statusBar()->clearMessage();
+    if (image.isNull()) {
+        QMessageBox::warning (this, QStringLiteral("多張疊合"), *stackError);
+        return;
+    }
+    if (img.isNull()) {
+        setImage (image);
+        return;
+    }
+    ip *newIPWin = new ip();
+    newIPWin->show();
+    newIPWin->setImage (image);
+    newIPWin->setWindowTitle (QStringLiteral("疊合結果"));
+}
+
+void ip::setTemplate ()
+{
+    if (img.isNull() || roi.isEmpty())
+    {
+        statusBar()->showMessage (QStringLiteral("請先拖曳選取樣板區域"));
+        return;
+    }
+    sharedTemplate = TemplateMatcher (roiImage());
+    if (!sharedTemplate.isValid())
+    {
+        statusBar()->showMessage (QStringLiteral("選取區域沒有明暗變化, 無法作為樣板"));
+        return;
+    }
+    statusBar()->showMessage (QStringLiteral("樣板 %1x%2").arg(roi.width()).arg(roi.height()));
+}
+
+void ip::findTemplate ()
+{
+    if (img.isNull())
+        return;
+    if (!sharedTemplate.isValid())
+    {
+        statusBar()->showMessage (QStringLiteral("請先選取區域並設為樣板"));
+        return;
+    }
+    // The search runs on a copy of the image and template; opening another
+    // image cancels it, so the matches always belong to what is shown.
+    QSharedPointer<QVector<TemplateMatch>> found (new QVector<TemplateMatch>);
+    foundMatches = found;
+    const TemplateMatcher templ = sharedTemplate;
+    const QImage searched = img;
+    matchJob->start ([templ, searched, found]() {
+        *found = templ.find (searched, 20, 0.8);
+        return searched;
+    });
+    statusBar()->showMessage (QStringLiteral("尋找樣板中..."));
+}
+
+void ip::matchReady (const QImage &)
+{
+    matches = *foundMatches;
+    updateView();
+    if (matches.isEmpty())
+    {
+        statusBar()->showMessage (QStringLiteral("找不到樣板"));
+        return;
+    }
+    statusBar()->showMessage (QStringLiteral("找到 %1 處, 最佳 (%2,%3) 相關係數 %4")
+                                  .arg(matches.size()).arg(matches[0].pos.x()).arg(matches[0].pos.y())
+                                  .arg(matches[0].score, 0, 'f', 3));
+}
+
 void ip::mouseMoveEvent (QMouseEvent *event)
 {
-    int x=event->x();
-    int y=event->y();
+    if ((event->buttons() & Qt::LeftButton) && rubberBand->isVisible())
+        rubberBand->setGeometry (QRect(dragStart, event->pos()).normalized());
+    QPoint pos = toImagePos (event->pos());
+    int x=pos.x();
+    int y=pos.y();
     QString str = "("+ QString::number(x) + "," +
                   QString::number (y) +")";
     if (!img.isNull() && x >= 0 && x < img.width() && y >= 0 && y < img.height())
@@ -160,7 +627,12 @@ void ip::mouseMoveEvent (QMouseEvent *event)
         QColor color = img.pixelColor(x, y);
         int grayValue = (color.red() + color.green() + color.blue()) / 3;
         str += " = " + QString::number(grayValue);
+        BoxStats st = integralTable().stats (QRect(x - 3, y - 3, 7, 7));
+        statsLabel->setText (QStringLiteral("7x7 平均 %1 標準差 %2")
+                                 .arg(st.mean, 0, 'f', 1).arg(st.stddev, 0, 'f', 1));
     }
+    else
+        statsLabel->clear();
     mousePosLabel->setText(str);
 }
 void ip::mousePressEvent (QMouseEvent *event)
@@ -170,6 +642,12 @@ void ip::mousePressEvent (QMouseEvent *event)
     if (event->button() == Qt::LeftButton)
     {
         statusBar()->showMessage (QStringLiteral("左鍵:")+str);
+        if (imgWin->rect().contains (imgWin->mapFrom (this, event->pos())))
+        {
+            dragStart = event->pos();
+            rubberBand->setGeometry (QRect(dragStart, QSize()));
+            rubberBand->show();
+        }
     }
     else if (event->button()== Qt::RightButton)
     {
@@ -186,4 +664,53 @@ void ip::mouseReleaseEvent (QMouseEvent *event)
     QString str = "(" + QString::number (event->x()) + "," +
                   QString::number (event->y()) +")";
     statusBar ()->showMessage (QStringLiteral("釋放:")+str);
+    if (event->button() != Qt::LeftButton || !rubberBand->isVisible())
+        return;
+    rubberBand->hide();
+    if (img.isNull())
+        return;
+    if ((event->pos() - dragStart).manhattanLength() < 4)
+    {
+        // A click rather than a drag picks the component under the pointer.
+        selectComponent (toImagePos (event->pos()));
+        return;
+    }
+    roi = QRect (toImagePos (dragStart), toImagePos (event->pos()))
+              .normalized().intersected (img.rect());
+    updateView();
+    BoxStats st = integralTable().stats (roi);
+    statusBar ()->showMessage (QStringLiteral("選取區域:") +
+                               QString("(%1,%2) %3x%4").arg(roi.x()).arg(roi.y())
+                                                       .arg(roi.width()).arg(roi.height()) +
+                               QStringLiteral(" 平均 %1 標準差 %2")
+                                   .arg(st.mean, 0, 'f', 1).arg(st.stddev, 0, 'f', 1));
+}
+
+void ip::compareWith ()
+{
+    if (img.isNull())
+        return;
+    QString other = QFileDialog::getOpenFileName (this, QStringLiteral("選擇比較影像"), ".",
+                                                  "bmp(*.bmp);;png(*.png);;Jpeg(*.jpg);;ipx(*.ipx)");
+    if (other.isEmpty())
+        return;
+    QImage ref = isIpxFile (other) ? loadIpx (other) : QImage (other);
+    ImageComparison result;
+    QImage heat;
+    QString error;
+    if (ref.isNull() || !compareImages (img, ref, &result, &heat, &error)) {
+        QMessageBox::warning (this, QStringLiteral("比較影像"),
+                              ref.isNull() ? QStringLiteral("無法讀取 %1").arg(other) : error);
+        return;
+    }
+    QString psnr = std::isinf (result.psnr) ? QStringLiteral("∞")
+                                            : QString::number (result.psnr, 'f', 2);
+    QString summary = QStringLiteral("PSNR %1 dB, SSIM %2, 最大誤差 %3, 相異像素 %4")
+                          .arg(psnr).arg(result.ssim, 0, 'f', 4)
+                          .arg(result.maxError).arg(result.differingPixels);
+    statusBar()->showMessage (summary);
+    ip *newIPWin = new ip();
+    newIPWin->show();
+    newIPWin->setImage (heat);
+    newIPWin->setWindowTitle (QStringLiteral("差異熱圖 - %1").arg(summary));
 }
@@ -8,7 +8,15 @@
 #include <QImage>
 #include <QLabel>
 #include "gtransform.h"
+#include "imgfilter.h"
+#include "liveview.h"
+#include "ccl.h"
+#include "integral.h"
+#include "match.h"
 #include <QMouseEvent>
+#include <QRubberBand>
+#include <QSharedPointer>
+#include <QTimer>
 
 
 class ip : public QMainWindow
@@ -21,7 +29,10 @@ public:
     void createActions();
     void createMenus();
     void createToolBars();
-    void loadFile (QString filename);
+    void loadFile (QString path);
+
+public slots:
+    void setImage (const QImage &image);
 
 protected:
     void mouseMoveEvent(QMouseEvent *event) override;
@@ -33,24 +44,77 @@ private slots:
     void bigsize();
     void ssize();
     void showGeometryTransform();
+    void showFilterTool();
+    void showLiveView();
+    void cropRoi();
+    void clearRoi();
+    void streamFile();
+    void streamProgress();
+    void streamReady(const QImage &done);
+    void stackFolder();
+    void stackReady(const QImage &image);
+    void setTemplate();
+    void findTemplate();
+    void matchReady(const QImage &searched);
+    void compareWith();
+    void showComponents(bool on);
 
 private:
+    QPoint toImagePos (const QPoint &pos) const;
+    QImage roiImage () const;
+    void updateView ();
+    void selectComponent (const QPoint &pos);
+    const IntegralImage &integralTable ();
+    gtransform *geometryWindow ();
+    imgfilter *filterWindow ();
+    liveview *liveWindow ();
+
     gtransform *gWin;
+    imgfilter *filterWin;
+    liveview *liveWin;
     QWidget *central;
     QMenu *fileMenu;
+    QMenu *toolMenu;
     QToolBar *fileTool;
     QImage img;
     QString filename;
     QLabel *imgWin;
+    QRubberBand *rubberBand;
+    QPoint dragStart;
+    QRect roi;
+    Labeling labeling;
+    int selectedLabel;
+    IntegralImage integral;
+    QVector<TemplateMatch> matches;
+    ImageJob *matchJob;
+    QSharedPointer<QVector<TemplateMatch>> foundMatches;
+    ImageJob *stackJob;
+    QSharedPointer<QString> stackError;
+    ImageJob *streamJob;
+    QSharedPointer<QString> streamError;
+    QSharedPointer<QAtomicInt> streamPercent;
+    QString streamOutName;
+    QTimer *streamTimer;
 
     QLabel *statusLabel;
     QLabel *mousePosLabel;
+    QLabel *statsLabel;
 
     QAction *openFileAction;
     QAction *exitAction;
     QAction *bigFileAction;
     QAction *sAction;
     QAction *geometryAction;
+    QAction *filterAction;
+    QAction *cropAction;
+    QAction *clearRoiAction;
+    QAction *streamAction;
+    QAction *stackAction;
+    QAction *liveAction;
+    QAction *setTemplateAction;
+    QAction *findTemplateAction;
+    QAction *compareAction;
+    QAction *labelAction;
 
 };
 #endif // IP_H
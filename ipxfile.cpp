@@ -0,0 +1,459 @@
+#include "ipxfile.h"
+#include "scheduler.h"
+#include <QSaveFile>
+#include <QtEndian>
+#include <cstring>
+
+namespace {
+
+const char Magic[4] = { 'I', 'P', 'X', '1' };
+const int Version = 1;
+const int HeaderSize = 24;
+const int EntrySize = 16;
+const int DefaultTile = 256;
+// Tiles encoded before they are written out, per worker.
+const int TilesPerBatch = 4;
+
+enum TileCodec { CodecRaw, CodecQoi };
+
+enum QoiOp {
+    OpIndex = 0x00, OpDiff = 0x40, OpLuma = 0x80, OpRun = 0xc0,
+    OpRgb = 0xfe, OpRgba = 0xff, OpMask = 0xc0
+};
+
+inline int qoiHash(QRgb p)
+{
+    return (qRed(p) * 3 + qGreen(p) * 5 + qBlue(p) * 7 + qAlpha(p) * 11) & 63;
+}
+
+QImage::Format formatFor(int channels)
+{
+    return channels == 1 ? QImage::Format_Grayscale8
+         : channels == 3 ? QImage::Format_RGB32 : QImage::Format_ARGB32;
+}
+
+inline QRgb loadPixel(const uchar *row, int x, int channels)
+{
+    if (channels == 1)
+        return qRgb(row[x], row[x], row[x]);
+    const QRgb p = reinterpret_cast<const QRgb *>(row)[x];
+    return channels == 3 ? p | 0xff000000u : p;
+}
+
+inline void storePixel(uchar *row, int x, int channels, QRgb p)
+{
+    if (channels == 1)
+        row[x] = uchar(qRed(p));
+    else
+        reinterpret_cast<QRgb *>(row)[x] = p;
+}
+
+// A w x h tile starting at src; raw if the QOI ops do not make it smaller.
+QByteArray encodeTile(const uchar *src, qsizetype bpl, int w, int h, int channels, quint32 *codec)
+{
+    const qsizetype rawSize = qsizetype(w) * h * channels;
+    QByteArray out(qsizetype(w) * h * 5 + 1, Qt::Uninitialized);
+    uchar *d = reinterpret_cast<uchar *>(out.data());
+    uchar *const begin = d;
+    QRgb cache[64] = {};
+    QRgb prev = 0xff000000u;
+    int run = 0;
+    for (int y = 0; y < h && d - begin < rawSize; ++y) {
+        const uchar *row = src + y * bpl;
+        for (int x = 0; x < w; ++x) {
+            const QRgb p = loadPixel(row, x, channels);
+            if (p == prev) {
+                if (++run == 62) {
+                    *d++ = uchar(OpRun | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run) {
+                *d++ = uchar(OpRun | (run - 1));
+                run = 0;
+            }
+            const int hash = qoiHash(p);
+            if (cache[hash] == p) {
+                *d++ = uchar(OpIndex | hash);
+            } else {
+                cache[hash] = p;
+                if (qAlpha(p) == qAlpha(prev)) {
+                    const int dr = qRed(p) - qRed(prev);
+                    const int dg = qGreen(p) - qGreen(prev);
+                    const int db = qBlue(p) - qBlue(prev);
+                    const int dgr = dr - dg, dgb = db - dg;
+                    if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                        *d++ = uchar(OpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+                    } else if (dg >= -32 && dg <= 31 && dgr >= -8 && dgr <= 7 && dgb >= -8 && dgb <= 7) {
+                        *d++ = uchar(OpLuma | (dg + 32));
+                        *d++ = uchar((dgr + 8) << 4 | (dgb + 8));
+                    } else {
+                        *d++ = OpRgb;
+                        *d++ = uchar(qRed(p));
+                        *d++ = uchar(qGreen(p));
+                        *d++ = uchar(qBlue(p));
+                    }
+                } else {
+                    *d++ = OpRgba;
+                    *d++ = uchar(qRed(p));
+                    *d++ = uchar(qGreen(p));
+                    *d++ = uchar(qBlue(p));
+                    *d++ = uchar(qAlpha(p));
+                }
+            }
+            prev = p;
+        }
+    }
+    if (run)
+        *d++ = uchar(OpRun | (run - 1));
+
+    if (d - begin < rawSize) {
+        out.truncate(d - begin);
+        *codec = CodecQoi;
+        return out;
+    }
+    // Raw: gray bytes, or R G B (A) per pixel.
+    out.resize(rawSize);
+    d = reinterpret_cast<uchar *>(out.data());
+    for (int y = 0; y < h; ++y) {
+        const uchar *row = src + y * bpl;
+        if (channels == 1) {
+            memcpy(d, row, w);
+            d += w;
+            continue;
+        }
+        for (int x = 0; x < w; ++x) {
+            const QRgb p = loadPixel(row, x, channels);
+            *d++ = uchar(qRed(p));
+            *d++ = uchar(qGreen(p));
+            *d++ = uchar(qBlue(p));
+            if (channels == 4)
+                *d++ = uchar(qAlpha(p));
+        }
+    }
+    *codec = CodecRaw;
+    return out;
+}
+
+// Decodes one tile into dst; false if the data is truncated or malformed.
+bool decodeTile(const uchar *data, qsizetype length, quint32 codec, int channels,
+                uchar *dst, qsizetype bpl, int w, int h)
+{
+    const uchar *p = data, *const end = data + length;
+    if (codec == CodecRaw) {
+        if (length != qsizetype(w) * h * channels)
+            return false;
+        for (int y = 0; y < h; ++y) {
+            uchar *row = dst + y * bpl;
+            if (channels == 1) {
+                memcpy(row, p, w);
+                p += w;
+                continue;
+            }
+            for (int x = 0; x < w; ++x, p += channels)
+                storePixel(row, x, channels,
+                           qRgba(p[0], p[1], p[2], channels == 4 ? p[3] : 255));
+        }
+        return true;
+    }
+    if (codec != CodecQoi)
+        return false;
+
+    QRgb cache[64] = {};
+    QRgb px = 0xff000000u;
+    int run = 0;
+    for (int y = 0; y < h; ++y) {
+        uchar *row = dst + y * bpl;
+        for (int x = 0; x < w; ++x) {
+            if (run) {
+                --run;
+            } else {
+                if (p >= end)
+                    return false;
+                const int op = *p++;
+                if (op == OpRgb || op == OpRgba) {
+                    const int n = op == OpRgb ? 3 : 4;
+                    if (end - p < n)
+                        return false;
+                    px = qRgba(p[0], p[1], p[2], n == 4 ? p[3] : qAlpha(px));
+                    p += n;
+                } else {
+                    switch (op & OpMask) {
+                    case OpIndex:
+                        px = cache[op];
+                        break;
+                    case OpDiff:
+                        px = qRgba((qRed(px) + ((op >> 4) & 3) - 2) & 255,
+                                   (qGreen(px) + ((op >> 2) & 3) - 2) & 255,
+                                   (qBlue(px) + (op & 3) - 2) & 255, qAlpha(px));
+                        break;
+                    case OpLuma: {
+                        if (p >= end)
+                            return false;
+                        const int dg = (op & 63) - 32;
+                        const int b = *p++;
+                        px = qRgba((qRed(px) + dg + (b >> 4) - 8) & 255, (qGreen(px) + dg) & 255,
+                                   (qBlue(px) + dg + (b & 15) - 8) & 255, qAlpha(px));
+                        break;
+                    }
+                    default:
+                        run = op & 63;
+                        break;
+                    }
+                }
+                cache[qoiHash(px)] = px;
+            }
+            storePixel(row, x, channels, px);
+        }
+    }
+    return p == end;
+}
+
+void setError(QString *error, const QString &message)
+{
+    if (error)
+        *error = message;
+}
+
+struct Header
+{
+    int channels, width, height, tile, tiles;
+};
+
+bool parseHeader(const uchar *h, qint64 fileSize, Header *header)
+{
+    if (memcmp(h, Magic, 4) != 0 || qFromLittleEndian<quint16>(h + 4) != Version)
+        return false;
+    header->channels = h[6];
+    header->width = int(qFromLittleEndian<quint32>(h + 8));
+    header->height = int(qFromLittleEndian<quint32>(h + 12));
+    header->tile = qFromLittleEndian<quint16>(h + 16);
+    header->tiles = int(qFromLittleEndian<quint32>(h + 20));
+    if ((header->channels != 1 && header->channels != 3 && header->channels != 4)
+        || header->width <= 0 || header->height <= 0 || header->tile <= 0)
+        return false;
+    const qint64 tilesX = (qint64(header->width) + header->tile - 1) / header->tile;
+    const qint64 tilesY = (qint64(header->height) + header->tile - 1) / header->tile;
+    return header->tiles == tilesX * tilesY
+        && HeaderSize + qint64(header->tiles) * EntrySize <= fileSize;
+}
+
+QRect tileRectOf(const Header &h, int index)
+{
+    const int tilesX = (h.width + h.tile - 1) / h.tile;
+    const QRect r((index % tilesX) * h.tile, (index / tilesX) * h.tile, h.tile, h.tile);
+    return r.intersected(QRect(0, 0, h.width, h.height));
+}
+
+} // namespace
+
+bool isIpxFile(const QString &path)
+{
+    QFile f(path);
+    char magic[4];
+    return f.open(QIODevice::ReadOnly) && f.read(magic, 4) == 4 && memcmp(magic, Magic, 4) == 0;
+}
+
+bool saveIpx(const QImage &image, const QString &path, QString *error)
+{
+    if (image.isNull()) {
+        setError(error, QStringLiteral("empty image"));
+        return false;
+    }
+    const int channels = image.format() == QImage::Format_Grayscale8 ? 1
+                       : image.hasAlphaChannel() ? 4 : 3;
+    const QImage img = image.convertToFormat(formatFor(channels));
+    Header h = { channels, img.width(), img.height(), DefaultTile, 0 };
+    const int tilesX = (h.width + h.tile - 1) / h.tile;
+    h.tiles = tilesX * ((h.height + h.tile - 1) / h.tile);
+
+    uchar header[HeaderSize] = {};
+    memcpy(header, Magic, 4);
+    qToLittleEndian<quint16>(Version, header + 4);
+    header[6] = uchar(channels);
+    qToLittleEndian<quint32>(h.width, header + 8);
+    qToLittleEndian<quint32>(h.height, header + 12);
+    qToLittleEndian<quint16>(h.tile, header + 16);
+    qToLittleEndian<quint32>(h.tiles, header + 20);
+    QByteArray entries(qsizetype(h.tiles) * EntrySize, '\0');
+
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly)
+        || out.write(reinterpret_cast<const char *>(header), HeaderSize) != HeaderSize
+        || out.write(entries) != entries.size()) {
+        setError(error, out.errorString());
+        return false;
+    }
+
+    // Tiles are encoded a batch at a time so only a few are held in memory;
+    // the index is filled in once their offsets are known.
+    const uchar *bits = img.constBits();
+    const qsizetype bpl = img.bytesPerLine();
+    const int bytesPerPixel = channels == 1 ? 1 : 4;
+    const int batch = TilesPerBatch * (TaskScheduler::instance().workerCount() + 1);
+    QVector<QByteArray> blobs(batch);
+    QVector<quint32> codecs(batch);
+    quint64 offset = HeaderSize + quint64(entries.size());
+    uchar *entry = reinterpret_cast<uchar *>(entries.data());
+    for (int first = 0; first < h.tiles; first += batch) {
+        const int count = qMin(batch, h.tiles - first);
+        TaskScheduler::instance().run(count, [&](int i) {
+            const QRect r = tileRectOf(h, first + i);
+            blobs[i] = encodeTile(bits + r.top() * bpl + r.left() * bytesPerPixel, bpl,
+                                  r.width(), r.height(), channels, &codecs[i]);
+        });
+        for (int i = 0; i < count; ++i) {
+            if (out.write(blobs[i]) != blobs[i].size()) {
+                setError(error, out.errorString());
+                out.cancelWriting();
+                return false;
+            }
+            uchar *e = entry + qsizetype(first + i) * EntrySize;
+            qToLittleEndian<quint64>(offset, e);
+            qToLittleEndian<quint32>(quint32(blobs[i].size()), e + 8);
+            qToLittleEndian<quint32>(codecs[i], e + 12);
+            offset += blobs[i].size();
+        }
+    }
+    if (!out.seek(HeaderSize) || out.write(entries) != entries.size() || !out.commit()) {
+        setError(error, out.errorString());
+        return false;
+    }
+    return true;
+}
+
+QImage loadIpx(const QString &path, QString *error)
+{
+    QFile in(path);
+    if (!in.open(QIODevice::ReadOnly)) {
+        setError(error, in.errorString());
+        return QImage();
+    }
+    const QByteArray data = in.readAll();
+    const uchar *base = reinterpret_cast<const uchar *>(data.constData());
+    Header h;
+    if (data.size() < HeaderSize || !parseHeader(base, data.size(), &h)) {
+        setError(error, QStringLiteral("not an IPX file"));
+        return QImage();
+    }
+    QImage img(h.width, h.height, formatFor(h.channels));
+    if (img.isNull()) {
+        setError(error, QStringLiteral("image too large"));
+        return QImage();
+    }
+    uchar *bits = img.bits();
+    const qsizetype bpl = img.bytesPerLine();
+    const int bytesPerPixel = h.channels == 1 ? 1 : 4;
+    QAtomicInt failed(0);
+    TaskScheduler::instance().run(h.tiles, [&](int i) {
+        const uchar *e = base + HeaderSize + qsizetype(i) * EntrySize;
+        const quint64 offset = qFromLittleEndian<quint64>(e);
+        const quint32 length = qFromLittleEndian<quint32>(e + 8);
+        const QRect r = tileRectOf(h, i);
+        if (offset > quint64(data.size()) || length > quint64(data.size()) - offset
+            || !decodeTile(base + offset, length, qFromLittleEndian<quint32>(e + 12), h.channels,
+                           bits + r.top() * bpl + r.left() * bytesPerPixel, bpl,
+                           r.width(), r.height()))
+            failed.storeRelaxed(1);
+    });
+    if (failed.loadRelaxed()) {
+        setError(error, QStringLiteral("corrupt IPX tile data"));
+        return QImage();
+    }
+    return img;
+}
+
+bool IpxReader::open(const QString &path, QString *error)
+{
+    close();
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        setError(error, file.errorString());
+        return false;
+    }
+    uchar header[HeaderSize];
+    Header h;
+    if (file.read(reinterpret_cast<char *>(header), HeaderSize) != HeaderSize
+        || !parseHeader(header, file.size(), &h)) {
+        setError(error, QStringLiteral("not an IPX file"));
+        close();
+        return false;
+    }
+    QByteArray entries = file.read(qint64(h.tiles) * EntrySize);
+    if (entries.size() != qsizetype(h.tiles) * EntrySize) {
+        setError(error, QStringLiteral("truncated IPX index"));
+        close();
+        return false;
+    }
+    index.resize(h.tiles);
+    for (int i = 0; i < h.tiles; ++i) {
+        const uchar *e = reinterpret_cast<const uchar *>(entries.constData()) + qsizetype(i) * EntrySize;
+        index[i] = Entry{ qFromLittleEndian<quint64>(e), qFromLittleEndian<quint32>(e + 8),
+                          qFromLittleEndian<quint32>(e + 12) };
+    }
+    width = h.width;
+    height = h.height;
+    channels = h.channels;
+    tile = h.tile;
+    return true;
+}
+
+void IpxReader::close()
+{
+    file.close();
+    width = height = channels = tile = 0;
+    index.clear();
+}
+
+QRect IpxReader::tileRect(int tx, int ty) const
+{
+    return QRect(tx * tile, ty * tile, tile, tile).intersected(QRect(0, 0, width, height));
+}
+
+bool IpxReader::readEntry(int i, QByteArray *data)
+{
+    const Entry &e = index[i];
+    if (!file.seek(qint64(e.offset)))
+        return false;
+    *data = file.read(e.length);
+    return data->size() == qsizetype(e.length);
+}
+
+QImage IpxReader::readTile(int tx, int ty)
+{
+    if (tx < 0 || ty < 0 || tx >= tilesX() || ty >= tilesY())
+        return QImage();
+    const int i = ty * tilesX() + tx;
+    const QRect r = tileRect(tx, ty);
+    QByteArray data;
+    QImage img(r.size(), formatFor(channels));
+    if (!readEntry(i, &data)
+        || !decodeTile(reinterpret_cast<const uchar *>(data.constData()), data.size(),
+                       index[i].codec, channels, img.bits(), img.bytesPerLine(),
+                       r.width(), r.height()))
+        return QImage();
+    return img;
+}
+
+QImage IpxReader::read(const QRect &rect)
+{
+    const QRect area = rect.intersected(QRect(0, 0, width, height));
+    if (area.isEmpty())
+        return QImage();
+    QImage out(area.size(), formatFor(channels));
+    const int bytesPerPixel = channels == 1 ? 1 : 4;
+    for (int ty = area.top() / tile; ty <= area.bottom() / tile; ++ty)
+        for (int tx = area.left() / tile; tx <= area.right() / tile; ++tx) {
+            const QImage t = readTile(tx, ty);
+            if (t.isNull())
+                return QImage();
+            const QRect r = tileRect(tx, ty).intersected(area);
+            const QPoint from = r.topLeft() - tileRect(tx, ty).topLeft();
+            for (int y = 0; y < r.height(); ++y)
+                memcpy(out.scanLine(r.top() - area.top() + y) + (r.left() - area.left()) * bytesPerPixel,
+                       t.constScanLine(from.y() + y) + from.x() * bytesPerPixel,
+                       size_t(r.width()) * bytesPerPixel);
+        }
+    return out;
+}
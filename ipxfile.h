@@ -0,0 +1,57 @@
+#ifndef IPXFILE_H
+#define IPXFILE_H
+
+#include <QFile>
+#include <QImage>
+#include <QRect>
+#include <QString>
+#include <QVector>
+
+// IPX is the native lossless scratch format for intermediate results. The
+// image is cut into square tiles that are coded independently, QOI style
+// (pixel cache, small deltas and runs; raw when that does not pay off), so
+// tiles are encoded and decoded in parallel and any one of them can be read
+// on its own through the index after the header:
+//
+//   "IPX1"  u16 version  u8 channels (1 gray, 3 RGB, 4 RGBA)  u8 0
+//   u32 width  u32 height  u16 tile size  u16 0  u32 tile count
+//   tile count x { u64 offset  u32 length  u32 codec }
+//   tile data, tiles in row-major order
+//
+// All numbers are little endian.
+
+bool isIpxFile(const QString &path);
+
+// Grayscale8 stays one channel, images without alpha three, the rest four.
+bool saveIpx(const QImage &image, const QString &path, QString *error = nullptr);
+QImage loadIpx(const QString &path, QString *error = nullptr);
+
+// Random access to the tiles of an IPX file without decoding the rest.
+class IpxReader
+{
+public:
+    bool open(const QString &path, QString *error = nullptr);
+    void close();
+
+    QSize size() const { return QSize(width, height); }
+    int channelCount() const { return channels; }
+    int tileSize() const { return tile; }
+    int tilesX() const { return tile ? (width + tile - 1) / tile : 0; }
+    int tilesY() const { return tile ? (height + tile - 1) / tile : 0; }
+    QRect tileRect(int tx, int ty) const;
+
+    QImage readTile(int tx, int ty);
+    // rect of the image, decoding only the tiles it touches.
+    QImage read(const QRect &rect);
+
+private:
+    struct Entry { quint64 offset; quint32 length, codec; };
+
+    bool readEntry(int index, QByteArray *data);
+
+    QFile file;
+    int width = 0, height = 0, channels = 0, tile = 0;
+    QVector<Entry> index;
+};
+
+#endif // IPXFILE_H
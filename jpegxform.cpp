@@ -0,0 +1,290 @@
+#include "jpegxform.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QVector>
+
+JpegXform jpegXformFor(bool hFlip, bool vFlip, int angle)
+{
+    angle %= 360;
+    if (angle < 0)
+        angle += 360;
+    if (angle % 90 != 0)
+        return JpegInvalid;
+
+    // 2x2 integer matrix of the mirror, then one clockwise quarter turn at a time.
+    int a = hFlip ? -1 : 1, b = 0, c = 0, d = vFlip ? -1 : 1;
+    for (int k = 0; k < angle / 90; ++k) {
+        int na = -c, nb = -d, nc = a, nd = b;
+        a = na; b = nb; c = nc; d = nd;
+    }
+
+    static const struct { int a, b, c, d; JpegXform xform; } table[] = {
+        {  1,  0,  0,  1, JpegNone },
+        { -1,  0,  0,  1, JpegFlipH },
+        {  1,  0,  0, -1, JpegFlipV },
+        {  0,  1,  1,  0, JpegTranspose },
+        {  0, -1, -1,  0, JpegTransverse },
+        {  0, -1,  1,  0, JpegRot90 },
+        { -1,  0,  0, -1, JpegRot180 },
+        {  0,  1, -1,  0, JpegRot270 },
+    };
+    for (const auto &t : table)
+        if (t.a == a && t.b == b && t.c == c && t.d == d)
+            return t.xform;
+    return JpegInvalid;
+}
+
+bool isJpegFile(const QString &path)
+{
+    const QString suffix = QFileInfo(path).suffix().toLower();
+    return suffix == "jpg" || suffix == "jpeg" || suffix == "jpe";
+}
+
+#ifdef HAVE_LIBJPEG
+
+#include <cstdio>
+#include <csetjmp>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <jpeglib.h>
+
+namespace {
+
+struct ErrorMgr
+{
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+void errorExit(j_common_ptr cinfo)
+{
+    ErrorMgr *err = reinterpret_cast<ErrorMgr *>(cinfo->err);
+    (*cinfo->err->format_message)(cinfo, err->message);
+    longjmp(err->jump, 1);
+}
+
+void silentMessage(j_common_ptr, int)
+{
+}
+
+// How the output block grid relates to the source one: optionally transpose,
+// then reverse the output x and/or y axis.
+struct BlockMap
+{
+    bool transpose;
+    bool flipX;
+    bool flipY;
+};
+
+BlockMap blockMapFor(JpegXform xform)
+{
+    switch (xform) {
+    case JpegFlipH:      return { false, true,  false };
+    case JpegFlipV:      return { false, false, true  };
+    case JpegRot180:     return { false, true,  true  };
+    case JpegTranspose:  return { true,  false, false };
+    case JpegRot90:      return { true,  true,  false };
+    case JpegRot270:     return { true,  false, true  };
+    case JpegTransverse: return { true,  true,  true  };
+    default:             return { false, false, false };
+    }
+}
+
+void transposeQuantTables(j_compress_ptr dst)
+{
+    for (int i = 0; i < NUM_QUANT_TBLS; ++i) {
+        JQUANT_TBL *q = dst->quant_tbl_ptrs[i];
+        if (!q)
+            continue;
+        for (int r = 0; r < DCTSIZE; ++r)
+            for (int c = r + 1; c < DCTSIZE; ++c)
+                std::swap(q->quantval[r * DCTSIZE + c], q->quantval[c * DCTSIZE + r]);
+    }
+}
+
+void copyMarkers(j_decompress_ptr src, j_compress_ptr dst)
+{
+    for (jpeg_saved_marker_ptr m = src->marker_list; m; m = m->next) {
+        // The compressor writes its own JFIF and Adobe headers.
+        if (dst->write_JFIF_header && m->marker == JPEG_APP0 && m->data_length >= 5
+            && memcmp(m->data, "JFIF", 5) == 0)
+            continue;
+        if (dst->write_Adobe_marker && m->marker == JPEG_APP0 + 14 && m->data_length >= 5
+            && memcmp(m->data, "Adobe", 5) == 0)
+            continue;
+        jpeg_write_marker(dst, m->marker, m->data, m->data_length);
+    }
+}
+
+} // namespace
+
+bool jpegLosslessAvailable()
+{
+    return true;
+}
+
+bool transformJpegFile(const QString &inPath, const QString &outPath, JpegXform xform,
+                       QString *error)
+{
+    if (xform == JpegInvalid) {
+        if (error)
+            *error = QStringLiteral("not a lossless orientation");
+        return false;
+    }
+    QFile in(inPath);
+    if (!in.open(QIODevice::ReadOnly)) {
+        if (error)
+            *error = in.errorString();
+        return false;
+    }
+    const QByteArray data = in.readAll();
+    in.close();
+
+    jpeg_decompress_struct src;
+    jpeg_compress_struct dst;
+    ErrorMgr err;
+    src.err = dst.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = errorExit;
+    err.pub.emit_message = silentMessage;
+    err.message[0] = 0;
+    unsigned char *outBuf = nullptr;
+    unsigned long outSize = 0;
+    // Everything with a destructor lives above the setjmp.
+    QVector<jvirt_barray_ptr> dstCoefs;
+    QVector<JDIMENSION> srcBw, srcBh;
+
+    jpeg_create_decompress(&src);
+    jpeg_create_compress(&dst);
+    if (setjmp(err.jump)) {
+        if (error)
+            *error = QString::fromLocal8Bit(err.message);
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        free(outBuf);
+        return false;
+    }
+
+    jpeg_mem_src(&src, reinterpret_cast<const unsigned char *>(data.constData()),
+                 static_cast<unsigned long>(data.size()));
+    jpeg_save_markers(&src, JPEG_COM, 0xffff);
+    for (int m = 0; m < 16; ++m)
+        jpeg_save_markers(&src, JPEG_APP0 + m, 0xffff);
+    jpeg_read_header(&src, TRUE);
+
+    const BlockMap map = blockMapFor(xform);
+    const int mcuW = src.max_h_samp_factor * DCTSIZE;
+    const int mcuH = src.max_v_samp_factor * DCTSIZE;
+    // A source axis that ends up reversed can only keep whole MCUs.
+    const bool trimX = map.transpose ? map.flipY : map.flipX;
+    const bool trimY = map.transpose ? map.flipX : map.flipY;
+    const JDIMENSION srcW = trimX ? src.image_width / mcuW * mcuW : src.image_width;
+    const JDIMENSION srcH = trimY ? src.image_height / mcuH * mcuH : src.image_height;
+    if (srcW == 0 || srcH == 0) {
+        if (error)
+            *error = QStringLiteral("image smaller than one MCU");
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        return false;
+    }
+
+    // Destination coefficient arrays must be requested before read_coefficients
+    // realizes the source ones.
+    const int comps = src.num_components;
+    dstCoefs.resize(comps);
+    srcBw.resize(comps);
+    srcBh.resize(comps);
+    for (int ci = 0; ci < comps; ++ci) {
+        const jpeg_component_info *comp = &src.comp_info[ci];
+        srcBw[ci] = (srcW * comp->h_samp_factor + mcuW - 1) / mcuW;
+        srcBh[ci] = (srcH * comp->v_samp_factor + mcuH - 1) / mcuH;
+        const int hs = map.transpose ? comp->v_samp_factor : comp->h_samp_factor;
+        const int vs = map.transpose ? comp->h_samp_factor : comp->v_samp_factor;
+        const JDIMENSION bw = map.transpose ? srcBh[ci] : srcBw[ci];
+        const JDIMENSION bh = map.transpose ? srcBw[ci] : srcBh[ci];
+        dstCoefs[ci] = (*src.mem->request_virt_barray)(
+            reinterpret_cast<j_common_ptr>(&src), JPOOL_IMAGE, FALSE,
+            (bw + hs - 1) / hs * hs, (bh + vs - 1) / vs * vs, vs);
+    }
+
+    jvirt_barray_ptr *srcCoefs = jpeg_read_coefficients(&src);
+    jpeg_copy_critical_parameters(&src, &dst);
+    dst.image_width = map.transpose ? srcH : srcW;
+    dst.image_height = map.transpose ? srcW : srcH;
+    if (map.transpose) {
+        for (int ci = 0; ci < comps; ++ci)
+            std::swap(dst.comp_info[ci].h_samp_factor, dst.comp_info[ci].v_samp_factor);
+        transposeQuantTables(&dst);
+    }
+    dst.optimize_coding = TRUE;
+    if (src.progressive_mode)
+        jpeg_simple_progression(&dst);
+
+    for (int ci = 0; ci < comps; ++ci) {
+        const JDIMENSION outBw = map.transpose ? srcBh[ci] : srcBw[ci];
+        const JDIMENSION outBh = map.transpose ? srcBw[ci] : srcBh[ci];
+        for (JDIMENSION oy = 0; oy < outBh; ++oy) {
+            JBLOCKROW outRow = *(*src.mem->access_virt_barray)(
+                reinterpret_cast<j_common_ptr>(&src), dstCoefs[ci], oy, 1, TRUE);
+            const JDIMENSION ty = map.flipY ? outBh - 1 - oy : oy;
+            JBLOCKROW inRow = nullptr;
+            if (!map.transpose)
+                inRow = *(*src.mem->access_virt_barray)(
+                    reinterpret_cast<j_common_ptr>(&src), srcCoefs[ci], ty, 1, FALSE);
+            for (JDIMENSION ox = 0; ox < outBw; ++ox) {
+                const JDIMENSION tx = map.flipX ? outBw - 1 - ox : ox;
+                const JCOEF *from;
+                if (map.transpose)
+                    from = (*(*src.mem->access_virt_barray)(
+                        reinterpret_cast<j_common_ptr>(&src), srcCoefs[ci], tx, 1, FALSE))[ty];
+                else
+                    from = inRow[tx];
+                JCOEF *to = outRow[ox];
+                for (int v = 0; v < DCTSIZE; ++v) {
+                    for (int u = 0; u < DCTSIZE; ++u) {
+                        // Mirroring a block negates its odd frequencies along that axis.
+                        JCOEF coef = map.transpose ? from[u * DCTSIZE + v] : from[v * DCTSIZE + u];
+                        if ((map.flipX && (u & 1)) != (map.flipY && (v & 1)))
+                            coef = -coef;
+                        to[v * DCTSIZE + u] = coef;
+                    }
+                }
+            }
+        }
+    }
+
+    jpeg_mem_dest(&dst, &outBuf, &outSize);
+    jpeg_write_coefficients(&dst, dstCoefs.data());
+    copyMarkers(&src, &dst);
+    jpeg_finish_compress(&dst);
+    jpeg_finish_decompress(&src);
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+
+    QSaveFile out(outPath);
+    bool ok = out.open(QIODevice::WriteOnly)
+              && out.write(reinterpret_cast<const char *>(outBuf), qint64(outSize)) == qint64(outSize)
+              && out.commit();
+    if (!ok && error)
+        *error = out.errorString();
+    free(outBuf);
+    return ok;
+}
+
+#else
+
+bool jpegLosslessAvailable()
+{
+    return false;
+}
+
+bool transformJpegFile(const QString &, const QString &, JpegXform, QString *error)
+{
+    if (error)
+        *error = QStringLiteral("built without libjpeg");
+    return false;
+}
+
+#endif // HAVE_LIBJPEG
@@ -0,0 +1,34 @@
+#ifndef JPEGXFORM_H
+#define JPEGXFORM_H
+
+#include <QString>
+
+// The eight orientations reachable with mirrors and quarter turns.
+// Rotations are clockwise on screen, matching QTransform::rotate().
+enum JpegXform {
+    JpegInvalid = -1,
+    JpegNone,
+    JpegFlipH,
+    JpegFlipV,
+    JpegTranspose,
+    JpegTransverse,
+    JpegRot90,
+    JpegRot180,
+    JpegRot270
+};
+
+// Orientation of an image mirrored (hFlip/vFlip) and then rotated by angle degrees.
+// Returns JpegInvalid when angle is not a multiple of 90.
+JpegXform jpegXformFor(bool hFlip, bool vFlip, int angle);
+
+bool jpegLosslessAvailable();
+bool isJpegFile(const QString &path);
+
+// Rewrites the JPEG inPath into outPath with xform applied to its DCT coefficients,
+// so no decode/re-encode loss happens. Like "jpegtran -trim", partial edge MCUs that
+// cannot be moved losslessly are dropped. Returns false (with *error set) on failure,
+// in which case the caller should fall back to the pixel path.
+bool transformJpegFile(const QString &inPath, const QString &outPath, JpegXform xform,
+                       QString *error = nullptr);
+
+#endif // JPEGXFORM_H
@@ -0,0 +1,95 @@
+#include "lens.h"
+#include "tiles.h"
+#include <QList>
+#include <QMutex>
+#include <QtMath>
+
+namespace {
+
+const int BandRows = 16;
+// Cameras in use at once; the least recently used map is dropped beyond this.
+const int MaxCachedMaps = 4;
+
+struct CachedMap
+{
+    LensModel lens;
+    QSharedPointer<const RemapMap> map;
+};
+
+} // namespace
+
+RemapMap undistortMap(const LensModel &lens, const QSize &size)
+{
+    RemapMap map;
+    if (size.isEmpty())
+        return map;
+    map.sourceSize = size;
+    map.size = size;
+    map.coords.resize(2 * qsizetype(size.width()) * size.height());
+
+    const int w = size.width(), h = size.height();
+    const double f = lens.focal > 0 ? lens.focal : 0.5 * qSqrt(double(w) * w + double(h) * h);
+    const double cx = 0.5 * w + lens.cx, cy = 0.5 * h + lens.cy;
+    const double scale = 1 << RemapFracBits;
+    qint32 *coords = map.coords.data();
+    parallelRows(QRect(QPoint(0, 0), size), BandRows, [&](const QRect &band) {
+        for (int v = band.top(); v <= band.bottom(); ++v) {
+            qint32 *c = coords + 2 * qsizetype(v) * w;
+            const double y = (v + 0.5 - cy) / f;
+            for (int u = 0; u < w; ++u, c += 2) {
+                const double x = (u + 0.5 - cx) / f;
+                const double r2 = x * x + y * y;
+                const double radial = 1 + r2 * (lens.k1 + r2 * (lens.k2 + r2 * lens.k3));
+                const double xd = x * radial + 2 * lens.p1 * x * y + lens.p2 * (r2 + 2 * x * x);
+                const double yd = y * radial + lens.p1 * (r2 + 2 * y * y) + 2 * lens.p2 * x * y;
+                // Sample position relative to the centre of pixel (0, 0).
+                const double sx = xd * f + cx - 0.5, sy = yd * f + cy - 0.5;
+                // Also rejects NaN; one pixel of margin keeps the edge blend.
+                if (!(sx > -1.0 && sx < w && sy > -1.0 && sy < h)) {
+                    c[0] = c[1] = RemapOutside;
+                    continue;
+                }
+                c[0] = qint32(qFloor(sx * scale + 0.5));
+                c[1] = qint32(qFloor(sy * scale + 0.5));
+            }
+        }
+    });
+    return map;
+}
+
+QSharedPointer<const RemapMap> cachedUndistortMap(const LensModel &lens, const QSize &size)
+{
+    static QMutex mutex;
+    static QList<CachedMap> cache;   // most recently used first
+    const auto lookup = [&]() {
+        for (int i = 0; i < cache.size(); ++i) {
+            if (cache[i].lens == lens && cache[i].map->size == size) {
+                cache.prepend(cache.takeAt(i));
+                return cache[0].map;
+            }
+        }
+        return QSharedPointer<const RemapMap>();
+    };
+    {
+        QMutexLocker locker(&mutex);
+        if (QSharedPointer<const RemapMap> map = lookup())
+            return map;
+    }
+    // Built unlocked so other cameras are not held up; a thread that built
+    // the same map meanwhile wins.
+    QSharedPointer<const RemapMap> map(new RemapMap(undistortMap(lens, size)));
+    QMutexLocker locker(&mutex);
+    if (QSharedPointer<const RemapMap> existing = lookup())
+        return existing;
+    cache.prepend({ lens, map });
+    while (cache.size() > MaxCachedMaps)
+        cache.removeLast();
+    return map;
+}
+
+QImage undistortImage(const QImage &src, const LensModel &lens)
+{
+    if (src.isNull() || lens.isIdentity())
+        return src;
+    return remapImage(src, *cachedUndistortMap(lens, src.size()));
+}
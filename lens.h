@@ -0,0 +1,36 @@
+#ifndef LENS_H
+#define LENS_H
+
+#include <QImage>
+#include <QSharedPointer>
+#include "warp.h"
+
+// Brown-Conrady lens model on coordinates normalised by the focal length:
+// a point (x, y) at radius r from the principal point is seen at
+//   x (1 + k1 r^2 + k2 r^4 + k3 r^6) + 2 p1 x y + p2 (r^2 + 2 x^2)
+//   y (1 + k1 r^2 + k2 r^4 + k3 r^6) + p1 (r^2 + 2 y^2) + 2 p2 x y
+struct LensModel
+{
+    double k1 = 0, k2 = 0, k3 = 0;   // radial; negative for barrel distortion
+    double p1 = 0, p2 = 0;           // tangential
+    double focal = 0;                // pixels; 0 for half the image diagonal
+    double cx = 0, cy = 0;           // principal point, pixels from the image centre
+
+    bool operator==(const LensModel &o) const
+    {
+        return k1 == o.k1 && k2 == o.k2 && k3 == o.k3 && p1 == o.p1 && p2 == o.p2
+            && focal == o.focal && cx == o.cx && cy == o.cy;
+    }
+    bool isIdentity() const { return k1 == 0 && k2 == 0 && k3 == 0 && p1 == 0 && p2 == 0; }
+};
+
+// Map from the corrected image back into a distorted one of the same size.
+RemapMap undistortMap(const LensModel &lens, const QSize &size);
+
+// The same map, built once per lens and size and shared: a camera's frames
+// only pay for the sampling.
+QSharedPointer<const RemapMap> cachedUndistortMap(const LensModel &lens, const QSize &size);
+
+QImage undistortImage(const QImage &src, const LensModel &lens);
+
+#endif // LENS_H
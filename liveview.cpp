@@ -0,0 +1,109 @@
+#include "liveview.h"
+#include <QPixmap>
+
+namespace {
+
+const int PollMs = 15;
+
+} // namespace
+
+liveview::liveview(QWidget *parent)
+    : QWidget(parent), pendingStamp(0), received(0), processed(0)
+{
+    setWindowTitle (QStringLiteral("即時影像"));
+    mainLayout = new QVBoxLayout (this);
+    controlLayout = new QHBoxLayout ();
+
+    keyEdit = new QLineEdit (QStringLiteral("imagerprocessor-live"), this);
+    keyEdit->setToolTip (QStringLiteral("影像來源的共享記憶體名稱"));
+    recipeEdit = new QLineEdit (this);
+    recipeEdit->setPlaceholderText (QStringLiteral("例如 downscale:2 median:1 canny:1.4:30:90"));
+    startButton = new QPushButton (QStringLiteral("開始"), this);
+    controlLayout->addWidget (new QLabel (QStringLiteral("來源"), this));
+    controlLayout->addWidget (keyEdit);
+    controlLayout->addWidget (new QLabel (QStringLiteral("處理步驟"), this));
+    controlLayout->addWidget (recipeEdit, 1);
+    controlLayout->addWidget (startButton);
+    mainLayout->addLayout (controlLayout);
+
+    viewWin = new QLabel (this);
+    viewWin->setMinimumSize (320, 240);
+    viewWin->setAlignment (Qt::AlignCenter);
+    mainLayout->addWidget (viewWin, 1);
+    statsLabel = new QLabel (this);
+    mainLayout->addWidget (statsLabel);
+
+    timer = new QTimer (this);
+    timer->setInterval (PollMs);
+    job = new ImageJob (this);
+    connect (startButton, SIGNAL (clicked()), this, SLOT (toggle()));
+    connect (timer, SIGNAL (timeout()), this, SLOT (poll()));
+    connect (job, SIGNAL (ready(QImage)), this, SLOT (frameReady(QImage)));
+}
+
+liveview::~liveview()
+{
+    stop();
+}
+
+void liveview::toggle()
+{
+    if (timer->isActive()) {
+        stop();
+        return;
+    }
+    QString error;
+    if (!parsePipeline (recipeEdit->text(), &steps, &error)
+        || !reader.attach (keyEdit->text(), &error)) {
+        statsLabel->setText (QStringLiteral("無法開始: %1").arg (error));
+        return;
+    }
+    received = processed = 0;
+    latency.clear();
+    startButton->setText (QStringLiteral("停止"));
+    timer->start();
+}
+
+void liveview::stop()
+{
+    timer->stop();
+    job->cancel();
+    reader.detach();
+    startButton->setText (QStringLiteral("開始"));
+}
+
+void liveview::poll()
+{
+    // Still busy with the previous frame: whatever arrives now is dropped
+    // rather than queued, so the view never falls behind the source.
+    if (job->isRunning())
+        return;
+    QImage frame;
+    FrameInfo info;
+    if (!reader.readLatest (&frame, &info)) {
+        if (reader.isFinished()) {
+            stop();
+            updateStats();
+        }
+        return;
+    }
+    ++received;
+    pendingStamp = info.timestamp;
+    const QList<PipelineStep> recipe = steps;
+    job->start ([frame, recipe]() { return runPipeline (frame, recipe); });
+}
+
+void liveview::frameReady(const QImage &image)
+{
+    ++processed;
+    latency.add ((frameClockNs() - pendingStamp) / 1e6);
+    viewWin->setPixmap (QPixmap::fromImage (image).scaled (viewWin->size(), Qt::KeepAspectRatio));
+    updateStats();
+}
+
+void liveview::updateStats()
+{
+    statsLabel->setText (QStringLiteral("已接收 %1, 已處理 %2, 丟棄 %3 | 延遲 %4")
+                         .arg (received).arg (processed).arg (reader.dropped())
+                         .arg (latency.summary()));
+}
@@ -0,0 +1,55 @@
+#ifndef LIVEVIEW_H
+#define LIVEVIEW_H
+
+#include <QWidget>
+#include <QLabel>
+#include <QLineEdit>
+#include <QPushButton>
+#include <QTimer>
+#include <QHBoxLayout>
+#include <QVBoxLayout>
+#include <QImage>
+#include <QList>
+#include "framering.h"
+#include "pipeline.h"
+#include "scheduler.h"
+
+// Shows frames from a FrameRingWriter (e.g. "ImagerProcessor produce") run
+// through a recipe. Only one frame is processed at a time; frames arriving
+// meanwhile are dropped and the view always continues from the newest one.
+class liveview : public QWidget
+{
+    Q_OBJECT
+
+public:
+    liveview(QWidget *parent = nullptr);
+    ~liveview();
+
+    QLineEdit *keyEdit;
+    QLineEdit *recipeEdit;
+    QPushButton *startButton;
+    QLabel *viewWin;
+    QLabel *statsLabel;
+    QHBoxLayout *controlLayout;
+    QVBoxLayout *mainLayout;
+
+private slots:
+    void toggle();
+    void poll();
+    void frameReady(const QImage &image);
+
+private:
+    void stop();
+    void updateStats();
+
+    QTimer *timer;
+    ImageJob *job;
+    FrameRingReader reader;
+    QList<PipelineStep> steps;
+    qint64 pendingStamp;
+    quint64 received;
+    quint64 processed;
+    LatencyStats latency;
+};
+
+#endif // LIVEVIEW_H
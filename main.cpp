@@ -1,11 +1,38 @@
 #include "ip.h"
+#include "cli.h"
+#include "startup.h"
 
 #include <QApplication>
+#include <QTimer>
+#include <cstring>
 
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && isCliCommand(argv[1]))
+        return runCli(argc, argv);
+    // --startup-trace times the cold start, prints the report on stderr and
+    // quits, so launch scripts can keep an eye on it.
+    bool trace = false;
+    for (int i = 1; i < argc; ++i)
+        if (strcmp(argv[i], "--startup-trace") == 0)
+            trace = true;
+    startupTraceBegin(trace);
     QApplication a(argc, argv);
+    startupMark("QApplication");
     ip w;
+    startupMark("main window built");
     w.show();
+    startupMark("main window shown");
+    QTimer::singleShot(0, [] {
+        startupReady();
+        if (!startupTraceEnabled()) {
+            warmUpInBackground();
+            return;
+        }
+        // Timed in the foreground so the report shows what it costs.
+        warmUp();
+        startupReport();
+        QApplication::quit();
+    });
     return a.exec();
 }
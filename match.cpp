@@ -0,0 +1,269 @@
+#include "match.h"
+#include "colorspace.h"
+#include "fft.h"
+#include "integral.h"
+#include "scheduler.h"
+#include "tiles.h"
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const int BandRows = 16;
+const int MaxLevels = 5;
+// The coarsest template keeps at least this many pixels on its short side.
+const int MinLevelSide = 16;
+// Placements searched on either side of a candidate at each finer level.
+const int RefineRadius = 2;
+// Coarse scores run lower than full-resolution ones; candidates are kept
+// down to minScore minus this.
+const double CoarseSlack = 0.25;
+const int CandidatesPerMatch = 4;
+
+QImage halve(const QImage &gray)
+{
+    QImage out(gray.width() / 2, gray.height() / 2, QImage::Format_Grayscale8);
+    uchar *bits = out.bits();
+    const qsizetype bpl = out.bytesPerLine();
+    parallelRows(out.rect(), 64, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const uchar *a = gray.constScanLine(2 * y), *b = gray.constScanLine(2 * y + 1);
+            uchar *d = bits + y * bpl;
+            for (int x = 0; x < out.width(); ++x)
+                d[x] = uchar((a[2 * x] + a[2 * x + 1] + b[2 * x] + b[2 * x + 1] + 2) / 4);
+        }
+    });
+    return out;
+}
+
+// Sum over the template of image(x + i, y + j) * t(i, j) for every placement
+// (x, y) in placements, into out (one row of placements.width() per row).
+// Template taps go in the outer loops so the inner loop runs along the row.
+void correlateDirect(const QImage &gray, const QVector<float> &t, int tw, int th,
+                     const QRect &placements, float *out)
+{
+    const int pw = placements.width();
+    for (int y = placements.top(); y <= placements.bottom(); ++y) {
+        float *acc = out + qsizetype(y - placements.top()) * pw;
+        std::fill(acc, acc + pw, 0.0f);
+        for (int j = 0; j < th; ++j) {
+            const uchar *src = gray.constScanLine(y + j) + placements.left();
+            const float *taps = t.constData() + qsizetype(j) * tw;
+            for (int i = 0; i < tw; ++i) {
+                const float c = taps[i];
+                const uchar *s = src + i;
+                for (int x = 0; x < pw; ++x)
+                    acc[x] += c * s[x];
+            }
+        }
+    }
+}
+
+// The same correlation for every placement at once, as the inverse transform
+// of F(image) conj(F(t)). The planes are padded to at least the image, so the
+// circular correlation never wraps for a valid placement.
+QVector<float> correlateFft(const QImage &gray, const QVector<float> &t, int tw, int th)
+{
+    const int w = gray.width(), h = gray.height();
+    const int pw = w - tw + 1, ph = h - th + 1;
+    const int fw = fftSize(w), fh = fftSize(h);
+    QVector<float> plane(qsizetype(fw) * fh, 0.0f), kernel(plane.size(), 0.0f);
+    for (int y = 0; y < h; ++y) {
+        const uchar *s = gray.constScanLine(y);
+        float *d = plane.data() + qsizetype(y) * fw;
+        for (int x = 0; x < w; ++x)
+            d[x] = s[x];
+    }
+    for (int j = 0; j < th; ++j)
+        std::copy(t.constData() + qsizetype(j) * tw, t.constData() + qsizetype(j + 1) * tw,
+                  kernel.data() + qsizetype(j) * fw);
+
+    Spectrum a = forwardFft(plane, fw, fh);
+    const Spectrum b = forwardFft(kernel, fw, fh);
+    for (qsizetype i = 0; i < a.bins.size(); ++i)
+        a.bins[i] *= std::conj(b.bins[i]);
+    plane = inverseFft(a);
+
+    QVector<float> out(qsizetype(pw) * ph);
+    for (int y = 0; y < ph; ++y)
+        std::copy(plane.constData() + qsizetype(y) * fw, plane.constData() + qsizetype(y) * fw + pw,
+                  out.data() + qsizetype(y) * pw);
+    return out;
+}
+
+// Turns numerators into scores in place: the image window's sum of squared
+// deviations comes from sat, whose origin is placement (0, 0) of map.
+void normalise(float *map, const QRect &placements, const IntegralImage &sat,
+               int tw, int th, double norm)
+{
+    const double n = double(tw) * th;
+    const int pw = placements.width();
+    for (int y = 0; y < placements.height(); ++y) {
+        float *m = map + qsizetype(y) * pw;
+        for (int x = 0; x < pw; ++x) {
+            const double s = double(sat.sum(x, y, x + tw - 1, y + th - 1));
+            const double s2 = double(sat.sumOfSquares(x, y, x + tw - 1, y + th - 1));
+            const double variance = s2 - s * s / n;
+            // A flat window matches nothing.
+            m[x] = variance > 0.5 ? float(qBound(-1.0, m[x] / qSqrt(variance * norm), 1.0)) : 0.0f;
+        }
+    }
+}
+
+// Greedy non-maximum suppression: best first, dropping anything within half
+// the template of a kept match.
+QVector<TemplateMatch> suppress(QVector<TemplateMatch> matches, int tw, int th, int limit)
+{
+    std::sort(matches.begin(), matches.end(),
+              [](const TemplateMatch &a, const TemplateMatch &b) { return a.score > b.score; });
+    QVector<TemplateMatch> kept;
+    for (const TemplateMatch &m : matches) {
+        if (kept.size() >= limit)
+            break;
+        bool overlaps = false;
+        for (const TemplateMatch &k : kept)
+            if (2 * qAbs(m.pos.x() - k.pos.x()) < tw && 2 * qAbs(m.pos.y() - k.pos.y()) < th) {
+                overlaps = true;
+                break;
+            }
+        if (!overlaps)
+            kept.append(m);
+    }
+    return kept;
+}
+
+} // namespace
+
+TemplateMatcher::TemplateMatcher(const QImage &templ)
+{
+    if (templ.isNull())
+        return;
+    QImage gray = lumaImage(templ);
+    while (levels.size() < MaxLevels) {
+        Level level;
+        level.width = gray.width();
+        level.height = gray.height();
+        level.values.resize(qsizetype(level.width) * level.height);
+        double mean = 0;
+        for (int y = 0; y < level.height; ++y) {
+            const uchar *s = gray.constScanLine(y);
+            for (int x = 0; x < level.width; ++x)
+                mean += s[x];
+        }
+        mean /= double(level.values.size());
+        for (int y = 0; y < level.height; ++y) {
+            const uchar *s = gray.constScanLine(y);
+            float *d = level.values.data() + qsizetype(y) * level.width;
+            for (int x = 0; x < level.width; ++x) {
+                d[x] = float(s[x] - mean);
+                level.norm += double(d[x]) * d[x];
+            }
+        }
+        if (level.norm < 0.5 * level.values.size())
+            break;
+        levels.append(level);
+        if (qMin(gray.width(), gray.height()) / 2 < MinLevelSide)
+            break;
+        gray = halve(gray);
+    }
+}
+
+QSize TemplateMatcher::size() const
+{
+    return levels.isEmpty() ? QSize() : QSize(levels[0].width, levels[0].height);
+}
+
+QVector<TemplateMatch> TemplateMatcher::find(const QImage &image, int maxMatches,
+                                             double minScore) const
+{
+    if (!isValid() || image.isNull() || maxMatches < 1)
+        return QVector<TemplateMatch>();
+    QVector<QImage> pyramid;
+    pyramid.append(lumaImage(image));
+    if (pyramid[0].width() < levels[0].width || pyramid[0].height() < levels[0].height)
+        return QVector<TemplateMatch>();
+    while (pyramid.size() < levels.size()) {
+        const Level &next = levels[pyramid.size()];
+        if (pyramid.last().width() / 2 < next.width || pyramid.last().height() / 2 < next.height)
+            break;
+        pyramid.append(halve(pyramid.last()));
+    }
+
+    // Whole score map at the coarsest level.
+    int top = int(pyramid.size()) - 1;
+    const Level &t = levels[top];
+    const QImage &coarse = pyramid[top];
+    const QRect placements(0, 0, coarse.width() - t.width + 1, coarse.height() - t.height + 1);
+    const int fw = fftSize(coarse.width()), fh = fftSize(coarse.height());
+    const double directCost = double(placements.width()) * placements.height() * t.values.size();
+    const double fftCost = 3.0 * fw * fh * std::log2(double(fw) * fh);
+    QVector<float> map;
+    if (directCost <= fftCost) {
+        map.resize(qsizetype(placements.width()) * placements.height());
+        parallelRows(placements, BandRows, [&](const QRect &band) {
+            correlateDirect(coarse, t.values, t.width, t.height, band,
+                            map.data() + qsizetype(band.top()) * placements.width());
+        });
+    } else {
+        map = correlateFft(coarse, t.values, t.width, t.height);
+    }
+    normalise(map.data(), placements, buildIntegralImage(coarse), t.width, t.height, t.norm);
+
+    // Local maxima as candidates, with slack when they still need refining.
+    const float threshold = float(top > 0 ? minScore - CoarseSlack : minScore);
+    QVector<TemplateMatch> found;
+    const int pw = placements.width(), ph = placements.height();
+    for (int y = 0; y < ph; ++y)
+        for (int x = 0; x < pw; ++x) {
+            const float s = map[qsizetype(y) * pw + x];
+            if (s < threshold)
+                continue;
+            bool peak = true;
+            for (int dy = -1; dy <= 1 && peak; ++dy)
+                for (int dx = -1; dx <= 1; ++dx) {
+                    const int nx = x + dx, ny = y + dy;
+                    if (nx >= 0 && ny >= 0 && nx < pw && ny < ph
+                        && map[qsizetype(ny) * pw + nx] > s) {
+                        peak = false;
+                        break;
+                    }
+                }
+            if (peak)
+                found.append({ QPoint(x, y), s });
+        }
+    found = suppress(found, t.width, t.height,
+                     top > 0 ? maxMatches * CandidatesPerMatch : maxMatches);
+
+    // Refine each candidate in a small window at every finer level; the
+    // window's summed-area table covers just the pixels it touches.
+    for (int l = top - 1; l >= 0; --l) {
+        const Level &lt = levels[l];
+        const QImage &gray = pyramid[l];
+        const QRect valid(0, 0, gray.width() - lt.width + 1, gray.height() - lt.height + 1);
+        TaskScheduler::instance().run(int(found.size()), [&](int i) {
+            const QPoint c(2 * found[i].pos.x(), 2 * found[i].pos.y());
+            const QRect window = QRect(c.x() - RefineRadius, c.y() - RefineRadius,
+                                       2 * RefineRadius + 2, 2 * RefineRadius + 2).intersected(valid);
+            QVector<float> scores(qsizetype(window.width()) * window.height());
+            correlateDirect(gray, lt.values, lt.width, lt.height, window, scores.data());
+            const QRect pixels(window.x(), window.y(), window.width() + lt.width - 1,
+                               window.height() + lt.height - 1);
+            normalise(scores.data(), window, buildIntegralImage(gray.copy(pixels)),
+                      lt.width, lt.height, lt.norm);
+            const qsizetype best = std::max_element(scores.constData(), scores.constData() + scores.size())
+                                   - scores.constData();
+            found[i].pos = window.topLeft() + QPoint(int(best % window.width()), int(best / window.width()));
+            found[i].score = scores[best];
+        });
+    }
+
+    if (top > 0) {
+        QVector<TemplateMatch> kept;
+        for (const TemplateMatch &m : found)
+            if (m.score >= minScore)
+                kept.append(m);
+        found = suppress(kept, levels[0].width, levels[0].height, maxMatches);
+    }
+    return found;
+}
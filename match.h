@@ -0,0 +1,51 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <QImage>
+#include <QPoint>
+#include <QSize>
+#include <QVector>
+
+struct TemplateMatch
+{
+    QPoint pos;      // top-left corner of the template in the image
+    double score;    // normalised cross-correlation, -1 .. 1
+};
+
+// Locates a template in images by normalised cross-correlation of luma, so
+// matches survive changes of brightness and contrast. Prepare the template
+// once and call find() for every frame.
+//
+// The search runs coarse to fine on 2x2-averaged pyramids of the template
+// and the image: the whole score map is computed only at the coarsest level,
+// and each candidate found there is refined in a small window at every finer
+// level. The window sums and sums of squares of the denominator come from
+// summed-area tables; the numerator is a plain correlation for small maps
+// and an FFT product when that is cheaper.
+class TemplateMatcher
+{
+public:
+    TemplateMatcher() = default;
+    explicit TemplateMatcher(const QImage &templ);
+
+    // False for an empty or flat template, for which NCC is undefined.
+    bool isValid() const { return !levels.isEmpty(); }
+    QSize size() const;
+
+    // Best placements, highest score first, at least minScore and not
+    // overlapping each other by more than half the template.
+    QVector<TemplateMatch> find(const QImage &image, int maxMatches = 1,
+                                double minScore = 0.8) const;
+
+private:
+    struct Level
+    {
+        int width = 0;
+        int height = 0;
+        QVector<float> values;   // luma minus its mean
+        double norm = 0;         // sum of values^2
+    };
+    QVector<Level> levels;       // level i is halved i times
+};
+
+#endif // MATCH_H
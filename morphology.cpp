@@ -0,0 +1,385 @@
+#include "morphology.h"
+#include "scheduler.h"
+#include "tiles.h"
+#include <QVector>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// Strip width in bytes for the vertical pass: narrow enough that the running
+// max/min columns of a strip stay in cache.
+const int StripBytes = 256;
+
+struct MaxOp
+{
+    static uchar neutral() { return 0; }
+    static uchar apply(uchar a, uchar b) { return a > b ? a : b; }
+};
+
+struct MinOp
+{
+    static uchar neutral() { return 255; }
+    static uchar apply(uchar a, uchar b) { return a < b ? a : b; }
+};
+
+struct LineBuffers
+{
+    QVector<uchar> f, g, h;
+};
+
+// van Herk/Gil-Werman along one line of n pixels of c interleaved bytes each.
+// The line is padded by the element's reach with the neutral value and cut into
+// blocks of k pixels; g holds prefix extrema of each block and h suffix extrema,
+// so any k-window spans at most two blocks: out[i] = op(h[i], g[i + k - 1]).
+template <typename Op>
+void vhgwLine(const uchar *in, int n, int c, int k, uchar *out, LineBuffers &buf)
+{
+    const int before = (k - 1) / 2;
+    const int len = (n + k - 1) * c;
+    buf.f.fill(Op::neutral(), len);
+    buf.g.resize(len);
+    buf.h.resize(len);
+    uchar *f = buf.f.data(), *g = buf.g.data(), *h = buf.h.data();
+    memcpy(f + before * c, in, size_t(n) * c);
+
+    const int block = k * c;
+    for (int b = 0; b < len; b += block) {
+        const int e = qMin(len, b + block);
+        memcpy(g + b, f + b, size_t(c));
+        for (int i = b + c; i < e; ++i)
+            g[i] = Op::apply(g[i - c], f[i]);
+        memcpy(h + e - c, f + e - c, size_t(c));
+        for (int i = e - c - 1; i >= b; --i)
+            h[i] = Op::apply(h[i + c], f[i]);
+    }
+    const uchar *gk = g + (k - 1) * c;
+    for (int i = 0; i < n * c; ++i)
+        out[i] = Op::apply(h[i], gk[i]);
+}
+
+template <typename Op>
+void horizontalPass(QImage &img, int c, int k)
+{
+    const int w = img.width();
+    uchar *bits = img.bits();
+    const qsizetype bpl = img.bytesPerLine();
+    parallelRows(img.rect(), 16, [&](const QRect &band) {
+        LineBuffers buf;
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            // The row is copied into the padded buffer first, so it can be
+            // overwritten in place.
+            uchar *row = bits + y * bpl;
+            vhgwLine<Op>(row, w, c, k, row, buf);
+        }
+    });
+}
+
+// Same recurrences run on whole rows at once, one strip of columns per task,
+// so every inner loop is a straight elementwise op over contiguous bytes.
+template <typename Op>
+void verticalPass(QImage &img, int c, int k)
+{
+    const int rowBytes = img.width() * c;
+    const int h = img.height();
+    const int before = (k - 1) / 2;
+    const int len = h + k - 1;
+    const QImage in = img.copy();
+    uchar *bits = img.bits();
+    const qsizetype bpl = img.bytesPerLine();
+
+    parallelTiles(QRect(0, 0, rowBytes, 1), StripBytes, [&](const QRect &strip) {
+        const int x0 = strip.left(), sw = strip.width();
+        QVector<uchar> g(qsizetype(len) * sw), hh(qsizetype(len) * sw);
+        const QVector<uchar> neutral(sw, Op::neutral());
+        auto src = [&](int p) -> const uchar * {
+            const int y = p - before;
+            return y >= 0 && y < h ? in.constScanLine(y) + x0 : neutral.constData();
+        };
+
+        for (int p = 0; p < len; ++p) {
+            uchar *gp = g.data() + qsizetype(p) * sw;
+            const uchar *s = src(p);
+            if (p % k == 0) {
+                memcpy(gp, s, size_t(sw));
+            } else {
+                const uchar *prev = gp - sw;
+                for (int x = 0; x < sw; ++x)
+                    gp[x] = Op::apply(prev[x], s[x]);
+            }
+        }
+        for (int p = len - 1; p >= 0; --p) {
+            uchar *hp = hh.data() + qsizetype(p) * sw;
+            const uchar *s = src(p);
+            if ((p + 1) % k == 0 || p == len - 1) {
+                memcpy(hp, s, size_t(sw));
+            } else {
+                const uchar *next = hp + sw;
+                for (int x = 0; x < sw; ++x)
+                    hp[x] = Op::apply(next[x], s[x]);
+            }
+        }
+        for (int y = 0; y < h; ++y) {
+            uchar *d = bits + y * bpl + x0;
+            const uchar *a = hh.constData() + qsizetype(y) * sw;
+            const uchar *b = g.constData() + qsizetype(y + k - 1) * sw;
+            for (int x = 0; x < sw; ++x)
+                d[x] = Op::apply(a[x], b[x]);
+        }
+    });
+}
+
+// Diagonals are gathered into a contiguous line, filtered and scattered back.
+// anti selects lines of constant x + y instead of x - y.
+template <typename Op>
+void diagonalPass(QImage &img, int c, int k, bool anti)
+{
+    const int w = img.width(), h = img.height();
+    const QImage in = img.copy();
+    uchar *bits = img.bits();
+    const qsizetype bpl = img.bytesPerLine();
+    const int lines = w + h - 1;
+    const int chunk = 32;
+    TaskScheduler::instance().run((lines + chunk - 1) / chunk, [&](int part) {
+        LineBuffers lb;
+        QVector<uchar> buf(qsizetype(qMin(w, h)) * c), out(buf.size());
+        for (int d = part * chunk; d < qMin(lines, (part + 1) * chunk); ++d) {
+            // Line d starts on the top row or, past the last column, on the
+            // left (right for anti) edge and walks down.
+            const int x = anti ? qMin(d, w - 1) : qMax(0, w - 1 - d);
+            const int y = qMax(0, d - (w - 1));
+            const int step = anti ? -1 : 1;
+            int n = 0;
+            for (int px = x, py = y; px >= 0 && px < w && py < h; px += step, ++py, ++n)
+                memcpy(buf.data() + n * c, in.constScanLine(py) + px * c, size_t(c));
+            vhgwLine<Op>(buf.constData(), n, c, k, out.data(), lb);
+            for (int i = 0; i < n; ++i)
+                memcpy(bits + (y + i) * bpl + (x + step * i) * c, out.constData() + i * c, size_t(c));
+        }
+    });
+}
+
+template <typename Op>
+void lineFilter(QImage &img, int c, MorphShape shape, int width, int height)
+{
+    switch (shape) {
+    case MorphRect:
+        if (width > 1)
+            horizontalPass<Op>(img, c, width);
+        if (height > 1)
+            verticalPass<Op>(img, c, height);
+        break;
+    case MorphLineH:
+        if (width > 1)
+            horizontalPass<Op>(img, c, width);
+        break;
+    case MorphLineV:
+        if (width > 1)
+            verticalPass<Op>(img, c, width);
+        break;
+    case MorphLineDiag:
+    case MorphLineAntiDiag:
+        if (width > 1)
+            diagonalPass<Op>(img, c, width, shape == MorphLineAntiDiag);
+        break;
+    }
+}
+
+// Word i of a row of n words shifted so that pixel x takes the value of pixel
+// x + shift, with 0 past either end.
+quint64 shiftedWord(const quint64 *s, int n, int i, int shift)
+{
+    const int q = shift >= 0 ? shift / 64 : -((63 - shift) / 64);
+    const int r = shift - 64 * q;
+    const int j = i + q;
+    const quint64 lo = j >= 0 && j < n ? s[j] : 0;
+    if (!r)
+        return lo;
+    const quint64 hi = j + 1 >= 0 && j + 1 < n ? s[j + 1] : 0;
+    return lo >> r | hi << (64 - r);
+}
+
+// dst(p) = src(p + steps * (dx, dy)), OR-ed with src(p) if keep.
+void shiftMask(const BitMask &src, BitMask &dst, int dx, int dy, int steps, bool keep)
+{
+    const int h = src.height(), n = src.wordsPerLine();
+    const quint64 last = src.width() & 63 ? (quint64(1) << (src.width() & 63)) - 1 : ~quint64(0);
+    // dst may still share its words with a copy (the caller's mask after a
+    // swap); taking the pointer here detaches it once, not in every worker.
+    quint64 *dstBits = dst.row(0);
+    parallelRows(src.rect(), 64, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const int sy = y + steps * dy;
+            const quint64 *s = sy >= 0 && sy < h ? src.constRow(sy) : nullptr;
+            const quint64 *own = src.constRow(y);
+            quint64 *d = dstBits + qsizetype(y) * n;
+            for (int i = 0; i < n; ++i) {
+                const quint64 moved = s ? shiftedWord(s, n, i, steps * dx) : 0;
+                d[i] = keep ? own[i] | moved : moved;
+            }
+            // Pixels moved right land in the bits past the width.
+            d[n - 1] &= last;
+        }
+    });
+}
+
+// OR of the mask with itself shifted along (dx, dy), doubling the reach each
+// pass until it spans reach + 1 pixels. Every pass only reads pixels that are
+// inside the image or all outside it, so 0 outside stays exact.
+void growLine(BitMask &mask, BitMask &tmp, int dx, int dy, int reach)
+{
+    for (int span = 1; span <= reach;) {
+        const int step = qMin(span, reach + 1 - span);
+        shiftMask(mask, tmp, dx, dy, step, true);
+        std::swap(mask, tmp);
+        span += step;
+    }
+}
+
+// Dilation along the line of k pixels in direction (dx, dy), placed like the
+// elements of vhgwLine: reach (k - 1) / 2 back and k / 2 forward.
+void dilateLine(BitMask &mask, int dx, int dy, int k)
+{
+    BitMask tmp(mask.size());
+    growLine(mask, tmp, -dx, -dy, (k - 1) / 2);
+    growLine(mask, tmp, dx, dy, k / 2);
+}
+
+void dilateMask(BitMask &mask, MorphShape shape, int width, int height)
+{
+    switch (shape) {
+    case MorphRect:
+        if (width > 1)
+            dilateLine(mask, 1, 0, width);
+        if (height > 1)
+            dilateLine(mask, 0, 1, height);
+        break;
+    case MorphLineH:
+        if (width > 1)
+            dilateLine(mask, 1, 0, width);
+        break;
+    case MorphLineV:
+        if (width > 1)
+            dilateLine(mask, 0, 1, width);
+        break;
+    case MorphLineDiag:
+        if (width > 1)
+            dilateLine(mask, 1, 1, width);
+        break;
+    case MorphLineAntiDiag:
+        if (width > 1)
+            dilateLine(mask, -1, 1, width);
+        break;
+    }
+}
+
+void erodeMask(BitMask &mask, MorphShape shape, int width, int height)
+{
+    mask.invert();
+    dilateMask(mask, shape, width, height);
+    mask.invert();
+}
+
+// True when every pixel is 0 or 255, as in a thresholded mask.
+bool isBinary(const QImage &gray)
+{
+    for (int y = 0; y < gray.height(); ++y) {
+        const uchar *s = gray.constScanLine(y);
+        for (int x = 0; x < gray.width(); ++x)
+            if (s[x] != 0 && s[x] != 255)
+                return false;
+    }
+    return true;
+}
+
+} // namespace
+
+QImage morphology(const QImage &src, MorphOp op, MorphShape shape, int width, int height)
+{
+    if (src.isNull())
+        return QImage();
+    width = qMax(1, width);
+    height = height > 0 ? height : width;
+
+    const bool gray = src.format() == QImage::Format_Grayscale8
+                      || src.format() == QImage::Format_Mono
+                      || src.format() == QImage::Format_MonoLSB;
+    QImage img = src.convertToFormat(gray ? QImage::Format_Grayscale8 : QImage::Format_ARGB32);
+    const int c = gray ? 1 : 4;
+    // A binary mask gives the same result a word of 64 pixels at a time.
+    if (gray && isBinary(img))
+        return morphology(BitMask::fromImage(img), op, shape, width, height).toImage();
+
+    switch (op) {
+    case MorphErode:
+        lineFilter<MinOp>(img, c, shape, width, height);
+        break;
+    case MorphDilate:
+        lineFilter<MaxOp>(img, c, shape, width, height);
+        break;
+    case MorphOpen:
+        lineFilter<MinOp>(img, c, shape, width, height);
+        lineFilter<MaxOp>(img, c, shape, width, height);
+        break;
+    case MorphClose:
+        lineFilter<MaxOp>(img, c, shape, width, height);
+        lineFilter<MinOp>(img, c, shape, width, height);
+        break;
+    }
+    return img;
+}
+
+BitMask morphology(const BitMask &mask, MorphOp op, MorphShape shape, int width, int height)
+{
+    if (mask.isNull())
+        return BitMask();
+    width = qMax(1, width);
+    height = height > 0 ? height : width;
+
+    BitMask result = mask;
+    switch (op) {
+    case MorphErode:
+        erodeMask(result, shape, width, height);
+        break;
+    case MorphDilate:
+        dilateMask(result, shape, width, height);
+        break;
+    case MorphOpen:
+        erodeMask(result, shape, width, height);
+        dilateMask(result, shape, width, height);
+        break;
+    case MorphClose:
+        dilateMask(result, shape, width, height);
+        erodeMask(result, shape, width, height);
+        break;
+    }
+    return result;
+}
+
+bool parseMorphOp(const QString &text, MorphOp *op)
+{
+    static const struct { const char *name; MorphOp op; } names[] = {
+        { "erode", MorphErode }, { "dilate", MorphDilate },
+        { "open", MorphOpen }, { "close", MorphClose },
+    };
+    for (const auto &n : names)
+        if (text == QLatin1String(n.name)) {
+            *op = n.op;
+            return true;
+        }
+    return false;
+}
+
+bool parseMorphShape(const QString &text, MorphShape *shape)
+{
+    static const struct { const char *name; MorphShape shape; } names[] = {
+        { "rect", MorphRect }, { "hline", MorphLineH }, { "vline", MorphLineV },
+        { "diag", MorphLineDiag }, { "antidiag", MorphLineAntiDiag },
+    };
+    for (const auto &n : names)
+        if (text == QLatin1String(n.name)) {
+            *shape = n.shape;
+            return true;
+        }
+    return false;
+}
@@ -0,0 +1,43 @@
+#ifndef MORPHOLOGY_H
+#define MORPHOLOGY_H
+
+#include "bitmask.h"
+#include <QImage>
+#include <QString>
+
+enum MorphOp {
+    MorphErode,
+    MorphDilate,
+    MorphOpen,
+    MorphClose
+};
+
+enum MorphShape {
+    MorphRect,          // width x height
+    MorphLineH,         // width pixels along x
+    MorphLineV,         // width pixels along y
+    MorphLineDiag,      // width pixels along x = y
+    MorphLineAntiDiag   // width pixels along x = -y
+};
+
+// Grayscale morphology with a flat structuring element centred on each pixel
+// (the extra pixel of an even size goes right/down). Uses van Herk/Gil-Werman,
+// so the cost per pixel does not depend on the element size; a rectangle is
+// done as a horizontal then a vertical line. Pixels outside the image never
+// win. Grayscale8 and mono input give Grayscale8, everything else is handled
+// per channel as ARGB32. Gray input holding only 0 and 255 goes through the
+// BitMask overload below, which gives the same pixels.
+QImage morphology(const QImage &src, MorphOp op, MorphShape shape, int width, int height = 0);
+
+// The same on a binary mask, 64 pixels per word operation. A line of k pixels
+// is built by doubling, OR-ing the mask with itself shifted by 1, 2, 4, ...
+// pixels, so it costs about log2(k) passes over the words; erosion is dilation
+// of the inverted mask, so pixels outside the image still never win.
+BitMask morphology(const BitMask &mask, MorphOp op, MorphShape shape, int width, int height = 0);
+
+// Parses "erode", "dilate", "open", "close" and "rect", "hline", "vline",
+// "diag", "antidiag" for the command line.
+bool parseMorphOp(const QString &text, MorphOp *op);
+bool parseMorphShape(const QString &text, MorphShape *shape);
+
+#endif // MORPHOLOGY_H
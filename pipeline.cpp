@@ -0,0 +1,159 @@
+#include "pipeline.h"
+#include "bilateral.h"
+#include "canny.h"
+#include "colorspace.h"
+#include "contrast.h"
+#include "lens.h"
+#include "morphology.h"
+#include "rankfilter.h"
+#include "threshold.h"
+#include <QRegularExpression>
+#include <QStringList>
+#include <QtMath>
+#include <cmath>
+
+namespace {
+
+const struct StepName
+{
+    const char *name;
+    PipelineStep::Type type;
+    int fixed;           // leading argument implied by the name, or -1
+    int argCount;        // arguments after it
+    double defaults[5];
+    double minimum;      // lower bound of the first argument
+} stepNames[] = {
+    { "gray", PipelineStep::Gray, -1, 0, { 0, 0, 0 }, 0 },
+    { "downscale", PipelineStep::Downscale, -1, 1, { 2, 0, 0 }, 1 },
+    { "median", PipelineStep::Median, -1, 1, { 1, 0, 0 }, 1 },
+    { "erode", PipelineStep::Morph, MorphErode, 2, { 3, 3, 0 }, 1 },
+    { "dilate", PipelineStep::Morph, MorphDilate, 2, { 3, 3, 0 }, 1 },
+    { "open", PipelineStep::Morph, MorphOpen, 2, { 3, 3, 0 }, 1 },
+    { "close", PipelineStep::Morph, MorphClose, 2, { 3, 3, 0 }, 1 },
+    { "equalize", PipelineStep::Equalize, -1, 0, { 0, 0, 0 }, 0 },
+    { "clahe", PipelineStep::Clahe, -1, 2, { 8, 2, 0 }, 1 },
+    { "otsu", PipelineStep::Otsu, -1, 1, { 0, 0, 0 }, 0 },
+    { "adaptive", PipelineStep::Adaptive, -1, 2, { 15, 5, 0 }, 1 },
+    { "canny", PipelineStep::Canny, -1, 3, { 1.4, 30, 90 }, 0.1 },
+    { "bilateral", PipelineStep::Bilateral, -1, 2, { 8, 20, 0 }, 1 },
+    { "undistort", PipelineStep::Undistort, -1, 5, { 0, 0, 0, 0, 0 }, -HUGE_VAL },
+};
+
+bool fail(QString *error, const QString &message)
+{
+    if (error)
+        *error = message;
+    return false;
+}
+
+} // namespace
+
+bool parsePipeline(const QString &text, QList<PipelineStep> *steps, QString *error)
+{
+    QList<PipelineStep> parsed;
+    for (const QString &word : text.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts)) {
+        const QStringList parts = word.toLower().split(':');
+        const StepName *n = nullptr;
+        for (const StepName &candidate : stepNames)
+            if (parts[0] == QLatin1String(candidate.name))
+                n = &candidate;
+        if (!n)
+            return fail(error, QStringLiteral("unknown step %1").arg(word));
+        if (parts.size() - 1 > n->argCount)
+            return fail(error, QStringLiteral("too many arguments in %1").arg(word));
+
+        PipelineStep step;
+        step.type = n->type;
+        if (n->fixed >= 0)
+            step.args.append(n->fixed);
+        for (int i = 0; i < n->argCount; ++i) {
+            double value = n->defaults[i];
+            if (i + 1 < parts.size()) {
+                bool ok = true;
+                value = step.type == PipelineStep::Otsu && parts[i + 1] == "inv"
+                    ? 1 : parts[i + 1].toDouble(&ok);
+                if (!ok || (i == 0 && value < n->minimum))
+                    return fail(error, QStringLiteral("bad argument in %1").arg(word));
+            }
+            step.args.append(value);
+        }
+        parsed.append(step);
+    }
+    *steps = parsed;
+    return true;
+}
+
+QString pipelineText(const QList<PipelineStep> &steps)
+{
+    QStringList words;
+    for (const PipelineStep &step : steps) {
+        const int fixed = step.type == PipelineStep::Morph ? int(step.args.value(0)) : -1;
+        for (const StepName &n : stepNames) {
+            if (n.type != step.type || n.fixed != fixed)
+                continue;
+            QString word = QLatin1String(n.name);
+            if (step.type == PipelineStep::Otsu) {
+                if (step.args.value(0) != 0)
+                    word += ":inv";
+            } else {
+                for (int i = fixed >= 0 ? 1 : 0; i < step.args.size(); ++i)
+                    word += ":" + QString::number(step.args[i]);
+            }
+            words.append(word);
+            break;
+        }
+    }
+    return words.join(" ");
+}
+
+QImage runPipeline(const QImage &src, const QList<PipelineStep> &steps)
+{
+    QImage img = src;
+    for (const PipelineStep &step : steps) {
+        const QVector<double> &a = step.args;
+        switch (step.type) {
+        case PipelineStep::Gray:
+            img = lumaImage(img);
+            break;
+        case PipelineStep::Downscale:
+            img = img.scaled(qMax(1, int(img.width() / a[0])), qMax(1, int(img.height() / a[0])),
+                             Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+            break;
+        case PipelineStep::Median:
+            img = medianFilter(img, int(a[0]));
+            break;
+        case PipelineStep::Morph:
+            img = morphology(img, MorphOp(int(a[0])), MorphRect, int(a[1]), int(a[2]));
+            break;
+        case PipelineStep::Equalize:
+            img = equalizeHistogram(img);
+            break;
+        case PipelineStep::Clahe:
+            img = clahe(img, int(a[0]), int(a[0]), a[1]);
+            break;
+        case PipelineStep::Otsu:
+            img = thresholdImage(img, otsuThreshold(img), a[0] != 0);
+            break;
+        case PipelineStep::Adaptive:
+            img = adaptiveThreshold(img, int(a[0]), int(a[1]));
+            break;
+        case PipelineStep::Canny:
+            img = cannyEdges(img, a[0], a[1], a[2]);
+            break;
+        case PipelineStep::Bilateral:
+            img = bilateralFilter(img, a[0], a[1]);
+            break;
+        case PipelineStep::Undistort: {
+            LensModel lens;
+            lens.k1 = a[0];
+            lens.k2 = a[1];
+            lens.p1 = a[2];
+            lens.p2 = a[3];
+            lens.k3 = a[4];
+            img = undistortImage(img, lens);
+            break;
+        }
+        }
+    }
+    return img;
+}
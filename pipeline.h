@@ -0,0 +1,43 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <QImage>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+// One whole-image step of a processing recipe.
+struct PipelineStep
+{
+    enum Type {
+        Gray,       // luma
+        Downscale,  // 1 / args[0] size, smooth
+        Median,     // radius args[0]
+        Morph,      // args[0] MorphOp, args[1] x args[2] rectangle
+        Equalize,
+        Clahe,      // args[0] tiles per side, args[1] clip limit
+        Otsu,       // args[0] != 0 inverts
+        Adaptive,   // radius args[0], offset args[1]
+        Canny,      // sigma args[0], thresholds args[1] and args[2]
+        Bilateral,  // spatial sigma args[0], range sigma args[1]
+        Undistort   // LensModel k1, k2, p1, p2, k3
+    };
+    Type type;
+    QVector<double> args;   // always every argument, defaults filled in
+};
+
+// A recipe is whitespace-separated steps, each a name with colon-separated
+// arguments; trailing arguments may be left out:
+//   gray  downscale:N  median:R  erode|dilate|open|close:W:H  equalize
+//   clahe:TILES:CLIP  otsu[:inv]  adaptive:R:OFFSET  canny:SIGMA:LOW:HIGH
+//   bilateral:SPATIAL:RANGE  undistort:K1:K2:P1:P2:K3
+// e.g. "downscale:2 median:1 canny:1.4:30:90".
+bool parsePipeline(const QString &text, QList<PipelineStep> *steps, QString *error = nullptr);
+
+// Canonical text of steps with every argument spelled out, so equal recipes
+// compare (and hash) equal however they were written.
+QString pipelineText(const QList<PipelineStep> &steps);
+
+QImage runPipeline(const QImage &src, const QList<PipelineStep> &steps);
+
+#endif // PIPELINE_H
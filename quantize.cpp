@@ -0,0 +1,506 @@
+#include "quantize.h"
+#include "scheduler.h"
+#include "tiles.h"
+#include <QtMath>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+namespace {
+
+// Histogram pixels counted at most; larger images are sampled by rows.
+const qint64 SampledPixels = 4 * 1024 * 1024;
+const int KMeansIterations = 10;
+
+inline int binOf(QRgb p)
+{
+    return (qRed(p) >> 3) << 10 | (qGreen(p) >> 3) << 5 | qBlue(p) >> 3;
+}
+
+inline bool isTransparent(QRgb p)
+{
+    return qAlpha(p) < 128;
+}
+
+bool hasTransparentPixels(const QImage &img)
+{
+    if (!img.hasAlphaChannel())
+        return false;
+    for (int y = 0; y < img.height(); ++y) {
+        const QRgb *s = reinterpret_cast<const QRgb *>(img.constScanLine(y));
+        for (int x = 0; x < img.width(); ++x)
+            if (isTransparent(s[x]))
+                return true;
+    }
+    return false;
+}
+
+struct Bin
+{
+    quint64 count, r, g, b;
+};
+
+// 32^3 bins with the colour sums of the pixels in each.
+QVector<Bin> colorHistogram(const QImage &img)
+{
+    const int h = img.height(), w = img.width();
+    const int step = int(qMax<qint64>(1, qint64(w) * h / SampledPixels));
+    const int rows = (h + step - 1) / step;
+    const int parts = qMin(rows, TaskScheduler::instance().workerCount() + 1);
+    QVector<QVector<Bin>> partial(parts);
+    TaskScheduler::instance().run(parts, [&](int part) {
+        QVector<Bin> &bins = partial[part];
+        bins.fill(Bin{ 0, 0, 0, 0 }, 32768);
+        for (int i = rows * part / parts; i < rows * (part + 1) / parts; ++i) {
+            const QRgb *s = reinterpret_cast<const QRgb *>(img.constScanLine(i * step));
+            for (int x = 0; x < w; ++x) {
+                if (isTransparent(s[x]))
+                    continue;
+                Bin &bin = bins[binOf(s[x])];
+                ++bin.count;
+                bin.r += qRed(s[x]);
+                bin.g += qGreen(s[x]);
+                bin.b += qBlue(s[x]);
+            }
+        }
+    });
+    QVector<Bin> bins = partial.value(0);
+    for (int part = 1; part < parts; ++part)
+        for (int i = 0; i < 32768; ++i) {
+            const Bin &p = partial[part][i];
+            bins[i].count += p.count;
+            bins[i].r += p.r;
+            bins[i].g += p.g;
+            bins[i].b += p.b;
+        }
+    return bins;
+}
+
+// All opaque colours of img, sorted, if there are no more than colors of them.
+bool exactPalette(const QImage &img, int colors, QVector<QRgb> *palette)
+{
+    palette->clear();
+    QRgb last = 0;
+    bool haveLast = false;
+    for (int y = 0; y < img.height(); ++y) {
+        const QRgb *s = reinterpret_cast<const QRgb *>(img.constScanLine(y));
+        for (int x = 0; x < img.width(); ++x) {
+            if (isTransparent(s[x]))
+                continue;
+            const QRgb c = s[x] | 0xff000000u;
+            if (haveLast && c == last)
+                continue;
+            const auto it = std::lower_bound(palette->begin(), palette->end(), c);
+            if (it == palette->end() || *it != c) {
+                if (palette->size() == colors)
+                    return false;
+                palette->insert(it - palette->begin(), c);
+            }
+            last = c;
+            haveLast = true;
+        }
+    }
+    return true;
+}
+
+struct OctreeNode
+{
+    Bin sum;
+    int r, g, b;    // 5-bit coordinates of one of the bins below the node
+};
+
+// Merges the histogram bottom-up: all leaves sit one level below the level
+// being reduced, and the nodes with the fewest pixels fold their children
+// into themselves first until at most colors leaves remain.
+QVector<QRgb> octreePalette(const QVector<Bin> &bins, int colors)
+{
+    QVector<OctreeNode> leaves;
+    for (int i = 0; i < bins.size(); ++i)
+        if (bins[i].count)
+            leaves.append(OctreeNode{ bins[i], i >> 10, (i >> 5) & 31, i & 31 });
+
+    for (int level = 4; level >= 0 && leaves.size() > colors; --level) {
+        const int shift = 5 - level;
+        auto parentOf = [&](const OctreeNode &n) {
+            return (n.r >> shift) << (2 * level) | (n.g >> shift) << level | n.b >> shift;
+        };
+        struct Parent { quint64 count; int children; bool merge; };
+        QVector<Parent> parents(1 << (3 * level), Parent{ 0, 0, false });
+        for (const OctreeNode &n : leaves) {
+            Parent &p = parents[parentOf(n)];
+            p.count += n.sum.count;
+            ++p.children;
+        }
+        QVector<int> order;
+        for (int i = 0; i < parents.size(); ++i)
+            if (parents[i].children > 1)
+                order.append(i);
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            return parents[a].count < parents[b].count;
+        });
+        qsizetype remaining = leaves.size();
+        // The first pass skips merges that would overshoot, so that as many
+        // leaves as allowed survive; the second one merges regardless.
+        for (int pass = 0; pass < 2; ++pass)
+            for (int i : order) {
+                if (remaining <= colors)
+                    break;
+                if (parents[i].merge || (pass == 0 && remaining - (parents[i].children - 1) < colors))
+                    continue;
+                parents[i].merge = true;
+                remaining -= parents[i].children - 1;
+            }
+
+        QVector<OctreeNode> next;
+        QVector<int> merged(parents.size(), -1);
+        for (const OctreeNode &n : leaves) {
+            const int p = parentOf(n);
+            if (!parents[p].merge) {
+                next.append(n);
+            } else if (merged[p] < 0) {
+                merged[p] = int(next.size());
+                next.append(n);
+            } else {
+                Bin &s = next[merged[p]].sum;
+                s.count += n.sum.count;
+                s.r += n.sum.r;
+                s.g += n.sum.g;
+                s.b += n.sum.b;
+            }
+        }
+        leaves = next;
+    }
+
+    QVector<QRgb> palette;
+    for (const OctreeNode &n : leaves) {
+        const quint64 c = n.sum.count, half = c / 2;
+        palette.append(qRgb(int((n.sum.r + half) / c), int((n.sum.g + half) / c),
+                            int((n.sum.b + half) / c)));
+    }
+    return palette;
+}
+
+// Weighted Lloyd iterations over the bin means, starting from seed.
+QVector<QRgb> kmeansPalette(const QVector<Bin> &bins, const QVector<QRgb> &seed)
+{
+    struct Point { float r, g, b, weight; };
+    QVector<Point> points;
+    for (const Bin &bin : bins)
+        if (bin.count) {
+            const float c = float(bin.count);
+            points.append(Point{ bin.r / c, bin.g / c, bin.b / c, c });
+        }
+    const int k = int(seed.size());
+    if (k < 2 || points.size() <= k)
+        return seed;
+    QVector<float> centres(3 * k);
+    for (int i = 0; i < k; ++i) {
+        centres[3 * i] = qRed(seed[i]);
+        centres[3 * i + 1] = qGreen(seed[i]);
+        centres[3 * i + 2] = qBlue(seed[i]);
+    }
+
+    const int parts = TaskScheduler::instance().workerCount() + 1;
+    QVector<QVector<double>> sums(parts);
+    for (int iteration = 0; iteration < KMeansIterations; ++iteration) {
+        const float *cen = centres.constData();
+        TaskScheduler::instance().run(parts, [&](int part) {
+            QVector<double> &acc = sums[part];
+            acc.fill(0, 4 * k);
+            const qsizetype begin = points.size() * part / parts;
+            const qsizetype end = points.size() * (part + 1) / parts;
+            for (qsizetype i = begin; i < end; ++i) {
+                const Point &p = points.at(i);
+                int best = 0;
+                float bestDist = 1e30f;
+                for (int j = 0; j < k; ++j) {
+                    const float dr = p.r - cen[3 * j], dg = p.g - cen[3 * j + 1],
+                                db = p.b - cen[3 * j + 2];
+                    const float d = dr * dr + dg * dg + db * db;
+                    if (d < bestDist) {
+                        bestDist = d;
+                        best = j;
+                    }
+                }
+                acc[4 * best] += p.weight;
+                acc[4 * best + 1] += double(p.r) * p.weight;
+                acc[4 * best + 2] += double(p.g) * p.weight;
+                acc[4 * best + 3] += double(p.b) * p.weight;
+            }
+        });
+
+        float moved = 0;
+        for (int j = 0; j < k; ++j) {
+            double w = 0, r = 0, g = 0, b = 0;
+            for (int part = 0; part < parts; ++part) {
+                w += sums[part][4 * j];
+                r += sums[part][4 * j + 1];
+                g += sums[part][4 * j + 2];
+                b += sums[part][4 * j + 3];
+            }
+            if (w <= 0)
+                continue;   // an empty cluster keeps its centre
+            const float nr = float(r / w), ng = float(g / w), nb = float(b / w);
+            moved = qMax(moved, qAbs(nr - centres[3 * j]) + qAbs(ng - centres[3 * j + 1])
+                                    + qAbs(nb - centres[3 * j + 2]));
+            centres[3 * j] = nr;
+            centres[3 * j + 1] = ng;
+            centres[3 * j + 2] = nb;
+        }
+        if (moved < 0.5f)
+            break;
+    }
+
+    QVector<QRgb> palette(k);
+    for (int j = 0; j < k; ++j)
+        palette[j] = qRgb(qBound(0, qRound(centres[3 * j]), 255),
+                          qBound(0, qRound(centres[3 * j + 1]), 255),
+                          qBound(0, qRound(centres[3 * j + 2]), 255));
+    return palette;
+}
+
+// Exact nearest palette entry. Each of the 32^3 cells of RGB space keeps the
+// entries whose distance to the cell is no more than the smallest farthest
+// distance of any entry, i.e. the only ones that can win inside it.
+class PaletteLookup
+{
+public:
+    explicit PaletteLookup(const QVector<QRgb> &palette)
+        : colors(palette), offsets(32768 + 1)
+    {
+        const int n = int(palette.size());
+        QVector<QVector<uchar>> slabs(32);
+        QVector<QVector<int>> counts(32);
+        TaskScheduler::instance().run(32, [&](int r) {
+            QVector<uchar> &list = slabs[r];
+            QVector<int> &count = counts[r];
+            count.resize(32 * 32);
+            QVector<int> minDist(n);
+            for (int g = 0; g < 32; ++g)
+                for (int b = 0; b < 32; ++b) {
+                    int limit = INT_MAX;
+                    for (int i = 0; i < n; ++i) {
+                        int lo = 0, hi = 0;
+                        axis(qRed(palette[i]), r, &lo, &hi);
+                        axis(qGreen(palette[i]), g, &lo, &hi);
+                        axis(qBlue(palette[i]), b, &lo, &hi);
+                        minDist[i] = lo;
+                        limit = qMin(limit, hi);
+                    }
+                    int found = 0;
+                    for (int i = 0; i < n; ++i)
+                        if (minDist[i] <= limit) {
+                            list.append(uchar(i));
+                            ++found;
+                        }
+                    count[g * 32 + b] = found;
+                }
+        });
+        for (int r = 0; r < 32; ++r) {
+            for (int i = 0; i < 32 * 32; ++i)
+                offsets[r * 1024 + i + 1] = offsets[r * 1024 + i] + counts[r][i];
+            candidates += slabs[r];
+        }
+    }
+
+    int nearest(int r, int g, int b) const
+    {
+        const int cell = (r >> 3) << 10 | (g >> 3) << 5 | b >> 3;
+        const uchar *c = candidates.constData() + offsets[cell];
+        const int n = offsets[cell + 1] - offsets[cell];
+        int best = c[0], bestDist = INT_MAX;
+        for (int i = 0; i < n; ++i) {
+            const QRgb p = colors[c[i]];
+            const int dr = r - qRed(p), dg = g - qGreen(p), db = b - qBlue(p);
+            const int d = dr * dr + dg * dg + db * db;
+            if (d < bestDist) {
+                bestDist = d;
+                best = c[i];
+            }
+        }
+        return best;
+    }
+
+private:
+    // Adds the nearest and farthest squared distance along one axis from value
+    // to cell [8 * cell, 8 * cell + 7].
+    static void axis(int value, int cell, int *lo, int *hi)
+    {
+        const int from = cell * 8, to = from + 7;
+        const int near = value < from ? from - value : (value > to ? value - to : 0);
+        const int far = qMax(qAbs(value - from), qAbs(value - to));
+        *lo += near * near;
+        *hi += far * far;
+    }
+
+    QVector<QRgb> colors;
+    QVector<int> offsets;
+    QVector<uchar> candidates;
+};
+
+// 8x8 Bayer matrix, 0..63.
+const uchar Bayer[8][8] = {
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+inline int clampByte(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// Error diffusion is inherently sequential, so this runs on one thread. Rows
+// alternate direction and the error is kept in 1/16 units.
+void floydSteinberg(const QImage &img, const PaletteLookup &lookup, const QVector<QRgb> &palette,
+                    int transparent, uchar *bits, qsizetype bpl)
+{
+    const int w = img.width();
+    QVector<int> errors(2 * 3 * (w + 2), 0);
+    int *cur = errors.data(), *next = cur + 3 * (w + 2);
+    for (int y = 0; y < img.height(); ++y) {
+        const QRgb *s = reinterpret_cast<const QRgb *>(img.constScanLine(y));
+        uchar *d = bits + y * bpl;
+        const bool forward = (y & 1) == 0;
+        const int dir = forward ? 1 : -1;
+        std::fill(next, next + 3 * (w + 2), 0);
+        for (int i = 0; i < w; ++i) {
+            const int x = forward ? i : w - 1 - i;
+            if (transparent >= 0 && isTransparent(s[x])) {
+                d[x] = uchar(transparent);
+                continue;
+            }
+            int *e = cur + 3 * (x + 1);
+            const int want[3] = { clampByte(qRed(s[x]) + ((e[0] + 8) >> 4)),
+                                  clampByte(qGreen(s[x]) + ((e[1] + 8) >> 4)),
+                                  clampByte(qBlue(s[x]) + ((e[2] + 8) >> 4)) };
+            const int index = lookup.nearest(want[0], want[1], want[2]);
+            d[x] = uchar(index);
+            const QRgb p = palette[index];
+            const int got[3] = { qRed(p), qGreen(p), qBlue(p) };
+            int *ahead = e + 3 * dir;
+            int *below = next + 3 * (x + 1);
+            for (int c = 0; c < 3; ++c) {
+                const int err = want[c] - got[c];
+                ahead[c] += err * 7;
+                below[c - 3 * dir] += err * 3;
+                below[c] += err * 5;
+                below[c + 3 * dir] += err;
+            }
+        }
+        std::swap(cur, next);
+    }
+}
+
+} // namespace
+
+QVector<QRgb> buildPalette(const QImage &src, int colors, QuantizeMethod method)
+{
+    colors = qBound(1, colors, 256);
+    if (src.isNull())
+        return QVector<QRgb>();
+    const QImage img = src.convertToFormat(QImage::Format_ARGB32);
+    QVector<QRgb> palette;
+    if (exactPalette(img, colors, &palette))
+        return palette;
+    const QVector<Bin> bins = colorHistogram(img);
+    palette = octreePalette(bins, colors);
+    if (method == QuantizeKMeans)
+        palette = kmeansPalette(bins, palette);
+    return palette;
+}
+
+QImage remapToPalette(const QImage &src, const QVector<QRgb> &palette, DitherMode dither)
+{
+    if (src.isNull())
+        return QImage();
+    const QImage img = src.convertToFormat(QImage::Format_ARGB32);
+    const int w = img.width();
+    const bool hasTransparent = hasTransparentPixels(img);
+
+    QVector<QRgb> table = palette.mid(0, hasTransparent ? 255 : 256);
+    for (QRgb &c : table)
+        c |= 0xff000000u;
+    if (table.isEmpty())
+        table.append(qRgb(0, 0, 0));
+    const int transparent = hasTransparent ? int(table.size()) : -1;
+    const PaletteLookup lookup(table);
+    if (hasTransparent)
+        table.append(qRgba(0, 0, 0, 0));
+
+    QImage out(img.size(), QImage::Format_Indexed8);
+    out.setColorTable(QList<QRgb>(table.begin(), table.end()));
+    uchar *bits = out.bits();
+    const qsizetype bpl = out.bytesPerLine();
+
+    if (dither == DitherFloydSteinberg) {
+        floydSteinberg(img, lookup, table, transparent, bits, bpl);
+        return out;
+    }
+
+    // Ordered dithering spreads the threshold over about half the spacing of
+    // an even palette of the same size; a full step looks noisier than no
+    // dithering at all with adaptive palettes.
+    const int spread = dither == DitherOrdered
+        ? qRound(96 / std::cbrt(double(qMax(2, transparent >= 0 ? transparent : int(table.size())))))
+        : 0;
+    parallelRows(img.rect(), 32, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const QRgb *s = reinterpret_cast<const QRgb *>(img.constScanLine(y));
+            uchar *d = bits + y * bpl;
+            for (int x = 0; x < w; ++x) {
+                if (transparent >= 0 && isTransparent(s[x])) {
+                    d[x] = uchar(transparent);
+                    continue;
+                }
+                const int offset = spread ? (Bayer[y & 7][x & 7] * 2 - 63) * spread / 128 : 0;
+                d[x] = uchar(lookup.nearest(clampByte(qRed(s[x]) + offset),
+                                            clampByte(qGreen(s[x]) + offset),
+                                            clampByte(qBlue(s[x]) + offset)));
+            }
+        }
+    });
+    return out;
+}
+
+QImage quantizeImage(const QImage &src, int colors, QuantizeMethod method, DitherMode dither)
+{
+    if (src.isNull())
+        return QImage();
+    colors = qBound(2, colors, 256);
+    const QImage img = src.convertToFormat(QImage::Format_ARGB32);
+    // Leave room for the transparent entry only if it will be needed.
+    const int opaque = hasTransparentPixels(img) ? colors - 1 : colors;
+    return remapToPalette(img, buildPalette(img, opaque, method), dither);
+}
+
+bool parseQuantizeMethod(const QString &text, QuantizeMethod *method)
+{
+    static const struct { const char *name; QuantizeMethod method; } names[] = {
+        { "octree", QuantizeOctree }, { "kmeans", QuantizeKMeans },
+    };
+    for (const auto &n : names)
+        if (text == QLatin1String(n.name)) {
+            *method = n.method;
+            return true;
+        }
+    return false;
+}
+
+bool parseDitherMode(const QString &text, DitherMode *dither)
+{
+    static const struct { const char *name; DitherMode dither; } names[] = {
+        { "none", DitherNone }, { "fs", DitherFloydSteinberg }, { "ordered", DitherOrdered },
+    };
+    for (const auto &n : names)
+        if (text == QLatin1String(n.name)) {
+            *dither = n.dither;
+            return true;
+        }
+    return false;
+}
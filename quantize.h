@@ -0,0 +1,30 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <QImage>
+#include <QString>
+#include <QVector>
+
+enum QuantizeMethod { QuantizeOctree, QuantizeKMeans };
+enum DitherMode { DitherNone, DitherFloydSteinberg, DitherOrdered };
+
+// Palette of at most colors entries for src. Both methods work on a histogram
+// with 5 bits per channel (sampled on large images) instead of the pixels:
+// the octree is merged bottom-up from its least used nodes, and k-means starts
+// from that palette and refines it with weighted Lloyd iterations.
+QVector<QRgb> buildPalette(const QImage &src, int colors, QuantizeMethod method = QuantizeKMeans);
+
+// Maps src onto palette as Indexed8. Nearest colours come from a 32^3 grid
+// whose cells keep only the entries that can be nearest anywhere inside them.
+// If src has pixels with alpha below 128, one extra transparent entry is
+// appended for them (so the palette should leave room for it).
+QImage remapToPalette(const QImage &src, const QVector<QRgb> &palette, DitherMode dither = DitherNone);
+
+// buildPalette() plus remapToPalette(), keeping colors entries in total.
+QImage quantizeImage(const QImage &src, int colors = 256, QuantizeMethod method = QuantizeKMeans,
+                     DitherMode dither = DitherFloydSteinberg);
+
+bool parseQuantizeMethod(const QString &text, QuantizeMethod *method);
+bool parseDitherMode(const QString &text, DitherMode *dither);
+
+#endif // QUANTIZE_H
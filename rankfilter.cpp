@@ -0,0 +1,224 @@
+#include "rankfilter.h"
+#include "scheduler.h"
+#include <QVector>
+#include <QtMath>
+#include <cstring>
+
+namespace {
+
+inline int clampTo(int v, int hi)
+{
+    return v < 0 ? 0 : (v > hi ? hi : v);
+}
+
+// One colour channel as a dense w x h plane.
+template <typename T>
+struct Plane
+{
+    QVector<T> data;
+    int w;
+    int h;
+
+    const T *row(int y) const { return data.constData() + qsizetype(y) * w; }
+    T *row(int y) { return data.data() + qsizetype(y) * w; }
+};
+
+template <typename T>
+Plane<T> extractPlane(const QImage &img, int comps, int ch)
+{
+    Plane<T> p;
+    p.w = img.width();
+    p.h = img.height();
+    p.data.resize(qsizetype(p.w) * p.h);
+    for (int y = 0; y < p.h; ++y) {
+        const T *s = reinterpret_cast<const T *>(img.constScanLine(y)) + ch;
+        T *d = p.row(y);
+        for (int x = 0; x < p.w; ++x, s += comps)
+            d[x] = *s;
+    }
+    return p;
+}
+
+template <typename T>
+void insertPlane(QImage &img, uchar *bits, int comps, int ch, const Plane<T> &p)
+{
+    const qsizetype bpl = img.bytesPerLine();
+    for (int y = 0; y < p.h; ++y) {
+        T *d = reinterpret_cast<T *>(bits + y * bpl) + ch;
+        const T *s = p.row(y);
+        for (int x = 0; x < p.w; ++x, d += comps)
+            *d = s[x];
+    }
+}
+
+// 8-bit: 16 coarse bins of 16 fine ones, per column and for the kernel. Moving
+// the kernel one pixel adds one column histogram and removes another, so the
+// cost does not depend on the radius.
+void rankBand8(const Plane<uchar> &src, Plane<uchar> &dst, int y0, int y1, int r, int rank)
+{
+    const int w = src.w, hMax = src.h - 1, wMax = w - 1;
+    QVector<quint16> colFine(qsizetype(w) * 256, 0), colCoarse(qsizetype(w) * 16, 0);
+    auto addRow = [&](int y, int delta) {
+        const uchar *row = src.row(clampTo(y, hMax));
+        for (int x = 0; x < w; ++x) {
+            colFine[x * 256 + row[x]] += quint16(delta);
+            colCoarse[x * 16 + (row[x] >> 4)] += quint16(delta);
+        }
+    };
+    for (int y = y0 - r; y <= y0 + r; ++y)
+        addRow(y, 1);
+
+    quint32 fine[256], coarse[16];
+    auto addColumn = [&](int x, int sign) {
+        const quint16 *f = colFine.constData() + clampTo(x, wMax) * 256;
+        const quint16 *c = colCoarse.constData() + clampTo(x, wMax) * 16;
+        for (int i = 0; i < 256; ++i)
+            fine[i] += quint32(sign * f[i]);
+        for (int i = 0; i < 16; ++i)
+            coarse[i] += quint32(sign * c[i]);
+    };
+
+    for (int y = y0; y < y1; ++y) {
+        if (y > y0) {
+            addRow(y - r - 1, -1);
+            addRow(y + r, 1);
+        }
+        memset(fine, 0, sizeof(fine));
+        memset(coarse, 0, sizeof(coarse));
+        for (int x = -r; x <= r; ++x)
+            addColumn(x, 1);
+        uchar *out = dst.row(y);
+        for (int x = 0; x < w; ++x) {
+            quint32 acc = 0;
+            int c = 0;
+            while (acc + coarse[c] <= quint32(rank))
+                acc += coarse[c++];
+            int f = c << 4;
+            while (acc + fine[f] <= quint32(rank))
+                acc += fine[f++];
+            out[x] = uchar(f);
+            if (x < wMax) {
+                addColumn(x + r + 1, 1);
+                addColumn(x - r, -1);
+            }
+        }
+    }
+}
+
+// 16-bit: the columns only keep 256 coarse bins of the high byte (a fine level
+// per column would be 128 KiB each); the kernel's fine histogram is updated from
+// the pixels of the entering and leaving columns.
+void rankBand16(const Plane<quint16> &src, Plane<quint16> &dst, int y0, int y1, int r, int rank)
+{
+    const int w = src.w, hMax = src.h - 1, wMax = w - 1;
+    const int n = 2 * r + 1;
+    QVector<quint16> colCoarse(qsizetype(w) * 256, 0);
+    auto addRow = [&](int y, int delta) {
+        const quint16 *row = src.row(clampTo(y, hMax));
+        for (int x = 0; x < w; ++x)
+            colCoarse[x * 256 + (row[x] >> 8)] += quint16(delta);
+    };
+    for (int y = y0 - r; y <= y0 + r; ++y)
+        addRow(y, 1);
+
+    QVector<quint32> fine(65536);
+    quint32 coarse[256];
+    QVector<const quint16 *> rows(n);
+    auto addColumn = [&](int x, int sign) {
+        x = clampTo(x, wMax);
+        const quint16 *c = colCoarse.constData() + x * 256;
+        for (int i = 0; i < 256; ++i)
+            coarse[i] += quint32(sign * c[i]);
+        quint32 *f = fine.data();
+        for (int j = 0; j < n; ++j)
+            f[rows[j][x]] += quint32(sign);
+    };
+
+    for (int y = y0; y < y1; ++y) {
+        if (y > y0) {
+            addRow(y - r - 1, -1);
+            addRow(y + r, 1);
+        }
+        for (int j = 0; j < n; ++j)
+            rows[j] = src.row(clampTo(y - r + j, hMax));
+        fine.fill(0);
+        memset(coarse, 0, sizeof(coarse));
+        for (int x = -r; x <= r; ++x)
+            addColumn(x, 1);
+        quint16 *out = dst.row(y);
+        for (int x = 0; x < w; ++x) {
+            quint32 acc = 0;
+            int c = 0;
+            while (acc + coarse[c] <= quint32(rank))
+                acc += coarse[c++];
+            int f = c << 8;
+            while (acc + fine[f] <= quint32(rank))
+                acc += fine[f++];
+            out[x] = quint16(f);
+            if (x < wMax) {
+                addColumn(x + r + 1, 1);
+                addColumn(x - r, -1);
+            }
+        }
+    }
+}
+
+template <typename T>
+void rankPlane(const Plane<T> &src, Plane<T> &dst, int r, int rank,
+               void (*band)(const Plane<T> &, Plane<T> &, int, int, int, int))
+{
+    // Each band starts by filling its column histograms with 2r + 1 rows, so
+    // bands are kept at least that tall.
+    const int workers = TaskScheduler::instance().workerCount() + 1;
+    const int bandRows = qMax(qMax(16, 2 * r + 1), (src.h + 4 * workers - 1) / (4 * workers));
+    const int bands = (src.h + bandRows - 1) / bandRows;
+    TaskScheduler::instance().run(bands, [&](int i) {
+        band(src, dst, i * bandRows, qMin(src.h, (i + 1) * bandRows), r, rank);
+    });
+}
+
+template <typename T>
+void rankChannels(QImage &img, int comps, const QList<int> &channels, int r, int rank,
+                  void (*band)(const Plane<T> &, Plane<T> &, int, int, int, int))
+{
+    uchar *bits = img.bits();
+    for (int ch : channels) {
+        const Plane<T> src = extractPlane<T>(img, comps, ch);
+        Plane<T> dst = src;
+        rankPlane<T>(src, dst, r, rank, band);
+        insertPlane<T>(img, bits, comps, ch, dst);
+    }
+}
+
+} // namespace
+
+QImage rankFilter(const QImage &src, int radius, double percentile)
+{
+    if (src.isNull() || radius < 1)
+        return src;
+    radius = qMin(radius, 2000);
+    const int n = (2 * radius + 1) * (2 * radius + 1);
+    const int rank = qBound(0, qRound(qBound(0.0, percentile, 100.0) / 100.0 * (n - 1)), n - 1);
+
+    QImage img;
+    switch (src.format()) {
+    case QImage::Format_Grayscale8:
+        img = src.copy();
+        rankChannels<uchar>(img, 1, { 0 }, radius, rank, rankBand8);
+        break;
+    case QImage::Format_Grayscale16:
+        img = src.copy();
+        rankChannels<quint16>(img, 1, { 0 }, radius, rank, rankBand16);
+        break;
+    default:
+        if (src.depth() == 64) {
+            img = src.convertToFormat(QImage::Format_RGBA64);
+            rankChannels<quint16>(img, 4, { 0, 1, 2 }, radius, rank, rankBand16);
+        } else {
+            img = src.convertToFormat(QImage::Format_ARGB32);
+            rankChannels<uchar>(img, 4, { 0, 1, 2 }, radius, rank, rankBand8);
+        }
+        break;
+    }
+    return img;
+}
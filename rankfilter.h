@@ -0,0 +1,22 @@
+#ifndef RANKFILTER_H
+#define RANKFILTER_H
+
+#include <QImage>
+
+// Replaces every pixel by the given percentile (0 = min, 50 = median, 100 = max)
+// of its (2 radius + 1)^2 neighbourhood, with edge pixels replicated.
+// Uses per-column histograms that slide down the image and a kernel histogram
+// that slides along each row (Perreault/Hebert), run band-parallel.
+// 8-bit data is constant time per pixel for any radius. 16-bit data keeps coarse
+// column histograms of the high byte and updates the fine level per pixel, which
+// is linear in the radius but never sorts.
+// Grayscale8/Grayscale16 are filtered as is; 64-bit formats per colour channel
+// as RGBA64, everything else per colour channel as ARGB32. Alpha is kept.
+QImage rankFilter(const QImage &src, int radius, double percentile = 50.0);
+
+inline QImage medianFilter(const QImage &src, int radius)
+{
+    return rankFilter(src, radius, 50.0);
+}
+
+#endif // RANKFILTER_H
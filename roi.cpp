@@ -0,0 +1,51 @@
+#include "roi.h"
+#include <cstring>
+
+static void releaseParent(void *info)
+{
+    delete static_cast<QImage *>(info);
+}
+
+QImage roiView(const QImage &img, const QRect &rect)
+{
+    const QRect r = rect.intersected(img.rect());
+    if (r.isEmpty())
+        return QImage();
+    if (img.depth() < 8)
+        return img.copy(r);
+
+    // A shallow copy of the parent rides along as cleanup info, holding a
+    // reference on the shared buffer until the view is destroyed.
+    QImage *parent = new QImage(img);
+    const uchar *data = parent->constScanLine(r.top()) + r.left() * (parent->depth() / 8);
+    QImage view(data, r.width(), r.height(), parent->bytesPerLine(), parent->format(),
+                releaseParent, parent);
+    if (parent->format() == QImage::Format_Indexed8)
+        view.setColorTable(parent->colorTable());
+    return view;
+}
+
+QImage roiWritableView(QImage &img, const QRect &rect)
+{
+    const QRect r = rect.intersected(img.rect());
+    if (r.isEmpty() || img.depth() < 8)
+        return QImage();
+    uchar *data = img.scanLine(r.top()) + r.left() * (img.depth() / 8);
+    QImage view(data, r.width(), r.height(), img.bytesPerLine(), img.format());
+    if (img.format() == QImage::Format_Indexed8)
+        view.setColorTable(img.colorTable());
+    return view;
+}
+
+void pasteRoi(QImage &img, const QPoint &pos, const QImage &patch)
+{
+    const QRect r = QRect(pos, patch.size()).intersected(img.rect());
+    if (r.isEmpty() || img.depth() < 8)
+        return;
+    const QImage src = patch.format() == img.format() ? patch : patch.convertToFormat(img.format());
+    const int bpp = img.depth() / 8;
+    const int sx = r.left() - pos.x(), sy = r.top() - pos.y();
+    for (int y = 0; y < r.height(); ++y)
+        memcpy(img.scanLine(r.top() + y) + r.left() * bpp,
+               src.constScanLine(sy + y) + sx * bpp, size_t(r.width()) * bpp);
+}
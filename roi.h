@@ -0,0 +1,19 @@
+#ifndef ROI_H
+#define ROI_H
+
+#include <QImage>
+#include <QRect>
+
+// Read-only image of rect inside img that shares img's pixel buffer: no pixels
+// are copied, and the view keeps the buffer alive on its own. Writing to the view
+// detaches it like any other QImage. Falls back to copy() for sub-byte formats.
+QImage roiView(const QImage &img, const QRect &rect);
+
+// Writable view of rect inside img. img is detached first, and the view writes
+// straight into its buffer, so it must not outlive img or a later detach of it.
+QImage roiWritableView(QImage &img, const QRect &rect);
+
+// Copies patch (converted to img's format) into img with its top-left corner at pos.
+void pasteRoi(QImage &img, const QPoint &pos, const QImage &patch);
+
+#endif // ROI_H
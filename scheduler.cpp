@@ -0,0 +1,298 @@
+#include "scheduler.h"
+#include <QMetaObject>
+#include <QThread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const int PriorityCount = 2;
+
+struct Task
+{
+    std::function<void()> fn;
+};
+
+struct Worker
+{
+    std::mutex lock;
+    std::deque<Task> queue[PriorityCount];
+};
+
+// What the task running on this thread was submitted with.
+struct Context
+{
+    TaskPriority priority;
+    const CancelToken *token;
+};
+
+thread_local Context current = { PriorityInteractive, nullptr };
+thread_local int workerIndex = -1;
+
+class ContextScope
+{
+public:
+    ContextScope(TaskPriority priority, const CancelToken *token) : saved(current)
+    {
+        current.priority = priority;
+        current.token = token;
+    }
+    ~ContextScope() { current = saved; }
+
+private:
+    Context saved;
+};
+
+} // namespace
+
+CancelToken::CancelToken() : flag(new QAtomicInt(0))
+{
+}
+
+void CancelToken::cancel()
+{
+    flag->storeRelease(1);
+}
+
+bool CancelToken::isCanceled() const
+{
+    return flag->loadAcquire() != 0;
+}
+
+struct TaskScheduler::Private
+{
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    std::atomic<int> pending { 0 };
+    std::atomic<unsigned> nextVictim { 0 };
+    bool stop = false;
+
+    void push(Task task, TaskPriority priority)
+    {
+        // Workers feed their own deque; other threads spread tasks round-robin.
+        const int n = int(workers.size());
+        const int target = workerIndex >= 0 ? workerIndex : int(nextVictim++ % unsigned(n));
+        {
+            std::lock_guard<std::mutex> guard(workers[target]->lock);
+            workers[target]->queue[priority].push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            ++pending;
+        }
+        wake.notify_one();
+    }
+
+    // Takes one task of at most maxPriority: interactive before batch, own
+    // newest first, then the oldest of another worker.
+    bool take(int maxPriority, Task *task)
+    {
+        const int n = int(workers.size());
+        const int self = workerIndex;
+        const int start = self >= 0 ? self : int(nextVictim % unsigned(n));
+        for (int p = 0; p <= maxPriority; ++p) {
+            for (int k = 0; k < n; ++k) {
+                const int i = (start + k) % n;
+                Worker *w = workers[i].get();
+                std::lock_guard<std::mutex> guard(w->lock);
+                std::deque<Task> &q = w->queue[p];
+                if (q.empty())
+                    continue;
+                if (i == self) {
+                    *task = std::move(q.back());
+                    q.pop_back();
+                } else {
+                    *task = std::move(q.front());
+                    q.pop_front();
+                }
+                --pending;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(int index)
+    {
+        workerIndex = index;
+        for (;;) {
+            Task task;
+            if (take(PriorityCount - 1, &task)) {
+                task.fn();
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(sleepLock);
+            wake.wait(guard, [this] { return stop || pending > 0; });
+            if (stop)
+                return;
+        }
+    }
+};
+
+TaskScheduler::TaskScheduler() : d(new Private)
+{
+    // The thread waiting in run() helps, so leave it a core.
+    const int n = qMax(1, QThread::idealThreadCount() - 1);
+    for (int i = 0; i < n; ++i)
+        d->workers.emplace_back(new Worker);
+    for (int i = 0; i < n; ++i)
+        d->threads.emplace_back(&Private::workerLoop, d, i);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        std::lock_guard<std::mutex> guard(d->sleepLock);
+        d->stop = true;
+    }
+    d->wake.notify_all();
+    for (std::thread &t : d->threads)
+        t.join();
+    delete d;
+}
+
+TaskScheduler &TaskScheduler::instance()
+{
+    static TaskScheduler scheduler;
+    return scheduler;
+}
+
+int TaskScheduler::workerCount() const
+{
+    return int(d->workers.size());
+}
+
+TaskPriority TaskScheduler::currentPriority()
+{
+    return current.priority;
+}
+
+bool TaskScheduler::isCanceled()
+{
+    return current.token && current.token->isCanceled();
+}
+
+void TaskScheduler::submit(const std::function<void()> &fn, TaskPriority priority,
+                           const CancelToken &token)
+{
+    Task task;
+    task.fn = [fn, priority, token]() {
+        if (token.isCanceled())
+            return;
+        ContextScope scope(priority, &token);
+        fn();
+    };
+    d->push(std::move(task), priority);
+}
+
+void TaskScheduler::run(int count, const std::function<void(int)> &fn)
+{
+    if (count <= 0)
+        return;
+    const Context ctx = current;
+    if (count == 1) {
+        if (!isCanceled())
+            fn(0);
+        return;
+    }
+
+    struct Group
+    {
+        std::atomic<int> remaining;
+        std::mutex lock;
+        std::condition_variable done;
+    };
+    // Shared, since the last item may still be signalling after run() returns.
+    std::shared_ptr<Group> group = std::make_shared<Group>();
+    group->remaining = count;
+    for (int i = 0; i < count; ++i) {
+        Task task;
+        task.fn = [group, ctx, &fn, i]() {
+            if (!(ctx.token && ctx.token->isCanceled())) {
+                ContextScope scope(ctx.priority, ctx.token);
+                fn(i);
+            }
+            if (--group->remaining == 0) {
+                std::lock_guard<std::mutex> guard(group->lock);
+                group->done.notify_all();
+            }
+        };
+        d->push(std::move(task), ctx.priority);
+    }
+
+    // Help out instead of blocking, but never with lower-priority work than ours.
+    while (group->remaining > 0) {
+        Task task;
+        if (d->take(ctx.priority, &task)) {
+            task.fn();
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(group->lock);
+        group->done.wait_for(guard, std::chrono::milliseconds(1),
+                             [&group] { return group->remaining == 0; });
+    }
+}
+
+struct ImageJob::Owner
+{
+    std::mutex lock;
+    ImageJob *job;
+};
+
+ImageJob::ImageJob(QObject *parent)
+    : QObject(parent), owner(new Owner), serial(0), running(false)
+{
+    owner->job = this;
+}
+
+ImageJob::~ImageJob()
+{
+    token.cancel();
+    std::lock_guard<std::mutex> guard(owner->lock);
+    owner->job = nullptr;
+}
+
+void ImageJob::start(const std::function<QImage()> &job, TaskPriority priority)
+{
+    token.cancel();
+    token = CancelToken();
+    running = true;
+    const int id = ++serial;
+    const CancelToken t = token;
+    const QSharedPointer<Owner> o = owner;
+    TaskScheduler::instance().submit([job, id, t, o]() {
+        const QImage image = job();
+        std::lock_guard<std::mutex> guard(o->lock);
+        if (o->job && !t.isCanceled())
+            QMetaObject::invokeMethod(o->job, "deliver", Qt::QueuedConnection,
+                                      Q_ARG(int, id), Q_ARG(QImage, image));
+    }, priority, t);
+}
+
+void ImageJob::cancel()
+{
+    token.cancel();
+    running = false;
+}
+
+bool ImageJob::isRunning() const
+{
+    return running;
+}
+
+void ImageJob::deliver(int id, const QImage &image)
+{
+    // A result can still be in the event queue when a newer job starts.
+    if (id != serial || token.isCanceled())
+        return;
+    running = false;
+    emit ready(image);
+}
@@ -0,0 +1,87 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <QObject>
+#include <QImage>
+#include <QSharedPointer>
+#include <QAtomicInt>
+#include <functional>
+
+// Interactive work (previews, dial drags) always runs before batch work.
+enum TaskPriority { PriorityInteractive, PriorityBatch };
+
+// Shared cancellation flag; copies refer to the same flag.
+class CancelToken
+{
+public:
+    CancelToken();
+    void cancel();
+    bool isCanceled() const;
+
+private:
+    QSharedPointer<QAtomicInt> flag;
+};
+
+// Process-wide work-stealing pool. Each worker owns a deque per priority, pops
+// its own newest task and steals the oldest from the others when it runs dry.
+class TaskScheduler
+{
+public:
+    static TaskScheduler &instance();
+
+    // Queues fn and returns at once. fn, and any run() it makes, sees priority
+    // and token as the current ones.
+    void submit(const std::function<void()> &fn, TaskPriority priority,
+                const CancelToken &token = CancelToken());
+
+    // Runs fn(i) for every i in [0, count) and returns when all have finished;
+    // the calling thread works on them too. Items inherit the caller's priority
+    // and token, and items not started yet when the token is canceled are skipped.
+    void run(int count, const std::function<void(int)> &fn);
+
+    // Priority and cancellation state of the task running on this thread.
+    // Threads outside the pool count as interactive and never canceled.
+    static TaskPriority currentPriority();
+    static bool isCanceled();
+
+    int workerCount() const;
+
+private:
+    TaskScheduler();
+    ~TaskScheduler();
+    Q_DISABLE_COPY(TaskScheduler)
+
+    struct Private;
+    Private *d;
+};
+
+// Computes one image at a time on the pool and hands it back to the thread this
+// object lives in through the queued ready() signal. Starting a new job cancels
+// the previous one, and results of superseded jobs are never delivered.
+class ImageJob : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ImageJob(QObject *parent = nullptr);
+    ~ImageJob();
+
+    void start(const std::function<QImage()> &job, TaskPriority priority = PriorityInteractive);
+    void cancel();
+    bool isRunning() const;
+
+signals:
+    void ready(const QImage &image);
+
+private slots:
+    void deliver(int serial, const QImage &image);
+
+private:
+    struct Owner;
+    QSharedPointer<Owner> owner;
+    CancelToken token;
+    int serial;
+    bool running;
+};
+
+#endif // SCHEDULER_H
@@ -0,0 +1,378 @@
+#include "stack.h"
+#include "ipxfile.h"
+#include "scheduler.h"
+#include "tiles.h"
+#include <QDir>
+#include <QImageReader>
+#include <QTemporaryDir>
+#include <QVector>
+#include <QtMath>
+#include <cstring>
+
+namespace {
+
+const int BandRows = 16;
+// Bytes of a row handled at once by median and sigma clipping, so the
+// per-lane state stays in L1 while it is swept once per frame.
+const int ChunkLanes = 4096;
+// Sigma clipping stops after this many passes even if values still drop out.
+const int MaxClipPasses = 5;
+
+void setError(QString *error, const QString &message)
+{
+    if (error)
+        *error = message;
+}
+
+bool probeFrame(const QString &path, QSize *size, bool *gray)
+{
+    if (isIpxFile(path)) {
+        IpxReader reader;
+        if (!reader.open(path))
+            return false;
+        *size = reader.size();
+        *gray = reader.channelCount() == 1;
+        return true;
+    }
+    QImageReader reader(path);
+    *size = reader.size();
+    *gray = reader.imageFormat() == QImage::Format_Grayscale8;
+    return size->isValid();
+}
+
+QImage readFrame(const QString &path, const QRect &rect, QImage::Format format)
+{
+    QImage img;
+    if (isIpxFile(path)) {
+        IpxReader reader;
+        if (reader.open(path))
+            img = reader.read(rect);
+    } else {
+        QImageReader reader(path);
+        reader.setClipRect(rect);
+        img = reader.read();
+    }
+    if (img.size() != rect.size())
+        return QImage();
+    return img.convertToFormat(format);
+}
+
+// The row kernels below treat every byte of a row as an independent lane and
+// sweep the frames in the outer loop, so the inner loops are plain byte and
+// float arithmetic the compiler vectorises.
+
+// out[i] = k-th smallest (0-based) of rows[f][i] over the frames, decided one
+// bit at a time from the top: the result is the largest value with at most k
+// values below it, and each bit costs one counting sweep.
+void selectLanes(const uchar *const *rows, int frames, int k, int n, uchar *out, quint16 *count)
+{
+    std::memset(out, 0, n);
+    for (int bit = 128; bit; bit >>= 1) {
+        std::memset(count, 0, n * sizeof(quint16));
+        for (int f = 0; f < frames; ++f) {
+            const uchar *v = rows[f];
+            for (int i = 0; i < n; ++i)
+                count[i] += v[i] < (out[i] | bit);
+        }
+        for (int i = 0; i < n; ++i)
+            if (count[i] <= k)
+                out[i] |= bit;
+    }
+}
+
+void medianLanes(const uchar *const *rows, int frames, int n, uchar *out, quint16 *count, uchar *above)
+{
+    const int half = frames / 2;
+    selectLanes(rows, frames, (frames - 1) / 2, n, out, count);
+    if (frames % 2)
+        return;
+    // Even count: average with the next order statistic, which is out itself
+    // when it occurs more than half times, else the smallest value above it.
+    std::memset(count, 0, n * sizeof(quint16));
+    std::memset(above, 255, n);
+    for (int f = 0; f < frames; ++f) {
+        const uchar *v = rows[f];
+        for (int i = 0; i < n; ++i) {
+            count[i] += v[i] <= out[i];
+            above[i] = v[i] > out[i] ? qMin(above[i], v[i]) : above[i];
+        }
+    }
+    for (int i = 0; i < n; ++i)
+        if (count[i] <= half)
+            out[i] = uchar((out[i] + above[i] + 1) / 2);
+}
+
+struct ClipScratch
+{
+    QVector<float> lo, hi, sum, sq;
+    QVector<quint16> count, kept;
+};
+
+void clipLanes(const uchar *const *rows, int frames, float kappa, int n, uchar *out, ClipScratch &s)
+{
+    s.lo.fill(-1.0f, n);
+    s.hi.fill(256.0f, n);
+    s.sum.resize(n);
+    s.sq.resize(n);
+    s.count.fill(quint16(frames), n);
+    s.kept.resize(n);
+    float *lo = s.lo.data(), *hi = s.hi.data(), *sum = s.sum.data(), *sq = s.sq.data();
+    quint16 *count = s.count.data(), *kept = s.kept.data();
+
+    for (int pass = 0; pass < MaxClipPasses; ++pass) {
+        std::memset(sum, 0, n * sizeof(float));
+        std::memset(sq, 0, n * sizeof(float));
+        std::memset(kept, 0, n * sizeof(quint16));
+        for (int f = 0; f < frames; ++f) {
+            const uchar *v = rows[f];
+            for (int i = 0; i < n; ++i) {
+                const float x = v[i];
+                const bool in = x >= lo[i] && x <= hi[i];
+                sum[i] += in ? x : 0.0f;
+                sq[i] += in ? x * x : 0.0f;
+                kept[i] += in;
+            }
+        }
+        bool changed = pass == 0;
+        for (int i = 0; i < n; ++i) {
+            changed |= kept[i] != count[i];
+            count[i] = kept[i];
+        }
+        if (!changed || pass == MaxClipPasses - 1)
+            break;
+        for (int i = 0; i < n; ++i) {
+            const float c = qMax<float>(count[i], 1);
+            const float mean = sum[i] / c;
+            // The epsilon keeps values exactly on the bound despite rounding
+            // in sq / c - mean^2.
+            const float reach = kappa * std::sqrt(qMax(0.0f, sq[i] / c - mean * mean)) + 0.01f;
+            lo[i] = mean - reach;
+            hi[i] = mean + reach;
+        }
+    }
+    for (int i = 0; i < n; ++i)
+        out[i] = uchar(qBound(0, int(sum[i] / qMax<float>(count[i], 1) + 0.5f), 255));
+}
+
+// Mean, min and max: frames are decoded a batch at a time and folded into
+// full-frame accumulators.
+bool streamStack(const QStringList &files, StackMode mode, QImage &out, QString *error)
+{
+    const int w = out.width(), h = out.height(), frames = int(files.size());
+    const int lanes = out.depth() / 8 * w;
+    const QRect area = out.rect();
+    uchar *outBits = out.bits();
+    const qsizetype outBpl = out.bytesPerLine();
+
+    QVector<quint32> sums;
+    if (mode == StackMean)
+        sums.fill(0, qsizetype(lanes) * h);
+    else
+        for (int y = 0; y < h; ++y)
+            std::memset(outBits + y * outBpl, mode == StackMin ? 255 : 0, lanes);
+    quint32 *sumBits = sums.data();
+
+    const int batchSize = qMax(1, TaskScheduler::instance().workerCount());
+    for (int first = 0; first < frames; first += batchSize) {
+        QVector<QImage> batch(qMin(batchSize, frames - first));
+        TaskScheduler::instance().run(int(batch.size()), [&](int i) {
+            batch[i] = readFrame(files[first + i], area, out.format());
+        });
+        if (TaskScheduler::isCanceled())
+            return false;
+        for (int i = 0; i < batch.size(); ++i)
+            if (batch[i].isNull()) {
+                setError(error, QStringLiteral("cannot read %1").arg(files[first + i]));
+                return false;
+            }
+
+        parallelRows(area, BandRows, [&](const QRect &band) {
+            for (int y = band.top(); y <= band.bottom(); ++y) {
+                uchar *d = outBits + y * outBpl;
+                quint32 *s = sumBits + qsizetype(y) * lanes;
+                for (const QImage &frame : batch) {
+                    const uchar *v = frame.constScanLine(y);
+                    if (mode == StackMean)
+                        for (int i = 0; i < lanes; ++i)
+                            s[i] += v[i];
+                    else if (mode == StackMin)
+                        for (int i = 0; i < lanes; ++i)
+                            d[i] = qMin(d[i], v[i]);
+                    else
+                        for (int i = 0; i < lanes; ++i)
+                            d[i] = qMax(d[i], v[i]);
+                }
+            }
+        });
+    }
+    if (TaskScheduler::isCanceled())
+        return false;
+
+    if (mode == StackMean)
+        parallelRows(area, BandRows, [&](const QRect &band) {
+            for (int y = band.top(); y <= band.bottom(); ++y) {
+                uchar *d = outBits + y * outBpl;
+                const quint32 *s = sumBits + qsizetype(y) * lanes;
+                for (int i = 0; i < lanes; ++i)
+                    d[i] = uchar((s[i] + frames / 2) / frames);
+            }
+        });
+    return true;
+}
+
+// A band read from a compressed frame decodes the whole frame again, so when
+// the stack takes more than one band each such frame is decoded once into an
+// IPX file in scratch and the bands are read from its tiles instead.
+bool spillFrames(QStringList &files, QImage::Format format, const QTemporaryDir &scratch,
+                 QString *error)
+{
+    const int frames = int(files.size());
+    QVector<QString> spilled(frames);
+    QVector<bool> failed(frames, false);
+    TaskScheduler::instance().run(frames, [&](int f) {
+        if (isIpxFile(files.at(f)) || TaskScheduler::isCanceled())
+            return;
+        QImageReader reader(files.at(f));
+        const QImage img = reader.read().convertToFormat(format);
+        const QString path = scratch.filePath(QStringLiteral("%1.ipx").arg(f));
+        if (img.isNull() || !saveIpx(img, path))
+            failed[f] = true;
+        else
+            spilled[f] = path;
+    });
+    if (TaskScheduler::isCanceled())
+        return false;
+    for (int f = 0; f < frames; ++f) {
+        if (failed[f]) {
+            setError(error, QStringLiteral("cannot read %1").arg(files[f]));
+            return false;
+        }
+        if (!spilled[f].isEmpty())
+            files[f] = spilled[f];
+    }
+    return true;
+}
+
+// Median and sigma clipping: every frame's copy of one band of rows is held
+// at once, and the band is as tall as memoryBudget allows.
+bool bandStack(QStringList files, StackMode mode, float kappa, qsizetype memoryBudget,
+               QImage &out, QString *error)
+{
+    const int w = out.width(), h = out.height(), frames = int(files.size());
+    const int lanes = out.depth() / 8 * w;
+    const int bandHeight = int(qBound<qsizetype>(1, memoryBudget / (qsizetype(frames) * lanes), h));
+    uchar *outBits = out.bits();
+    const qsizetype outBpl = out.bytesPerLine();
+
+    QTemporaryDir scratch;
+    if (bandHeight < h) {
+        if (!scratch.isValid()) {
+            setError(error, scratch.errorString());
+            return false;
+        }
+        if (!spillFrames(files, out.format(), scratch, error))
+            return false;
+    }
+
+    for (int y0 = 0; y0 < h; y0 += bandHeight) {
+        const QRect rect(0, y0, w, qMin(bandHeight, h - y0));
+        QVector<QImage> band(frames);
+        TaskScheduler::instance().run(frames, [&](int f) {
+            band[f] = readFrame(files[f], rect, out.format());
+        });
+        if (TaskScheduler::isCanceled())
+            return false;
+        for (int f = 0; f < frames; ++f)
+            if (band[f].isNull()) {
+                setError(error, QStringLiteral("cannot read %1").arg(files[f]));
+                return false;
+            }
+
+        parallelRows(QRect(0, 0, w, rect.height()), BandRows, [&](const QRect &rows) {
+            QVector<const uchar *> lines(frames);
+            QVector<quint16> count(ChunkLanes);
+            QVector<uchar> above(ChunkLanes);
+            ClipScratch clip;
+            for (int y = rows.top(); y <= rows.bottom(); ++y) {
+                uchar *d = outBits + (y0 + y) * outBpl;
+                for (int x = 0; x < lanes; x += ChunkLanes) {
+                    const int n = qMin(ChunkLanes, lanes - x);
+                    for (int f = 0; f < frames; ++f)
+                        lines[f] = band[f].constScanLine(y) + x;
+                    if (mode == StackMedian)
+                        medianLanes(lines.constData(), frames, n, d + x, count.data(), above.data());
+                    else
+                        clipLanes(lines.constData(), frames, kappa, n, d + x, clip);
+                }
+            }
+        });
+        if (TaskScheduler::isCanceled())
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool parseStackMode(const QString &text, StackMode *mode)
+{
+    static const struct { const char *name; StackMode mode; } names[] = {
+        { "mean", StackMean }, { "sigma", StackSigmaClip }, { "median", StackMedian },
+        { "min", StackMin }, { "max", StackMax },
+    };
+    for (const auto &n : names)
+        if (text == QLatin1String(n.name)) {
+            *mode = n.mode;
+            return true;
+        }
+    return false;
+}
+
+QStringList stackFrameFiles(const QString &dir)
+{
+    const QDir d(dir);
+    const QStringList names = d.entryList({ "*.png", "*.jpg", "*.jpeg", "*.bmp", "*.ppm", "*.pgm",
+                                            "*.tif", "*.tiff", "*.ipx" },
+                                          QDir::Files, QDir::Name);
+    QStringList files;
+    for (const QString &name : names)
+        files.append(d.filePath(name));
+    return files;
+}
+
+QImage stackFrames(const QStringList &files, StackMode mode, double clipSigma,
+                   qsizetype memoryBudget, QString *error)
+{
+    if (files.isEmpty()) {
+        setError(error, QStringLiteral("no frames"));
+        return QImage();
+    }
+    if (files.size() > 65535) {
+        setError(error, QStringLiteral("too many frames"));
+        return QImage();
+    }
+    QSize size;
+    bool allGray = true;
+    for (const QString &file : files) {
+        QSize s;
+        bool gray;
+        if (!probeFrame(file, &s, &gray)) {
+            setError(error, QStringLiteral("cannot read %1").arg(file));
+            return QImage();
+        }
+        if (size.isValid() && s != size) {
+            setError(error, QStringLiteral("%1 is %2x%3, the other frames %4x%5")
+                                .arg(file).arg(s.width()).arg(s.height())
+                                .arg(size.width()).arg(size.height()));
+            return QImage();
+        }
+        size = s;
+        allGray = allGray && gray;
+    }
+
+    QImage out(size, allGray ? QImage::Format_Grayscale8 : QImage::Format_ARGB32);
+    const bool ok = mode == StackMedian || mode == StackSigmaClip
+        ? bandStack(files, mode, float(qMax(1.0, clipSigma)), memoryBudget, out, error)
+        : streamStack(files, mode, out, error);
+    return ok ? out : QImage();
+}
@@ -0,0 +1,41 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include <QImage>
+#include <QString>
+#include <QStringList>
+
+// How the frames of a burst are combined, per pixel and channel.
+enum StackMode {
+    StackMean,       // average
+    StackSigmaClip,  // average after dropping outliers beyond clipSigma (>= 1) deviations
+    StackMedian,
+    StackMin,
+    StackMax
+};
+
+// Parses "mean", "sigma", "median", "min" and "max".
+bool parseStackMode(const QString &text, StackMode *mode);
+
+// Image files in dir (png, jpg, bmp, ppm/pgm, tif, ipx), sorted by name.
+QStringList stackFrameFiles(const QString &dir);
+
+// Combines already aligned frames of one size into a single image; the result
+// is Grayscale8 when every frame is, ARGB32 otherwise.
+//
+// Mean, min and max stream the frames: a few are decoded at a time, in
+// parallel, and folded into 32-bit per-channel accumulators, so memory does
+// not grow with the frame count. Median and sigma clipping need every value
+// of a pixel at once; they work through the frame a band of rows at a time,
+// with the band height chosen so the band of all frames fits memoryBudget
+// bytes, and read only the tiles of each IPX frame that band touches. When
+// that takes more than one band, other formats are first decoded once each
+// into temporary IPX files. Sigma clipping repeats mean and standard
+// deviation over the surviving values until no more are dropped.
+//
+// Returns a null image, with error set, when a frame cannot be read or the
+// sizes differ, and a null image when the calling job is canceled.
+QImage stackFrames(const QStringList &files, StackMode mode, double clipSigma = 2.5,
+                   qsizetype memoryBudget = qsizetype(512) << 20, QString *error = nullptr);
+
+#endif // STACK_H
@@ -0,0 +1,108 @@
+#include "startup.h"
+#include "scheduler.h"
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QImageReader>
+#include <QMutex>
+#include <QTextStream>
+#include <QVector>
+
+namespace {
+
+struct Mark
+{
+    const char *what;
+    qint64 nsecs;
+};
+
+struct Trace
+{
+    bool enabled = false;
+    QElapsedTimer clock;
+    QMutex mutex;
+    QVector<Mark> marks;
+    qint64 ready = -1;
+};
+
+Trace &trace()
+{
+    static Trace t;
+    return t;
+}
+
+} // namespace
+
+void startupTraceBegin(bool enabled)
+{
+    Trace &t = trace();
+    t.enabled = enabled;
+    if (enabled) {
+        t.clock.start();
+        startupMark("main");
+    }
+}
+
+bool startupTraceEnabled()
+{
+    return trace().enabled;
+}
+
+void startupMark(const char *what)
+{
+    Trace &t = trace();
+    if (!t.enabled)
+        return;
+    QMutexLocker lock(&t.mutex);
+    t.marks.append(Mark{ what, t.clock.nsecsElapsed() });
+}
+
+void startupReady()
+{
+    Trace &t = trace();
+    if (!t.enabled)
+        return;
+    startupMark("ready");
+    QMutexLocker lock(&t.mutex);
+    t.ready = t.marks.last().nsecs;
+}
+
+void startupReport()
+{
+    Trace &t = trace();
+    if (!t.enabled)
+        return;
+    QMutexLocker lock(&t.mutex);
+    QTextStream err(stderr);
+    err << "startup trace (ms since main, step)\n";
+    qint64 last = 0;
+    for (const Mark &m : t.marks) {
+        err << QString::asprintf("  %8.1f  %7.1f  %s\n", m.nsecs / 1e6, (m.nsecs - last) / 1e6, m.what);
+        last = m.nsecs;
+    }
+    if (t.ready >= 0) {
+        const double ready = t.ready / 1e6;
+        err << QString::asprintf("ready after %.1f ms, target %d ms%s\n", ready, StartupTargetMs,
+                                 ready > StartupTargetMs ? " (over)" : "");
+    }
+}
+
+void warmUp()
+{
+    TaskScheduler::instance();
+    // Enumerating the formats loads the plugin index; writing and reading a
+    // tiny JPEG loads the plugin library itself (PNG and BMP are built in).
+    QImageReader::supportedImageFormats();
+    QByteArray data;
+    QBuffer buffer(&data);
+    QImage probe(8, 8, QImage::Format_RGB32);
+    probe.fill(0);
+    if (buffer.open(QIODevice::WriteOnly) && probe.save(&buffer, "JPEG"))
+        QImage::fromData(data, "JPEG");
+    startupMark("warm-up done");
+}
+
+void warmUpInBackground()
+{
+    TaskScheduler::instance().submit(warmUp, PriorityBatch);
+}
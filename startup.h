@@ -0,0 +1,24 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+// Cold start budget of the GUI, from main() until the first window is up and
+// the event loop has gone idle; --startup-trace reports against it.
+const int StartupTargetMs = 250;
+
+// Startup timing for "ImagerProcessor --startup-trace". startupTraceBegin()
+// is the first thing main() does and startupReady() marks the end of the
+// cold start; marks are cheap no-ops without the flag and may come from any
+// thread. startupReport() prints them on stderr.
+void startupTraceBegin(bool enabled);
+bool startupTraceEnabled();
+void startupMark(const char *what);
+void startupReady();
+void startupReport();
+
+// Spins up the worker pool and loads the image-format plugins, so the first
+// open or save does not pay for them. warmUpInBackground() runs warmUp() on a
+// batch task once the main window is showing.
+void warmUp();
+void warmUpInBackground();
+
+#endif // STARTUP_H
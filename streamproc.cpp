@@ -0,0 +1,1046 @@
+#include "streamproc.h"
+#include "scheduler.h"
+#include "tiles.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QSaveFile>
+#include <QVector>
+#include <QtMath>
+#include <QtEndian>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#ifdef HAVE_LIBJPEG
+#include <cstdio>
+#include <csetjmp>
+#include <jpeglib.h>
+#include <jerror.h>
+#endif
+#ifdef HAVE_LIBPNG
+#include <png.h>
+#endif
+
+namespace {
+
+enum StreamFormat { UnknownFormat, PnmFormat, BmpFormat, JpegFormat, PngFormat };
+
+StreamFormat formatOf(const QString &path)
+{
+    const QString suffix = QFileInfo(path).suffix().toLower();
+    if (suffix == "ppm" || suffix == "pgm" || suffix == "pnm")
+        return PnmFormat;
+    if (suffix == "bmp")
+        return BmpFormat;
+#ifdef HAVE_LIBJPEG
+    if (suffix == "jpg" || suffix == "jpeg")
+        return JpegFormat;
+#endif
+#ifdef HAVE_LIBPNG
+    if (suffix == "png")
+        return PngFormat;
+#endif
+    return UnknownFormat;
+}
+
+//------------------------------------------------------------------------------
+// Readers: fill rows [0, count) of an ARGB32 band with the next scanlines.
+
+class BandReader
+{
+public:
+    virtual ~BandReader() {}
+    virtual bool open(QIODevice *dev, QString *error) = 0;
+    virtual bool read(QImage &band, int count) = 0;
+    int width() const { return w; }
+    int height() const { return h; }
+
+protected:
+    int w = 0;
+    int h = 0;
+};
+
+class PnmReader : public BandReader
+{
+public:
+    bool open(QIODevice *d, QString *error) override
+    {
+        dev = d;
+        const QByteArray magic = token();
+        bool okW, okH, okM;
+        w = token().toInt(&okW);
+        h = token().toInt(&okH);
+        maxVal = token().toInt(&okM);
+        if ((magic != "P5" && magic != "P6") || !okW || !okH || !okM
+            || w <= 0 || h <= 0 || maxVal <= 0 || maxVal > 65535) {
+            *error = QStringLiteral("unsupported PNM header");
+            return false;
+        }
+        channels = magic == "P6" ? 3 : 1;
+        sampleBytes = maxVal > 255 ? 2 : 1;
+        return true;
+    }
+
+    bool read(QImage &band, int count) override
+    {
+        const qsizetype rowBytes = qsizetype(w) * channels * sampleBytes;
+        buf.resize(rowBytes * count);
+        if (dev->read(buf.data(), buf.size()) != buf.size())
+            return false;
+        for (int y = 0; y < count; ++y) {
+            const uchar *s = reinterpret_cast<const uchar *>(buf.constData()) + y * rowBytes;
+            QRgb *d = reinterpret_cast<QRgb *>(band.scanLine(y));
+            for (int x = 0; x < w; ++x) {
+                int v[3];
+                for (int c = 0; c < channels; ++c, s += sampleBytes) {
+                    const int raw = sampleBytes == 2 ? (s[0] << 8 | s[1]) : s[0];
+                    v[c] = raw * 255 / maxVal;
+                }
+                d[x] = channels == 3 ? qRgb(v[0], v[1], v[2]) : qRgb(v[0], v[0], v[0]);
+            }
+        }
+        return true;
+    }
+
+private:
+    QByteArray token()
+    {
+        QByteArray tok;
+        char c;
+        while (dev->getChar(&c)) {
+            if (c == '#') {
+                while (dev->getChar(&c) && c != '\n') {}
+                continue;
+            }
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+                if (!tok.isEmpty())
+                    break;
+                continue;
+            }
+            tok.append(c);
+        }
+        return tok;
+    }
+
+    QIODevice *dev = nullptr;
+    QByteArray buf;
+    int maxVal = 255;
+    int channels = 3;
+    int sampleBytes = 1;
+};
+
+class BmpReader : public BandReader
+{
+public:
+    bool open(QIODevice *d, QString *error) override
+    {
+        dev = d;
+        uchar hdr[54];
+        if (dev->read(reinterpret_cast<char *>(hdr), sizeof(hdr)) != qint64(sizeof(hdr))
+            || hdr[0] != 'B' || hdr[1] != 'M') {
+            *error = QStringLiteral("not a BMP file");
+            return false;
+        }
+        offset = qFromLittleEndian<quint32>(hdr + 10);
+        w = qFromLittleEndian<qint32>(hdr + 18);
+        const qint32 rawH = qFromLittleEndian<qint32>(hdr + 22);
+        bpp = qFromLittleEndian<quint16>(hdr + 28);
+        const quint32 compression = qFromLittleEndian<quint32>(hdr + 30);
+        topDown = rawH < 0;
+        h = topDown ? -rawH : rawH;
+        if (w <= 0 || h <= 0 || (bpp != 24 && bpp != 32) || compression != 0) {
+            *error = QStringLiteral("only uncompressed 24/32-bit BMP can be streamed");
+            return false;
+        }
+        stride = (qsizetype(w) * bpp + 31) / 32 * 4;
+        return true;
+    }
+
+    bool read(QImage &band, int count) override
+    {
+        // Bottom-up files store the band's rows contiguously but in reverse.
+        const int first = topDown ? row : h - row - count;
+        buf.resize(stride * count);
+        if (!dev->seek(offset + qint64(first) * stride)
+            || dev->read(buf.data(), buf.size()) != buf.size())
+            return false;
+        for (int y = 0; y < count; ++y) {
+            const int fileRow = topDown ? y : count - 1 - y;
+            const uchar *s = reinterpret_cast<const uchar *>(buf.constData()) + fileRow * stride;
+            QRgb *d = reinterpret_cast<QRgb *>(band.scanLine(y));
+            const int step = bpp / 8;
+            for (int x = 0; x < w; ++x, s += step)
+                d[x] = qRgb(s[2], s[1], s[0]);
+        }
+        row += count;
+        return true;
+    }
+
+private:
+    QIODevice *dev = nullptr;
+    QByteArray buf;
+    qint64 offset = 0;
+    qsizetype stride = 0;
+    int bpp = 24;
+    int row = 0;
+    bool topDown = false;
+};
+
+#ifdef HAVE_LIBJPEG
+
+struct JpegError
+{
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+};
+
+void jpegErrorExit(j_common_ptr cinfo)
+{
+    longjmp(reinterpret_cast<JpegError *>(cinfo->err)->jump, 1);
+}
+
+// libjpeg source/destination managers over a QIODevice, so file names never
+// have to go through FILE*.
+struct JpegSource
+{
+    jpeg_source_mgr pub;
+    QIODevice *dev;
+    JOCTET buf[65536];
+};
+
+void jpegInitSource(j_decompress_ptr) {}
+void jpegTermSource(j_decompress_ptr) {}
+
+boolean jpegFillInput(j_decompress_ptr cinfo)
+{
+    JpegSource *src = reinterpret_cast<JpegSource *>(cinfo->src);
+    qint64 n = src->dev->read(reinterpret_cast<char *>(src->buf), sizeof(src->buf));
+    if (n <= 0) {
+        // Premature end: feed a fake EOI, as libjpeg's own stdio source does.
+        src->buf[0] = 0xff;
+        src->buf[1] = JPEG_EOI;
+        n = 2;
+    }
+    src->pub.next_input_byte = src->buf;
+    src->pub.bytes_in_buffer = size_t(n);
+    return TRUE;
+}
+
+void jpegSkipInput(j_decompress_ptr cinfo, long count)
+{
+    JpegSource *src = reinterpret_cast<JpegSource *>(cinfo->src);
+    while (count > long(src->pub.bytes_in_buffer)) {
+        count -= long(src->pub.bytes_in_buffer);
+        jpegFillInput(cinfo);
+    }
+    src->pub.next_input_byte += count;
+    src->pub.bytes_in_buffer -= size_t(count);
+}
+
+class JpegReader : public BandReader
+{
+public:
+    ~JpegReader() override
+    {
+        if (started)
+            jpeg_destroy_decompress(&cinfo);
+    }
+
+    bool open(QIODevice *d, QString *error) override
+    {
+        src.dev = d;
+        cinfo.err = jpeg_std_error(&err.pub);
+        err.pub.error_exit = jpegErrorExit;
+        jpeg_create_decompress(&cinfo);
+        started = true;
+        if (setjmp(err.jump)) {
+            *error = QStringLiteral("JPEG decode error");
+            return false;
+        }
+        src.pub.init_source = jpegInitSource;
+        src.pub.fill_input_buffer = jpegFillInput;
+        src.pub.skip_input_data = jpegSkipInput;
+        src.pub.resync_to_restart = jpeg_resync_to_restart;
+        src.pub.term_source = jpegTermSource;
+        src.pub.bytes_in_buffer = 0;
+        src.pub.next_input_byte = nullptr;
+        cinfo.src = &src.pub;
+        jpeg_read_header(&cinfo, TRUE);
+        cinfo.out_color_space = JCS_RGB;
+        jpeg_start_decompress(&cinfo);
+        w = int(cinfo.output_width);
+        h = int(cinfo.output_height);
+        row.resize(qsizetype(w) * 3);
+        return true;
+    }
+
+    bool read(QImage &band, int count) override
+    {
+        if (setjmp(err.jump))
+            return false;
+        for (int y = 0; y < count; ++y) {
+            JSAMPROW r = reinterpret_cast<JSAMPROW>(row.data());
+            if (jpeg_read_scanlines(&cinfo, &r, 1) != 1)
+                return false;
+            const uchar *s = reinterpret_cast<const uchar *>(row.constData());
+            QRgb *d = reinterpret_cast<QRgb *>(band.scanLine(y));
+            for (int x = 0; x < w; ++x, s += 3)
+                d[x] = qRgb(s[0], s[1], s[2]);
+        }
+        return true;
+    }
+
+private:
+    jpeg_decompress_struct cinfo;
+    JpegError err;
+    JpegSource src;
+    QByteArray row;
+    bool started = false;
+};
+
+#endif // HAVE_LIBJPEG
+
+#ifdef HAVE_LIBPNG
+
+void pngRead(png_structp png, png_bytep data, png_size_t length)
+{
+    QIODevice *dev = static_cast<QIODevice *>(png_get_io_ptr(png));
+    if (dev->read(reinterpret_cast<char *>(data), qint64(length)) != qint64(length))
+        png_error(png, "read error");
+}
+
+void pngWrite(png_structp png, png_bytep data, png_size_t length)
+{
+    QIODevice *dev = static_cast<QIODevice *>(png_get_io_ptr(png));
+    if (dev->write(reinterpret_cast<const char *>(data), qint64(length)) != qint64(length))
+        png_error(png, "write error");
+}
+
+void pngFlush(png_structp) {}
+
+class PngReader : public BandReader
+{
+public:
+    ~PngReader() override
+    {
+        if (png)
+            png_destroy_read_struct(&png, &info, nullptr);
+    }
+
+    bool open(QIODevice *d, QString *error) override
+    {
+        png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        info = png ? png_create_info_struct(png) : nullptr;
+        if (!info || setjmp(png_jmpbuf(png))) {
+            *error = QStringLiteral("PNG decode error");
+            return false;
+        }
+        png_set_read_fn(png, d, pngRead);
+        png_read_info(png, info);
+        if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE) {
+            *error = QStringLiteral("interlaced PNG cannot be streamed");
+            return false;
+        }
+        // Always hand out 8-bit BGRA, which is ARGB32 in memory.
+        png_set_expand(png);
+        png_set_strip_16(png);
+        png_set_gray_to_rgb(png);
+        png_set_bgr(png);
+        png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+        png_read_update_info(png, info);
+        w = int(png_get_image_width(png, info));
+        h = int(png_get_image_height(png, info));
+        return true;
+    }
+
+    bool read(QImage &band, int count) override
+    {
+        if (setjmp(png_jmpbuf(png)))
+            return false;
+        for (int y = 0; y < count; ++y)
+            png_read_row(png, band.scanLine(y), nullptr);
+        return true;
+    }
+
+private:
+    png_structp png = nullptr;
+    png_infop info = nullptr;
+};
+
+#endif // HAVE_LIBPNG
+
+std::unique_ptr<BandReader> makeReader(StreamFormat format)
+{
+    switch (format) {
+    case PnmFormat: return std::unique_ptr<BandReader>(new PnmReader);
+    case BmpFormat: return std::unique_ptr<BandReader>(new BmpReader);
+#ifdef HAVE_LIBJPEG
+    case JpegFormat: return std::unique_ptr<BandReader>(new JpegReader);
+#endif
+#ifdef HAVE_LIBPNG
+    case PngFormat: return std::unique_ptr<BandReader>(new PngReader);
+#endif
+    default: return nullptr;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Writers: encode rows [0, count) of an ARGB32 band.
+
+class BandWriter
+{
+public:
+    virtual ~BandWriter() {}
+    virtual bool open(QIODevice *dev, int w, int h) = 0;
+    virtual bool write(const QImage &band, int count) = 0;
+    virtual bool finish() { return true; }
+};
+
+class PnmWriter : public BandWriter
+{
+public:
+    bool open(QIODevice *d, int width, int height) override
+    {
+        dev = d;
+        w = width;
+        return dev->write(QString("P6\n%1 %2\n255\n").arg(width).arg(height).toLatin1()) > 0;
+    }
+
+    bool write(const QImage &band, int count) override
+    {
+        buf.resize(qsizetype(w) * 3);
+        for (int y = 0; y < count; ++y) {
+            const QRgb *s = reinterpret_cast<const QRgb *>(band.constScanLine(y));
+            uchar *d = reinterpret_cast<uchar *>(buf.data());
+            for (int x = 0; x < w; ++x) {
+                *d++ = uchar(qRed(s[x]));
+                *d++ = uchar(qGreen(s[x]));
+                *d++ = uchar(qBlue(s[x]));
+            }
+            if (dev->write(buf) != buf.size())
+                return false;
+        }
+        return true;
+    }
+
+private:
+    QIODevice *dev = nullptr;
+    QByteArray buf;
+    int w = 0;
+};
+
+class BmpWriter : public BandWriter
+{
+public:
+    bool open(QIODevice *d, int width, int height) override
+    {
+        dev = d;
+        w = width;
+        // 32-bit rows need no padding, and a negative height makes the file
+        // top-down so rows can be appended in order.
+        const quint32 imageBytes = quint32(qsizetype(width) * height * 4);
+        uchar hdr[54] = {};
+        hdr[0] = 'B';
+        hdr[1] = 'M';
+        qToLittleEndian<quint32>(54 + imageBytes, hdr + 2);
+        qToLittleEndian<quint32>(54, hdr + 10);
+        qToLittleEndian<quint32>(40, hdr + 14);
+        qToLittleEndian<qint32>(width, hdr + 18);
+        qToLittleEndian<qint32>(-height, hdr + 22);
+        qToLittleEndian<quint16>(1, hdr + 26);
+        qToLittleEndian<quint16>(32, hdr + 28);
+        qToLittleEndian<quint32>(imageBytes, hdr + 34);
+        return dev->write(reinterpret_cast<const char *>(hdr), sizeof(hdr)) == qint64(sizeof(hdr));
+    }
+
+    bool write(const QImage &band, int count) override
+    {
+        // ARGB32 is already BGRA byte order in memory.
+        for (int y = 0; y < count; ++y)
+            if (dev->write(reinterpret_cast<const char *>(band.constScanLine(y)), qint64(w) * 4)
+                != qint64(w) * 4)
+                return false;
+        return true;
+    }
+
+private:
+    QIODevice *dev = nullptr;
+    int w = 0;
+};
+
+#ifdef HAVE_LIBJPEG
+
+struct JpegDest
+{
+    jpeg_destination_mgr pub;
+    QIODevice *dev;
+    JOCTET buf[65536];
+};
+
+void jpegInitDest(j_compress_ptr cinfo)
+{
+    JpegDest *dst = reinterpret_cast<JpegDest *>(cinfo->dest);
+    dst->pub.next_output_byte = dst->buf;
+    dst->pub.free_in_buffer = sizeof(dst->buf);
+}
+
+boolean jpegEmptyOutput(j_compress_ptr cinfo)
+{
+    JpegDest *dst = reinterpret_cast<JpegDest *>(cinfo->dest);
+    if (dst->dev->write(reinterpret_cast<const char *>(dst->buf), sizeof(dst->buf))
+        != qint64(sizeof(dst->buf)))
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+    jpegInitDest(cinfo);
+    return TRUE;
+}
+
+void jpegTermDest(j_compress_ptr cinfo)
+{
+    JpegDest *dst = reinterpret_cast<JpegDest *>(cinfo->dest);
+    const qint64 n = qint64(sizeof(dst->buf) - dst->pub.free_in_buffer);
+    if (n > 0 && dst->dev->write(reinterpret_cast<const char *>(dst->buf), n) != n)
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+}
+
+class JpegWriter : public BandWriter
+{
+public:
+    ~JpegWriter() override
+    {
+        if (started)
+            jpeg_destroy_compress(&cinfo);
+    }
+
+    bool open(QIODevice *d, int width, int height) override
+    {
+        cinfo.err = jpeg_std_error(&err.pub);
+        err.pub.error_exit = jpegErrorExit;
+        jpeg_create_compress(&cinfo);
+        started = true;
+        if (setjmp(err.jump))
+            return false;
+        dst.dev = d;
+        dst.pub.init_destination = jpegInitDest;
+        dst.pub.empty_output_buffer = jpegEmptyOutput;
+        dst.pub.term_destination = jpegTermDest;
+        cinfo.dest = &dst.pub;
+        cinfo.image_width = JDIMENSION(width);
+        cinfo.image_height = JDIMENSION(height);
+        cinfo.input_components = 3;
+        cinfo.in_color_space = JCS_RGB;
+        jpeg_set_defaults(&cinfo);
+        jpeg_set_quality(&cinfo, 90, TRUE);
+        jpeg_start_compress(&cinfo, TRUE);
+        w = width;
+        row.resize(qsizetype(width) * 3);
+        return true;
+    }
+
+    bool write(const QImage &band, int count) override
+    {
+        if (setjmp(err.jump))
+            return false;
+        for (int y = 0; y < count; ++y) {
+            const QRgb *s = reinterpret_cast<const QRgb *>(band.constScanLine(y));
+            uchar *d = reinterpret_cast<uchar *>(row.data());
+            for (int x = 0; x < w; ++x) {
+                *d++ = uchar(qRed(s[x]));
+                *d++ = uchar(qGreen(s[x]));
+                *d++ = uchar(qBlue(s[x]));
+            }
+            JSAMPROW r = reinterpret_cast<JSAMPROW>(row.data());
+            jpeg_write_scanlines(&cinfo, &r, 1);
+        }
+        return true;
+    }
+
+    bool finish() override
+    {
+        if (setjmp(err.jump))
+            return false;
+        jpeg_finish_compress(&cinfo);
+        return true;
+    }
+
+private:
+    jpeg_compress_struct cinfo;
+    JpegError err;
+    JpegDest dst;
+    QByteArray row;
+    int w = 0;
+    bool started = false;
+};
+
+#endif // HAVE_LIBJPEG
+
+#ifdef HAVE_LIBPNG
+
+class PngWriter : public BandWriter
+{
+public:
+    ~PngWriter() override
+    {
+        if (png)
+            png_destroy_write_struct(&png, &info);
+    }
+
+    bool open(QIODevice *d, int width, int height) override
+    {
+        png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+        info = png ? png_create_info_struct(png) : nullptr;
+        if (!info || setjmp(png_jmpbuf(png)))
+            return false;
+        png_set_write_fn(png, d, pngWrite, pngFlush);
+        png_set_IHDR(png, info, png_uint_32(width), png_uint_32(height), 8,
+                     PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+                     PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_write_info(png, info);
+        png_set_bgr(png);
+        return true;
+    }
+
+    bool write(const QImage &band, int count) override
+    {
+        if (setjmp(png_jmpbuf(png)))
+            return false;
+        for (int y = 0; y < count; ++y)
+            png_write_row(png, const_cast<png_bytep>(band.constScanLine(y)));
+        return true;
+    }
+
+    bool finish() override
+    {
+        if (setjmp(png_jmpbuf(png)))
+            return false;
+        png_write_end(png, info);
+        return true;
+    }
+
+private:
+    png_structp png = nullptr;
+    png_infop info = nullptr;
+};
+
+#endif // HAVE_LIBPNG
+
+std::unique_ptr<BandWriter> makeWriter(StreamFormat format)
+{
+    switch (format) {
+    case PnmFormat: return std::unique_ptr<BandWriter>(new PnmWriter);
+    case BmpFormat: return std::unique_ptr<BandWriter>(new BmpWriter);
+#ifdef HAVE_LIBJPEG
+    case JpegFormat: return std::unique_ptr<BandWriter>(new JpegWriter);
+#endif
+#ifdef HAVE_LIBPNG
+    case PngFormat: return std::unique_ptr<BandWriter>(new PngWriter);
+#endif
+    default: return nullptr;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Stages. Each one receives bands of rows, may modify them in place, and hands
+// bands on to the next stage; stages that change the geometry buffer their own
+// output band.
+
+class Stage
+{
+public:
+    virtual ~Stage() {}
+    // Called once with the incoming size, returns the size this stage produces.
+    virtual QSize begin(const QSize &in) { return in; }
+    virtual void push(QImage &band, int count) = 0;
+    virtual void finish() { if (next) next->finish(); }
+    Stage *next = nullptr;
+};
+
+class MirrorStage : public Stage
+{
+public:
+    void push(QImage &band, int count) override
+    {
+        const int w = band.width();
+        uchar *bits = band.bits();
+        const qsizetype bpl = band.bytesPerLine();
+        parallelRows(QRect(0, 0, w, count), 16, [&](const QRect &rows) {
+            for (int y = rows.top(); y <= rows.bottom(); ++y) {
+                QRgb *p = reinterpret_cast<QRgb *>(bits + y * bpl);
+                std::reverse(p, p + w);
+            }
+        });
+        next->push(band, count);
+    }
+};
+
+class PointStage : public Stage
+{
+public:
+    PointStage(StreamOp::Type type, double value) : gray(type == StreamOp::Gray)
+    {
+        for (int v = 0; v < 256; ++v) {
+            if (type == StreamOp::Invert)
+                lut[v] = uchar(255 - v);
+            else if (type == StreamOp::Gamma)
+                lut[v] = uchar(qRound(255.0 * qPow(v / 255.0, 1.0 / value)));
+            else
+                lut[v] = uchar(v);
+        }
+    }
+
+    void push(QImage &band, int count) override
+    {
+        const int w = band.width();
+        uchar *bits = band.bits();
+        const qsizetype bpl = band.bytesPerLine();
+        parallelRows(QRect(0, 0, w, count), 16, [&](const QRect &rows) {
+            for (int y = rows.top(); y <= rows.bottom(); ++y) {
+                QRgb *p = reinterpret_cast<QRgb *>(bits + y * bpl);
+                for (int x = 0; x < w; ++x) {
+                    const QRgb c = p[x];
+                    if (gray) {
+                        const int g = qGray(c);
+                        p[x] = qRgba(g, g, g, qAlpha(c));
+                    } else {
+                        p[x] = qRgba(lut[qRed(c)], lut[qGreen(c)], lut[qBlue(c)], qAlpha(c));
+                    }
+                }
+            }
+        });
+        next->push(band, count);
+    }
+
+private:
+    uchar lut[256];
+    bool gray;
+};
+
+// Base for stages that emit rows at their own pace.
+class BufferedStage : public Stage
+{
+public:
+    explicit BufferedStage(int bandRows) : bandRows(bandRows) {}
+
+    void finish() override
+    {
+        flushOut();
+        Stage::finish();
+    }
+
+protected:
+    void allocOut(int width)
+    {
+        out = QImage(width, bandRows, QImage::Format_ARGB32);
+        outRows = 0;
+    }
+
+    QRgb *nextOutRow()
+    {
+        if (outRows == bandRows)
+            flushOut();
+        return reinterpret_cast<QRgb *>(out.scanLine(outRows++));
+    }
+
+    void flushOut()
+    {
+        if (outRows > 0)
+            next->push(out, outRows);
+        outRows = 0;
+    }
+
+    QImage out;
+    int bandRows;
+    int outRows = 0;
+};
+
+class DownscaleStage : public BufferedStage
+{
+public:
+    DownscaleStage(int factor, int bandRows) : BufferedStage(bandRows), n(qMax(1, factor)) {}
+
+    QSize begin(const QSize &in) override
+    {
+        inW = in.width();
+        inH = in.height();
+        outW = (inW + n - 1) / n;
+        acc.fill(0, qsizetype(outW) * 4);
+        allocOut(outW);
+        return QSize(outW, (inH + n - 1) / n);
+    }
+
+    void push(QImage &band, int count) override
+    {
+        for (int y = 0; y < count; ++y) {
+            const QRgb *s = reinterpret_cast<const QRgb *>(band.constScanLine(y));
+            for (int x = 0; x < inW; ++x) {
+                quint32 *a = acc.data() + (x / n) * 4;
+                a[0] += qRed(s[x]);
+                a[1] += qGreen(s[x]);
+                a[2] += qBlue(s[x]);
+                a[3] += qAlpha(s[x]);
+            }
+            ++rowsIn;
+            if (++groupRows == n || rowsIn == inH)
+                emitRow();
+        }
+    }
+
+private:
+    void emitRow()
+    {
+        QRgb *d = nextOutRow();
+        for (int ox = 0; ox < outW; ++ox) {
+            const quint32 cols = quint32(qMin(n, inW - ox * n));
+            const quint32 area = cols * quint32(groupRows);
+            const quint32 *a = acc.constData() + ox * 4;
+            d[ox] = qRgba(int((a[0] + area / 2) / area), int((a[1] + area / 2) / area),
+                          int((a[2] + area / 2) / area), int((a[3] + area / 2) / area));
+        }
+        acc.fill(0);
+        groupRows = 0;
+    }
+
+    QVector<quint32> acc;
+    int n;
+    int inW = 0, inH = 0, outW = 0;
+    int rowsIn = 0;
+    int groupRows = 0;
+};
+
+// Separable Gaussian. Incoming rows are blurred horizontally into a ring of float
+// rows, and output row y is produced once row y+r has arrived, so only 2r plus one
+// band of rows is ever held. Both passes run over whole bands in parallel.
+class BlurStage : public BufferedStage
+{
+public:
+    BlurStage(double sigma, int bandRows) : BufferedStage(bandRows)
+    {
+        r = qMax(1, qCeil(3.0 * sigma));
+        kernel.resize(2 * r + 1);
+        float sum = 0;
+        for (int i = -r; i <= r; ++i)
+            sum += kernel[i + r] = float(qExp(-0.5 * i * i / (sigma * sigma)));
+        for (float &k : kernel)
+            k /= sum;
+        ringRows = 2 * r + bandRows;
+    }
+
+    QSize begin(const QSize &in) override
+    {
+        w = in.width();
+        h = in.height();
+        ring.fill(0.0f, qsizetype(ringRows) * w * 4);
+        allocOut(w);
+        return in;
+    }
+
+    void push(QImage &band, int count) override
+    {
+        const int first = rowsIn;
+        parallelRows(QRect(0, 0, w, count), 8, [&](const QRect &rows) {
+            for (int y = rows.top(); y <= rows.bottom(); ++y)
+                blurRow(reinterpret_cast<const QRgb *>(band.constScanLine(y)), slot(first + y));
+        });
+        rowsIn += count;
+        emitRows(rowsIn - r);
+    }
+
+    void finish() override
+    {
+        emitRows(h);
+        BufferedStage::finish();
+    }
+
+private:
+    float *slot(int y) { return ring.data() + qsizetype(y % ringRows) * w * 4; }
+
+    void blurRow(const QRgb *s, float *d)
+    {
+        for (int x = 0; x < w; ++x) {
+            float acc[4] = { 0, 0, 0, 0 };
+            for (int k = -r; k <= r; ++k) {
+                const QRgb p = s[qBound(0, x + k, w - 1)];
+                const float f = kernel[k + r];
+                acc[0] += f * qRed(p);
+                acc[1] += f * qGreen(p);
+                acc[2] += f * qBlue(p);
+                acc[3] += f * qAlpha(p);
+            }
+            for (int c = 0; c < 4; ++c)
+                d[x * 4 + c] = acc[c];
+        }
+    }
+
+    // Vertical pass for output rows [nextOut, end), rows past the last one read
+    // are clamped to it.
+    void emitRows(int end)
+    {
+        const int last = rowsIn - 1;
+        while (nextOut < end) {
+            if (outRows == bandRows)
+                flushOut();
+            const int count = qMin(end - nextOut, bandRows - outRows);
+            const int base = nextOut, outBase = outRows;
+            uchar *bits = out.bits();
+            const qsizetype bpl = out.bytesPerLine();
+            parallelRows(QRect(0, 0, w, count), 8, [&](const QRect &rows) {
+                for (int i = rows.top(); i <= rows.bottom(); ++i) {
+                    QRgb *d = reinterpret_cast<QRgb *>(bits + (outBase + i) * bpl);
+                    for (int x = 0; x < w; ++x) {
+                        float acc[4] = { 0, 0, 0, 0 };
+                        for (int k = -r; k <= r; ++k) {
+                            const float *s = slot(qBound(0, base + i + k, last)) + x * 4;
+                            for (int c = 0; c < 4; ++c)
+                                acc[c] += kernel[k + r] * s[c];
+                        }
+                        d[x] = qRgba(qBound(0, qRound(acc[0]), 255), qBound(0, qRound(acc[1]), 255),
+                                     qBound(0, qRound(acc[2]), 255), qBound(0, qRound(acc[3]), 255));
+                    }
+                }
+            });
+            nextOut += count;
+            outRows += count;
+        }
+    }
+
+    QVector<float> kernel;
+    QVector<float> ring;
+    int r;
+    int ringRows;
+    int w = 0, h = 0;
+    int rowsIn = 0;
+    int nextOut = 0;
+};
+
+class SinkStage : public Stage
+{
+public:
+    explicit SinkStage(BandWriter *writer) : writer(writer) {}
+
+    void push(QImage &band, int count) override
+    {
+        if (ok)
+            ok = writer->write(band, count);
+    }
+
+    void finish() override
+    {
+        if (ok)
+            ok = writer->finish();
+    }
+
+    BandWriter *writer;
+    bool ok = true;
+};
+
+} // namespace
+
+bool parseStreamOp(const QString &text, StreamOp *op)
+{
+    const QStringList parts = text.trimmed().toLower().split(':');
+    const QString name = parts.value(0);
+    bool ok = true;
+    const double value = parts.size() > 1 ? parts.at(1).toDouble(&ok) : 0.0;
+    if (!ok)
+        return false;
+    if (name == "hmirror")
+        *op = { StreamOp::HMirror, 0 };
+    else if (name == "invert")
+        *op = { StreamOp::Invert, 0 };
+    else if (name == "gray")
+        *op = { StreamOp::Gray, 0 };
+    else if (name == "gamma" && value > 0)
+        *op = { StreamOp::Gamma, value };
+    else if (name == "downscale" && value >= 1)
+        *op = { StreamOp::Downscale, value };
+    else if (name == "blur" && value > 0)
+        *op = { StreamOp::Blur, value };
+    else
+        return false;
+    return true;
+}
+
+bool streamFormatSupported(const QString &path)
+{
+    return formatOf(path) != UnknownFormat;
+}
+
+bool streamProcess(const QString &inPath, const QString &outPath,
+                   const QList<StreamOp> &ops, int bandRows, QString *error,
+                   const std::function<void(int rows, int total)> &progress)
+{
+    QString err;
+    auto fail = [&](const QString &msg) {
+        if (error)
+            *error = msg;
+        return false;
+    };
+
+    std::unique_ptr<BandReader> reader = makeReader(formatOf(inPath));
+    std::unique_ptr<BandWriter> writer = makeWriter(formatOf(outPath));
+    if (!reader)
+        return fail(QStringLiteral("cannot stream-decode %1").arg(inPath));
+    if (!writer)
+        return fail(QStringLiteral("cannot stream-encode %1").arg(outPath));
+
+    QFile in(inPath);
+    if (!in.open(QIODevice::ReadOnly))
+        return fail(in.errorString());
+    if (!reader->open(&in, &err))
+        return fail(err);
+
+    bandRows = qMax(1, bandRows);
+    std::vector<std::unique_ptr<Stage>> stages;
+    for (const StreamOp &op : ops) {
+        switch (op.type) {
+        case StreamOp::HMirror:
+            stages.emplace_back(new MirrorStage);
+            break;
+        case StreamOp::Invert:
+        case StreamOp::Gamma:
+        case StreamOp::Gray:
+            stages.emplace_back(new PointStage(op.type, op.value));
+            break;
+        case StreamOp::Downscale:
+            stages.emplace_back(new DownscaleStage(int(op.value), bandRows));
+            break;
+        case StreamOp::Blur:
+            stages.emplace_back(new BlurStage(op.value, bandRows));
+            break;
+        }
+    }
+    SinkStage *sink = new SinkStage(writer.get());
+    stages.emplace_back(sink);
+    QSize size(reader->width(), reader->height());
+    for (size_t i = 0; i < stages.size(); ++i) {
+        if (i + 1 < stages.size())
+            stages[i]->next = stages[i + 1].get();
+        size = stages[i]->begin(size);
+    }
+
+    // Written next to outPath and renamed over it by commit(); returning
+    // early discards it.
+    QSaveFile out(outPath);
+    if (!out.open(QIODevice::WriteOnly))
+        return fail(out.errorString());
+    if (!writer->open(&out, size.width(), size.height()))
+        return fail(QStringLiteral("cannot write %1").arg(outPath));
+
+    QImage band(reader->width(), bandRows, QImage::Format_ARGB32);
+    for (int y = 0; y < reader->height() && sink->ok; y += bandRows) {
+        if (TaskScheduler::isCanceled())
+            return fail(QStringLiteral("canceled"));
+        const int count = qMin(bandRows, reader->height() - y);
+        if (!reader->read(band, count))
+            return fail(QStringLiteral("decode error at row %1").arg(y));
+        stages.front()->push(band, count);
+        if (progress)
+            progress(y + count, reader->height());
+    }
+    stages.front()->finish();
+    if (!sink->ok)
+        return fail(QStringLiteral("encode error writing %1").arg(outPath));
+    if (!out.commit())
+        return fail(out.errorString());
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef STREAMPROC_H
+#define STREAMPROC_H
+
+#include <QList>
+#include <QString>
+#include <functional>
+
+// One step of a streaming pipeline. Only operations that never need more than a
+// bounded window of rows are allowed, so images of any height can pass through.
+struct StreamOp
+{
+    enum Type {
+        HMirror,    // mirror each row
+        Invert,     // 255 - v on the colour channels
+        Gamma,      // v^(1/value)
+        Gray,       // replace colour with qGray()
+        Downscale,  // box average over value x value blocks
+        Blur        // separable Gaussian with sigma = value, rolling row window
+    };
+    Type type;
+    double value;
+};
+
+// Parses "hmirror", "invert", "gray", "gamma:2.2", "downscale:4", "blur:1.5".
+bool parseStreamOp(const QString &text, StreamOp *op);
+
+// Formats that can be decoded or encoded a band of rows at a time:
+// ppm/pgm and uncompressed bmp always, jpg and png when built with libjpeg/libpng.
+bool streamFormatSupported(const QString &path);
+
+// Decodes inPath bandRows scanlines at a time, runs every band through ops and
+// encodes the result incrementally into outPath. Memory use depends on the image
+// width and the ops, never on the image height. outPath is only replaced once
+// the whole image went through, so a failure or a canceled task (checked once
+// per band) leaves whatever was there before. progress, if given, is called
+// after every band with the input rows read so far.
+bool streamProcess(const QString &inPath, const QString &outPath,
+                   const QList<StreamOp> &ops, int bandRows = 64,
+                   QString *error = nullptr,
+                   const std::function<void(int rows, int total)> &progress = nullptr);
+
+#endif // STREAMPROC_H
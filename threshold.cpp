@@ -0,0 +1,117 @@
+#include "threshold.h"
+#include "colorspace.h"
+#include "integral.h"
+#include "scheduler.h"
+#include "tiles.h"
+#include <QVector>
+
+int otsuThreshold(const QImage &src)
+{
+    if (src.isNull())
+        return 0;
+    const QImage img = lumaImage(src);
+    const int w = img.width(), h = img.height();
+
+    const int bandRows = 64;
+    const int bands = (h + bandRows - 1) / bandRows;
+    QVector<quint32> partial(qsizetype(bands) * 256, 0);
+    TaskScheduler::instance().run(bands, [&](int b) {
+        quint32 *hist = partial.data() + b * 256;
+        for (int y = b * bandRows; y < qMin(h, (b + 1) * bandRows); ++y) {
+            const uchar *row = img.constScanLine(y);
+            for (int x = 0; x < w; ++x)
+                ++hist[row[x]];
+        }
+    });
+    double hist[256] = {};
+    for (int b = 0; b < bands; ++b)
+        for (int i = 0; i < 256; ++i)
+            hist[i] += partial[b * 256 + i];
+
+    double total = 0, sumAll = 0;
+    for (int i = 0; i < 256; ++i) {
+        total += hist[i];
+        sumAll += i * hist[i];
+    }
+    // A flat image has no split; its own value puts everything in the background.
+    int best = qBound(0, int(sumAll / total), 255);
+    double bestVar = -1, w0 = 0, sum0 = 0;
+    for (int t = 0; t < 255; ++t) {
+        w0 += hist[t];
+        sum0 += t * hist[t];
+        const double w1 = total - w0;
+        if (w0 == 0 || w1 == 0)
+            continue;
+        const double d = sum0 / w0 - (sumAll - sum0) / w1;
+        const double var = w0 * w1 * d * d;
+        if (var > bestVar) {
+            bestVar = var;
+            best = t;
+        }
+    }
+    return best;
+}
+
+QImage thresholdImage(const QImage &src, int level, bool invert)
+{
+    return thresholdMask(src, level, invert).toImage();
+}
+
+BitMask thresholdMask(const QImage &src, int level, bool invert)
+{
+    if (src.isNull())
+        return BitMask();
+    const QImage img = lumaImage(src);
+    const int w = img.width();
+    BitMask mask(img.size());
+    parallelRows(img.rect(), 64, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const uchar *s = img.constScanLine(y);
+            quint64 *d = mask.row(y);
+            for (int x0 = 0; x0 < w; x0 += 64) {
+                const int n = qMin(64, w - x0);
+                quint64 word = 0;
+                for (int x = 0; x < n; ++x)
+                    word |= quint64(s[x0 + x] > level) << x;
+                d[x0 / 64] = word;
+            }
+        }
+    });
+    if (invert)
+        mask.invert();
+    return mask;
+}
+
+QImage adaptiveThreshold(const QImage &src, int radius, int offset, bool invert)
+{
+    return adaptiveThresholdMask(src, radius, offset, invert).toImage();
+}
+
+BitMask adaptiveThresholdMask(const QImage &src, int radius, int offset, bool invert)
+{
+    if (src.isNull())
+        return BitMask();
+    const QImage img = lumaImage(src);
+    const int w = img.width(), h = img.height();
+    const int r = qBound(1, radius, qMax(w, h));
+    const IntegralImage table = buildIntegralImage(img, false);
+
+    BitMask mask(img.size());
+    parallelRows(img.rect(), 64, [&](const QRect &band) {
+        for (int y = band.top(); y <= band.bottom(); ++y) {
+            const int y0 = qMax(0, y - r), y1 = qMin(h - 1, y + r);
+            const uchar *s = img.constScanLine(y);
+            quint64 *d = mask.row(y);
+            for (int x = 0; x < w; ++x) {
+                const int x0 = qMax(0, x - r), x1 = qMin(w - 1, x + r);
+                const qint64 count = qint64(x1 - x0 + 1) * (y1 - y0 + 1);
+                const qint64 sum = qint64(table.sum(x0, y0, x1, y1));
+                if ((s[x] + offset) * count > sum)
+                    d[x >> 6] |= quint64(1) << (x & 63);
+            }
+        }
+    });
+    if (invert)
+        mask.invert();
+    return mask;
+}
@@ -0,0 +1,25 @@
+#ifndef THRESHOLD_H
+#define THRESHOLD_H
+
+#include "bitmask.h"
+#include <QImage>
+
+// All of these work on BT.601 luma and return a Grayscale8 mask that is 255 on
+// the foreground and 0 elsewhere, or the same as a BitMask; invert swaps the two.
+
+// Otsu's level for the luma histogram: the split that maximises the variance
+// between the two classes. Pixels above the level are the foreground.
+int otsuThreshold(const QImage &src);
+
+// 255 where luma > level.
+QImage thresholdImage(const QImage &src, int level, bool invert = false);
+BitMask thresholdMask(const QImage &src, int level, bool invert = false);
+
+// 255 where luma > (mean of the (2 radius + 1)^2 window) - offset. Windows are
+// cut at the image border and averaged over the pixels they still cover. Window
+// sums come from a summed-area table, so the cost per pixel does not depend on
+// the radius.
+QImage adaptiveThreshold(const QImage &src, int radius, int offset = 5, bool invert = false);
+BitMask adaptiveThresholdMask(const QImage &src, int radius, int offset = 5, bool invert = false);
+
+#endif // THRESHOLD_H
@@ -0,0 +1,26 @@
+#include "tiles.h"
+#include "scheduler.h"
+#include <QVector>
+
+void parallelTiles(const QRect &area, int tileSize,
+                   const std::function<void(const QRect &tile)> &fn)
+{
+    if (area.isEmpty() || tileSize <= 0)
+        return;
+    QVector<QRect> tiles;
+    for (int y = area.top(); y <= area.bottom(); y += tileSize)
+        for (int x = area.left(); x <= area.right(); x += tileSize)
+            tiles.append(QRect(x, y, tileSize, tileSize).intersected(area));
+    TaskScheduler::instance().run(tiles.size(), [&](int i) { fn(tiles.at(i)); });
+}
+
+void parallelRows(const QRect &area, int bandHeight,
+                  const std::function<void(const QRect &band)> &fn)
+{
+    if (area.isEmpty() || bandHeight <= 0)
+        return;
+    QVector<QRect> bands;
+    for (int y = area.top(); y <= area.bottom(); y += bandHeight)
+        bands.append(QRect(area.left(), y, area.width(), bandHeight).intersected(area));
+    TaskScheduler::instance().run(bands.size(), [&](int i) { fn(bands.at(i)); });
+}
@@ -0,0 +1,17 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <QRect>
+#include <functional>
+
+// Splits area into tileSize x tileSize blocks and runs fn on each of them in parallel
+// on the shared TaskScheduler. Returns once every tile has been processed or skipped:
+// tiles not started when the calling task's token is canceled are dropped.
+void parallelTiles(const QRect &area, int tileSize,
+                   const std::function<void(const QRect &tile)> &fn);
+
+// Same as parallelTiles but with full-width bands of bandHeight rows.
+void parallelRows(const QRect &area, int bandHeight,
+                  const std::function<void(const QRect &band)> &fn);
+
+#endif // TILES_H
@@ -0,0 +1,372 @@
+#include "warp.h"
+#include "tiles.h"
+#include <QLineF>
+#include <QtMath>
+#include <cmath>
+
+namespace {
+
+const int TileSize = 64;
+
+// Source positions are stepped in fixed point with this many fractional
+// bits, from coefficients rounded once per warp, so every CPU and compiler
+// produces the same pixels.
+const int FixedBits = 24;
+const qint64 FixedOne = qint64(1) << FixedBits;
+
+struct Source
+{
+    const uchar *bits;
+    qsizetype bpl;
+    int w;
+    int h;
+    bool clamp;     // extend the edge pixels instead of reading transparent
+
+    inline QRgb at(int x, int y) const
+    {
+        if (uint(x) >= uint(w) || uint(y) >= uint(h)) {
+            if (!clamp)
+                return 0;
+            x = qBound(0, x, w - 1);
+            y = qBound(0, y, h - 1);
+        }
+        return reinterpret_cast<const QRgb *>(bits + y * bpl)[x];
+    }
+};
+
+// Blends two premultiplied pixels, t in [0, 256], two channels per multiply.
+inline QRgb lerpPixel(QRgb a, QRgb b, uint t)
+{
+    uint rb = (((a & 0xff00ff) * (256 - t) + (b & 0xff00ff) * t) >> 8) & 0xff00ff;
+    uint ag = (((a >> 8) & 0xff00ff) * (256 - t) + ((b >> 8) & 0xff00ff) * t) & 0xff00ff00;
+    return rb | ag;
+}
+
+inline void cubicWeights(double t, float w[4])
+{
+    // Catmull-Rom (a = -0.5) for taps at -1, 0, 1, 2.
+    const double t2 = t * t, t3 = t2 * t;
+    w[0] = float(-0.5 * t3 + t2 - 0.5 * t);
+    w[1] = float(1.5 * t3 - 2.5 * t2 + 1.0);
+    w[2] = float(-1.5 * t3 + 2.0 * t2 + 0.5 * t);
+    w[3] = float(0.5 * t3 - 0.5 * t2);
+}
+
+// fx, fy: source position in fixed point, pixel centres at half-integers.
+template <WarpInterp Interp>
+inline QRgb sample(const Source &s, qint64 fx, qint64 fy)
+{
+    if (Interp == WarpNearest)
+        return s.at(int(fx >> FixedBits), int(fy >> FixedBits));
+
+    const qint64 gx = fx - FixedOne / 2, gy = fy - FixedOne / 2;
+    const int x0 = int(gx >> FixedBits), y0 = int(gy >> FixedBits);
+    if (Interp == WarpBilinear) {
+        const uint wx = uint(gx >> (FixedBits - 8)) & 0xff;
+        const uint wy = uint(gy >> (FixedBits - 8)) & 0xff;
+        if (uint(x0) < uint(s.w - 1) && uint(y0) < uint(s.h - 1)) {
+            const QRgb *a = reinterpret_cast<const QRgb *>(s.bits + y0 * s.bpl) + x0;
+            const QRgb *b = reinterpret_cast<const QRgb *>(s.bits + (y0 + 1) * s.bpl) + x0;
+            return lerpPixel(lerpPixel(a[0], a[1], wx), lerpPixel(b[0], b[1], wx), wy);
+        }
+        return lerpPixel(lerpPixel(s.at(x0, y0), s.at(x0 + 1, y0), wx),
+                         lerpPixel(s.at(x0, y0 + 1), s.at(x0 + 1, y0 + 1), wx), wy);
+    }
+
+    float wx[4], wy[4];
+    cubicWeights(double(gx & (FixedOne - 1)) / FixedOne, wx);
+    cubicWeights(double(gy & (FixedOne - 1)) / FixedOne, wy);
+    // Sources under 4 pixels across always go through the bounds-checked reader.
+    const bool inside = s.w >= 4 && s.h >= 4
+                        && uint(x0 - 1) < uint(s.w - 3) && uint(y0 - 1) < uint(s.h - 3);
+    float acc[4] = { 0, 0, 0, 0 };
+    for (int j = 0; j < 4; ++j) {
+        const QRgb *line = inside
+            ? reinterpret_cast<const QRgb *>(s.bits + (y0 - 1 + j) * s.bpl) + x0 - 1 : nullptr;
+        float row[4] = { 0, 0, 0, 0 };
+        for (int i = 0; i < 4; ++i) {
+            const QRgb p = inside ? line[i] : s.at(x0 - 1 + i, y0 - 1 + j);
+            row[0] += wx[i] * qAlpha(p);
+            row[1] += wx[i] * qRed(p);
+            row[2] += wx[i] * qGreen(p);
+            row[3] += wx[i] * qBlue(p);
+        }
+        for (int c = 0; c < 4; ++c)
+            acc[c] += wy[j] * row[c];
+    }
+    const int a = qBound(0, qRound(acc[0]), 255);
+    return qRgba(qBound(0, qRound(acc[1]), a), qBound(0, qRound(acc[2]), a),
+                 qBound(0, qRound(acc[3]), a), a);
+}
+
+// The inverse transform in fixed point. Positions are kept doubled, so the
+// half-pixel offset of a pixel centre stays an integer.
+struct FixedTransform
+{
+    qint64 m11, m12, m13, m21, m22, m23, m31, m32, m33;
+    bool affine;
+};
+
+// An affine warp steps source positions directly, so it uses FixedBits. A
+// projective one only ever divides x and y by w, which cancels the scale, so
+// it uses as many fractional bits as the destination size leaves room for:
+// the perspective terms are around 1e-4 for a real deskew, and at 2^-24 they
+// would move sample positions by most of a pixel across a large frame.
+FixedTransform toFixed(const QTransform &t, const QSize &dstSize)
+{
+    int bits = FixedBits;
+    if (!t.isAffine()) {
+        const double cx = 2.0 * dstSize.width() + 1, cy = 2.0 * dstSize.height() + 1;
+        const double reach = qMax(qMax(qAbs(t.m11()) * cx + qAbs(t.m21()) * cy + 2 * qAbs(t.m31()),
+                                       qAbs(t.m12()) * cx + qAbs(t.m22()) * cy + 2 * qAbs(t.m32())),
+                                  qAbs(t.m13()) * cx + qAbs(t.m23()) * cy + 2 * qAbs(t.m33()));
+        // Every |f| stays below 2^61, so stepping it never overflows.
+        int exponent;
+        std::frexp(reach, &exponent);
+        bits = qBound(0, 61 - exponent, 60);
+    }
+    const auto f = [bits](double v) { return qRound64(std::ldexp(v, bits)); };
+    return { f(t.m11()), f(t.m12()), f(t.m13()), f(t.m21()), f(t.m22()), f(t.m23()),
+             f(t.m31()), f(t.m32()), f(t.m33()), t.isAffine() };
+}
+
+// Inverse-maps one span of a destination row, stepping the homogeneous source
+// position by integer adds. A projective warp divides exactly representable
+// integers once per pixel, which IEEE rounding makes the same everywhere.
+template <WarpInterp Interp>
+void warpSpan(const Source &s, const FixedTransform &inv, QRgb *out, int x0, int x1, int y)
+{
+    const qint64 cx = 2 * qint64(x0) + 1, cy = 2 * qint64(y) + 1;
+    qint64 fx = inv.m11 * cx + inv.m21 * cy + 2 * inv.m31;
+    qint64 fy = inv.m12 * cx + inv.m22 * cy + 2 * inv.m32;
+    qint64 fw = inv.m13 * cx + inv.m23 * cy + 2 * inv.m33;
+    const qint64 dx = 2 * inv.m11, dy = 2 * inv.m12, dw = 2 * inv.m13;
+    // Positions farther out than this only ever read the border.
+    const qint64 minPos = -2 * FixedOne;
+    const qint64 maxX = (s.w + 2) * FixedOne, maxY = (s.h + 2) * FixedOne;
+
+    for (int x = x0; x <= x1; ++x, fx += dx, fy += dy, fw += dw) {
+        qint64 sx, sy;
+        if (inv.affine) {
+            sx = fx >> 1;
+            sy = fy >> 1;
+        } else {
+            if (fw <= 0) {
+                out[x] = 0;
+                continue;
+            }
+            const double qx = double(fx) / double(fw), qy = double(fy) / double(fw);
+            if (!(qx > -2.0 && qx < s.w + 2.0 && qy > -2.0 && qy < s.h + 2.0)) {
+                out[x] = 0;
+                continue;
+            }
+            sx = qint64(std::floor(qx * FixedOne));
+            sy = qint64(std::floor(qy * FixedOne));
+        }
+        if (sx <= minPos || sx >= maxX || sy <= minPos || sy >= maxY) {
+            out[x] = s.clamp ? sample<Interp>(s, qBound(minPos + 1, sx, maxX - 1),
+                                              qBound(minPos + 1, sy, maxY - 1)) : 0;
+            continue;
+        }
+        out[x] = sample<Interp>(s, sx, sy);
+    }
+}
+
+QImage warpFixed(const QImage &src, const QTransform &xform, const QSize &dstSize,
+                 WarpInterp interp, bool clamp)
+{
+    if (src.isNull() || dstSize.isEmpty())
+        return QImage();
+    bool ok = false;
+    const QTransform inv = xform.inverted(&ok);
+    if (!ok)
+        return QImage();
+
+    const QImage in = src.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QImage dst(dstSize, QImage::Format_ARGB32_Premultiplied);
+    const Source s = { in.constBits(), in.bytesPerLine(), in.width(), in.height(), clamp };
+    uchar *dstBits = dst.bits();
+    const qsizetype dstBpl = dst.bytesPerLine();
+    const FixedTransform fixed = toFixed(inv, dstSize);
+
+    parallelTiles(dst.rect(), TileSize, [&](const QRect &tile) {
+        for (int y = tile.top(); y <= tile.bottom(); ++y) {
+            QRgb *out = reinterpret_cast<QRgb *>(dstBits + y * dstBpl);
+            switch (interp) {
+            case WarpNearest:
+                warpSpan<WarpNearest>(s, fixed, out, tile.left(), tile.right(), y);
+                break;
+            case WarpBilinear:
+                warpSpan<WarpBilinear>(s, fixed, out, tile.left(), tile.right(), y);
+                break;
+            case WarpBicubic:
+                warpSpan<WarpBicubic>(s, fixed, out, tile.left(), tile.right(), y);
+                break;
+            }
+        }
+    });
+    return dst;
+}
+
+// Both remap rows read the four neighbours of a fixed-point coordinate
+// directly when they are all inside, and as zero where they fall outside, so
+// the edge of a remapped image fades out over one pixel in gray and ARGB alike.
+void remapRowArgb(const Source &s, const qint32 *c, QRgb *out, int width)
+{
+    for (int x = 0; x < width; ++x, c += 2) {
+        if (c[0] == RemapOutside) {
+            out[x] = 0;
+            continue;
+        }
+        const int x0 = c[0] >> RemapFracBits, y0 = c[1] >> RemapFracBits;
+        const uint wx = uint(c[0]) & ((1u << RemapFracBits) - 1);
+        const uint wy = uint(c[1]) & ((1u << RemapFracBits) - 1);
+        if (uint(x0) < uint(s.w - 1) && uint(y0) < uint(s.h - 1)) {
+            const QRgb *a = reinterpret_cast<const QRgb *>(s.bits + y0 * s.bpl) + x0;
+            const QRgb *b = reinterpret_cast<const QRgb *>(s.bits + (y0 + 1) * s.bpl) + x0;
+            out[x] = lerpPixel(lerpPixel(a[0], a[1], wx), lerpPixel(b[0], b[1], wx), wy);
+        } else {
+            out[x] = lerpPixel(lerpPixel(s.at(x0, y0), s.at(x0 + 1, y0), wx),
+                               lerpPixel(s.at(x0, y0 + 1), s.at(x0 + 1, y0 + 1), wx), wy);
+        }
+    }
+}
+
+void remapRowGray(const uchar *bits, qsizetype bpl, int w, int h,
+                  const qint32 *c, uchar *out, int width)
+{
+    const uint one = 1u << RemapFracBits;
+    const auto at = [&](int x, int y) -> uint {
+        return uint(x) < uint(w) && uint(y) < uint(h) ? bits[y * bpl + x] : 0;
+    };
+    for (int x = 0; x < width; ++x, c += 2) {
+        if (c[0] == RemapOutside) {
+            out[x] = 0;
+            continue;
+        }
+        const int x0 = c[0] >> RemapFracBits, y0 = c[1] >> RemapFracBits;
+        const uint wx = uint(c[0]) & (one - 1), wy = uint(c[1]) & (one - 1);
+        uint a0, a1, b0, b1;
+        if (uint(x0) < uint(w - 1) && uint(y0) < uint(h - 1)) {
+            const uchar *a = bits + y0 * bpl + x0;
+            a0 = a[0];
+            a1 = a[1];
+            b0 = a[bpl];
+            b1 = a[bpl + 1];
+        } else {
+            a0 = at(x0, y0);
+            a1 = at(x0 + 1, y0);
+            b0 = at(x0, y0 + 1);
+            b1 = at(x0 + 1, y0 + 1);
+        }
+        const uint top = a0 * (one - wx) + a1 * wx;
+        const uint bottom = b0 * (one - wx) + b1 * wx;
+        out[x] = uchar((top * (one - wy) + bottom * wy + (one * one / 2)) >> (2 * RemapFracBits));
+    }
+}
+
+QTransform triangleBasis(const QPolygonF &p)
+{
+    // Maps (0,0), (1,0), (0,1) onto p[0], p[1], p[2].
+    return QTransform(p[1].x() - p[0].x(), p[1].y() - p[0].y(),
+                      p[2].x() - p[0].x(), p[2].y() - p[0].y(),
+                      p[0].x(), p[0].y());
+}
+
+} // namespace
+
+QImage warpImage(const QImage &src, const QTransform &xform, const QSize &dstSize,
+                 WarpInterp interp)
+{
+    return warpFixed(src, xform, dstSize, interp, false);
+}
+
+QImage scaleImage(const QImage &src, const QSize &dstSize, WarpInterp interp)
+{
+    if (src.isNull() || dstSize.isEmpty())
+        return QImage();
+    return warpFixed(src, QTransform::fromScale(double(dstSize.width()) / src.width(),
+                                                double(dstSize.height()) / src.height()),
+                     dstSize, interp, true);
+}
+
+QImage remapImage(const QImage &src, const RemapMap &map)
+{
+    if (src.isNull() || src.size() != map.sourceSize || map.size.isEmpty()
+        || map.coords.size() != 2 * qsizetype(map.size.width()) * map.size.height())
+        return QImage();
+    const int width = map.size.width();
+    const qint32 *coords = map.coords.constData();
+
+    if (src.format() == QImage::Format_Grayscale8) {
+        QImage dst(map.size, QImage::Format_Grayscale8);
+        uchar *dstBits = dst.bits();
+        const qsizetype dstBpl = dst.bytesPerLine();
+        parallelTiles(dst.rect(), TileSize, [&](const QRect &tile) {
+            for (int y = tile.top(); y <= tile.bottom(); ++y)
+                remapRowGray(src.constBits(), src.bytesPerLine(), src.width(), src.height(),
+                             coords + 2 * (qsizetype(y) * width + tile.left()),
+                             dstBits + y * dstBpl + tile.left(), tile.width());
+        });
+        return dst;
+    }
+
+    const QImage in = src.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QImage dst(map.size, QImage::Format_ARGB32_Premultiplied);
+    const Source s = { in.constBits(), in.bytesPerLine(), in.width(), in.height(), false };
+    uchar *dstBits = dst.bits();
+    const qsizetype dstBpl = dst.bytesPerLine();
+    parallelTiles(dst.rect(), TileSize, [&](const QRect &tile) {
+        for (int y = tile.top(); y <= tile.bottom(); ++y)
+            remapRowArgb(s, coords + 2 * (qsizetype(y) * width + tile.left()),
+                          reinterpret_cast<QRgb *>(dstBits + y * dstBpl) + tile.left(), tile.width());
+    });
+    return dst;
+}
+
+QTransform affineFromPoints(const QPolygonF &from, const QPolygonF &to)
+{
+    if (from.size() < 3 || to.size() < 3)
+        return QTransform();
+    bool ok = false;
+    const QTransform fromInv = triangleBasis(from).inverted(&ok);
+    if (!ok)
+        return QTransform();
+    return fromInv * triangleBasis(to);
+}
+
+QTransform affineDeskew(const QPolygonF &quad, QSize *outSize)
+{
+    *outSize = QSize();
+    if (quad.size() < 3)
+        return QTransform();
+    const QPointF u = quad[1] - quad[0], v = quad[2] - quad[1];
+    const int w = qRound(QLineF(quad[0], quad[1]).length());
+    const int h = qRound(QLineF(quad[1], quad[2]).length());
+    if (w < 1 || h < 1 || qFuzzyIsNull(u.x() * v.y() - u.y() * v.x()))
+        return QTransform();
+
+    const QPolygonF rect = { QPointF(0, 0), QPointF(w, 0), QPointF(w, h) };
+    *outSize = QSize(w, h);
+    return affineFromPoints(quad, rect);
+}
+
+QTransform perspectiveDeskew(const QPolygonF &quad, QSize *outSize)
+{
+    *outSize = QSize();
+    if (quad.size() < 4)
+        return QTransform();
+    const int w = qRound(qMax(QLineF(quad[0], quad[1]).length(),
+                              QLineF(quad[3], quad[2]).length()));
+    const int h = qRound(qMax(QLineF(quad[0], quad[3]).length(),
+                              QLineF(quad[1], quad[2]).length()));
+    if (w < 1 || h < 1)
+        return QTransform();
+
+    const QPolygonF rect = { QPointF(0, 0), QPointF(w, 0), QPointF(w, h), QPointF(0, h) };
+    QTransform t;
+    if (!QTransform::quadToQuad(QPolygonF(quad.mid(0, 4)), rect, t))
+        return QTransform();
+    *outSize = QSize(w, h);
+    return t;
+}
@@ -0,0 +1,57 @@
+#ifndef WARP_H
+#define WARP_H
+
+#include <QImage>
+#include <QTransform>
+#include <QPolygonF>
+#include <QVector>
+
+enum WarpInterp {
+    WarpNearest,
+    WarpBilinear,
+    WarpBicubic
+};
+
+// Maps src through xform (source -> destination coordinates, affine or projective)
+// into a dstSize image. Every destination pixel is inverse-mapped back into src;
+// pixels that fall outside src are left transparent. Result is ARGB32_Premultiplied.
+// Source positions are stepped in integer fixed point and nearest / bilinear
+// sampling is integer too, so the output is bit-identical on every machine.
+QImage warpImage(const QImage &src, const QTransform &xform, const QSize &dstSize,
+                 WarpInterp interp = WarpBilinear);
+
+// Resizes src to dstSize the same way, extending the edge pixels instead of
+// fading them out.
+QImage scaleImage(const QImage &src, const QSize &dstSize, WarpInterp interp = WarpBilinear);
+
+// Source position of every destination pixel, precomputed once for a geometry
+// that does not change between frames. Coordinates are fixed point with
+// RemapFracBits fractional bits, measured from the centre of source pixel
+// (0, 0); positions outside the source are stored as RemapOutside.
+const int RemapFracBits = 8;
+const qint32 RemapOutside = -0x7fffffff - 1;
+
+struct RemapMap
+{
+    QSize sourceSize;
+    QSize size;
+    QVector<qint32> coords;   // x, y per destination pixel, row by row
+};
+
+// Bilinear resampling of src through map, which must have been built for
+// src's size. Grayscale8 stays gray; anything else comes out
+// ARGB32_Premultiplied. Both treat everything outside src as zero, black or
+// transparent, so the border fades out the same way in either.
+QImage remapImage(const QImage &src, const RemapMap &map);
+
+// Affine transform taking the three points of from onto the three points of to.
+QTransform affineFromPoints(const QPolygonF &from, const QPolygonF &to);
+
+// Control points for deskew / perspective correction: quad is the document outline
+// clicked in the image (top-left, top-right, bottom-right, bottom-left; the last one
+// is ignored for affine). Returns the transform straightening it into a rectangle of
+// size *outSize, or an identity transform when the points are degenerate.
+QTransform affineDeskew(const QPolygonF &quad, QSize *outSize);
+QTransform perspectiveDeskew(const QPolygonF &quad, QSize *outSize);
+
+#endif // WARP_H
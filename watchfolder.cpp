@@ -0,0 +1,216 @@
+#include "watchfolder.h"
+#include "ipxfile.h"
+#include "scheduler.h"
+#include "stack.h"
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QSaveFile>
+#include <QVector>
+
+namespace {
+
+// A file counts as completely written once its size and time have not changed
+// for this long; it is checked every SettleCheckMs meanwhile.
+const int SettleMs = 1000;
+const int SettleCheckMs = 250;
+// inotify reports files created, renamed or deleted in the folder but not
+// always a file rewritten in place, so the folder is also rescanned this often.
+const int RescanMs = 60000;
+
+void setError(QString *error, const QString &message)
+{
+    if (error)
+        *error = message;
+}
+
+bool writeFile(const QString &path, const QByteArray &bytes)
+{
+    QSaveFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(bytes) == bytes.size() && file.commit();
+}
+
+QByteArray readFile(const QString &path)
+{
+    QFile file(path);
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+int processFile(const QString &path, const QString &outputDir, const QString &cacheDir,
+                const QList<PipelineStep> &steps, const QByteArray &recipeHash, QString *error)
+{
+    const QByteArray content = readFile(path);
+    if (content.isEmpty()) {
+        setError(error, QStringLiteral("cannot read %1").arg(path));
+        return FolderWatcher::Failed;
+    }
+    const QByteArray key = QCryptographicHash::hash(
+        QCryptographicHash::hash(content, QCryptographicHash::Sha256) + recipeHash,
+        QCryptographicHash::Sha256).toHex();
+    // Two levels, so no single folder collects the whole corpus.
+    const QString shard = QDir(cacheDir).filePath(QString::fromUtf8(key.left(2)));
+    const QString cached = QDir(shard).filePath(QString::fromUtf8(key) + ".png");
+    // The whole file name, so a.jpg and a.png do not write the same result.
+    const QString target = QDir(outputDir).filePath(QFileInfo(path).fileName() + ".png");
+
+    if (QFileInfo(cached).exists()) {
+        // Always rewritten: an older output of the same name may hold anything.
+        const QByteArray png = readFile(cached);
+        if (png.isEmpty() || !writeFile(target, png)) {
+            setError(error, QStringLiteral("cannot write %1").arg(target));
+            return FolderWatcher::Failed;
+        }
+        return FolderWatcher::Cached;
+    }
+
+    QImage img = isIpxFile(path) ? loadIpx(path) : QImage::fromData(content);
+    if (img.isNull()) {
+        setError(error, QStringLiteral("cannot decode %1").arg(path));
+        return FolderWatcher::Failed;
+    }
+    img = runPipeline(img, steps);
+    QByteArray png;
+    QBuffer buffer(&png);
+    buffer.open(QIODevice::WriteOnly);
+    if (img.isNull() || !img.save(&buffer, "PNG")) {
+        setError(error, QStringLiteral("cannot process %1").arg(path));
+        return FolderWatcher::Failed;
+    }
+    if (!QDir().mkpath(shard) || !writeFile(cached, png)) {
+        setError(error, QStringLiteral("cannot write to the cache %1").arg(cacheDir));
+        return FolderWatcher::Failed;
+    }
+    if (!writeFile(target, png)) {
+        setError(error, QStringLiteral("cannot write %1").arg(target));
+        return FolderWatcher::Failed;
+    }
+    return FolderWatcher::Processed;
+}
+
+} // namespace
+
+FolderWatcher::FolderWatcher(const QString &inputDir, const QString &outputDir,
+                             const QString &cacheDir, const QList<PipelineStep> &steps,
+                             QObject *parent)
+    : QObject(parent), input(inputDir), output(outputDir), cache(cacheDir), steps(steps)
+{
+    recipeHash = QCryptographicHash::hash(pipelineText(steps).toUtf8(), QCryptographicHash::Sha256);
+    settleTimer.setInterval(SettleCheckMs);
+    rescanTimer.setInterval(RescanMs);
+    connect(&watcher, SIGNAL(directoryChanged(QString)), this, SLOT(rescan()));
+    connect(&settleTimer, SIGNAL(timeout()), this, SLOT(settle()));
+    connect(&rescanTimer, SIGNAL(timeout()), this, SLOT(rescan()));
+}
+
+bool FolderWatcher::prepare(QString *error)
+{
+    if (!QFileInfo(input).isDir()) {
+        setError(error, QStringLiteral("%1 is not a folder").arg(input));
+        return false;
+    }
+    if (!QDir().mkpath(output) || !QDir().mkpath(cache)) {
+        setError(error, QStringLiteral("cannot create %1 or %2").arg(output, cache));
+        return false;
+    }
+    // Results written into the input folder would be picked up as new input,
+    // and a.jpg.png turn into a.jpg.png.png without end.
+    const QString in = QFileInfo(input).canonicalFilePath();
+    if (QFileInfo(output).canonicalFilePath() == in || QFileInfo(cache).canonicalFilePath() == in) {
+        setError(error, QStringLiteral("the output and cache folders must not be %1").arg(input));
+        return false;
+    }
+    return true;
+}
+
+bool FolderWatcher::start(QString *error)
+{
+    if (!prepare(error))
+        return false;
+    if (!watcher.addPath(input)) {
+        setError(error, QStringLiteral("cannot watch %1").arg(input));
+        return false;
+    }
+    rescanTimer.start();
+    rescan();
+    return true;
+}
+
+int FolderWatcher::processAll(QString *error)
+{
+    if (!prepare(error))
+        return -1;
+    const QStringList files = stackFrameFiles(input);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (const QString &file : files) {
+        const QFileInfo info(file);
+        done.insert(file, { info.size(), info.lastModified().toMSecsSinceEpoch(), now });
+    }
+    QVector<int> outcomes(files.size());
+    QVector<QString> errors(files.size());
+    TaskScheduler::instance().run(int(files.size()), [&](int i) {
+        outcomes[i] = processFile(files[i], output, cache, steps, recipeHash, &errors[i]);
+    });
+    int failed = 0;
+    for (int i = 0; i < files.size(); ++i) {
+        failed += outcomes[i] == Failed;
+        emit fileDone(files[i], outcomes[i], errors[i]);
+    }
+    return failed;
+}
+
+void FolderWatcher::rescan()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (const QString &file : stackFrameFiles(input)) {
+        const QFileInfo info(file);
+        const Stamp stamp = { info.size(), info.lastModified().toMSecsSinceEpoch(), now };
+        const auto same = [&](const QHash<QString, Stamp> &table) {
+            const auto it = table.constFind(file);
+            return it != table.constEnd() && it.value().size == stamp.size
+                && it.value().modified == stamp.modified;
+        };
+        if (!same(done) && !same(pending))
+            pending.insert(file, stamp);
+    }
+    if (!pending.isEmpty() && !settleTimer.isActive())
+        settleTimer.start();
+}
+
+void FolderWatcher::settle()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QStringList ready;
+    for (auto it = pending.begin(); it != pending.end();) {
+        const QFileInfo info(it.key());
+        if (!info.exists()) {
+            it = pending.erase(it);
+            continue;
+        }
+        const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+        if (info.size() != it.value().size || modified != it.value().modified) {
+            it.value() = { info.size(), modified, now };
+        } else if (now - it.value().unchangedSince >= SettleMs) {
+            ready.append(it.key());
+            done.insert(it.key(), it.value());
+            it = pending.erase(it);
+            continue;
+        }
+        ++it;
+    }
+    if (pending.isEmpty())
+        settleTimer.stop();
+    if (ready.isEmpty())
+        return;
+
+    QVector<int> outcomes(ready.size());
+    QVector<QString> errors(ready.size());
+    TaskScheduler::instance().run(int(ready.size()), [&](int i) {
+        outcomes[i] = processFile(ready[i], output, cache, steps, recipeHash, &errors[i]);
+    });
+    for (int i = 0; i < ready.size(); ++i)
+        emit fileDone(ready[i], outcomes[i], errors[i]);
+}
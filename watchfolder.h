@@ -0,0 +1,66 @@
+#ifndef WATCHFOLDER_H
+#define WATCHFOLDER_H
+
+#include <QObject>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QTimer>
+#include "pipeline.h"
+
+// Runs every image that appears or changes in an input folder through a
+// recipe and writes the result to an output folder as the file name plus
+// .png, so a.jpg becomes a.jpg.png and never collides with a.png. Results
+// are also kept in a cache folder under the SHA-256 of the file's content
+// and of the canonical recipe, so files already processed with the same
+// recipe (before a restart, or copied in again) are never recomputed.
+class FolderWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Outcome { Processed, Cached, Failed };
+
+    FolderWatcher(const QString &inputDir, const QString &outputDir, const QString &cacheDir,
+                  const QList<PipelineStep> &steps, QObject *parent = nullptr);
+
+    // Creates the output and cache folders and starts watching; what is
+    // already in the input folder is picked up by the first scan.
+    bool start(QString *error = nullptr);
+    // Processes everything in the input folder now, without waiting for files
+    // to settle; returns the number of failures, or -1 with error set when the
+    // input folder is missing, the output folders cannot be created or one of
+    // them is the input folder.
+    int processAll(QString *error = nullptr);
+
+signals:
+    void fileDone(const QString &file, int outcome, const QString &error);
+
+private slots:
+    void rescan();
+    void settle();
+
+private:
+    struct Stamp
+    {
+        qint64 size;
+        qint64 modified;
+        qint64 unchangedSince;   // ms since the epoch
+    };
+
+    bool prepare(QString *error);
+
+    QString input;
+    QString output;
+    QString cache;
+    QList<PipelineStep> steps;
+    QByteArray recipeHash;
+    QFileSystemWatcher watcher;
+    QTimer settleTimer;
+    QTimer rescanTimer;
+    QHash<QString, Stamp> pending;   // changed files waiting to stop changing
+    QHash<QString, Stamp> done;      // size and time of the last version handled
+};
+
+#endif // WATCHFOLDER_H